@@ -21,6 +21,8 @@
  */
 #include "kqf_app.h"
 
+#include "kqf_mem.h"
+
 
 static
 int init_info(KQMOE_INFO *info)
@@ -117,7 +119,7 @@ int detect_version(KQMOE_INFO *info)
 			DWORD spare;
 			CHAR  name[sizeof(".?AVKQMonster@@")];
 		} const *td = kqmoe_rva_ptr(info, monster_rva[version].td);
-		if ((td != NULL) && !IsBadReadPtr(td, sizeof(*td)) && (0 == td->spare) &&
+		if ((td != NULL) && kqf_mem_readable(td, sizeof(*td)) && (0 == td->spare) &&
 		    (0 == lstrcmpA(td->name, ".?AVKQMonster@@"))) {
 			struct RTTICompleteObjectLocator {
 				DWORD signature;
@@ -126,10 +128,10 @@ int detect_version(KQMOE_INFO *info)
 				DWORD pTypeDescriptor;
 				DWORD pClassDescriptor;
 			} const *ol = kqmoe_rva_ptr(info, monster_rva[version].ol);
-			if ((ol != NULL) && !IsBadReadPtr(ol, sizeof(*ol)) && (0 == ol->signature) && (0 == ol->offset) && (0 == ol->cdOffset)) {
+			if ((ol != NULL) && kqf_mem_readable(ol, sizeof(*ol)) && (0 == ol->signature) && (0 == ol->offset) && (0 == ol->cdOffset)) {
 				if (td == kqmoe_va_ptr(info, ol->pTypeDescriptor)) {
 					DWORD const *vf = kqmoe_rva_ptr(info, monster_rva[version].vf);
-					if ((vf != NULL) && !IsBadReadPtr(&vf[-1], sizeof(*vf)) &&
+					if ((vf != NULL) && kqf_mem_readable(&vf[-1], sizeof(*vf)) &&
 					    (ol == kqmoe_va_ptr(info, vf[-1]))) {
 						info->version = version;
 						return (1);
@@ -152,10 +154,7 @@ LONG /*volatile*/ runtime_active /* = 0 */;
 void kqf_init_app(void)
 {
 	if (NULL == kqf_mod) {
-		MEMORY_BASIC_INFORMATION mbi;
-		if (kqf_query_mem((LPCVOID)(ULONG_PTR)kqf_init_app, mbi)) {
-			kqf_mod = (HINSTANCE)mbi.AllocationBase;
-		}
+		kqf_mod = (HINSTANCE)kqf_mem_base((LPCVOID)(ULONG_PTR)kqf_init_app);
 	}
 	if (NULL == kqf_app.inst) {
 		CHAR filename[MAX_PATH];
@@ -176,6 +175,7 @@ void kqf_init_app(void)
 		kqf_app.path_len = lstrlenA(kqf_app.path);
 		kqf_app.inst = (HINSTANCE)GetModuleHandleA(NULL);
 #ifdef KQF_RUNTIME
+		kqf_mem_cache(kqf_app.inst);
 		kqmoe_info(&kqf_app.info, kqf_app.inst);
 #endif
 	}
@@ -58,7 +58,18 @@ struct opt_inf {
 	{"window.noborder", KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_TRUE         },  // KQF_CFGO_WINDOW_NOBORDER
 	{"cdrom.fake",      KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_TRUE         },  // KQF_CFGO_CDROM_FAKE
 	{"mem.trace",       KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_MEM_TRACE
-	{"text.hebrew.rtl", KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        }   // KQF_CFGO_TEXT_HEBREW_RTL
+	{"text.hebrew.rtl", KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_TEXT_HEBREW_RTL
+	{"mem.profile",     KQF_OPT_MEM_PROFILE_COUNT, KQF_OPT_MEM_PROFILE_DEFAULT},  // KQF_CFGO_MEM_PROFILE
+	{"mem.pool",        KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_MEM_POOL
+	{"mem.leaks",       KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_MEM_LEAKS
+	{"mem.large",       KQF_OPT_MEM_LARGE_COUNT,  KQF_OPT_MEM_LARGE_DEFAULT },  // KQF_CFGO_MEM_LARGE
+	{"mem.sample",      KQF_OPT_MEM_SAMPLE_COUNT, KQF_OPT_MEM_SAMPLE_DEFAULT},  // KQF_CFGO_MEM_SAMPLE
+	{"video.player",    KQF_OPT_VIDEO_PLAYER_COUNT, KQF_OPT_VIDEO_PLAYER_DEFAULT},  // KQF_CFGO_VIDEO_PLAYER
+	{"video.prewarm",   KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_VIDEO_PREWARM
+	{"file.watch",      KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_FILE_WATCH
+	{"cdrom.overlay",   KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_CDROM_OVERLAY
+	{"save.profile",    KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        },  // KQF_CFGO_SAVE_PROFILE
+	{"save.prefetch",   KQF_OPT_BOOL_COUNT,       KQF_OPT_BOOL_FALSE        }   // KQF_CFGO_SAVE_PREFETCH
 };
 
 static
@@ -85,7 +96,18 @@ int opt_val[KQF_CFGO_COUNT] = {
 	KQF_OPT_BOOL_TRUE,           // KQF_CFGO_WINDOW_NOBORDER
 	KQF_OPT_BOOL_TRUE,           // KQF_CFGO_CDROM_FAKE
 	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_MEM_TRACE
-	KQF_OPT_BOOL_FALSE           // KQF_CFGO_TEXT_HEBREW_RTL
+	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_TEXT_HEBREW_RTL
+	KQF_OPT_MEM_PROFILE_DEFAULT, // KQF_CFGO_MEM_PROFILE
+	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_MEM_POOL
+	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_MEM_LEAKS
+	KQF_OPT_MEM_LARGE_DEFAULT,   // KQF_CFGO_MEM_LARGE
+	KQF_OPT_MEM_SAMPLE_DEFAULT,  // KQF_CFGO_MEM_SAMPLE
+	KQF_OPT_VIDEO_PLAYER_DEFAULT,// KQF_CFGO_VIDEO_PLAYER
+	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_VIDEO_PREWARM
+	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_FILE_WATCH
+	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_CDROM_OVERLAY
+	KQF_OPT_BOOL_FALSE,          // KQF_CFGO_SAVE_PROFILE
+	KQF_OPT_BOOL_FALSE           // KQF_CFGO_SAVE_PREFETCH
 };
 
 
@@ -55,6 +55,39 @@ typedef enum KQF_OPT_CRASH_DUMP_ {
 	KQF_OPT_CRASH_DUMP_DEFAULT = KQF_OPT_CRASH_DUMP_NONE
 } KQF_OPT_CRASH_DUMP_;
 
+typedef enum KQF_OPT_MEM_PROFILE_ {
+	KQF_OPT_MEM_PROFILE_NONE,    // 0 = do not profile allocation sites (default)
+	KQF_OPT_MEM_PROFILE_UNLOAD,  // 1 = report at unload only
+	                             // N = report every N - 1 minutes and at unload
+	KQF_OPT_MEM_PROFILE_COUNT = 62,
+	KQF_OPT_MEM_PROFILE_DEFAULT = KQF_OPT_MEM_PROFILE_NONE
+} KQF_OPT_MEM_PROFILE_;
+
+typedef enum KQF_OPT_MEM_LARGE_ {
+	KQF_OPT_MEM_LARGE_NONE,  // 0 = allocate large blocks from the CRT heap (default)
+	                         // N = reserved region for blocks of N * 64 KiB and more
+	KQF_OPT_MEM_LARGE_COUNT = 65,
+	KQF_OPT_MEM_LARGE_DEFAULT = KQF_OPT_MEM_LARGE_NONE
+} KQF_OPT_MEM_LARGE_;
+
+typedef enum KQF_OPT_MEM_SAMPLE_ {
+	KQF_OPT_MEM_SAMPLE_NONE,  // 0 = do not sample the address space (default)
+	                          // N = sample address space and heaps every N seconds
+	KQF_OPT_MEM_SAMPLE_COUNT = 3601,
+	KQF_OPT_MEM_SAMPLE_DEFAULT = KQF_OPT_MEM_SAMPLE_NONE
+} KQF_OPT_MEM_SAMPLE_;
+
+typedef enum KQF_OPT_VIDEO_PLAYER_ {
+	KQF_OPT_VIDEO_PLAYER_SHELL,     // 0 = open the AVI file with the registered player (default)
+	KQF_OPT_VIDEO_PLAYER_INTERNAL,  // 1 = play in the game window (Media Foundation)
+	KQF_OPT_VIDEO_PLAYER_WMP,       // 2 = Windows Media Player (legacy)
+	KQF_OPT_VIDEO_PLAYER_UWP,       // 3 = same as 0 (no UWP activation by path)
+	KQF_OPT_VIDEO_PLAYER_VLC,       // 4 = VLC media player
+	KQF_OPT_VIDEO_PLAYER_MPV,       // 5 = mpv
+	KQF_OPT_VIDEO_PLAYER_COUNT,
+	KQF_OPT_VIDEO_PLAYER_DEFAULT = KQF_OPT_VIDEO_PLAYER_SHELL
+} KQF_OPT_VIDEO_PLAYER_;
+
 typedef enum KQF_CFGO_ {
 	KQF_CFGO_LOG_TYPE,         // KQF_LOGT_
 	KQF_CFGO_LOG_LEVEL,        // KQF_LOGL_
@@ -79,6 +112,17 @@ typedef enum KQF_CFGO_ {
 	KQF_CFGO_CDROM_FAKE,       // KQF_OPT_BOOL_
 	KQF_CFGO_MEM_TRACE,        // KQF_OPT_BOOL_
 	KQF_CFGO_TEXT_HEBREW_RTL,  // KQF_OPT_BOOL_
+	KQF_CFGO_MEM_PROFILE,      // KQF_OPT_MEM_PROFILE_
+	KQF_CFGO_MEM_POOL,         // KQF_OPT_BOOL_
+	KQF_CFGO_MEM_LEAKS,        // KQF_OPT_BOOL_
+	KQF_CFGO_MEM_LARGE,        // KQF_OPT_MEM_LARGE_
+	KQF_CFGO_MEM_SAMPLE,       // KQF_OPT_MEM_SAMPLE_
+	KQF_CFGO_VIDEO_PLAYER,     // KQF_OPT_VIDEO_PLAYER_
+	KQF_CFGO_VIDEO_PREWARM,    // KQF_OPT_BOOL_
+	KQF_CFGO_FILE_WATCH,       // KQF_OPT_BOOL_
+	KQF_CFGO_CDROM_OVERLAY,    // KQF_OPT_BOOL_
+	KQF_CFGO_SAVE_PROFILE,     // KQF_OPT_BOOL_
+	KQF_CFGO_SAVE_PREFETCH,    // KQF_OPT_BOOL_
 	KQF_CFGO_COUNT
 } KQF_CFGO_;
 
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "kqf_mem.h"
+
+#include "kqf_win.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                     Address space region cache
+//
+// IsBadReadPtr/IsBadCodePtr probe the memory inside an exception handler. This
+// is slow, not thread-safe, and a guard page hit is silently consumed (a stack
+// would never grow again). The image of the game is walked once with
+// VirtualQuery and the sorted region list answers the access checks with a
+// binary search. Addresses outside of the cached allocations are queried
+// directly (heap and mapped views are changing too often to be cached).
+//
+
+enum MEMINIT_ {
+	MEMINIT_NONE = 2,
+	MEMINIT_INIT = 1,
+	MEMINIT_DONE = 0
+};
+enum MEMCACHE_ {
+	MEMCACHE_SIZE  = 64,  // regions (the game image has less than 16)
+	MEMCACHE_ALLOC = 8    // allocations
+};
+
+#define MEM_READ (PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+#define MEM_WRITE (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+#define MEM_EXECUTE (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+
+
+static LONG /*volatile*/ s_init = MEMINIT_NONE;
+static CRITICAL_SECTION s_lock /* = {0} */;
+static KQF_MEM_REGION s_cache[MEMCACHE_SIZE] /* = {0} */;
+static int s_count /* = 0 */;
+
+
+static
+void init(void)
+{
+	switch (InterlockedCompareExchange(&s_init, MEMINIT_INIT, MEMINIT_NONE)) {
+	case MEMINIT_NONE:
+		InitializeCriticalSection(&s_lock);
+		InterlockedCompareExchange(&s_init, MEMINIT_DONE, MEMINIT_INIT);
+		break;
+	case MEMINIT_INIT:
+		while (MEMINIT_INIT == InterlockedCompareExchange(&s_init, MEMINIT_DONE, MEMINIT_DONE))
+			;
+		break;
+	}
+}
+
+
+static
+int query(void const *addr, KQF_MEM_REGION *region)
+{
+	MEMORY_BASIC_INFORMATION mbi;
+	if (!kqf_query_mem(addr, mbi)) {
+		return (0);
+	}
+	region->begin   = (unsigned char const *)mbi.BaseAddress;
+	region->end     = (unsigned char const *)mbi.BaseAddress + mbi.RegionSize;
+	region->alloc   = mbi.AllocationBase;
+	region->state   = mbi.State;
+	region->protect = mbi.Protect;
+	region->type    = mbi.Type;
+	return (1);
+}
+
+// binary search (s_lock has to be held)
+static
+int find(unsigned char const *addr)
+{
+	int lo = 0;
+	int hi = s_count;
+	while (lo < hi) {
+		int const mid = lo + (hi - lo) / 2;
+		if (addr < s_cache[mid].begin) {
+			hi = mid;
+		} else if (addr >= s_cache[mid].end) {
+			lo = mid + 1;
+		} else {
+			return (mid);
+		}
+	}
+	return (-1);
+}
+
+// append all regions of an allocation (s_lock has to be held)
+static
+void walk(void const *alloc)
+{
+	KQF_MEM_REGION region;
+	unsigned char const *addr = (unsigned char const *)alloc;
+	while ((s_count < MEMCACHE_SIZE) && query(addr, &region) &&
+	       (region.alloc == alloc) && (region.state != MEM_FREE)) {
+		s_cache[s_count++] = region;
+		addr = region.end;
+	}
+}
+
+// insertion sort by address (s_lock has to be held)
+static
+void sort(void)
+{
+	int i;
+	for (i = 1; i < s_count; ++i) {
+		KQF_MEM_REGION const region = s_cache[i];
+		int j = i;
+		while ((j > 0) && (region.begin < s_cache[j - 1].begin)) {
+			s_cache[j] = s_cache[j - 1];
+			--j;
+		}
+		s_cache[j] = region;
+	}
+}
+
+
+int kqf_mem_cache(void const *addr)
+{
+	int result = 0;
+	KQF_MEM_REGION region;
+	if (s_init != MEMINIT_DONE)
+		init();
+	if (query(addr, &region) && (region.state != MEM_FREE)) {
+		EnterCriticalSection(&s_lock);
+		if (find(region.begin) < 0) {
+			walk(region.alloc);
+			sort();
+		}
+		result = (find(region.begin) >= 0);
+		LeaveCriticalSection(&s_lock);
+	}
+	return (result);
+}
+
+void kqf_mem_refresh(void)
+{
+	if (s_init != MEMINIT_DONE)
+		init();
+	EnterCriticalSection(&s_lock);
+	{
+		void const *alloc[MEMCACHE_ALLOC];
+		int count = 0;
+		int i;
+		for (i = 0; i < s_count; ++i) {
+			int j = 0;
+			while ((j < count) && (alloc[j] != s_cache[i].alloc))
+				++j;
+			if ((j == count) && (count < MEMCACHE_ALLOC))
+				alloc[count++] = s_cache[i].alloc;
+		}
+		s_count = 0;
+		for (i = 0; i < count; ++i)
+			walk(alloc[i]);
+		sort();
+	}
+	LeaveCriticalSection(&s_lock);
+}
+
+
+int kqf_mem_query(void const *addr, KQF_MEM_REGION *region)
+{
+	int index = -1;
+	if (s_count > 0) {
+		if (s_init != MEMINIT_DONE)
+			init();
+		EnterCriticalSection(&s_lock);
+		index = find((unsigned char const *)addr);
+		if (index >= 0)
+			*region = s_cache[index];
+		LeaveCriticalSection(&s_lock);
+	}
+	return ((index >= 0) || query(addr, region));
+}
+
+static
+int check(void const *addr, SIZE_T size, DWORD access)
+{
+	unsigned char const *pos = (unsigned char const *)addr;
+	unsigned char const *const end = pos + size;
+	if ((NULL == addr) || (end < pos))
+		return (0);
+	while (pos < end) {
+		KQF_MEM_REGION region;
+		if (!kqf_mem_query(pos, &region) ||
+		    (region.state != MEM_COMMIT) ||
+		    (PAGE_GUARD & region.protect) ||
+		    !(access & region.protect) ||
+		    (region.end <= pos))
+			return (0);
+		pos = region.end;
+	}
+	return (1);
+}
+
+int kqf_mem_readable(void const *addr, SIZE_T size)
+{
+	return (check(addr, size, MEM_READ));
+}
+
+int kqf_mem_writable(void const *addr, SIZE_T size)
+{
+	return (check(addr, size, MEM_WRITE));
+}
+
+int kqf_mem_executable(void const *addr, SIZE_T size)
+{
+	return (check(addr, size, MEM_EXECUTE));
+}
+
+
+void const *kqf_mem_base(void const *addr)
+{
+	KQF_MEM_REGION region;
+	if (!kqf_mem_query(addr, &region) || (MEM_FREE == region.state))
+		return (NULL);
+	return (region.alloc);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef KQF_MEM_H_
+#define KQF_MEM_H_
+
+#include "kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct KQF_MEM_REGION {
+	unsigned char const *begin;  // MEMORY_BASIC_INFORMATION.BaseAddress
+	unsigned char const *end;    // BaseAddress + RegionSize
+	void const          *alloc;  // AllocationBase
+	DWORD                state;  // MEM_COMMIT, MEM_RESERVE, MEM_FREE
+	DWORD                protect;
+	DWORD                type;   // MEM_IMAGE, MEM_MAPPED, MEM_PRIVATE
+} KQF_MEM_REGION;
+
+
+// cache all regions of the allocation (image) that contains addr
+int kqf_mem_cache(void const *addr);
+// walk all cached allocations again (after changing memory protection)
+void kqf_mem_refresh(void);
+
+
+// region of addr (cached or queried, but never added to the cache)
+int kqf_mem_query(void const *addr, KQF_MEM_REGION *region);
+
+// committed and accessible without PAGE_GUARD for the whole range
+int kqf_mem_readable(void const *addr, SIZE_T size);
+int kqf_mem_writable(void const *addr, SIZE_T size);
+int kqf_mem_executable(void const *addr, SIZE_T size);
+
+// allocation base of addr or NULL if the address is free
+void const *kqf_mem_base(void const *addr);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
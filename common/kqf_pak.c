@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "kqf_pak.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                          Compressed payload
+//
+// The shim runtime is embedded into the setup tool in blocks of 64 KiB that
+// are compressed with LZNT1 (RtlCompressBuffer/RtlDecompressBuffer are part of
+// NTDLL since Windows NT 3.51, no decompressor has to be linked in). Blocks are
+// decompressed one by one, so the payload can be streamed to disk. The CRC-32
+// of the uncompressed data identifies the content without loading the file.
+//
+
+typedef LONG (NTAPI *RTLDECOMPRESSBUFFER)(USHORT, PUCHAR, ULONG, PUCHAR, ULONG, PULONG);
+
+
+static DWORD const crc_table[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+DWORD kqf_pak_crc(DWORD crc, void const *data, DWORD size)
+{
+	unsigned char const *pos = (unsigned char const *)data;
+	crc = ~crc;
+	while (size--) {
+		crc ^= *pos++;
+		crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+		crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+	}
+	return (~crc);
+}
+
+
+DWORD kqf_pak_unpack(KQF_PAK_BLOCK const *block, void const *data, unsigned char out[KQF_PAK_CHUNK])
+{
+	static RTLDECOMPRESSBUFFER RtlDecompressBuffer /* = NULL */;
+	ULONG size = 0;
+	if ((block->size > KQF_PAK_CHUNK) || (block->packed > block->size)) {
+		return (ERROR_INVALID_DATA);
+	}
+	if (block->packed == block->size) {
+		unsigned char const *pos = (unsigned char const *)data;
+		for (size = 0; size < block->size; ++size)
+			out[size] = pos[size];
+		return (ERROR_SUCCESS);
+	}
+	if (NULL == RtlDecompressBuffer) {
+		HMODULE ntdll = GetModuleHandleA("NTDLL.dll");
+		if (ntdll != NULL)
+			RtlDecompressBuffer = (RTLDECOMPRESSBUFFER)GetProcAddress(ntdll, "RtlDecompressBuffer");
+		if (NULL == RtlDecompressBuffer)
+			return (ERROR_CALL_NOT_IMPLEMENTED);
+	}
+	if ((RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1, out, KQF_PAK_CHUNK,
+	    (PUCHAR)data, block->packed, &size) < 0) || (size != block->size)) {
+		return (ERROR_INVALID_DATA);
+	}
+	return (ERROR_SUCCESS);
+}
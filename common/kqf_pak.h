@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef KQF_PAK_H_
+#define KQF_PAK_H_
+
+#include "kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// compressed payload: header, then header.blocks times block + data
+enum KQF_PAK_ {
+	KQF_PAK_MAGIC = 0x5046514B,  // "KQFP"
+	KQF_PAK_CHUNK = 0x00010000   // uncompressed block size
+};
+
+typedef struct KQF_PAK_HEADER {
+	DWORD magic;
+	DWORD size;    // uncompressed
+	DWORD crc;     // CRC-32 of the uncompressed data
+	DWORD blocks;
+} KQF_PAK_HEADER;
+
+typedef struct KQF_PAK_BLOCK {
+	DWORD packed;  // LZNT1 data size (equal to size if stored)
+	DWORD size;    // uncompressed (up to KQF_PAK_CHUNK)
+} KQF_PAK_BLOCK;
+
+
+// CRC-32 (IEEE 802.3), start with 0
+DWORD kqf_pak_crc(DWORD crc, void const *data, DWORD size);
+
+// decompress a single block (Win32 error code)
+DWORD kqf_pak_unpack(KQF_PAK_BLOCK const *block, void const *data, unsigned char out[KQF_PAK_CHUNK]);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -53,6 +53,10 @@ DECLSPEC_IMPORT HWND VFWAPIV MCIWndCreateA(HWND hwndParent, HINSTANCE hInstance,
 # define InterlockedIncrement _InterlockedIncrement
 # pragma intrinsic(_InterlockedDecrement)
 # define InterlockedDecrement _InterlockedDecrement
+# pragma intrinsic(_InterlockedExchange)
+# define InterlockedExchange _InterlockedExchange
+# pragma intrinsic(_InterlockedExchangeAdd)
+# define InterlockedExchangeAdd _InterlockedExchangeAdd
 # pragma intrinsic(_InterlockedCompareExchange)
 # define InterlockedCompareExchange _InterlockedCompareExchange
 # pragma intrinsic(_ReturnAddress)
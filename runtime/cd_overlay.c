@@ -0,0 +1,547 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "cd_overlay.h"
+
+#include "hook_cdrom.h"
+
+#include "../common/kqf_app.h"
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                    Virtual CD-ROM served from an index
+//
+// The CD-ROM content folder is walked once at startup and all files and
+// directories are kept in an in-memory index (an entry array with the tree
+// links and an open addressing hash table over the case-insensitive FNV-1a of
+// the relative path). Files the game only needs the size of can be added as
+// virtual entries. All CreateFileA, GetFileAttributesA, and FindFirstFileA
+// calls on the fake drive are answered from the index (a lookup is one hash
+// and usually one string compare), so missing files are never probed on disk
+// and existing ones are opened through their real path. The index is only
+// modified during the initialization and therefore read without locking.
+// Find handles are sentinel values (like the fake file handles) that index a
+// small per-handle state; the "." and ".." entries are not reported.
+//
+
+enum CDOVERLAY_ {
+	CDOVERLAY_ENTRIES = 0x10000,  // limit
+	CDOVERLAY_FINDS   = 16
+};
+
+#define CDOVERLAY_FIND_BASE 0xFBAE0000UL
+
+typedef struct CDOVERLAY_FIND {
+	LONG /*volatile*/ used;
+	int               next;  // next entry to match (or -1)
+	char              pattern[MAX_PATH];
+} CDOVERLAY_FIND;
+
+static HANDLE s_heap /* = NULL */;
+static CD_OVERLAY_ENTRY *s_entry /* = NULL */;
+static int s_count /* = 0 */;
+static int s_capacity /* = 0 */;
+static int *s_slot /* = NULL */;  // index + 1 (0 = unused)
+static int s_slots /* = 0 */;     // power of two
+static LONG /*volatile*/ s_hits /* = 0 */;
+static LONG /*volatile*/ s_misses /* = 0 */;
+static CDOVERLAY_FIND s_find[CDOVERLAY_FINDS] /* = {0} */;
+
+
+static
+char lower_char(char ch)
+{
+	if (('A' <= ch) && (ch <= 'Z')) {
+		return (ch + ('a' - 'A'));
+	}
+	return (ch);
+}
+
+static
+DWORD name_hash(char const *name)
+{
+	DWORD hash = 2166136261UL;
+	while (*name) {
+		hash = (hash ^ (unsigned char)lower_char(*name++)) * 16777619UL;
+	}
+	return (hash);
+}
+
+// case-insensitive match with '*' and '?' wildcards
+static
+int match_name(char const *name, char const *pattern)
+{
+	char const *star = NULL;
+	char const *back = NULL;
+	while (*name) {
+		if ('*' == *pattern) {
+			star = ++pattern;
+			back = name;
+		} else if (('?' == *pattern) || (lower_char(*pattern) == lower_char(*name))) {
+			++pattern;
+			++name;
+		} else if (star != NULL) {
+			pattern = star;
+			name = ++back;
+		} else {
+			return (0);
+		}
+	}
+	while ('*' == *pattern) {
+		++pattern;
+	}
+	return ('\0' == *pattern);
+}
+
+// relative path below the fake drive root ('/' replaced, no trailing '\')
+static
+int relative_name(char const *path, char name[MAX_PATH])
+{
+	int len = 0;
+	if (!cd_overlay_path(path)) {
+		return (0);
+	}
+	path += sizeof(FAKE_CDROM) - 1;
+	while (*path) {
+		if (len >= MAX_PATH - 1) {
+			return (0);
+		}
+		name[len++] = ('/' == *path) ? '\\' : *path;
+		++path;
+	}
+	while ((len > 0) && ('\\' == name[len - 1])) {
+		--len;
+	}
+	name[len] = '\0';
+	return (1);
+}
+
+static
+int lookup(char const *name)
+{
+	if (s_slots) {
+		DWORD const mask = (DWORD)s_slots - 1;
+		DWORD i = name_hash(name) & mask;
+		while (s_slot[i]) {
+			int const entry = s_slot[i] - 1;
+			if (0 == lstrcmpiA(s_entry[entry].name, name)) {
+				return (entry);
+			}
+			i = (i + 1) & mask;
+		}
+	}
+	return (-1);
+}
+
+static
+void insert_slot(int entry)
+{
+	DWORD const mask = (DWORD)s_slots - 1;
+	DWORD i = name_hash(s_entry[entry].name) & mask;
+	while (s_slot[i]) {
+		i = (i + 1) & mask;
+	}
+	s_slot[i] = entry + 1;
+}
+
+// appends an entry to the directory (NULL if out of memory)
+static
+CD_OVERLAY_ENTRY *add_entry(int parent, char const *name, char const *source)
+{
+	CD_OVERLAY_ENTRY *entry;
+	char *text;
+	int const len = lstrlenA(name);
+	int const src = source ? lstrlenA(source) + 1 : 0;
+	if (s_count >= CDOVERLAY_ENTRIES) {
+		return (NULL);
+	}
+	if (s_count >= s_capacity) {
+		int const capacity = s_capacity ? s_capacity * 2 : 256;
+		CD_OVERLAY_ENTRY *grown = (CD_OVERLAY_ENTRY *)(s_entry ?
+			HeapReAlloc(s_heap, 0, s_entry, capacity * sizeof(CD_OVERLAY_ENTRY)) :
+			HeapAlloc(s_heap, 0, capacity * sizeof(CD_OVERLAY_ENTRY)));
+		if (NULL == grown) {
+			return (NULL);
+		}
+		s_entry = grown;
+		s_capacity = capacity;
+	}
+	if ((s_count + 1) * 2 > s_slots) {
+		int const slots = s_slots ? s_slots * 2 : 512;
+		int *grown = (int *)HeapAlloc(s_heap, HEAP_ZERO_MEMORY, slots * sizeof(int));
+		int i;
+		if (NULL == grown) {
+			return (NULL);
+		}
+		if (s_slot != NULL) {
+			HeapFree(s_heap, 0, s_slot);
+		}
+		s_slot = grown;
+		s_slots = slots;
+		for (i = 0; i < s_count; ++i) {
+			insert_slot(i);
+		}
+	}
+	text = (char *)HeapAlloc(s_heap, 0, len + 1 + src);
+	if (NULL == text) {
+		return (NULL);
+	}
+	lstrcpyA(text, name);
+	entry = &s_entry[s_count];
+	ZeroMemory(entry, sizeof(*entry));
+	entry->name = text;
+	if (source != NULL) {
+		entry->source = lstrcpyA(&text[len + 1], source);
+	}
+	entry->base = len;
+	while ((entry->base > 0) && (name[entry->base - 1] != '\\')) {
+		--entry->base;
+	}
+	entry->parent = parent;
+	entry->child = -1;
+	entry->next = -1;
+	if (parent >= 0) {
+		entry->next = s_entry[parent].child;
+		s_entry[parent].child = s_count;
+	}
+	insert_slot(s_count++);
+	return (entry);
+}
+
+// directory entry for the relative path (virtual directories are created)
+static
+int add_directory(char const *name)
+{
+	char parent[MAX_PATH];
+	int entry = lookup(name);
+	int len;
+	if (entry >= 0) {
+		return ((FILE_ATTRIBUTE_DIRECTORY & s_entry[entry].attributes) ? entry : -1);
+	}
+	len = lstrlenA(name);
+	while ((len > 0) && (name[len - 1] != '\\')) {
+		--len;
+	}
+	lstrcpynA(parent, name, len ? len : 1);
+	entry = add_directory(parent);
+	if (entry >= 0) {
+		CD_OVERLAY_ENTRY *dir = add_entry(entry, name, NULL);
+		if (NULL == dir) {
+			return (-1);
+		}
+		dir->attributes = FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_READONLY;
+		entry = s_count - 1;
+	}
+	return (entry);
+}
+
+// adds the folder content recursively (path and name are modified, but restored)
+static
+void add_folder(int parent, char path[MAX_PATH], char name[MAX_PATH])
+{
+	int const path_len = lstrlenA(path);
+	int const name_len = lstrlenA(name);
+	WIN32_FIND_DATAA data;
+	HANDLE find;
+	if (path_len + 2 > MAX_PATH) {
+		return;
+	}
+	lstrcpyA(&path[path_len], "*");
+	find = FindFirstFileA(path, &data);
+	if (INVALID_HANDLE_VALUE == find) {
+		path[path_len] = '\0';
+		return;
+	}
+	do {
+		int const len = lstrlenA(data.cFileName);
+		CD_OVERLAY_ENTRY *entry;
+		if (('.' == data.cFileName[0]) && (('\0' == data.cFileName[1]) ||
+		    (('.' == data.cFileName[1]) && ('\0' == data.cFileName[2])))) {
+			continue;
+		}
+		if ((path_len + len + 2 > MAX_PATH) || (name_len + len + 2 > MAX_PATH)) {
+			kqf_log(KQF_LOGL_WARNING, "CdOverlay: path too long '%s%s'\n", path, data.cFileName);
+			continue;
+		}
+		lstrcpyA(&path[path_len], data.cFileName);
+		if (name_len) {
+			name[name_len] = '\\';
+			lstrcpyA(&name[name_len + 1], data.cFileName);
+		} else {
+			lstrcpyA(name, data.cFileName);
+		}
+		entry = add_entry(parent, name, path);
+		if (NULL == entry) {
+			kqf_log(KQF_LOGL_ERROR, "CdOverlay: index full at '%s'\n", path);
+			break;
+		}
+		entry->attributes = data.dwFileAttributes | FILE_ATTRIBUTE_READONLY;
+		entry->size = data.nFileSizeLow;
+		entry->time = data.ftLastWriteTime;
+		if (FILE_ATTRIBUTE_DIRECTORY & data.dwFileAttributes) {
+			lstrcatA(path, "\\");
+			add_folder(s_count - 1, path, name);
+		}
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+	path[path_len] = '\0';
+	name[name_len] = '\0';
+}
+
+static
+void fill_data(CD_OVERLAY_ENTRY const *entry, LPWIN32_FIND_DATAA data)
+{
+	if (data != NULL) {
+		ZeroMemory(data, sizeof(*data));
+		data->dwFileAttributes = entry->attributes;
+		data->ftCreationTime = entry->time;
+		data->ftLastAccessTime = entry->time;
+		data->ftLastWriteTime = entry->time;
+		data->nFileSizeLow = entry->size;
+		lstrcpynA(data->cFileName, &entry->name[entry->base], sizeof(data->cFileName));
+	}
+}
+
+// first entry from index on that matches the pattern (or -1)
+static
+int next_match(int entry, char const *pattern)
+{
+	while ((entry >= 0) && !match_name(&s_entry[entry].name[s_entry[entry].base], pattern)) {
+		entry = s_entry[entry].next;
+	}
+	return (entry);
+}
+
+static
+CDOVERLAY_FIND *find_state(HANDLE handle)
+{
+	ULONG_PTR const slot = ((ULONG_PTR)handle - CDOVERLAY_FIND_BASE) >> 2;
+	if ((slot < CDOVERLAY_FINDS) && (0 == (3 & (ULONG_PTR)handle)) && s_find[slot].used) {
+		return (&s_find[slot]);
+	}
+	return (NULL);
+}
+
+
+int init_cd_overlay(void)
+{
+	char path[MAX_PATH];
+	char name[MAX_PATH];
+	CD_OVERLAY_ENTRY *root;
+	int len;
+	if (s_heap != NULL) {
+		return (1);
+	}
+	s_heap = HeapCreate(0, 0, 0);
+	if (NULL == s_heap) {
+		kqf_log(KQF_LOGL_ERROR, "CdOverlay: failed to create heap (%#lx)\n", GetLastError());
+		return (0);
+	}
+	kqf_app_filepath("kq8fix.ini", name);
+	GetPrivateProfileStringA("cdrom", "source", FAKE_CDROM, path, sizeof(path) - 1, name);
+	len = lstrlenA(path);
+	if ((len > 0) && (path[len - 1] != '\\') && (path[len - 1] != '/')) {
+		lstrcpyA(&path[len], "\\");
+	}
+	root = add_entry(-1, "", path);
+	if (NULL == root) {
+		kqf_log(KQF_LOGL_ERROR, "CdOverlay: out of memory\n");
+		free_cd_overlay();
+		return (0);
+	}
+	root->attributes = FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_READONLY;
+	name[0] = '\0';
+	add_folder(0, path, name);
+	kqf_log(KQF_LOGL_INFO, "CdOverlay: %i entries from '%s'\n", s_count - 1, path);
+	return (1);
+}
+
+void free_cd_overlay(void)
+{
+	if (s_heap != NULL) {
+		kqf_log(KQF_LOGL_INFO, "CdOverlay: %i entries, %li hits, %li misses\n", s_count, s_hits, s_misses);
+		HeapDestroy(s_heap), s_heap = NULL;
+		s_entry = NULL;
+		s_count = s_capacity = 0;
+		s_slot = NULL;
+		s_slots = 0;
+	}
+}
+
+int cd_overlay_add(char const *path, DWORD size, char const *source)
+{
+	char name[MAX_PATH];
+	char parent[MAX_PATH];
+	CD_OVERLAY_ENTRY *entry;
+	WIN32_FIND_DATAA data;
+	int dir;
+	int len;
+	if ((NULL == s_heap) || !relative_name(path, name) || !name[0] || (lookup(name) >= 0)) {
+		return (0);
+	}
+	ZeroMemory(&data, sizeof(data));
+	if (source != NULL) {
+		HANDLE find = FindFirstFileA(source, &data);
+		if (INVALID_HANDLE_VALUE == find) {
+			return (0);
+		}
+		FindClose(find);
+	}
+	len = lstrlenA(name);
+	while ((len > 0) && (name[len - 1] != '\\')) {
+		--len;
+	}
+	lstrcpynA(parent, name, len ? len : 1);
+	dir = add_directory(parent);
+	entry = (dir >= 0) ? add_entry(dir, name, source) : NULL;
+	if (NULL == entry) {
+		return (0);
+	}
+	if (source != NULL) {
+		entry->attributes = data.dwFileAttributes | FILE_ATTRIBUTE_READONLY;
+		entry->size = data.nFileSizeLow;
+		entry->time = data.ftLastWriteTime;
+	} else {
+		entry->attributes = FILE_ATTRIBUTE_READONLY;
+		entry->size = size;
+	}
+	kqf_log(KQF_LOGL_DEBUG, "CdOverlay: added '%s' (%lu bytes)\n", path, entry->size);
+	return (1);
+}
+
+int cd_overlay_path(char const *path)
+{
+	CHAR root[sizeof(FAKE_CDROM)];
+	if ((NULL == s_heap) || (NULL == path)) {
+		return (0);
+	}
+	lstrcpynA(root, path, sizeof(FAKE_CDROM));
+	return (0 == lstrcmpiA(root, FAKE_CDROM));
+}
+
+CD_OVERLAY_ENTRY const *cd_overlay_find(char const *path)
+{
+	char name[MAX_PATH];
+	int entry;
+	if (!relative_name(path, name)) {
+		SetLastError(ERROR_PATH_NOT_FOUND);
+		return (NULL);
+	}
+	entry = lookup(name);
+	if (entry < 0) {
+		int len = lstrlenA(name);
+		InterlockedIncrement(&s_misses);
+		while ((len > 0) && (name[len - 1] != '\\')) {
+			--len;
+		}
+		name[len ? len - 1 : 0] = '\0';
+		entry = lookup(name);
+		SetLastError(((entry >= 0) && (FILE_ATTRIBUTE_DIRECTORY & s_entry[entry].attributes)) ?
+			ERROR_FILE_NOT_FOUND : ERROR_PATH_NOT_FOUND);
+		return (NULL);
+	}
+	InterlockedIncrement(&s_hits);
+	return (&s_entry[entry]);
+}
+
+HANDLE cd_overlay_find_first(char const *pattern, LPWIN32_FIND_DATAA data)
+{
+	char name[MAX_PATH];
+	char mask[MAX_PATH];
+	int dir;
+	int entry;
+	int len;
+	int i;
+	if (!relative_name(pattern, name)) {
+		SetLastError(ERROR_PATH_NOT_FOUND);
+		return (INVALID_HANDLE_VALUE);
+	}
+	len = lstrlenA(name);
+	while ((len > 0) && (name[len - 1] != '\\')) {
+		--len;
+	}
+	lstrcpyA(mask, (0 == lstrcmpA(&name[len], "*.*")) ? "*" : &name[len]);
+	name[len ? len - 1 : 0] = '\0';
+	dir = lookup(name);
+	if ((dir < 0) || !(FILE_ATTRIBUTE_DIRECTORY & s_entry[dir].attributes)) {
+		InterlockedIncrement(&s_misses);
+		SetLastError(ERROR_PATH_NOT_FOUND);
+		return (INVALID_HANDLE_VALUE);
+	}
+	entry = next_match(s_entry[dir].child, mask);
+	if (entry < 0) {
+		InterlockedIncrement(&s_misses);
+		SetLastError(ERROR_FILE_NOT_FOUND);
+		return (INVALID_HANDLE_VALUE);
+	}
+	InterlockedIncrement(&s_hits);
+	for (i = 0; i < CDOVERLAY_FINDS; ++i) {
+		if (0 == InterlockedCompareExchange(&s_find[i].used, 1, 0)) {
+			lstrcpynA(s_find[i].pattern, mask, sizeof(s_find[i].pattern));
+			s_find[i].next = s_entry[entry].next;
+			fill_data(&s_entry[entry], data);
+			SetLastError(ERROR_SUCCESS);
+			return ((HANDLE)(ULONG_PTR)(CDOVERLAY_FIND_BASE + ((ULONG_PTR)i << 2)));
+		}
+	}
+	kqf_log(KQF_LOGL_WARNING, "CdOverlay: no find handle left for '%s'\n", pattern);
+	SetLastError(ERROR_NO_MORE_FILES);
+	return (INVALID_HANDLE_VALUE);
+}
+
+int cd_overlay_find_handle(HANDLE handle)
+{
+	return (find_state(handle) != NULL);
+}
+
+BOOL cd_overlay_find_next(HANDLE handle, LPWIN32_FIND_DATAA data)
+{
+	CDOVERLAY_FIND *find = find_state(handle);
+	int entry;
+	if (NULL == find) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return (FALSE);
+	}
+	entry = next_match(find->next, find->pattern);
+	if (entry < 0) {
+		find->next = -1;
+		SetLastError(ERROR_NO_MORE_FILES);
+		return (FALSE);
+	}
+	find->next = s_entry[entry].next;
+	fill_data(&s_entry[entry], data);
+	SetLastError(ERROR_SUCCESS);
+	return (TRUE);
+}
+
+BOOL cd_overlay_find_close(HANDLE handle)
+{
+	CDOVERLAY_FIND *find = find_state(handle);
+	if (NULL == find) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return (FALSE);
+	}
+	InterlockedExchange(&find->used, 0);
+	SetLastError(ERROR_SUCCESS);
+	return (TRUE);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CD_OVERLAY_H_
+#define CD_OVERLAY_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct CD_OVERLAY_ENTRY {
+	char const *name;    // path relative to the fake CD-ROM root ("" = root)
+	char const *source;  // real path (NULL = virtual file or directory)
+	int         base;    // offset of the last path component in name
+	int         parent;  // index of the directory entry
+	int         child;   // first entry in this directory (or -1)
+	int         next;    // next entry in the same directory (or -1)
+	DWORD       attributes;
+	DWORD       size;
+	FILETIME    time;
+} CD_OVERLAY_ENTRY;
+
+// KQF_CFGO_CDROM_OVERLAY
+
+// indexes the CD-ROM content folder ([cdrom] source in kq8fix.ini, defaults to FAKE_CDROM)
+int init_cd_overlay(void);
+void free_cd_overlay(void);
+
+// adds a file that is not in the folder (source NULL = size-only file, init only)
+int cd_overlay_add(char const *path, DWORD size, char const *source);
+
+// path on the fake CD-ROM drive (served from the index)
+int cd_overlay_path(char const *path);
+
+// entry for a path on the fake drive (NULL with last error set if not found)
+CD_OVERLAY_ENTRY const *cd_overlay_find(char const *path);
+
+// FindFirstFileA/FindNextFileA/FindClose on the index
+HANDLE cd_overlay_find_first(char const *pattern, LPWIN32_FIND_DATAA data);
+int cd_overlay_find_handle(HANDLE handle);
+BOOL cd_overlay_find_next(HANDLE handle, LPWIN32_FIND_DATAA data);
+BOOL cd_overlay_find_close(HANDLE handle);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
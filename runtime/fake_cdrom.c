@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "fake_cdrom.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                         Fake CD-ROM file table
+//
+// Files the game opens on the CD-ROM only to read their size (the data comes
+// from the hard disk installation). The table is looked up with a perfect hash
+// (eleven keys in 16 slots, so it is not minimal): FNV-1a of the lower-case
+// path with FAKE_CDROM_SEED as offset basis, and the upper four bits select
+// the slot. The seed is the smallest one without collisions for these paths,
+// so each lookup is one hash and one lstrcmpiA. If the table is changed, run
+// "make -C tools check" to verify the slots and to search a new seed.
+//
+
+// build-time checks (the slot is the upper four bits of a 32-bit hash)
+typedef char fake_cdrom_slot_bits[(16 == FAKE_CDROM_SLOTS) ? 1 : -1];
+typedef char fake_cdrom_slot_keys[(FAKE_CDROM_FILES <= FAKE_CDROM_SLOTS) ? 1 : -1];
+
+struct FAKE_CDROM_FILE const fake_cdrom_files[FAKE_CDROM_FILES] = {
+	{FAKE_CDROM "barren\\sound\\c_wtrdie.aud",    7246734},
+	{FAKE_CDROM "daventry\\sound\\c_drwndi.aud",  5787566},
+	{FAKE_CDROM "deadcity\\sound\\c_brndie.aud",  5239874},
+	{FAKE_CDROM "game\\sound\\c_blddie.aud",      4778978},
+	{FAKE_CDROM "game\\sound\\cr_baway.aud",        37755},
+	{FAKE_CDROM "gnome\\sound\\c_hngdie.aud",     3235452},
+	{FAKE_CDROM "iceworld\\resource.vol",        15279993},
+	{FAKE_CDROM "iceworld\\sound\\c_flydie.aud",  4573247},
+	{FAKE_CDROM "iceworld\\sound\\oh_fdie.aud",     76298},
+	{FAKE_CDROM "swamp\\sound\\c_spkdie.aud",     4289787},
+	{FAKE_CDROM "temple3\\8gui.vol",               411384}
+};
+
+signed char const fake_cdrom_slot[FAKE_CDROM_SLOTS] = {
+	0, -1, -1, 3, 7, -1, 9, -1, 2, 5, 10, 1, 8, -1, 4, 6
+};
+
+
+unsigned int fake_cdrom_hash(char const *path, unsigned int seed)
+{
+	unsigned int hash = seed;
+	while (*path) {
+		unsigned char ch = (unsigned char)*path++;
+		if (('A' <= ch) && (ch <= 'Z')) {
+			ch += 'a' - 'A';
+		}
+		hash = (hash ^ ch) * 16777619U;
+	}
+	return (hash & 0xFFFFFFFFU);
+}
+
+int fake_cdrom_lookup(char const *path)
+{
+	return (fake_cdrom_slot[(fake_cdrom_hash(path, FAKE_CDROM_SEED) >> 28) & (FAKE_CDROM_SLOTS - 1)]);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef FAKE_CDROM_H_
+#define FAKE_CDROM_H_
+
+// no Windows headers (the table is also checked on the host by tools/cdr_check)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// cannot be longer than 3 characters (application buffer size for drive root)
+#define FAKE_CDROM "cd\\"
+
+// offset basis for fake_cdrom_hash (searched by tools/cdr_check)
+#define FAKE_CDROM_SEED   20U
+#define FAKE_CDROM_SLOTS  16
+#define FAKE_CDROM_FILES  11
+
+
+struct FAKE_CDROM_FILE {
+	const char *  path;
+	unsigned long size;
+};
+
+extern struct FAKE_CDROM_FILE const fake_cdrom_files[FAKE_CDROM_FILES];
+
+// slot (hash >> 28) -> index in fake_cdrom_files (or -1)
+extern signed char const fake_cdrom_slot[FAKE_CDROM_SLOTS];
+
+// 32-bit FNV-1a of the lower-case path (seed = offset basis)
+unsigned int fake_cdrom_hash(char const *path, unsigned int seed);
+
+// index of the only table entry the path can match (or -1, has to be compared)
+int fake_cdrom_lookup(char const *path);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
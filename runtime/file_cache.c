@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "file_cache.h"
+
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                          File attribute cache
+//
+// The hooks probe the same few files over and over (the video redirection on
+// every video, the fake CD-ROM files on every open, and the CD detection on
+// every read of Install.Drive). The attributes of a path (or the fact that it
+// does not exist) are cached in a small hash table (case-insensitive FNV-1a of
+// the path, linear probing within a bucket of FILECACHE_WAYS slots, the oldest
+// slot is replaced). The entries expire after FILECACHE_TTL milliseconds. With
+// file.watch a background thread waits for change notifications of the current
+// directory tree (the game directory with the fake CD-ROM directory) and drops
+// all entries on a change, so that relative paths are kept until then.
+//
+
+enum FILECACHE_ {
+	FILECACHE_SLOTS = 256,
+	FILECACHE_WAYS  = 8,
+	FILECACHE_TTL   = 5000  // ms (not watched)
+};
+
+typedef struct FILECACHE_ENTRY {
+	DWORD hash;        // 0 = unused
+	DWORD attributes;
+	DWORD tick;        // GetTickCount() of the probe
+	LONG  generation;  // s_generation of the probe
+	int   watched;     // relative path
+	char  path[MAX_PATH];
+} FILECACHE_ENTRY;
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static LONG /*volatile*/ s_generation /* = 0 */;
+static LONG /*volatile*/ s_watching /* = 0 */;
+static LONG /*volatile*/ s_hits /* = 0 */;
+static LONG /*volatile*/ s_misses /* = 0 */;
+static LONG /*volatile*/ s_changes /* = 0 */;
+static HANDLE s_stop /* = NULL */;
+static CRITICAL_SECTION s_lock;
+static FILECACHE_ENTRY s_entry[FILECACHE_SLOTS] /* = {0} */;
+
+
+static
+DWORD path_hash(char const *path)
+{
+	DWORD hash = 2166136261UL;
+	while (*path) {
+		unsigned char ch = (unsigned char)*path++;
+		if (('A' <= ch) && (ch <= 'Z')) {
+			ch += 'a' - 'A';
+		} else if ('/' == ch) {
+			ch = '\\';
+		}
+		hash = (hash ^ ch) * 16777619UL;
+	}
+	return (hash ? hash : 1);
+}
+
+static
+int is_relative(char const *path)
+{
+	return ((path[0] != '\\') && (path[0] != '/') && (path[0] != '\0') && (path[1] != ':'));
+}
+
+// entry is still valid (s_lock has to be held)
+static
+int is_current(FILECACHE_ENTRY const *entry)
+{
+	if (entry->generation != s_generation) {
+		return (0);
+	}
+	if (entry->watched && s_watching) {
+		return (1);
+	}
+	return (GetTickCount() - entry->tick < FILECACHE_TTL);
+}
+
+static
+DWORD WINAPI watch_proc(LPVOID param)
+{
+	HANDLE wait[2];
+	UNREFERENCED_PARAMETER(param);
+	wait[0] = s_stop;
+	wait[1] = FindFirstChangeNotificationA(".", TRUE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_ATTRIBUTES);
+	if (INVALID_HANDLE_VALUE == wait[1]) {
+		kqf_log(KQF_LOGL_WARNING, "FileCache: failed to watch the current directory (%#lx)\n", GetLastError());
+		return (0);
+	}
+	InterlockedExchange(&s_watching, 1);
+	while (WAIT_OBJECT_0 + 1 == WaitForMultipleObjects(2, wait, FALSE, INFINITE)) {
+		InterlockedIncrement(&s_generation);
+		InterlockedIncrement(&s_changes);
+		if (!FindNextChangeNotification(wait[1])) {
+			break;
+		}
+	}
+	InterlockedExchange(&s_watching, 0);
+	FindCloseChangeNotification(wait[1]);
+	return (0);
+}
+
+
+int init_file_cache(int watch)
+{
+	if (s_active) {
+		return (1);
+	}
+	InitializeCriticalSection(&s_lock);
+	InterlockedExchange(&s_active, 1);
+	if (watch) {
+		HANDLE thread = NULL;
+		s_stop = CreateEventA(NULL, TRUE, FALSE, NULL);
+		if (s_stop != NULL) {
+			DWORD id;
+			thread = CreateThread(NULL, 0, watch_proc, NULL, 0, &id);
+		}
+		if (NULL == thread) {
+			kqf_log(KQF_LOGL_ERROR, "FileCache: failed to create watch thread (%#lx)\n", GetLastError());
+			return (0);
+		}
+		CloseHandle(thread);
+	}
+	kqf_log(KQF_LOGL_INFO, "FileCache: %u slots%s\n", FILECACHE_SLOTS, watch ? ", watching the current directory" : "");
+	return (1);
+}
+
+void free_file_cache(void)
+{
+	if (s_active) {
+		if (s_stop != NULL) {
+			// the thread is not joined (loader lock)
+			SetEvent(s_stop);
+		}
+		kqf_log(KQF_LOGL_INFO, "FileCache: %li hits, %li misses, %li directory changes\n", s_hits, s_misses, s_changes);
+	}
+}
+
+DWORD file_cache_attributes(char const *path)
+{
+	DWORD const hash = path_hash(path);
+	FILECACHE_ENTRY *entry;
+	FILECACHE_ENTRY *slot = NULL;
+	DWORD result;
+	LONG generation;
+	int i;
+	if (!s_active || (lstrlenA(path) >= MAX_PATH)) {
+		return (GetFileAttributesA(path));
+	}
+	EnterCriticalSection(&s_lock);
+	for (i = 0; i < FILECACHE_WAYS; ++i) {
+		entry = &s_entry[(hash + i) % FILECACHE_SLOTS];
+		if ((entry->hash == hash) && (0 == lstrcmpiA(entry->path, path))) {
+			if (is_current(entry)) {
+				result = entry->attributes;
+				LeaveCriticalSection(&s_lock);
+				InterlockedIncrement(&s_hits);
+				return (result);
+			}
+			slot = entry;
+			break;
+		}
+		if ((NULL == slot) || (0 == entry->hash) ||
+		    ((slot->hash != 0) && (entry->tick - slot->tick > 0x7FFFFFFFUL))) {
+			// free slot or the oldest one
+			slot = entry;
+		}
+	}
+	LeaveCriticalSection(&s_lock);
+	InterlockedIncrement(&s_misses);
+
+	// the probe is not made under the lock (optical and network drives might block)
+	generation = s_generation;
+	result = GetFileAttributesA(path);
+	EnterCriticalSection(&s_lock);
+	slot->hash = hash;
+	slot->attributes = result;
+	slot->tick = GetTickCount();
+	slot->generation = generation;
+	slot->watched = is_relative(path);
+	lstrcpyA(slot->path, path);
+	LeaveCriticalSection(&s_lock);
+	return (result);
+}
+
+int file_cache_exists(char const *path)
+{
+	DWORD const attributes = file_cache_attributes(path);
+	return ((attributes != INVALID_FILE_ATTRIBUTES) && !(FILE_ATTRIBUTE_DIRECTORY & attributes));
+}
+
+void file_cache_invalidate(char const *path)
+{
+	if (s_active) {
+		if (NULL == path) {
+			InterlockedIncrement(&s_generation);
+		} else {
+			DWORD const hash = path_hash(path);
+			int i;
+			EnterCriticalSection(&s_lock);
+			for (i = 0; i < FILECACHE_WAYS; ++i) {
+				FILECACHE_ENTRY *entry = &s_entry[(hash + i) % FILECACHE_SLOTS];
+				if ((entry->hash == hash) && (0 == lstrcmpiA(entry->path, path))) {
+					entry->hash = 0;
+					break;
+				}
+			}
+			LeaveCriticalSection(&s_lock);
+		}
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_FILE_WATCH
+
+// watch: invalidate on changes in the current directory (else the entries expire)
+int init_file_cache(int watch);
+void free_file_cache(void);
+
+// cached GetFileAttributesA (INVALID_FILE_ATTRIBUTES if not found)
+DWORD file_cache_attributes(char const *path);
+
+// existing file (not a directory)
+int file_cache_exists(char const *path);
+
+// drops the cached entry (NULL drops all entries)
+void file_cache_invalidate(char const *path);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -21,46 +21,242 @@
  */
 #include "hook_cdrom.h"
 
+#include "cd_overlay.h"
+#include "file_cache.h"
 #include "hook_video.h"
+#include "mem_prof.h"
+#include "save_prof.h"
+#include "volume_cache.h"
 
+#include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
 
 
 #define CDROM_DETECT_NAME "iceworld\\resource.vol"
+#define WORLD_VOLUME_NAME "\\resource.vol"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                         Fake CD-ROM file handles
+//
+// Opened fake files (fake_cdrom.c) get distinct sentinel handles (negative
+// values, which are invalid user-mode handles for all other APIs) that index a
+// per-handle state, so concurrent opens from several threads do not overwrite
+// each other.
+//
+
+#define FAKE_HANDLE_BASE   0xFBAD0000UL
+#define FAKE_HANDLE_COUNT  64
+
+// per-handle state (index + 1 of the file, 0 = unused)
+static LONG /*volatile*/ fake_handles[FAKE_HANDLE_COUNT] /* = {0} */;
+
+
+static
+HANDLE fake_handle_open(int file)
+{
+	int i;
+	for (i = 0; i < FAKE_HANDLE_COUNT; ++i) {
+		if (0 == InterlockedCompareExchange(&fake_handles[i], file + 1, 0)) {
+			return ((HANDLE)(ULONG_PTR)(FAKE_HANDLE_BASE + ((ULONG_PTR)i << 2)));
+		}
+	}
+	return (INVALID_HANDLE_VALUE);
+}
+
+// index of the file for a fake handle (or -1)
+static
+int fake_handle_file(HANDLE handle)
+{
+	ULONG_PTR const slot = ((ULONG_PTR)handle - FAKE_HANDLE_BASE) >> 2;
+	if ((slot < FAKE_HANDLE_COUNT) && (0 == (3 & (ULONG_PTR)handle))) {
+		return ((int)fake_handles[slot] - 1);
+	}
+	return (-1);
+}
+
+static
+void fake_handle_close(HANDLE handle)
+{
+	InterlockedExchange(&fake_handles[((ULONG_PTR)handle - FAKE_HANDLE_BASE) >> 2], 0);
+}
+
+// adds the fake files and mask.inf to the CD-ROM overlay (if not in the folder)
+int init_cdrom_overlay(void)
+{
+	CHAR name[MAX_PATH];
+	int i;
+	if (!init_cd_overlay()) {
+		return (0);
+	}
+	for (i = 0; i < FAKE_CDROM_FILES; ++i) {
+		cd_overlay_add(fake_cdrom_files[i].path, fake_cdrom_files[i].size, NULL);
+	}
+	kqf_app_filepath("mask.inf", name);
+	if (!file_cache_exists(name))
+		kqf_app_filepath("mask.cs", name);
+	cd_overlay_add(FAKE_CDROM "mask.inf", 0, name);
+	return (1);
+}
 
 
-static struct FAKE_CDROM_FILE {
-	const char *  path;
-	unsigned long size;
-} const fake_cdrom_files[11] = {
-	{FAKE_CDROM "barren\\sound\\c_wtrdie.aud",    7246734},
-	{FAKE_CDROM "daventry\\sound\\c_drwndi.aud",  5787566},
-	{FAKE_CDROM "deadcity\\sound\\c_brndie.aud",  5239874},
-	{FAKE_CDROM "game\\sound\\c_blddie.aud",      4778978},
-	{FAKE_CDROM "game\\sound\\cr_baway.aud",        37755},
-	{FAKE_CDROM "gnome\\sound\\c_hngdie.aud",     3235452},
-	{FAKE_CDROM "iceworld\\resource.vol",        15279993},
-	{FAKE_CDROM "iceworld\\sound\\c_flydie.aud",  4573247},
-	{FAKE_CDROM "iceworld\\sound\\oh_fdie.aud",     76298},
-	{FAKE_CDROM "swamp\\sound\\c_spkdie.aud",     4289787},
-	{FAKE_CDROM "temple3\\8gui.vol",               411384}
-};
-static int fake_cdrom_file = -1;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                   Background CD-ROM drive detection
+//
+// The search for the game CD (GetDriveTypeA and a probe of CDROM_DETECT_NAME
+// on every CD-ROM drive) blocks for seconds if a drive is empty or has to spin
+// up. Therefore the search is started on a background thread at the runtime
+// initialization and the result is cached. It is not started if the fake
+// drive is used (the game does not need the CD, the override falls back to
+// the fake drive), or if the drive configured in mask.inf already has the
+// game CD (that probe is made by the override anyway and the result is kept
+// in the file cache). The Install.Drive override waits at most
+// CDROM_DETECT_TIMEOUT milliseconds for the result (only once, later reads do
+// not wait) and uses the configured drive on a timeout.
+// The error boxes for empty drives are suppressed with the error mode of the
+// detection thread (SetThreadErrorMode, Windows 7 and newer); only older
+// systems fall back to the process error mode.
+//
+
+#define CDROM_DETECT_TIMEOUT 2000
+
+typedef BOOL (WINAPI *PFNSETTHREADERRORMODE)(DWORD dwNewMode, LPDWORD lpOldMode);
+
+static HANDLE cdrom_detect_done /* = NULL */;
+static LONG /*volatile*/ cdrom_detect_stop /* = 0 */;
+static LONG /*volatile*/ cdrom_detect_late /* = 0 */;
+static CHAR cdrom_detect_drive[MAX_PATH] /* = {'\0'} */;
 
 
+// first CD-ROM drive with the game CD (the first drive is skipped)
 static
-int file_exists(char const *name)
+int find_cdrom_drive(LPSTR result, int length)
 {
-	WIN32_FIND_DATAA file;
-	HANDLE find = FindFirstFileA(name, &file);
-	if (find != INVALID_HANDLE_VALUE) {
-		FindClose(find);
-		return (0 == (FILE_ATTRIBUTE_DIRECTORY & file.dwFileAttributes));
+	int found = 0;
+	DWORD bytes = GetLogicalDriveStringsA(0, NULL);
+	LPSTR buffer = (LPSTR)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, bytes + 1);
+	if (buffer) {
+		DWORD size = GetLogicalDriveStringsA(bytes, buffer);
+		if ((0 < size) && (size <= bytes)) {
+			LPTSTR drive = buffer;
+			while (*drive && !cdrom_detect_stop) {
+				int len = lstrlenA(drive);
+				if ((drive != buffer) && (DRIVE_CDROM == volume_cache_type(drive))) {
+					CHAR name[MAX_PATH];
+					lstrcpyA(name, drive);
+					lstrcpynA(&name[len], CDROM_DETECT_NAME, ARRAYSIZE(name) - len);
+					if (file_cache_exists(name)) {
+						lstrcpynA(result, drive, length);
+						found = 1;
+						break;
+					}
+				}
+				drive += len + 1;
+			}
+		}
+		LocalFree((HLOCAL)buffer);
 	}
+	return (found);
+}
+
+static
+DWORD WINAPI cdrom_detect_proc(LPVOID param)
+{
+	DWORD const start = GetTickCount();
+	HMODULE const kernel32 = GetModuleHandleA("kernel32.dll");
+	PFNSETTHREADERRORMODE set_thread_error_mode = kernel32 ?
+		(PFNSETTHREADERRORMODE)GetProcAddress(kernel32, "SetThreadErrorMode") : NULL;
+	DWORD mode = 0;
+	UNREFERENCED_PARAMETER(param);
+	if (set_thread_error_mode && set_thread_error_mode(SEM_NOOPENFILEERRORBOX, &mode)) {
+		set_thread_error_mode(SEM_NOOPENFILEERRORBOX | mode, NULL);
+	} else {
+		// before Windows 7 (races with the game thread)
+		set_thread_error_mode = NULL;
+		mode =
+			SetErrorMode(SEM_NOOPENFILEERRORBOX);
+			SetErrorMode(SEM_NOOPENFILEERRORBOX | mode);
+	}
+	if (find_cdrom_drive(cdrom_detect_drive, ARRAYSIZE(cdrom_detect_drive))) {
+		kqf_log(KQF_LOGL_INFO, "cdrom: game CD found in '%s' (%lu ms)\n", cdrom_detect_drive, GetTickCount() - start);
+	} else {
+		kqf_log(KQF_LOGL_INFO, "cdrom: game CD not found (%lu ms)\n", GetTickCount() - start);
+	}
+	if (set_thread_error_mode) {
+		set_thread_error_mode(mode, NULL);
+	} else {
+		SetErrorMode(mode);
+	}
+	SetEvent(cdrom_detect_done);
 	return (0);
 }
 
+// detected drive (NULL if not found or not detected in time)
+static
+LPCSTR cdrom_detect_wait(void)
+{
+	if (NULL == cdrom_detect_done) {
+		// no background thread
+		return (find_cdrom_drive(cdrom_detect_drive, ARRAYSIZE(cdrom_detect_drive)) ? cdrom_detect_drive : NULL);
+	}
+	if (WaitForSingleObject(cdrom_detect_done, cdrom_detect_late ? 0 : CDROM_DETECT_TIMEOUT) != WAIT_OBJECT_0) {
+		if (!cdrom_detect_late) {
+			kqf_log(KQF_LOGL_WARNING, "cdrom: drive detection timed out after %u ms\n", CDROM_DETECT_TIMEOUT);
+			InterlockedExchange(&cdrom_detect_late, 1);
+		}
+		return (NULL);
+	}
+	return (cdrom_detect_drive[0] ? cdrom_detect_drive : NULL);
+}
+
+int init_cdrom_detect(void)
+{
+	HANDLE thread = NULL;
+	CHAR name[MAX_PATH];
+	CHAR drive[MAX_PATH];
+	DWORD len;
+	kqf_app_filepath("mask.inf", name);
+	len = GetPrivateProfileStringA("Install", "Drive", "", drive, ARRAYSIZE(drive), name);
+	if (len && (len + lstrlenA(CDROM_DETECT_NAME) < ARRAYSIZE(drive))) {
+		int found;
+		DWORD mode =
+			SetErrorMode(SEM_NOOPENFILEERRORBOX);
+			SetErrorMode(SEM_NOOPENFILEERRORBOX | mode);
+		lstrcpyA(&drive[len], CDROM_DETECT_NAME);
+		found = file_cache_exists(drive);
+		SetErrorMode(mode);
+		if (found) {
+			drive[len] = '\0';
+			kqf_log(KQF_LOGL_INFO, "cdrom: game CD found in configured drive '%s', no detection\n", drive);
+			return (1);
+		}
+	}
+	cdrom_detect_done = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (cdrom_detect_done != NULL) {
+		DWORD id;
+		thread = CreateThread(NULL, 0, cdrom_detect_proc, NULL, 0, &id);
+		if (NULL == thread) {
+			CloseHandle(cdrom_detect_done), cdrom_detect_done = NULL;
+		}
+	}
+	if (NULL == thread) {
+		kqf_log(KQF_LOGL_ERROR, "cdrom: failed to create drive detection thread (%#lx)\n", GetLastError());
+		return (0);
+	}
+	CloseHandle(thread);
+	return (1);
+}
+
+void free_cdrom_detect(void)
+{
+	// the thread is not joined (loader lock), it ends after the current probe
+	InterlockedExchange(&cdrom_detect_stop, 1);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -93,36 +289,18 @@ DWORD WINAPI KERNEL32_GetPrivateProfileStringA(LPCSTR lpAppName, LPCSTR lpKeyNam
 				SetErrorMode(SEM_NOOPENFILEERRORBOX | mode);
 			lstrcpyA(name, lpReturnedString);
 			lstrcpynA(&name[result], CDROM_DETECT_NAME, ARRAYSIZE(name) - result);
-			if (!file_exists(name)) {
-				DWORD bytes = GetLogicalDriveStringsA(0, NULL);
-				LPSTR buffer = (LPSTR)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, bytes + 1);
-				if (buffer) {
-					DWORD size = GetLogicalDriveStringsA(bytes, buffer);
-					if ((0 < size) && (size <= bytes)) {
-						LPTSTR drive = buffer;
-						while (*drive) {
-							int len = lstrlenA(drive);
-							if ((drive != buffer) && (DRIVE_CDROM == GetDriveTypeA(drive))) {
-								lstrcpyA(name, drive);
-								lstrcpynA(&name[len], CDROM_DETECT_NAME, ARRAYSIZE(name) - len);
-								if (file_exists(name))
-									break;
-							}
-							drive += len + 1;
-						}
-						if (*drive) {
-							kqf_log(KQF_LOGL_INFO, "mask.inf: Install.Drive '%s' overriden with '%s'\n", lpReturnedString, drive);
-							lstrcpynA(lpReturnedString, drive, nSize);
-							result = lstrlenA(lpReturnedString);
-						}
-					}
-					LocalFree((HLOCAL)buffer);
+			if (!file_cache_exists(name) && !kqf_get_opt(KQF_CFGO_CDROM_FAKE)) {
+				LPCSTR drive = cdrom_detect_wait();
+				if (drive) {
+					kqf_log(KQF_LOGL_INFO, "mask.inf: Install.Drive '%s' overriden with '%s'\n", lpReturnedString, drive);
+					lstrcpynA(lpReturnedString, drive, nSize);
+					result = lstrlenA(lpReturnedString);
 				}
 			}
 			if (kqf_get_opt(KQF_CFGO_CDROM_FAKE)) {
 				lstrcpyA(name, lpReturnedString);
 				lstrcpynA(&name[result], CDROM_DETECT_NAME, ARRAYSIZE(name) - result);
-				if (!file_exists(name)) {
+				if (!file_cache_exists(name)) {
 					lstrcpynA(lpReturnedString, FAKE_CDROM, nSize);
 					result = lstrlenA(lpReturnedString);
 					kqf_log(KQF_LOGL_INFO, "mask.inf: Install.Drive fallback to '%s'\n", lpReturnedString);
@@ -180,7 +358,7 @@ UINT WINAPI KERNEL32_GetDriveTypeA(LPCSTR lpRootPathName)
 		kqf_log(KQF_LOGL_INFO, "cdrom: fake drive type\n");
 		result = DRIVE_CDROM;
 	} else {
-		result = GetDriveTypeA(lpRootPathName);
+		result = volume_cache_type(lpRootPathName);
 	}
 	KQF_TRACE("GetDriveTypeA<%#08lx>('%s')[%u]{%#lx}\n", ReturnAddress, lpRootPathName, result, (result == DRIVE_UNKNOWN) ? ERROR_SUCCESS : GetLastError());
 	return (result);
@@ -204,33 +382,64 @@ BOOL WINAPI KERNEL32_GetVolumeInformationA(LPCSTR lpRootPathName, LPSTR lpVolume
 		kqf_log(KQF_LOGL_INFO, "cdrom: fake drive info\n");
 		result = TRUE;
 	} else {
-		result = GetVolumeInformationA(lpRootPathName, lpVolumeNameBuffer, nVolumeNameSize, lpVolumeSerialNumber, lpMaximumComponentLength, lpFileSystemFlags, lpFileSystemNameBuffer, nFileSystemNameSize);
+		result = volume_cache_info(lpRootPathName, lpVolumeNameBuffer, nVolumeNameSize, lpVolumeSerialNumber, lpMaximumComponentLength, lpFileSystemFlags, lpFileSystemNameBuffer, nFileSystemNameSize);
 	}
 	KQF_TRACE("GetVolumeInformationA<%#08lx>('%s')[%i,'%s',%#lx,%lu,%#lx,'%s']{%#lx}\n", ReturnAddress, lpRootPathName, result, lpVolumeNameBuffer ? lpVolumeNameBuffer : "", lpVolumeSerialNumber ? *lpVolumeSerialNumber : 0UL, lpMaximumComponentLength ? *lpMaximumComponentLength : 0UL, lpFileSystemFlags ? *lpFileSystemFlags : 0UL, lpFileSystemNameBuffer ? lpFileSystemNameBuffer : "", result ? ERROR_SUCCESS : GetLastError());
 	return (result);
 }
 
+// each world has its own "<world>\resource.vol" that is opened on a world change
+// (CreateFileA is called from several threads, so only the path hash is kept)
+static
+void world_volume(LPCSTR lpFileName)
+{
+	static LONG /*volatile*/ world /* = 0 */;
+	int const len = lstrlenA(lpFileName);
+	int const ext = sizeof(WORLD_VOLUME_NAME) - 1;
+	if ((len > ext) && (0 == lstrcmpiA(&lpFileName[len - ext], WORLD_VOLUME_NAME))) {
+		LONG const hash = (LONG)fake_cdrom_hash(lpFileName, 2166136261U);
+		if (InterlockedExchange(&world, hash) != hash) {
+			DWORD const error = GetLastError();
+			kqf_log(KQF_LOGL_INFO, "cdrom: world volume '%s'\n", lpFileName);
+			mem_prof_leaks("world change");
+			SetLastError(error);
+		}
+	}
+}
+
 HANDLE WINAPI KERNEL32_CreateFileA(LPCSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile)
 {
 	HANDLE result;
+	LONGLONG start;
 	KQF_TRACE("CreateFileA<%#08lx>('%s',%#lx,%#lx,%#08lx,%lu,%#lx,%#08lx)\n", ReturnAddress, lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
 	if (kqf_get_opt(KQF_CFGO_CDROM_FAKE) && lpFileName) {
 		CHAR root[sizeof(FAKE_CDROM)];
-		fake_cdrom_file = -1;
 		lstrcpynA(root, lpFileName, sizeof(FAKE_CDROM));
 		if (0 == lstrcmpiA(root, FAKE_CDROM)) {
 			if (OPEN_EXISTING == dwCreationDisposition) {
-				int i;
-				for (i = 0; i < ARRAYSIZE(fake_cdrom_files); ++i) {
-					if (0 == lstrcmpiA(lpFileName, fake_cdrom_files[i].path)) {
-						fake_cdrom_file = i;
-						if (!file_exists(lpFileName)) {
-							kqf_log(KQF_LOGL_INFO, "cdrom: fake '%s' open\n", lpFileName);
-							SetLastError(ERROR_SUCCESS);
-							return (NULL);
-						}
-						break;
+				int i = -1;
+				if (kqf_get_opt(KQF_CFGO_CDROM_OVERLAY)) {
+					CD_OVERLAY_ENTRY const *entry = cd_overlay_find(lpFileName);
+					if (NULL == entry) {
+						kqf_log(KQF_LOGL_INFO, "cdrom: '%s' not found\n", lpFileName);
+						return (INVALID_HANDLE_VALUE);
+					}
+					if (entry->source != NULL) {
+						lpFileName = entry->source;
+					} else if (!(FILE_ATTRIBUTE_DIRECTORY & entry->attributes)) {
+						i = fake_cdrom_lookup(lpFileName);
 					}
+				} else if (!file_cache_exists(lpFileName)) {
+					i = fake_cdrom_lookup(lpFileName);
+				}
+				if ((i >= 0) && (0 == lstrcmpiA(lpFileName, fake_cdrom_files[i].path))) {
+					result = fake_handle_open(i);
+					if (result != INVALID_HANDLE_VALUE) {
+						kqf_log(KQF_LOGL_INFO, "cdrom: fake '%s' open [%#08lx]\n", lpFileName, result);
+						SetLastError(ERROR_SUCCESS);
+						return (result);
+					}
+					kqf_log(KQF_LOGL_WARNING, "cdrom: no fake handle left for '%s'\n", lpFileName);
 				}
 			} else {
 				kqf_log(KQF_LOGL_INFO, "cdrom: '%s' access denied\n", lpFileName);
@@ -239,7 +448,13 @@ HANDLE WINAPI KERNEL32_CreateFileA(LPCSTR lpFileName, DWORD dwDesiredAccess, DWO
 			}
 		}
 	}
+	start = save_prof_clock();
 	result = CreateFileA(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
+	if ((result != INVALID_HANDLE_VALUE) && lpFileName) {
+		world_volume(lpFileName);
+		save_prof_open(lpFileName, result, dwDesiredAccess, start);
+		save_prefetch_open(lpFileName, result);
+	}
 	KQF_TRACE("CreateFileA<%#08lx>('%s',%#lx,%#lx,%#08lx,%lu,%#lx,%#08lx)[%#08lx]{%#lx}\n", ReturnAddress, lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile, result, (result != INVALID_HANDLE_VALUE) ? ERROR_SUCCESS : GetLastError());
 	return (result);
 }
@@ -247,18 +462,15 @@ HANDLE WINAPI KERNEL32_CreateFileA(LPCSTR lpFileName, DWORD dwDesiredAccess, DWO
 DWORD WINAPI KERNEL32_GetFileSize(HANDLE hFile, LPDWORD lpFileSizeHigh)
 {
 	DWORD result = 0;
+	int const file = fake_handle_file(hFile);
 	KQF_TRACE("GetFileSize<%#08lx>(%#08lx)\n", ReturnAddress, hFile);
-	if (fake_cdrom_file >= 0) {
-		if (NULL == hFile) {
-			kqf_log(KQF_LOGL_INFO, "cdrom: fake '%s' size [%lu]\n", fake_cdrom_files[fake_cdrom_file].path, fake_cdrom_files[fake_cdrom_file].size);
-			result = fake_cdrom_files[fake_cdrom_file].size;
-			if (lpFileSizeHigh)
-				*lpFileSizeHigh = 0UL;
-			SetLastError(NO_ERROR);
-		}
-		fake_cdrom_file = -1;
-	}
-	if (0 == result) {
+	if (file >= 0) {
+		kqf_log(KQF_LOGL_INFO, "cdrom: fake '%s' size [%lu]\n", fake_cdrom_files[file].path, fake_cdrom_files[file].size);
+		result = fake_cdrom_files[file].size;
+		if (lpFileSizeHigh)
+			*lpFileSizeHigh = 0UL;
+		SetLastError(NO_ERROR);
+	} else {
 		result = GetFileSize(hFile, lpFileSizeHigh);
 	}
 	KQF_TRACE("GetFileSize<%#08lx>(%#08lx)[%#lx,%#lx]{%#lx}\n", ReturnAddress, hFile, result, lpFileSizeHigh ? *lpFileSizeHigh : 0UL, (result != INVALID_FILE_SIZE) ? NO_ERROR : GetLastError());
@@ -268,18 +480,71 @@ DWORD WINAPI KERNEL32_GetFileSize(HANDLE hFile, LPDWORD lpFileSizeHigh)
 BOOL WINAPI KERNEL32_CloseHandle(HANDLE hObject)
 {
 	BOOL result = FALSE;
+	int const file = fake_handle_file(hObject);
 	KQF_TRACE("CloseHandle<%#08lx>(%#08lx)\n", ReturnAddress, hObject);
-	if (fake_cdrom_file >= 0) {
-		if (NULL == hObject) {
-			kqf_log(KQF_LOGL_INFO, "cdrom: fake '%s' close\n", fake_cdrom_files[fake_cdrom_file].path);
-			SetLastError(ERROR_SUCCESS);
-			result = TRUE;
-		}
-		fake_cdrom_file = -1;
-	}
-	if (!result) {
+	if (file >= 0) {
+		kqf_log(KQF_LOGL_INFO, "cdrom: fake '%s' close\n", fake_cdrom_files[file].path);
+		fake_handle_close(hObject);
+		SetLastError(ERROR_SUCCESS);
+		result = TRUE;
+	} else {
 		result = CloseHandle(hObject);
+		if (result) {
+			save_prof_close(hObject);
+			save_prefetch_close(hObject);
+		}
 	}
 	KQF_TRACE("CloseHandle<%#08lx>(%#08lx)[%i]{%#lx}\n", ReturnAddress, hObject, result, result ? ERROR_SUCCESS : GetLastError());
 	return (result);
 }
+
+// savegame I/O time (save.profile)
+
+BOOL WINAPI KERNEL32_ReadFile(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
+{
+	LONGLONG const start = save_prof_clock();
+	BOOL const result = ReadFile(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped);
+	DWORD const error = GetLastError();
+	save_prof_io(hFile, (result && lpNumberOfBytesRead) ? *lpNumberOfBytesRead : 0, start);
+	SetLastError(error);
+	return (result);
+}
+
+BOOL WINAPI KERNEL32_WriteFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite, LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped)
+{
+	LONGLONG const start = save_prof_clock();
+	BOOL const result = WriteFile(hFile, lpBuffer, nNumberOfBytesToWrite, lpNumberOfBytesWritten, lpOverlapped);
+	DWORD const error = GetLastError();
+	save_prof_io(hFile, (result && lpNumberOfBytesWritten) ? *lpNumberOfBytesWritten : 0, start);
+	SetLastError(error);
+	return (result);
+}
+
+BOOL WINAPI KERNEL32_FlushFileBuffers(HANDLE hFile)
+{
+	LONGLONG const start = save_prof_clock();
+	BOOL const result = FlushFileBuffers(hFile);
+	DWORD const error = GetLastError();
+	save_prof_io(hFile, 0, start);
+	SetLastError(error);
+	return (result);
+}
+
+DWORD WINAPI KERNEL32_GetFileAttributesA(LPCSTR lpFileName)
+{
+	DWORD result;
+	KQF_TRACE("GetFileAttributesA<%#08lx>('%s')\n", ReturnAddress, lpFileName);
+	if (kqf_get_opt(KQF_CFGO_CDROM_OVERLAY) && cd_overlay_path(lpFileName)) {
+		CD_OVERLAY_ENTRY const *entry = cd_overlay_find(lpFileName);
+		if (entry != NULL) {
+			result = entry->attributes;
+			SetLastError(ERROR_SUCCESS);
+		} else {
+			result = INVALID_FILE_ATTRIBUTES;
+		}
+	} else {
+		result = GetFileAttributesA(lpFileName);
+	}
+	KQF_TRACE("GetFileAttributesA<%#08lx>('%s')[%#lx]{%#lx}\n", ReturnAddress, lpFileName, result, (result != INVALID_FILE_ATTRIBUTES) ? ERROR_SUCCESS : GetLastError());
+	return (result);
+}
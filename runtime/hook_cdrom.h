@@ -23,14 +23,16 @@
 #define HOOK_CDROM_H_
 
 #include "../common/kqf_win.h"
+#include "fake_cdrom.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// cannot be longer than 3 characters (application buffer size for drive root)
-#define FAKE_CDROM "cd\\"
-
+// searches the game CD on a background thread (for Install.Drive, not used
+// with the fake drive, not started if the configured drive has the game CD)
+int init_cdrom_detect(void);
+void free_cdrom_detect(void);
 
 DWORD WINAPI KERNEL32_GetPrivateProfileStringA(LPCSTR lpAppName, LPCSTR lpKeyName, LPCSTR lpDefault, LPSTR lpReturnedString, DWORD nSize, LPCSTR lpFileName);
 
@@ -43,6 +45,16 @@ HANDLE WINAPI KERNEL32_CreateFileA(LPCSTR lpFileName, DWORD dwDesiredAccess, DWO
 DWORD WINAPI KERNEL32_GetFileSize(HANDLE hFile, LPDWORD lpFileSizeHigh);
 BOOL WINAPI KERNEL32_CloseHandle(HANDLE hObject);
 
+// KQF_CFGO_SAVE_PROFILE
+BOOL WINAPI KERNEL32_ReadFile(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped);
+BOOL WINAPI KERNEL32_WriteFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite, LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped);
+BOOL WINAPI KERNEL32_FlushFileBuffers(HANDLE hFile);
+
+// KQF_CFGO_CDROM_OVERLAY
+
+int init_cdrom_overlay(void);
+DWORD WINAPI KERNEL32_GetFileAttributesA(LPCSTR lpFileName);
+
 
 #ifdef __cplusplus
 }
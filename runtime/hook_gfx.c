@@ -24,6 +24,7 @@
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
+#include "../common/kqf_mem.h"
 
 
 typedef
@@ -71,7 +72,7 @@ HMODULE WINAPI KERNEL32_LoadLibraryA(LPCSTR lpLibFileName)
 {
 	HMODULE result;
 	KQF_TRACE("LoadLibraryA<%#08lx>('%s')\n", ReturnAddress, lpLibFileName);
-	if (!IsBadReadPtr(lpLibFileName, sizeof("glide2x.dll")) && (0 == lstrcmpiA(lpLibFileName, "glide2x.dll"))) {
+	if (kqf_mem_readable(lpLibFileName, sizeof("glide2x.dll")) && (0 == lstrcmpiA(lpLibFileName, "glide2x.dll"))) {
 		if (kqf_get_opt(KQF_CFGO_GLIDE_DISABLE)) {
 			kqf_log(KQF_LOGL_INFO, "LoadLibraryA: skipped glide2x.dll loading\n");
 			SetLastError(ERROR_FILE_NOT_FOUND);
@@ -221,17 +222,17 @@ void patch_D3DTotalVideoMemory(void)
 				switch (code[6]) {
 				case 0xE8CF8B00:
 					{
-						MEMORY_BASIC_INFORMATION mem;
+						KQF_MEM_REGION mem;
 						DWORD read_only;
-						if (!kqf_query_mem(code, mem))
-							mem.Protect = PAGE_NOACCESS;
-						read_only = mem.Protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
-						if (read_only && !VirtualProtect(code, 0x001C, PAGE_EXECUTE_READWRITE, &mem.Protect)) {
+						if (!kqf_mem_query(code, &mem))
+							mem.protect = PAGE_NOACCESS;
+						read_only = mem.protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
+						if (read_only && !VirtualProtect(code, 0x001C, PAGE_EXECUTE_READWRITE, &mem.protect)) {
 							kqf_log(KQF_LOGL_ERROR, "D3DTotalVideoMemory: failed to change memory protection (%#lx).\n", GetLastError());
 						} else {
 							code[6] = 0xE8F18900;
-							if (read_only && (mem.Protect != PAGE_NOACCESS))
-								VirtualProtect(code, 0x001C, mem.Protect, &mem.Protect);
+							if (read_only && (mem.protect != PAGE_NOACCESS))
+								VirtualProtect(code, 0x001C, mem.protect, &mem.protect);
 							FlushInstructionCache(GetCurrentProcess(), code, 0x001C);
 							kqf_log(KQF_LOGL_INFO, "D3DTotalVideoMemory: found and patched at %#08lx.\n", (BYTE *)code + 0x0019);
 						}
@@ -270,17 +271,17 @@ void patch_BrightnessSlider(void)
 				switch (rdata[3]) {
 				case 0x428EDB6D:
 					{
-						MEMORY_BASIC_INFORMATION mem;
+						KQF_MEM_REGION mem;
 						DWORD read_only;
-						if (!kqf_query_mem(rdata, mem))
-							mem.Protect = PAGE_NOACCESS;
-						read_only = mem.Protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
-						if (read_only && !VirtualProtect(rdata, 0x0010, PAGE_READWRITE, &mem.Protect)) {
+						if (!kqf_mem_query(rdata, &mem))
+							mem.protect = PAGE_NOACCESS;
+						read_only = mem.protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
+						if (read_only && !VirtualProtect(rdata, 0x0010, PAGE_READWRITE, &mem.protect)) {
 							kqf_log(KQF_LOGL_ERROR, "BrightnessSlider: failed to change memory protection (%#lx).\n", GetLastError());
 						} else {
 							rdata[3] = 0x428F9249;
-							if (read_only && (mem.Protect != PAGE_NOACCESS))
-								VirtualProtect(rdata, 0x0010, mem.Protect, &mem.Protect);
+							if (read_only && (mem.protect != PAGE_NOACCESS))
+								VirtualProtect(rdata, 0x0010, mem.protect, &mem.protect);
 							kqf_log(KQF_LOGL_INFO, "BrightnessSlider: found and patched at %#08lx.\n", &rdata[3]);
 						}
 					}
@@ -20,6 +20,11 @@
  * THE SOFTWARE.
  */
 #include "hook_memory.h"
+#include "mem_frag.h"
+#include "mem_large.h"
+#include "mem_pool.h"
+#include "mem_prof.h"
+#include "mem_trace.h"
 
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
@@ -27,31 +32,101 @@
 #include "../common/kqf_win.h"
 
 
+// pool and large blocks instead of CRT heap blocks (NULL: use the CRT heap)
+void *hook_alloc_block(unsigned int size)
+{
+	void *result = NULL;
+	if (kqf_get_opt(KQF_CFGO_MEM_LARGE)) {
+		result = mem_large_alloc(size);
+	}
+	if ((NULL == result) && kqf_get_opt(KQF_CFGO_MEM_POOL)) {
+		result = mem_pool_alloc(size);
+	}
+	return (result);
+}
+
+int hook_free_block(void *ptr)
+{
+	if (mem_pool_owns(ptr)) {
+		mem_pool_free(ptr);
+		return (1);
+	}
+	if (mem_large_owns(ptr)) {
+		mem_large_free(ptr);
+		return (1);
+	}
+	return (0);
+}
+
 extern
 void *(__cdecl *_imp__malloc)(unsigned int size);
 void * __cdecl MSVCRT_malloc (unsigned int size)
 {
-	void *result = _imp__malloc(size);
+	void *result = hook_alloc_block(size);
+	if (NULL == result) {
+		result = _imp__malloc(size);
+	}
 	if (runtime_active) {
+		if (kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
+			mem_trace(MEM_TRACE_MALLOC, size, result, ReturnAddress);
+		}
+		mem_prof_alloc(result, size, ReturnAddress);
 		if (NULL == result) {
 			kqf_log(KQF_LOGL_ERROR, "malloc: failed to allocate %u bytes at %#08lx.\n", size, ReturnAddress);
-		} else if (kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
-			kqf_log(KQF_LOGL_FORCE, "malloc<%#08lx>(%u)[%#08lx]\n", ReturnAddress, size, result);
+			mem_frag_report("malloc failure");
 		}
 	}
 	return (result);
 }
 
+// CRT heap blocks stay there, pool and large blocks move if grown beyond their usable size
+static
+void *block_realloc(void *ptr, unsigned int size, unsigned int used)
+{
+	void *result;
+	if (0 == size) {
+		hook_free_block(ptr);
+		return (NULL);
+	}
+	if (size <= used) {
+		return (ptr);
+	}
+	result = hook_alloc_block(size);
+	if (NULL == result) {
+		result = _imp__malloc(size);
+	}
+	if (result != NULL) {
+		CopyMemory(result, ptr, used);
+		hook_free_block(ptr);
+	}
+	return (result);
+}
+
 extern
 void *(__cdecl *_imp__realloc)(void *ptr, unsigned int size);
 void * __cdecl MSVCRT_realloc (void *ptr, unsigned int size)
 {
-	void *result = _imp__realloc(ptr, size);
+	void *result;
+	if (mem_pool_owns(ptr)) {
+		result = block_realloc(ptr, size, mem_pool_size(ptr));
+	} else if (mem_large_owns(ptr)) {
+		result = block_realloc(ptr, size, mem_large_size(ptr));
+	} else {
+		result = _imp__realloc(ptr, size);
+	}
 	if (runtime_active) {
-		if (NULL == result) {
+		if (kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
+			mem_trace(MEM_TRACE_REALLOC_OLD, 0, ptr, ReturnAddress);
+			mem_trace(MEM_TRACE_REALLOC, size, result, ReturnAddress);
+		}
+		// on failure the old block is still valid
+		if ((result != NULL) || (0 == size)) {
+			mem_prof_free(ptr);
+			mem_prof_alloc(result, size, ReturnAddress);
+		}
+		if ((NULL == result) && (size != 0)) {
 			kqf_log(KQF_LOGL_ERROR, "realloc: failed to allocate %u bytes for %#08lx at %#08lx.\n", size, ptr, ReturnAddress);
-		} else if (kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
-			kqf_log(KQF_LOGL_FORCE, "realloc<%#08lx>(%#08lx,%u)[%#08lx]\n", ReturnAddress, ptr, size, result);
+			mem_frag_report("realloc failure");
 		}
 	}
 	return (result);
@@ -63,9 +138,12 @@ void  __cdecl MSVCRT_free (void *ptr)
 {
 	if (ptr != NULL) {
 		if (runtime_active && kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
-			kqf_log(KQF_LOGL_FORCE, "free<%#08lx>(%#08lx)\n", ReturnAddress, ptr);
+			mem_trace(MEM_TRACE_FREE, 0, ptr, ReturnAddress);
+		}
+		mem_prof_free(ptr);
+		if (!hook_free_block(ptr)) {
+			_imp__free(ptr);
 		}
-		_imp__free(ptr);
 	}
 }
 
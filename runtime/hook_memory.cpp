@@ -23,6 +23,10 @@
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
+#include "hook_memory.h"
+#include "mem_frag.h"
+#include "mem_prof.h"
+#include "mem_trace.h"
 #include <intrin.h>
 
 #pragma intrinsic(_ReturnAddress)
@@ -48,10 +52,18 @@ extern "C" {
 	// Export with the exact mangled names that the linker expects
 	__declspec(dllexport) void * __cdecl __identifier("??2MSVCRT@@YAPAXI@Z")(unsigned int size)
 	{
-		void *result = __identifier("_imp_??2@YAPAXI@Z")(size);
+		void *result = hook_alloc_block(size);
+		if (NULL == result) {
+			result = __identifier("_imp_??2@YAPAXI@Z")(size);
+		}
 		if (runtime_active) {
+			if (kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
+				mem_trace(MEM_TRACE_NEW, size, result, ReturnAddress);
+			}
+			mem_prof_alloc(result, size, ReturnAddress);
 			if (NULL == result) {
 				kqf_log(KQF_LOGL_ERROR, "operator new: failed to allocate %u bytes at %#08lx.\n", size, ReturnAddress);
+				mem_frag_report("operator new failure");
 			} 
 		}
 		return (result);
@@ -60,7 +72,13 @@ extern "C" {
 	__declspec(dllexport) void __cdecl __identifier("??3MSVCRT@@YAXPAX@Z")(void *ptr)
 	{
 		if (ptr != NULL) {
-			__identifier("_imp_??3@YAXPAX@Z")(ptr);
+			if (runtime_active && kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
+				mem_trace(MEM_TRACE_DELETE, 0, ptr, ReturnAddress);
+			}
+			mem_prof_free(ptr);
+			if (!hook_free_block(ptr)) {
+				__identifier("_imp_??3@YAXPAX@Z")(ptr);
+			}
 		}
 	}
 }
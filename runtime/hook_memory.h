@@ -27,7 +27,12 @@ extern "C" {
 #endif
 
 
-// KQF_CFGO_MEM_TRACE
+// KQF_CFGO_MEM_TRACE, KQF_CFGO_MEM_POOL, KQF_CFGO_MEM_LARGE
+
+// pool or large block (NULL: use the CRT heap)
+void *hook_alloc_block(unsigned int size);
+// 0 if ptr is a CRT heap block
+int hook_free_block(void *ptr);
 
 void *__cdecl MSVCRT_malloc(unsigned int size);
 void *__cdecl MSVCRT_realloc(void *ptr, unsigned int size);
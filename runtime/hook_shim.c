@@ -24,8 +24,12 @@
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
+#include "../common/kqf_mem.h"
 
+#include "cd_overlay.h"
 #include "hook_cdrom.h"
+#include "save_prof.h"
+#include "volume_cache.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -82,15 +86,139 @@ BOOL WINAPI USER32_UnhookWindowsHookEx(HHOOK hhk)
 // only previously mapped views are unmapped. But the shim is only applied if
 // the filename is "Mask.exe" and is neither present in WinNT/Win2K nor Wine.
 // This implementation makes sure that UnmapViewOfFile is only called for the
-// base address of a memory region (avoids bugs due to previous MapViewOfFile
-// calls that might have been missed and saves the list management overhead).
+// base address of a view. The views mapped by the game are kept in an array
+// sorted by base address, so the check is a binary search without a system
+// call. Addresses outside of all known views (views that were mapped before
+// the hook was installed, or if the array is full) are checked for the base
+// address of the memory region with VirtualQuery.
 //
 
+#define MAPPED_VIEWS 256
+
+typedef struct MAPPED_VIEW {
+	ULONG_PTR base;
+	ULONG_PTR end;
+} MAPPED_VIEW;
+
+static LONG /*volatile*/ mapped_active /* = 0 */;
+static LONG /*volatile*/ mapped_ignored /* = 0 */;
+static LONG /*volatile*/ mapped_queried /* = 0 */;
+static CRITICAL_SECTION mapped_lock;
+static MAPPED_VIEW mapped_view[MAPPED_VIEWS] /* = {0} */;
+static int mapped_count /* = 0 */;
+
+
+// index of the last view with base <= addr or -1 (mapped_lock has to be held)
+static
+int mapped_find(ULONG_PTR addr)
+{
+	int lo = 0;
+	int hi = mapped_count;
+	while (lo < hi) {
+		int const mid = (lo + hi) / 2;
+		if (mapped_view[mid].base <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo - 1);
+}
+
+static
+void mapped_insert(LPCVOID view, SIZE_T size)
+{
+	ULONG_PTR const base = (ULONG_PTR)view;
+	int i;
+	if (0 == size) {
+		// whole file mapping (the view is one region)
+		KQF_MEM_REGION mem;
+		if (!kqf_mem_query(view, &mem)) {
+			return;
+		}
+		size = (SIZE_T)(mem.end - (unsigned char const *)view);
+	}
+	EnterCriticalSection(&mapped_lock);
+	i = mapped_find(base);
+	if ((i >= 0) && (mapped_view[i].base == base)) {
+		// stale entry (unmapped without the hook)
+		mapped_view[i].end = base + size;
+	} else if (mapped_count < MAPPED_VIEWS) {
+		++i;
+		MoveMemory(&mapped_view[i + 1], &mapped_view[i], (mapped_count - i) * sizeof(MAPPED_VIEW));
+		mapped_view[i].base = base;
+		mapped_view[i].end = base + size;
+		++mapped_count;
+	} else {
+		kqf_log(KQF_LOGL_DEBUG, "MapViewOfFile: view %#08lx not tracked (%i views)\n", view, mapped_count);
+	}
+	LeaveCriticalSection(&mapped_lock);
+}
+
+// 1 = base of a view (removed), 0 = inside of a view, -1 = unknown address
+static
+int mapped_remove(LPCVOID addr)
+{
+	int result = -1;
+	int i;
+	EnterCriticalSection(&mapped_lock);
+	i = mapped_find((ULONG_PTR)addr);
+	if (i >= 0) {
+		if (mapped_view[i].base == (ULONG_PTR)addr) {
+			--mapped_count;
+			MoveMemory(&mapped_view[i], &mapped_view[i + 1], (mapped_count - i) * sizeof(MAPPED_VIEW));
+			result = 1;
+		} else if ((ULONG_PTR)addr < mapped_view[i].end) {
+			result = 0;
+		}
+	}
+	LeaveCriticalSection(&mapped_lock);
+	return (result);
+}
+
+int init_view_map(void)
+{
+	if (!mapped_active) {
+		InitializeCriticalSection(&mapped_lock);
+		InterlockedExchange(&mapped_active, 1);
+	}
+	return (1);
+}
+
+void free_view_map(void)
+{
+	if (mapped_active) {
+		kqf_log(KQF_LOGL_INFO, "UnmapViewOfFile: %i views left, %li subchunks ignored, %li addresses queried\n", mapped_count, mapped_ignored, mapped_queried);
+	}
+}
+
+HANDLE WINAPI KERNEL32_CreateFileMappingA(HANDLE hFile, LPSECURITY_ATTRIBUTES lpFileMappingAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh, DWORD dwMaximumSizeLow, LPCSTR lpName)
+{
+	HANDLE result;
+	KQF_TRACE("CreateFileMappingA<%#08lx>(%#08lx,%#08lx,%#lx,%#lx,%#lx,'%s')\n", ReturnAddress, hFile, lpFileMappingAttributes, flProtect, dwMaximumSizeHigh, dwMaximumSizeLow, lpName ? lpName : "");
+	result = CreateFileMappingA(hFile, lpFileMappingAttributes, flProtect, dwMaximumSizeHigh, dwMaximumSizeLow, lpName);
+	if (result && kqf_get_opt(KQF_CFGO_SAVE_PREFETCH)) {
+		save_prefetch_mapping(hFile, result);
+	}
+	KQF_TRACE("CreateFileMappingA<%#08lx>(%#08lx,%#08lx,%#lx,%#lx,%#lx,'%s')[%#08lx]{%#lx}\n", ReturnAddress, hFile, lpFileMappingAttributes, flProtect, dwMaximumSizeHigh, dwMaximumSizeLow, lpName ? lpName : "", result, result ? ERROR_SUCCESS : GetLastError());
+	return (result);
+}
+
 LPVOID WINAPI KERNEL32_MapViewOfFile(HANDLE hFileMappingObject, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow, SIZE_T dwNumberOfBytesToMap)
 {
 	LPVOID result;
+	LONGLONG const start = save_prof_clock();
 	KQF_TRACE("MapViewOfFile<%#08lx>(%#08lx,%#lx,%#lx,%#lx,%#lx)\n", ReturnAddress, hFileMappingObject, dwDesiredAccess, dwFileOffsetHigh, dwFileOffsetLow, dwNumberOfBytesToMap);
 	result = MapViewOfFile(hFileMappingObject, dwDesiredAccess, dwFileOffsetHigh, dwFileOffsetLow, dwNumberOfBytesToMap);
+	if (result && mapped_active) {
+		mapped_insert(result, dwNumberOfBytesToMap);
+	}
+	if (result && kqf_get_opt(KQF_CFGO_SAVE_PREFETCH)) {
+		save_prefetch(hFileMappingObject, result, dwNumberOfBytesToMap);
+	}
+	if (result) {
+		save_prof_map(result, dwNumberOfBytesToMap, start);
+	}
 	KQF_TRACE("MapViewOfFile<%#08lx>(%#08lx,%#lx,%#lx,%#lx,%#lx)[%#08lx]{%#lx}\n", ReturnAddress, hFileMappingObject, dwDesiredAccess, dwFileOffsetHigh, dwFileOffsetLow, dwNumberOfBytesToMap, result, result ? ERROR_SUCCESS : GetLastError());
 	return (result);
 }
@@ -98,16 +226,29 @@ LPVOID WINAPI KERNEL32_MapViewOfFile(HANDLE hFileMappingObject, DWORD dwDesiredA
 BOOL WINAPI KERNEL32_UnmapViewOfFile(LPCVOID lpBaseAddress)
 {
 	BOOL result = TRUE;
+	int ignored = 0;
+	LONGLONG const start = save_prof_clock();
 	KQF_TRACE("UnmapViewOfFile<%#08lx>(%#08lx)\n", ReturnAddress, lpBaseAddress);
 	if (kqf_get_opt(KQF_CFGO_SHIM_UNMAP)) {
 		if (!lpBaseAddress) {
 			kqf_log(KQF_LOGL_INFO, "UnmapViewOfFile: ignored NULL pointer\n");
 			result = FALSE;
 		} else {
-			MEMORY_BASIC_INFORMATION mem;
-			if (kqf_query_mem(lpBaseAddress, mem) && (MEM_MAPPED & mem.Type) && (lpBaseAddress != mem.AllocationBase)) {
-				kqf_log(KQF_LOGL_INFO, "UnmapViewOfFile: ignored savegame subchunk (%#08lx,%#08lx)\n", mem.AllocationBase, lpBaseAddress);
+			int const view = mapped_active ? mapped_remove(lpBaseAddress) : -1;
+			if (0 == view) {
+				kqf_log(KQF_LOGL_INFO, "UnmapViewOfFile: ignored savegame subchunk (%#08lx)\n", lpBaseAddress);
+				InterlockedIncrement(&mapped_ignored);
+				ignored = 1;
 				result = FALSE;
+			} else if (view < 0) {
+				KQF_MEM_REGION mem;
+				InterlockedIncrement(&mapped_queried);
+				if (kqf_mem_query(lpBaseAddress, &mem) && (MEM_MAPPED & mem.type) && (lpBaseAddress != mem.alloc)) {
+					kqf_log(KQF_LOGL_INFO, "UnmapViewOfFile: ignored savegame subchunk (%#08lx,%#08lx)\n", mem.alloc, lpBaseAddress);
+					InterlockedIncrement(&mapped_ignored);
+					ignored = 1;
+					result = FALSE;
+				}
 			}
 		}
 	}
@@ -116,6 +257,9 @@ BOOL WINAPI KERNEL32_UnmapViewOfFile(LPCVOID lpBaseAddress)
 	} else {
 		result = UnmapViewOfFile(lpBaseAddress);
 	}
+	if (result || ignored) {
+		save_prof_unmap(lpBaseAddress, ignored, start);
+	}
 	KQF_TRACE("UnmapViewOfFile<%#08lx>(%#08lx)[%i]{%#lx}\n", ReturnAddress, lpBaseAddress, result, result ? ERROR_SUCCESS : GetLastError());
 	return (result);
 }
@@ -133,6 +277,8 @@ BOOL WINAPI KERNEL32_UnmapViewOfFile(LPCVOID lpBaseAddress)
 // The CD-ROM check of the European Release/Update verifies that the CD drive
 // has no free clusters and that the total size is between 670 and 685 MiB...
 // and last but not least, we have to support the fake CD-ROM directory here.
+// The results are taken from the volume cache, which applies both overrides
+// once per refresh.
 //
 
 BOOL WINAPI KERNEL32_GetDiskFreeSpaceA(LPCSTR lpRootPathName, LPDWORD lpSectorsPerCluster, LPDWORD lpBytesPerSector, LPDWORD lpNumberOfFreeClusters, LPDWORD lpTotalNumberOfClusters)
@@ -151,39 +297,8 @@ BOOL WINAPI KERNEL32_GetDiskFreeSpaceA(LPCSTR lpRootPathName, LPDWORD lpSectorsP
 		*lpTotalNumberOfClusters = (670 * 1024*1024) / 2048 / 16;
 		result = TRUE;
 	} else {
-		DWORD ErrorMode =
-			SetErrorMode(SEM_NOOPENFILEERRORBOX);
-			SetErrorMode(SEM_NOOPENFILEERRORBOX | ErrorMode);
-		result = GetDiskFreeSpaceA(lpRootPathName, lpSectorsPerCluster, lpBytesPerSector, lpNumberOfFreeClusters, lpTotalNumberOfClusters);
-		{
-			DWORD ErrorCode = GetLastError();
-			if (kqf_get_opt(KQF_CFGO_CDROM_SIZE) && result && lpRootPathName && (DRIVE_CDROM == GetDriveTypeA(lpRootPathName))) {
-				DWORD TotalBytes = *lpTotalNumberOfClusters * *lpSectorsPerCluster * *lpBytesPerSector;
-				if (*lpNumberOfFreeClusters) {
-					kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: number of free clusters overridden for CD-ROM ('%s')\n", lpRootPathName);
-					*lpNumberOfFreeClusters = 0;
-				}
-				if ((TotalBytes < 670 * 1024*1024) || (685 * 1024*1024 < TotalBytes)) {
-					kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: total number of clusters overridden for CD-ROM ('%s')\n", lpRootPathName);
-					*lpSectorsPerCluster     = 16;
-					*lpBytesPerSector        = 2048;
-					*lpTotalNumberOfClusters = (670 * 1024*1024) / 2048 / 16;
-				}
-			}
-			SetErrorMode(ErrorMode);
-			SetLastError(ErrorCode);
-		}
-		if (kqf_get_opt(KQF_CFGO_SHIM_GDFS) && result && *lpSectorsPerCluster && *lpBytesPerSector) {
-			DWORD ClusterLimit = MAXLONG / *lpSectorsPerCluster / *lpBytesPerSector;
-			if (*lpNumberOfFreeClusters > ClusterLimit) {
-				kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: number of free clusters limited to 2 GiB (%lu,%lu,'%s')\n", *lpNumberOfFreeClusters, ClusterLimit, lpRootPathName);
-				*lpNumberOfFreeClusters = ClusterLimit;
-			}
-			if (*lpTotalNumberOfClusters > ClusterLimit) {
-				kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: total number of clusters limited to 2 GiB (%lu,%lu,'%s')\n", *lpTotalNumberOfClusters, ClusterLimit, lpRootPathName);
-				*lpTotalNumberOfClusters = ClusterLimit;
-			}
-		}
+		// the CD-ROM size and the 2 GiB limit are applied by the cache
+		result = volume_cache_space(lpRootPathName, lpSectorsPerCluster, lpBytesPerSector, lpNumberOfFreeClusters, lpTotalNumberOfClusters);
 	}
 	KQF_TRACE("GetDiskFreeSpaceA<%#08lx>('%s',%lu,%lu,%lu,%lu)[%i]{%#lx}\n", ReturnAddress, lpRootPathName, *lpSectorsPerCluster, *lpBytesPerSector, *lpNumberOfFreeClusters, *lpTotalNumberOfClusters, result, result ? ERROR_SUCCESS : GetLastError());
 	return (result);
@@ -233,7 +348,11 @@ HANDLE WINAPI KERNEL32_FindFirstFileA(LPCSTR lpFileName, LPWIN32_FIND_DATAA lpFi
 {
 	HANDLE result;
 	KQF_TRACE("FindFirstFileA<%#08lx>('%s')\n", ReturnAddress, lpFileName);
-	result = FindFirstFileA(lpFileName, lpFindFileData);
+	if (kqf_get_opt(KQF_CFGO_CDROM_OVERLAY) && cd_overlay_path(lpFileName)) {
+		result = cd_overlay_find_first(lpFileName, lpFindFileData);
+	} else {
+		result = FindFirstFileA(lpFileName, lpFindFileData);
+	}
 	if ((INVALID_HANDLE_VALUE == result) && lpFindFileData) {
 		lpFindFileData->dwFileAttributes = 0;
 		lpFindFileData->cFileName[0] = '?';
@@ -251,6 +370,8 @@ BOOL WINAPI KERNEL32_FindNextFileA(HANDLE hFindFile, LPWIN32_FIND_DATAA lpFindFi
 		kqf_log(KQF_LOGL_INFO, "FindNextFileA: ignored invalid handle\n");
 		SetLastError(ERROR_INVALID_HANDLE);
 		result = 0;
+	} else if (cd_overlay_find_handle(hFindFile)) {
+		result = cd_overlay_find_next(hFindFile, lpFindFileData);
 	} else {
 		result = FindNextFileA(hFindFile, lpFindFileData);
 	}
@@ -273,6 +394,8 @@ BOOL WINAPI KERNEL32_FindClose(HANDLE hFindFile)
 		kqf_log(KQF_LOGL_INFO, "FindClose: ignored invalid handle\n");
 		SetLastError(ERROR_INVALID_HANDLE);
 		result = 0;
+	} else if (cd_overlay_find_handle(hFindFile)) {
+		result = cd_overlay_find_close(hFindFile);
 	} else {
 		result = FindClose(hFindFile);
 	}
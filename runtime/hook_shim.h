@@ -37,6 +37,9 @@ BOOL WINAPI USER32_UnhookWindowsHookEx(HHOOK hhk);
 
 // KQF_CFGO_SHIM_UNMAP
 
+int init_view_map(void);
+void free_view_map(void);
+HANDLE WINAPI KERNEL32_CreateFileMappingA(HANDLE hFile, LPSECURITY_ATTRIBUTES lpFileMappingAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh, DWORD dwMaximumSizeLow, LPCSTR lpName);
 LPVOID WINAPI KERNEL32_MapViewOfFile(HANDLE hFileMappingObject, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow, SIZE_T dwNumberOfBytesToMap);
 BOOL WINAPI KERNEL32_UnmapViewOfFile(LPCVOID lpBaseAddress);
 
@@ -25,6 +25,7 @@
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
+#include "../common/kqf_mem.h"
 #include "../common/kqf_win.h"
 
 
@@ -124,12 +125,12 @@ void hook_KQMonster_OnTalkMessageComplete(void)
 	    (ulongs[5] != 0x00000000UL)) {
 		kqf_log(KQF_LOGL_ERROR, "TalkComplete: unsupported code pattern\n");
 	} else {
-		MEMORY_BASIC_INFORMATION mem;
+		KQF_MEM_REGION mem;
 		DWORD read_only;
-		if (!kqf_query_mem(ulongs, mem))
-			mem.Protect = PAGE_NOACCESS;
-		read_only = mem.Protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
-		if (read_only && !VirtualProtect(ulongs, 0x0018UL, PAGE_EXECUTE_READWRITE, &mem.Protect)) {
+		if (!kqf_mem_query(ulongs, &mem))
+			mem.protect = PAGE_NOACCESS;
+		read_only = mem.protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
+		if (read_only && !VirtualProtect(ulongs, 0x0018UL, PAGE_EXECUTE_READWRITE, &mem.protect)) {
 			kqf_log(KQF_LOGL_ERROR, "TalkComplete: failed to change memory protection (%#lx)\n", GetLastError());
 		} else {
 			unsigned char *bytes = (unsigned char *)ulongs;
@@ -138,8 +139,8 @@ void hook_KQMonster_OnTalkMessageComplete(void)
 			*addr = (ULONG_PTR)MASK_KQMonster_OnTalkMessageComplete;
 			bytes[0x0005] = 0xC3U;
 			bytes[0x0010] = 0x52U;
-			if (read_only && (mem.Protect != PAGE_NOACCESS))
-				VirtualProtect(ulongs, 0x0018UL, mem.Protect, &mem.Protect);
+			if (read_only && (mem.protect != PAGE_NOACCESS))
+				VirtualProtect(ulongs, 0x0018UL, mem.protect, &mem.protect);
 			FlushInstructionCache(GetCurrentProcess(), ulongs, 0x0018UL);
 			kqf_log(KQF_LOGL_INFO, "TalkComplete: KQMonster::OnTalkMessageComplete hooked\n");
 		}
@@ -156,20 +157,20 @@ void unhook_KQMonster_OnTalkMessageComplete(void)
 	    (*addr == (ULONG_PTR)MASK_KQMonster_OnTalkMessageComplete) &&
 	    (0xC3 == bytes[0x0005]) &&
 	    (0x52 == bytes[0x0010])) {
-		MEMORY_BASIC_INFORMATION mem;
+		KQF_MEM_REGION mem;
 		DWORD read_only;
-		if (!kqf_query_mem(bytes, mem))
-			mem.Protect = PAGE_NOACCESS;
-		read_only = mem.Protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
-		if (read_only && !VirtualProtect(bytes, 0x0018UL, PAGE_EXECUTE_READWRITE, &mem.Protect)) {
+		if (!kqf_mem_query(bytes, &mem))
+			mem.protect = PAGE_NOACCESS;
+		read_only = mem.protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
+		if (read_only && !VirtualProtect(bytes, 0x0018UL, PAGE_EXECUTE_READWRITE, &mem.protect)) {
 			kqf_log(KQF_LOGL_ERROR, "TalkComplete: failed to change memory protection (%lx)\n", GetLastError());
 		} else {
 			bytes[0x0000] = 0x64;
 			*addr = 0x000000A1UL;
 			bytes[0x0005] = 0x00;
 			bytes[0x0010] = 0x50;
-			if (read_only && (mem.Protect != PAGE_NOACCESS))
-				VirtualProtect(bytes, 0x0018UL, mem.Protect, &mem.Protect);
+			if (read_only && (mem.protect != PAGE_NOACCESS))
+				VirtualProtect(bytes, 0x0018UL, mem.protect, &mem.protect);
 			FlushInstructionCache(GetCurrentProcess(), bytes, 0x0018UL);
 			kqf_log(KQF_LOGL_INFO, "TalkComplete: KQMonster::OnTalkMessageComplete restored\n");
 		}
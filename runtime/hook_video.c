@@ -23,22 +23,15 @@
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
+#include "cd_overlay.h"
+#include "file_cache.h"
 #include "hook_cdrom.h"
 #include "hook_window.h"
+#include "video_ext.h"
+#include "video_out.h"
+#include "video_stat.h"
 
 
-static
-int file_exists(char const *name)
-{
-	WIN32_FIND_DATAA file;
-	HANDLE find = FindFirstFileA(name, &file);
-	if (find != INVALID_HANDLE_VALUE) {
-		FindClose(find);
-		return (0 == (FILE_ATTRIBUTE_DIRECTORY & file.dwFileAttributes));
-	}
-	return (0);
-}
-
 static
 int redirect_video(char const *old_name, char new_name[MAX_PATH])
 {
@@ -49,7 +42,7 @@ int redirect_video(char const *old_name, char new_name[MAX_PATH])
 			if ((pos >= 0) && (0 == lstrcmpiA(&old_name[pos], "_1.dll"))) {
 				lstrcpyA(new_name, old_name);
 				lstrcpyA(&new_name[pos], "_1.avi");
-				return (file_exists(new_name));
+				return (file_cache_exists(new_name));
 			}
 		}
 	}
@@ -59,51 +52,6 @@ int redirect_video(char const *old_name, char new_name[MAX_PATH])
 
 HWND video_window /* = NULL */;
 
-// Helper structures and callbacks for video window detection
-typedef struct {
-	HWND hMainWindow;
-	HWND videoWindow;
-} FindVideoWindowData;
-
-
-// Callback to find the video player window
-BOOL CALLBACK FindVideoWindowProc(HWND hwnd, LPARAM lParam)
-{
-	if (!IsWindowVisible(hwnd)) return TRUE;
-	if (GetParent(hwnd) != NULL) return TRUE; // Skip child windows
-	
-	FindVideoWindowData* data = (FindVideoWindowData*)lParam;
-	if (hwnd == data->hMainWindow) return TRUE; // Skip main game window
-	
-	// Get window info for debugging
-	char windowTitle[256] = {0};
-	char className[256] = {0};
-	GetWindowTextA(hwnd, windowTitle, sizeof(windowTitle) - 1);
-	GetClassNameA(hwnd, className, sizeof(className) - 1);
-	
-	kqf_log(KQF_LOGL_DEBUG, "Enumerating window: %#08lx, Title: '%.50s', Class: '%.50s'\n", 
-		hwnd, windowTitle, className);
-	
-	// Look for Media Player specifically
-	if (strstr(windowTitle, "Media Player") ||
-		strstr(windowTitle, "Movies & TV") ||
-		strstr(windowTitle, "Films & TV") ||
-		strstr(windowTitle, ".avi") ||
-		strstr(windowTitle, "VLC") ||
-		strstr(className, "ApplicationFrameWindow") ||  // Windows 11 Media Player
-		strstr(className, "MediaPlayer") ||
-		strstr(className, "VLC")) {
-		
-		kqf_log(KQF_LOGL_DEBUG, "Found Media Player window: %#08lx, Title: '%.50s', Class: '%.50s'\n", 
-			hwnd, windowTitle, className);
-		data->videoWindow = hwnd;
-		return FALSE; // Stop enumeration
-	}
-	
-	return TRUE; // Continue looking
-}
-
-
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Redirect the video files (*_1.dll) to *_1.avi if present (this is required
@@ -130,193 +78,24 @@ void * __cdecl MSVCRT_fopen (char const *filename, char const *mode)
 			hMainWindow = GetForegroundWindow();
 		}
 		
+		char aviPath[MAX_PATH];
+		int const redirected = redirect_video(filename, aviPath);
+		video_stat_begin(filename);
+
+		// Play in the game window, fall back to the external player
+		if ((KQF_OPT_VIDEO_PLAYER_INTERNAL == kqf_get_opt(KQF_CFGO_VIDEO_PLAYER)) &&
+			video_out_play(hMainWindow, redirected ? aviPath : filename)) {
+			video_stat_end();
+			return NULL;
+		}
+
 		ShowWindow(hMainWindow, SW_HIDE);
 		AllowSetForegroundWindow(ASFW_ANY);
 		kqf_log(KQF_LOGL_DEBUG, "Original Window: %#08lx (app_window: %#08lx)\n", hMainWindow, app_window);
-		char aviPath[MAX_PATH];
-		redirect_video(filename, aviPath);
-
-		
-		char command[512];
+		video_stat_phase(VIDEO_PHASE_HIDE);
 
-		// Method 1: Try Windows Media Player first
-		strcpy(command, "\"");
-		strcat(command, aviPath);
-		strcat(command, "\"");
-		
-		// Store the current foreground window
-		HWND originalForeground = GetForegroundWindow();
-		
-		HINSTANCE result = ShellExecuteA(NULL, "open", command, NULL, NULL, SW_NORMAL);
-		kqf_log(KQF_LOGL_DEBUG, " Result code: %d\n", (INT_PTR)result);
+		video_ext_play(hMainWindow, redirected ? aviPath : filename, kqf_get_opt(KQF_CFGO_VIDEO_PLAYER));
 		kqf_log(KQF_LOGL_DEBUG, "Playing Video %s instead of %s\n", aviPath, filename);
-
-		// Give media player time to start
-		Sleep(3000);
-		DWORD startTime = GetTickCount64();
-		HWND videoWnd = NULL;
-		
-        // Active window scanning approach instead of waiting for foreground changes
-        while (GetTickCount64() - startTime < 15000) { // 15 second timeout
-            kqf_log(KQF_LOGL_DEBUG, "Scanning all windows for Video Player\n");
-            
-            // Use the existing FindVideoWindowProc callback to scan all windows
-            FindVideoWindowData findData;
-            findData.hMainWindow = hMainWindow;
-            findData.videoWindow = NULL;
-            
-            // Enumerate all top-level windows to find the media player
-            EnumWindows(FindVideoWindowProc, (LPARAM)&findData);
-            
-            if (findData.videoWindow) {
-                videoWnd = findData.videoWindow;
-                
-                char windowTitle[256] = {0};
-                char className[256] = {0};
-                GetWindowTextA(videoWnd, windowTitle, sizeof(windowTitle) - 1);
-                GetClassNameA(videoWnd, className, sizeof(className) - 1);
-                
-                kqf_log(KQF_LOGL_DEBUG, "Found video player via scanning: %#08lx, Title: '%.50s', Class: '%.50s'\n", 
-                    videoWnd, windowTitle, className);
-                
-                // Check if it's legacy Media Player vs Windows 11 Media Player
-				BOOL isLegacyPlayer = !strstr(className, "ApplicationFrameWindow");
-				
-				if (isLegacyPlayer) {
-					kqf_log(KQF_LOGL_DEBUG, "Detected legacy Media Player - using enhanced fullscreen scaling\n");
-					
-					// For legacy Media Player, we need to:
-					// 1. Set window to fullscreen size
-					// 2. Send specific commands to scale video content
-					
-					// Get screen dimensions
-					int screenWidth = GetSystemMetrics(SM_CXSCREEN);
-					int screenHeight = GetSystemMetrics(SM_CYSCREEN);
-					
-					// First bring to front
-					SetForegroundWindow(videoWnd);
-					BringWindowToTop(videoWnd);
-					
-					// Set window to exact screen size (borderless fullscreen)
-					SetWindowPos(videoWnd, HWND_TOP, 0, 0, screenWidth, screenHeight, 
-						SWP_SHOWWINDOW | SWP_FRAMECHANGED);
-					
-					// Force window style to borderless
-					LONG style = GetWindowLongA(videoWnd, GWL_STYLE);
-					SetWindowLongA(videoWnd, GWL_STYLE, style & ~(WS_CAPTION | WS_THICKFRAME | WS_MINIMIZE | WS_MAXIMIZE | WS_SYSMENU));
-					
-					// Apply the style change
-					SetWindowPos(videoWnd, NULL, 0, 0, 0, 0, 
-						SWP_FRAMECHANGED | SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER);
-					
-					Sleep(100);
-					
-					// Try to send fullscreen command via keyboard shortcut (Alt+Enter is common)
-					SetFocus(videoWnd);
-					keybd_event(VK_MENU, 0, 0, 0);          // Alt down
-					keybd_event(VK_RETURN, 0, 0, 0);        // Enter down
-					keybd_event(VK_RETURN, 0, KEYEVENTF_KEYUP, 0); // Enter up
-					keybd_event(VK_MENU, 0, KEYEVENTF_KEYUP, 0);   // Alt up
-					
-					Sleep(100);
-					
-					// Double-click on video area to trigger fullscreen (common in legacy players)
-					RECT windowRect;
-					if (GetWindowRect(videoWnd, &windowRect)) {
-						int centerX = (windowRect.left + windowRect.right) / 2;
-						int centerY = (windowRect.top + windowRect.bottom) / 2;
-						
-						SetCursorPos(centerX, centerY);
-						mouse_event(MOUSEEVENTF_LEFTDOWN, 0, 0, 0, 0);
-						mouse_event(MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
-						Sleep(50);
-						mouse_event(MOUSEEVENTF_LEFTDOWN, 0, 0, 0, 0);
-						mouse_event(MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
-					}
-					
-				} else {
-					kqf_log(KQF_LOGL_DEBUG, "Detected Windows 11 UWP Media Player - using standard activation\n");
-					
-					// Standard approach for Windows 11 Media Player
-					SetForegroundWindow(videoWnd);
-					BringWindowToTop(videoWnd);
-					ShowWindow(videoWnd, SW_SHOWMAXIMIZED);
-				}
-                
-                break;
-            }
-            
-            Sleep(500); // Check every 0.5 second
-        }
-		
-		kqf_log(KQF_LOGL_DEBUG, "Final Video Window: %#08lx\n", videoWnd);
-		
-		if (videoWnd) {
-			SetFocus(videoWnd);
-			UpdateWindow(videoWnd);
-			//SetForegroundWindow(videoWnd);
-			// Force maximize the video window with multiple aggressive attempts
-			
-			
-			kqf_log(KQF_LOGL_DEBUG, "Maximizing video window with aggressive methods\n");
-			
-			// Method 1: Standard approach
-			ShowWindow(videoWnd, SW_RESTORE);
-			Sleep(50);
-			ShowWindow(videoWnd, SW_SHOWMAXIMIZED);
-			//SetForegroundWindow(videoWnd);
-			BringWindowToTop(videoWnd);
-			
-			// Method 2: Use SetWindowPos for more control
-			
-			Sleep(100);
-			SetWindowPos(videoWnd, HWND_TOPMOST, 0, 0, 0, 0, 
-				SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW);
-			SetWindowPos(videoWnd, HWND_NOTOPMOST, 0, 0, 0, 0, 
-				SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW);
-			
-			// Method 3: Get screen dimensions and force fullscreen
-			
-
-			
-			int screenWidth = GetSystemMetrics(SM_CXSCREEN);
-			int screenHeight = GetSystemMetrics(SM_CYSCREEN);
-			SetWindowPos(videoWnd, HWND_TOP, 0, 0, screenWidth, screenHeight, 
-				SWP_SHOWWINDOW);
-			
-			
-			// Method 4: Final maximize attempt
-			
-			Sleep(100);
-			ShowWindow(videoWnd, SW_SHOWMAXIMIZED);
-			//SetForegroundWindow(videoWnd);
-			SwitchToThisWindow(videoWnd, TRUE);
-			
-			
-			kqf_log(KQF_LOGL_DEBUG, "Completed maximize attempts\n");
-			
-			
-			// Wait for video window to close with timeout
-			DWORD videoStartTime = GetTickCount64();
-			while (IsWindow(videoWnd) && IsWindowVisible(videoWnd)) {
-				// Keep main window hidden while video plays
-				//ShowWindow(hMainWindow, SW_HIDE);
-				
-				// Add timeout to prevent infinite loop (max 10 minutes)
-				if (GetTickCount64() - videoStartTime > 600000) {
-					kqf_log(KQF_LOGL_DEBUG, "Video timeout reached, breaking\n");
-					break;
-				}
-				
-				kqf_log(KQF_LOGL_DEBUG, "Waiting for video to close\n");
-				Sleep(500); // Check every 0.5 second
-			}
-			kqf_log(KQF_LOGL_DEBUG, "Video window closed!\n");
-		} else {
-			// Fallback: wait a reasonable time if no window was found
-			kqf_log(KQF_LOGL_DEBUG, "No video window found, waiting 1 second\n");
-			Sleep(1000);
-		}
 		
 		// Simple and clean window restoration
 		kqf_log(KQF_LOGL_DEBUG, "Restoring main window: %#08lx\n", hMainWindow);
@@ -379,6 +158,11 @@ void * __cdecl MSVCRT_fopen (char const *filename, char const *mode)
 		HWND finalForeground = GetForegroundWindow();
 
 		kqf_log(KQF_LOGL_DEBUG, "Final foreground window: %#08lx (target: %#08lx)\n", finalForeground, hMainWindow);
+		video_stat_phase(VIDEO_PHASE_RESTORE);
+		if (finalForeground != hMainWindow) {
+			video_stat_fail(VIDEO_FAIL_FOREGROUND);
+		}
+		video_stat_end();
 		
 		kqf_log(KQF_LOGL_DEBUG, "Main window restoration complete\n");
 		
@@ -392,10 +176,17 @@ void * __cdecl MSVCRT_fopen (char const *filename, char const *mode)
 		char new_name[MAX_PATH];
 		KQF_TRACE("fopen<%#08lx>('%s','%s')\n", ReturnAddress, filename ? filename : "", mode ? mode : "");
 		if (filename && mode && (0 == lstrcmpiA(mode, "rb"))) {
-			if (kqf_get_opt(KQF_CFGO_CDROM_FAKE) && (0 == lstrcmpiA(filename, FAKE_CDROM "mask.inf"))) {
-				if (!file_exists(filename)) {
+			CD_OVERLAY_ENTRY const *entry;
+			if (kqf_get_opt(KQF_CFGO_CDROM_OVERLAY) && cd_overlay_path(filename)) {
+				entry = cd_overlay_find(filename);
+				if (entry && entry->source && lstrcmpiA(filename, entry->source)) {
+					kqf_log(KQF_LOGL_INFO, "fopen: redirect '%s' to '%s'\n", filename, entry->source);
+					filename = entry->source;
+				}
+			} else if (kqf_get_opt(KQF_CFGO_CDROM_FAKE) && (0 == lstrcmpiA(filename, FAKE_CDROM "mask.inf"))) {
+				if (!file_cache_exists(filename)) {
 					kqf_app_filepath("mask.inf", new_name);
-					if (!file_exists(new_name))
+					if (!file_cache_exists(new_name))
 						kqf_app_filepath("mask.cs", new_name);
 					kqf_log(KQF_LOGL_INFO, "fopen: redirect '%s' to '%s'\n", filename, new_name);
 					filename = new_name;
@@ -33,7 +33,7 @@ extern
 HWND video_window;
 
 
-// KQF_CFGO_VIDEO_AVI, KQF_CFGO_CDROM_FAKE
+// KQF_CFGO_VIDEO_AVI, KQF_CFGO_VIDEO_PLAYER, KQF_CFGO_CDROM_FAKE
 
 void *__cdecl MSVCRT_fopen(char const *filename, char const *mode);
 
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "mem_frag.h"
+
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                   Address space and heap fragmentation
+//
+// If an allocation fails in a late world, the log should tell whether the
+// address space was exhausted or fragmented. A background thread samples the
+// user address space with VirtualQuery (free, largest free range, committed,
+// reserved, and mapped bytes) and walks the heaps with HeapWalk. Only the
+// default process heap and the CRT heap are walked: both are serialized, so
+// HeapLock keeps the game threads out while the sampler walks them. Other
+// heaps from GetProcessHeaps might have been created with HEAP_NO_SERIALIZE
+// and are only counted. On systems without HeapWalk (Windows 9x) only the
+// address space is sampled. Each sample is written to the log as a series
+// with the tick count, and the latest snapshot is embedded in the minidump
+// as user stream (MEM_FRAG_STREAM). The snapshots are double buffered, so the
+// exception filter never waits for the sampler.
+//
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static LONG /*volatile*/ s_sampling /* = 0 */;
+static LONG /*volatile*/ s_latest = -1;
+static MEM_FRAG_SNAPSHOT s_snap[2] /* = {0} */;
+static int s_heap_walk = 1;
+static unsigned char const *s_min /* = NULL */;
+static unsigned char const *s_max /* = NULL */;
+static HANDLE s_stop /* = NULL */;
+static DWORD s_period /* = 0 */;
+static HANDLE s_heap[MEM_FRAG_HEAPS] /* = {NULL} */;
+static DWORD s_heaps /* = 0 */;
+
+
+static
+void sample_space(MEM_FRAG_SNAPSHOT *snap)
+{
+	unsigned char const *addr = s_min;
+	MEMORY_BASIC_INFORMATION mbi;
+	while ((addr < s_max) && kqf_query_mem(addr, mbi)) {
+		DWORD const size = (DWORD)mbi.RegionSize;
+		switch (mbi.State) {
+		case MEM_FREE:
+			snap->free += size;
+			++snap->free_ranges;
+			if (snap->largest < size) {
+				snap->largest = size;
+			}
+			break;
+		case MEM_RESERVE:
+			snap->reserved += size;
+			break;
+		case MEM_COMMIT:
+			switch (mbi.Type) {
+			case MEM_IMAGE:
+				snap->image += size;
+				break;
+			case MEM_MAPPED:
+				snap->mapped += size;
+				break;
+			default:
+				snap->committed += size;
+				break;
+			}
+			break;
+		}
+		if ((unsigned char const *)mbi.BaseAddress + mbi.RegionSize <= addr) {
+			break;
+		}
+		addr = (unsigned char const *)mbi.BaseAddress + mbi.RegionSize;
+	}
+}
+
+static
+int sample_heap(HANDLE handle, MEM_FRAG_HEAP *heap)
+{
+	PROCESS_HEAP_ENTRY entry;
+	heap->handle = (DWORD)(ULONG_PTR)handle;
+	if (!HeapLock(handle)) {
+		return (0);
+	}
+	entry.lpData = NULL;
+	while (HeapWalk(handle, &entry)) {
+		if (entry.wFlags & PROCESS_HEAP_ENTRY_BUSY) {
+			heap->busy += entry.cbData;
+			++heap->busy_blocks;
+		} else if (entry.wFlags & PROCESS_HEAP_REGION) {
+			heap->committed += entry.u.Region.dwCommittedSize;
+		} else if (entry.wFlags & PROCESS_HEAP_UNCOMMITTED_RANGE) {
+			heap->uncommitted += entry.cbData;
+		} else {
+			heap->free += entry.cbData;
+			++heap->free_blocks;
+			if (heap->largest < entry.cbData) {
+				heap->largest = entry.cbData;
+			}
+		}
+	}
+	if (ERROR_CALL_NOT_IMPLEMENTED == GetLastError()) {
+		s_heap_walk = 0;
+	}
+	HeapUnlock(handle);
+	return (s_heap_walk);
+}
+
+static
+void sample(MEM_FRAG_SNAPSHOT *snap, int heaps)
+{
+	ZeroMemory(snap, sizeof(*snap));
+	snap->magic = MEM_FRAG_MAGIC;
+	snap->size = sizeof(*snap);
+	snap->tick = GetTickCount();
+	sample_space(snap);
+	if (heaps && s_heap_walk) {
+		DWORD i;
+		snap->heap_count = GetProcessHeaps(0, NULL);
+		for (i = 0; i < s_heaps; ++i) {
+			if (sample_heap(s_heap[i], &snap->heap[snap->heaps])) {
+				++snap->heaps;
+			}
+		}
+	}
+}
+
+typedef HANDLE (__cdecl *PFNGETHEAPHANDLE)(void);
+
+// default process heap and the heap of the game CRT (msvcrt.dll)
+static
+void find_heaps(void)
+{
+	HMODULE const crt = GetModuleHandleA("msvcrt.dll");
+	HANDLE heap = NULL;
+	s_heap[0] = GetProcessHeap();
+	s_heaps = 1;
+	if (crt != NULL) {
+		PFNGETHEAPHANDLE const get_heap_handle = (PFNGETHEAPHANDLE)GetProcAddress(crt, "_get_heap_handle");
+		HANDLE const *const crtheap = (HANDLE const *)GetProcAddress(crt, "_crtheap");
+		if (get_heap_handle != NULL) {
+			heap = get_heap_handle();
+		} else if (crtheap != NULL) {
+			heap = *crtheap;
+		}
+	}
+	if ((heap != NULL) && (heap != s_heap[0])) {
+		s_heap[s_heaps++] = heap;
+	}
+}
+
+// share of the free heap memory that is not part of the largest free block
+static
+DWORD fragmentation(MEM_FRAG_HEAP const *heap)
+{
+	if (0 == heap->free) {
+		return (0);
+	}
+	return (100 - (DWORD)MulDiv((int)heap->largest, 100, (int)heap->free));
+}
+
+static
+void log_snapshot(MEM_FRAG_SNAPSHOT const *snap, char const *reason)
+{
+	DWORD i;
+	kqf_log(KQF_LOGL_FORCE, "MemFrag: %lu %s: free %lu KiB (%lu ranges, largest %lu KiB), committed %lu KiB, reserved %lu KiB, mapped %lu KiB, image %lu KiB\n",
+		snap->tick, reason, snap->free >> 10, snap->free_ranges, snap->largest >> 10,
+		snap->committed >> 10, snap->reserved >> 10, snap->mapped >> 10, snap->image >> 10);
+	for (i = 0; i < snap->heaps; ++i) {
+		MEM_FRAG_HEAP const *heap = &snap->heap[i];
+		kqf_log(KQF_LOGL_FORCE, "MemFrag: %lu heap %#08lx: committed %lu KiB, busy %lu KiB (%lu blocks), free %lu KiB (%lu blocks, largest %lu KiB, %lu%% fragmented), uncommitted %lu KiB\n",
+			snap->tick, heap->handle, heap->committed >> 10, heap->busy >> 10, heap->busy_blocks,
+			heap->free >> 10, heap->free_blocks, heap->largest >> 10, fragmentation(heap), heap->uncommitted >> 10);
+	}
+}
+
+static
+void report(char const *reason, int heaps)
+{
+	if (s_active && (0 == InterlockedCompareExchange(&s_sampling, 1, 0))) {
+		DWORD const error = GetLastError();
+		LONG const next = (s_latest + 1) & 1;
+		sample(&s_snap[next], heaps);
+		InterlockedExchange(&s_latest, next);
+		log_snapshot(&s_snap[next], reason);
+		InterlockedExchange(&s_sampling, 0);
+		SetLastError(error);
+	}
+}
+
+void mem_frag_report(char const *reason)
+{
+	report(reason, 1);
+}
+
+int mem_frag_latest(MEM_FRAG_SNAPSHOT *snap)
+{
+	LONG const latest = s_latest;
+	if (latest < 0) {
+		return (0);
+	}
+	*snap = s_snap[latest];
+	return (1);
+}
+
+
+static
+DWORD WINAPI sample_proc(LPVOID param)
+{
+	UNREFERENCED_PARAMETER(param);
+	do {
+		mem_frag_report("sample");
+	} while (WAIT_TIMEOUT == WaitForSingleObject(s_stop, s_period));
+	return (0);
+}
+
+
+int init_mem_frag(unsigned int seconds)
+{
+	SYSTEM_INFO info;
+	HANDLE thread = NULL;
+	if (s_active) {
+		return (1);
+	}
+	GetSystemInfo(&info);
+	s_min = (unsigned char const *)info.lpMinimumApplicationAddress;
+	s_max = (unsigned char const *)info.lpMaximumApplicationAddress;
+	s_period = seconds * 1000;
+	find_heaps();
+	s_stop = CreateEventA(NULL, TRUE, FALSE, NULL);
+	InterlockedExchange(&s_active, 1);
+	if (s_stop != NULL) {
+		DWORD id;
+		thread = CreateThread(NULL, 0, sample_proc, NULL, 0, &id);
+	}
+	if (NULL == thread) {
+		kqf_log(KQF_LOGL_ERROR, "MemFrag: failed to create sampler thread (%#lx)\n", GetLastError());
+		InterlockedExchange(&s_active, 0);
+		if (s_stop != NULL) {
+			CloseHandle(s_stop);
+			s_stop = NULL;
+		}
+		return (0);
+	}
+	CloseHandle(thread);
+	kqf_log(KQF_LOGL_INFO, "MemFrag: sampling every %u seconds\n", seconds);
+	return (1);
+}
+
+void free_mem_frag(void)
+{
+	if (s_active) {
+		SetEvent(s_stop);
+		// a heap lock might be orphaned by a thread that was terminated at process exit
+		report("unload", 0);
+		InterlockedExchange(&s_active, 0);
+	}
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef MEM_FRAG_H_
+#define MEM_FRAG_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_MEM_SAMPLE
+
+#define MEM_FRAG_HEAPS  2  // default and CRT heap
+#define MEM_FRAG_MAGIC  0x464D514BUL  // "KQMF"
+#define MEM_FRAG_STREAM (LastReservedStream + 0x4B51)  // minidump user stream
+
+typedef struct MEM_FRAG_HEAP {
+	DWORD handle;
+	DWORD committed;    // bytes
+	DWORD uncommitted;
+	DWORD busy;
+	DWORD busy_blocks;
+	DWORD free;
+	DWORD free_blocks;
+	DWORD largest;      // free block
+} MEM_FRAG_HEAP;
+
+typedef struct MEM_FRAG_SNAPSHOT {
+	DWORD         magic;
+	DWORD         size;          // sizeof(MEM_FRAG_SNAPSHOT)
+	DWORD         tick;          // GetTickCount()
+	DWORD         free;          // bytes of the user address space
+	DWORD         free_ranges;
+	DWORD         largest;       // free range
+	DWORD         committed;     // private
+	DWORD         reserved;
+	DWORD         mapped;        // committed
+	DWORD         image;         // committed
+	DWORD         heaps;         // walked (default and CRT heap)
+	DWORD         heap_count;    // GetProcessHeaps
+	MEM_FRAG_HEAP heap[MEM_FRAG_HEAPS];
+} MEM_FRAG_SNAPSHOT;
+
+
+// seconds: sampling interval
+int init_mem_frag(unsigned int seconds);
+void free_mem_frag(void);
+
+// copies the latest snapshot (0 if there is none)
+int mem_frag_latest(MEM_FRAG_SNAPSHOT *snap);
+
+// takes and logs a snapshot (e.g. after a failed allocation)
+void mem_frag_report(char const *reason);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
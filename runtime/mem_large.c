@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "mem_large.h"
+
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                          Large block allocator
+//
+// Large world and texture buffers allocated from the CRT heap fragment the
+// 2 GiB address space of the game until large allocations fail, although the
+// total of free memory would be sufficient. With mem.large all blocks above
+// the configured threshold are served from one region that is reserved at
+// startup (while the address space is still in one piece). The pages of a
+// block are committed on allocation and decommitted on release, and the block
+// starts with a small header that holds its size.
+//
+// The free ranges of the region are nodes of two treaps: one ordered by the
+// address (neighbours for coalescing on release) and one ordered by the size
+// (best fit, and the largest free range for the reports). If the region has
+// no fitting range, the callers fall back to the CRT heap.
+//
+
+enum MEMLARGE_ {
+	MEMLARGE_PAGE    = 0x1000,
+	MEMLARGE_HEADER  = 16,          // keeps the 16-byte alignment
+	MEMLARGE_RESERVE = 0x20000000,  // 512 MiB (halved down to 64 MiB on failure)
+	MEMLARGE_MINIMUM = 0x04000000,
+	MEMLARGE_NODES   = 8192,        // free ranges
+	MEMLARGE_MAGIC   = 0x474C514B   // "KQLG"
+};
+
+enum MEMLARGE_TREE_ {
+	MEMLARGE_BY_ADDR,
+	MEMLARGE_BY_SIZE,
+	MEMLARGE_TREES
+};
+
+typedef struct LARGE_RANGE {
+	struct LARGE_RANGE *child[MEMLARGE_TREES][2];  // left, right
+	DWORD               prio;
+	DWORD               begin;  // page index
+	DWORD               pages;
+} LARGE_RANGE;
+
+typedef struct LARGE_HEADER {
+	DWORD magic;
+	DWORD pages;
+	DWORD size;  // requested
+	DWORD reserved;
+} LARGE_HEADER;
+
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static CRITICAL_SECTION s_lock /* = {0} */;
+static unsigned char *s_base /* = NULL */;
+static ULONG_PTR s_size /* = 0 */;
+static DWORD s_threshold /* = 0 */;
+static LARGE_RANGE *s_node /* = NULL */;  // MEMLARGE_NODES
+static LARGE_RANGE *s_spare /* = NULL */;  // unused nodes (linked through child[0][0])
+static LARGE_RANGE *s_root[MEMLARGE_TREES] /* = {NULL} */;
+static DWORD s_seed = 2463534242UL;
+static DWORD s_blocks /* = 0 */;
+static DWORD s_pages /* = 0 */;  // committed
+static DWORD s_peak /* = 0 */;
+static DWORD s_fallback /* = 0 */;
+static DWORD s_lost /* = 0 */;  // pages (out of nodes)
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                              Range treaps
+//
+// All functions require s_lock to be held.
+//
+
+static
+LARGE_RANGE *new_range(DWORD begin, DWORD pages)
+{
+	LARGE_RANGE *node = s_spare;
+	if (node != NULL) {
+		s_spare = node->child[0][0];
+		// xorshift32
+		s_seed ^= s_seed << 13;
+		s_seed ^= s_seed >> 17;
+		s_seed ^= s_seed << 5;
+		node->prio = s_seed;
+		node->begin = begin;
+		node->pages = pages;
+	}
+	return (node);
+}
+
+static
+void free_range(LARGE_RANGE *node)
+{
+	node->child[0][0] = s_spare;
+	s_spare = node;
+}
+
+// 1 if node is ordered after root
+static
+int after(LARGE_RANGE const *root, LARGE_RANGE const *node, int tree)
+{
+	if ((MEMLARGE_BY_SIZE == tree) && (node->pages != root->pages)) {
+		return (node->pages > root->pages);
+	}
+	return (node->begin > root->begin);
+}
+
+static
+LARGE_RANGE *insert_node(LARGE_RANGE *root, LARGE_RANGE *node, int tree)
+{
+	int side;
+	LARGE_RANGE *top;
+	if (NULL == root) {
+		node->child[tree][0] = NULL;
+		node->child[tree][1] = NULL;
+		return (node);
+	}
+	side = after(root, node, tree);
+	top = insert_node(root->child[tree][side], node, tree);
+	root->child[tree][side] = top;
+	if (top->prio > root->prio) {
+		root->child[tree][side] = top->child[tree][!side];
+		top->child[tree][!side] = root;
+		return (top);
+	}
+	return (root);
+}
+
+static
+LARGE_RANGE *merge_nodes(LARGE_RANGE *left, LARGE_RANGE *right, int tree)
+{
+	if (NULL == left) {
+		return (right);
+	}
+	if (NULL == right) {
+		return (left);
+	}
+	if (left->prio > right->prio) {
+		left->child[tree][1] = merge_nodes(left->child[tree][1], right, tree);
+		return (left);
+	}
+	right->child[tree][0] = merge_nodes(left, right->child[tree][0], tree);
+	return (right);
+}
+
+static
+LARGE_RANGE *remove_node(LARGE_RANGE *root, LARGE_RANGE *node, int tree)
+{
+	int side;
+	if (root == node) {
+		return (merge_nodes(node->child[tree][0], node->child[tree][1], tree));
+	}
+	side = after(root, node, tree);
+	root->child[tree][side] = remove_node(root->child[tree][side], node, tree);
+	return (root);
+}
+
+static
+void link_range(LARGE_RANGE *node)
+{
+	s_root[MEMLARGE_BY_ADDR] = insert_node(s_root[MEMLARGE_BY_ADDR], node, MEMLARGE_BY_ADDR);
+	s_root[MEMLARGE_BY_SIZE] = insert_node(s_root[MEMLARGE_BY_SIZE], node, MEMLARGE_BY_SIZE);
+}
+
+static
+void unlink_range(LARGE_RANGE *node)
+{
+	s_root[MEMLARGE_BY_ADDR] = remove_node(s_root[MEMLARGE_BY_ADDR], node, MEMLARGE_BY_ADDR);
+	s_root[MEMLARGE_BY_SIZE] = remove_node(s_root[MEMLARGE_BY_SIZE], node, MEMLARGE_BY_SIZE);
+}
+
+// smallest range with at least the number of pages (lowest address on ties)
+static
+LARGE_RANGE *best_fit(DWORD pages)
+{
+	LARGE_RANGE *best = NULL;
+	LARGE_RANGE *node = s_root[MEMLARGE_BY_SIZE];
+	while (node != NULL) {
+		if (node->pages >= pages) {
+			best = node;
+			node = node->child[MEMLARGE_BY_SIZE][0];
+		} else {
+			node = node->child[MEMLARGE_BY_SIZE][1];
+		}
+	}
+	return (best);
+}
+
+// free range that ends at (side 0) or starts at (side 1) the page
+static
+LARGE_RANGE *neighbour(DWORD page, int side)
+{
+	LARGE_RANGE *node = s_root[MEMLARGE_BY_ADDR];
+	while (node != NULL) {
+		if (side ? (node->begin == page) : (node->begin + node->pages == page)) {
+			return (node);
+		}
+		node = node->child[MEMLARGE_BY_ADDR][node->begin < page];
+	}
+	return (NULL);
+}
+
+static
+DWORD largest(void)
+{
+	LARGE_RANGE const *node = s_root[MEMLARGE_BY_SIZE];
+	if (NULL == node) {
+		return (0);
+	}
+	while (node->child[MEMLARGE_BY_SIZE][1] != NULL) {
+		node = node->child[MEMLARGE_BY_SIZE][1];
+	}
+	return (node->pages);
+}
+
+// returns the pages to the free ranges (coalesced with the neighbours)
+static
+void release(DWORD begin, DWORD pages)
+{
+	LARGE_RANGE *node = neighbour(begin, 0);
+	LARGE_RANGE *next = neighbour(begin + pages, 1);
+	if (node != NULL) {
+		unlink_range(node);
+		node->pages += pages;
+	} else {
+		node = new_range(begin, pages);
+	}
+	if (next != NULL) {
+		unlink_range(next);
+		if (node != NULL) {
+			node->pages += next->pages;
+			free_range(next);
+		} else {
+			// reuse the node of the following range
+			next->begin = begin;
+			next->pages += pages;
+			node = next;
+		}
+	}
+	if (node != NULL) {
+		link_range(node);
+	} else {
+		s_lost += pages;
+	}
+}
+
+
+void *mem_large_alloc(unsigned int size)
+{
+	LARGE_HEADER *block = NULL;
+	if (s_active && (size >= s_threshold) && (size <= s_size - MEMLARGE_HEADER)) {
+		DWORD const error = GetLastError();
+		DWORD const pages = (size + MEMLARGE_HEADER + MEMLARGE_PAGE - 1) / MEMLARGE_PAGE;
+		DWORD begin = 0;
+		LARGE_RANGE *node;
+		EnterCriticalSection(&s_lock);
+		node = best_fit(pages);
+		if (node != NULL) {
+			begin = node->begin;
+			unlink_range(node);
+			if (node->pages > pages) {
+				node->begin += pages;
+				node->pages -= pages;
+				link_range(node);
+			} else {
+				free_range(node);
+			}
+		} else {
+			++s_fallback;
+			kqf_log(KQF_LOGL_WARNING, "MemLarge: no free range for %u bytes, largest free range is %lu KiB\n", size, largest() * (MEMLARGE_PAGE / 1024));
+		}
+		LeaveCriticalSection(&s_lock);
+		if (node != NULL) {
+			block = (LARGE_HEADER *)VirtualAlloc(s_base + begin * MEMLARGE_PAGE, pages * MEMLARGE_PAGE, MEM_COMMIT, PAGE_READWRITE);
+			EnterCriticalSection(&s_lock);
+			if (NULL == block) {
+				++s_fallback;
+				release(begin, pages);
+			} else {
+				++s_blocks;
+				s_pages += pages;
+				if (s_peak < s_pages) {
+					s_peak = s_pages;
+				}
+			}
+			LeaveCriticalSection(&s_lock);
+		}
+		if (block != NULL) {
+			block->magic = MEMLARGE_MAGIC;
+			block->pages = pages;
+			block->size = size;
+			++block;
+		}
+		SetLastError(error);
+	}
+	return (block);
+}
+
+int mem_large_owns(void const *ptr)
+{
+	return ((ULONG_PTR)((unsigned char const *)ptr - s_base) < s_size);
+}
+
+unsigned int mem_large_size(void const *ptr)
+{
+	LARGE_HEADER const *block = (LARGE_HEADER const *)ptr - 1;
+	return (block->pages * MEMLARGE_PAGE - MEMLARGE_HEADER);
+}
+
+void mem_large_free(void *ptr)
+{
+	LARGE_HEADER *block = (LARGE_HEADER *)ptr - 1;
+	DWORD const pages = block->pages;
+	DWORD const error = GetLastError();
+	if (block->magic != MEMLARGE_MAGIC) {
+		kqf_log(KQF_LOGL_ERROR, "MemLarge: invalid block %#08lx\n", ptr);
+	} else {
+		block->magic = 0;
+		VirtualFree(block, pages * MEMLARGE_PAGE, MEM_DECOMMIT);
+		EnterCriticalSection(&s_lock);
+		release((DWORD)(((unsigned char *)block - s_base) / MEMLARGE_PAGE), pages);
+		--s_blocks;
+		s_pages -= pages;
+		LeaveCriticalSection(&s_lock);
+	}
+	SetLastError(error);
+}
+
+unsigned int mem_large_largest(void)
+{
+	DWORD pages = 0;
+	if (s_active) {
+		EnterCriticalSection(&s_lock);
+		pages = largest();
+		LeaveCriticalSection(&s_lock);
+	}
+	return (pages * MEMLARGE_PAGE);
+}
+
+
+int init_mem_large(unsigned int threshold)
+{
+	int i;
+	SIZE_T size;
+	if (s_active) {
+		return (1);
+	}
+	s_node = (LARGE_RANGE *)VirtualAlloc(NULL, MEMLARGE_NODES * sizeof(LARGE_RANGE), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (NULL == s_node) {
+		kqf_log(KQF_LOGL_ERROR, "MemLarge: failed to allocate nodes (%#lx)\n", GetLastError());
+		return (0);
+	}
+	for (size = MEMLARGE_RESERVE; size >= MEMLARGE_MINIMUM; size /= 2) {
+		s_base = (unsigned char *)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+		if (s_base != NULL) {
+			break;
+		}
+	}
+	if (NULL == s_base) {
+		kqf_log(KQF_LOGL_ERROR, "MemLarge: failed to reserve %lu KiB (%#lx)\n", MEMLARGE_MINIMUM / 1024, GetLastError());
+		VirtualFree(s_node, 0, MEM_RELEASE);
+		s_node = NULL;
+		return (0);
+	}
+	InitializeCriticalSection(&s_lock);
+	for (i = MEMLARGE_NODES - 1; i >= 0; --i) {
+		free_range(&s_node[i]);
+	}
+	link_range(new_range(0, (DWORD)(size / MEMLARGE_PAGE)));
+	s_threshold = threshold;
+	s_size = size;
+	InterlockedExchange(&s_active, 1);
+	kqf_log(KQF_LOGL_INFO, "MemLarge: %lu KiB reserved at %#08lx for blocks of %u bytes and more\n", (DWORD)(size / 1024), s_base, threshold);
+	return (1);
+}
+
+void free_mem_large(void)
+{
+	if (s_active) {
+		InterlockedExchange(&s_active, 0);
+		EnterCriticalSection(&s_lock);
+		kqf_log(KQF_LOGL_INFO, "MemLarge: %lu blocks (%lu KiB) in use, %lu KiB peak, largest free range %lu KiB, %lu fallbacks, %lu KiB lost\n",
+			s_blocks, s_pages * (MEMLARGE_PAGE / 1024), s_peak * (MEMLARGE_PAGE / 1024),
+			largest() * (MEMLARGE_PAGE / 1024), s_fallback, s_lost * (MEMLARGE_PAGE / 1024));
+		LeaveCriticalSection(&s_lock);
+	}
+}
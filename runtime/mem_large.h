@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef MEM_LARGE_H_
+#define MEM_LARGE_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_MEM_LARGE
+
+// threshold: smallest block served from the reserved region
+int init_mem_large(unsigned int threshold);
+void free_mem_large(void);  // the region stays valid (statistics only)
+
+// NULL if the size is too small, the region is disabled, or full
+void *mem_large_alloc(unsigned int size);
+
+// range check of the reserved region
+int mem_large_owns(void const *ptr);
+
+// usable size of a large block
+unsigned int mem_large_size(void const *ptr);
+void mem_large_free(void *ptr);
+
+// size of the largest free range in bytes
+unsigned int mem_large_largest(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "mem_pool.h"
+
+#include "../common/kqf_log.h"
+#include "../common/kqf_win.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                         Small block pool allocator
+//
+// The engine makes huge numbers of small malloc and operator new calls, each
+// of them serialized on the lock of the CRT heap. With mem.pool all blocks up
+// to MEM_POOL_MAX bytes are served from segregated size classes instead; each
+// class has its own lock, a free list, and carves new blocks from 64 KiB slabs.
+// The slabs are committed on demand from one reserved region, so a pointer is
+// identified as a pool block by a range check, and its size class is found by
+// the slab index. Blocks are never returned to the system (the pool is still
+// used after DLL_PROCESS_DETACH by the CRT shutdown of the game). If the region
+// is exhausted, the callers fall back to the CRT heap. The class lookup, the
+// slab carving, and the free lists are in mem_pool_core.c, this file only adds
+// the region, the slab commit, and the locks. tools/mtr_pool replays a
+// mem.trace against the same core (slab use, fallbacks, and the time of the
+// allocator paths compared to malloc).
+//
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static LONG /*volatile*/ s_slabs /* = 0 */;
+static LONG /*volatile*/ s_exhausted /* = 0 */;
+static CRITICAL_SECTION s_lock[MEM_POOL_CLASSES];  // per class
+static MEM_POOL_CORE s_core /* = {0} */;
+
+
+// commits the next slab of the reserved region (any class lock may be held)
+static
+int commit_slab(MEM_POOL_CORE *core)
+{
+	LONG const slab = InterlockedIncrement(&s_slabs) - 1;
+	if ((slab >= MEM_POOL_SLABS) ||
+		(NULL == VirtualAlloc(core->base + (ULONG_PTR)slab * MEM_POOL_SLAB, MEM_POOL_SLAB, MEM_COMMIT, PAGE_READWRITE))) {
+		InterlockedIncrement(&s_exhausted);
+		return (-1);
+	}
+	return ((int)slab);
+}
+
+void *mem_pool_alloc(unsigned int size)
+{
+	void *block = NULL;
+	if (s_active && (size <= MEM_POOL_MAX)) {
+		int const index = mem_pool_core_class(&s_core, size);
+		DWORD const error = GetLastError();
+		EnterCriticalSection(&s_lock[index]);
+		block = mem_pool_core_alloc(&s_core, index);
+		LeaveCriticalSection(&s_lock[index]);
+		SetLastError(error);
+	}
+	return (block);
+}
+
+int mem_pool_owns(void const *ptr)
+{
+	return (mem_pool_core_owns(&s_core, ptr));
+}
+
+unsigned int mem_pool_size(void const *ptr)
+{
+	return ((unsigned int)s_core.cls[mem_pool_core_class_of(&s_core, ptr)].size);
+}
+
+void mem_pool_free(void *ptr)
+{
+	int const index = mem_pool_core_class_of(&s_core, ptr);
+	EnterCriticalSection(&s_lock[index]);
+	mem_pool_core_free(&s_core, index, ptr);
+	LeaveCriticalSection(&s_lock[index]);
+}
+
+
+int init_mem_pool(void)
+{
+	void *base;
+	int index;
+	if (s_active) {
+		return (1);
+	}
+	base = VirtualAlloc(NULL, MEM_POOL_SLABS * MEM_POOL_SLAB, MEM_RESERVE, PAGE_NOACCESS);
+	if (NULL == base) {
+		kqf_log(KQF_LOGL_ERROR, "MemPool: failed to reserve %u KiB (%#lx)\n", MEM_POOL_SLABS * MEM_POOL_SLAB / 1024, GetLastError());
+		return (0);
+	}
+	for (index = 0; index < MEM_POOL_CLASSES; ++index) {
+		InitializeCriticalSection(&s_lock[index]);
+	}
+	mem_pool_core_init(&s_core, base, commit_slab);
+	InterlockedExchange(&s_active, 1);
+	kqf_log(KQF_LOGL_INFO, "MemPool: %u size classes up to %u bytes at %#08lx\n", MEM_POOL_CLASSES, MEM_POOL_MAX, base);
+	return (1);
+}
+
+void free_mem_pool(void)
+{
+	if (s_active) {
+		int index;
+		InterlockedExchange(&s_active, 0);
+		for (index = 0; index < MEM_POOL_CLASSES; ++index) {
+			MEM_POOL_CLASS const *cls = &s_core.cls[index];
+			if (cls->slabs != 0) {
+				kqf_log(KQF_LOGL_INFO, "MemPool: %4lu bytes: %lu slabs, %lu allocs, %lu blocks used, %lu peak\n", cls->size, cls->slabs, cls->allocs, cls->used, cls->peak);
+			}
+		}
+		kqf_log(KQF_LOGL_INFO, "MemPool: %li of %u slabs used, exhausted %li times\n", (s_slabs < MEM_POOL_SLABS) ? s_slabs : MEM_POOL_SLABS, MEM_POOL_SLABS, s_exhausted);
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef MEM_POOL_H_
+#define MEM_POOL_H_
+
+#include "mem_pool_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_MEM_POOL
+
+int init_mem_pool(void);
+void free_mem_pool(void);  // the pool stays valid (statistics only)
+
+// NULL if the size is too large, the pool is disabled, or exhausted
+void *mem_pool_alloc(unsigned int size);
+
+// range check of the reserved pool region
+int mem_pool_owns(void const *ptr);
+
+// usable size of a pool block
+unsigned int mem_pool_size(void const *ptr);
+void mem_pool_free(void *ptr);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
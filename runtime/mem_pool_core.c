@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "mem_pool_core.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                         Small block pool core
+//
+// Size class lookup, slab carving, free lists, and the owner check of the
+// small block pool. The platform part (mem_pool.c) reserves the region,
+// commits the slabs, and holds the lock of the class around the calls; the
+// same code is replayed on the host by tools/mtr_pool.
+//
+
+// build-time checks
+typedef char mem_pool_slab_class[(MEM_POOL_CLASSES <= 0x100) ? 1 : -1];
+typedef char mem_pool_block_link[(8 >= sizeof(void *)) ? 1 : -1];
+
+static
+unsigned long const class_size[] = {
+	MEM_POOL_CLASS_SIZES
+};
+
+typedef char mem_pool_class_sizes[(sizeof(class_size) / sizeof(class_size[0]) == MEM_POOL_CLASSES) ? 1 : -1];
+
+
+void mem_pool_core_init(MEM_POOL_CORE *core, void *base, MEM_POOL_COMMIT commit)
+{
+	int index;
+	unsigned long size;
+	core->base = (unsigned char *)base;
+	core->commit = commit;
+	for (index = 0; index < MEM_POOL_SLABS; ++index) {
+		core->slab_class[index] = 0;
+	}
+	for (index = 0; index < MEM_POOL_CLASSES; ++index) {
+		MEM_POOL_CLASS *cls = &core->cls[index];
+		cls->free = NULL;
+		cls->next = NULL;
+		cls->end = NULL;
+		cls->size = class_size[index];
+		cls->allocs = 0;
+		cls->used = 0;
+		cls->peak = 0;
+		cls->slabs = 0;
+	}
+	for (index = 0, size = 0; size <= MEM_POOL_MAX; size += 8) {
+		while (class_size[index] < size) {
+			++index;
+		}
+		core->index[size >> 3] = (unsigned char)index;
+	}
+}
+
+int mem_pool_core_class(MEM_POOL_CORE const *core, unsigned int size)
+{
+	return (core->index[(size + 7) >> 3]);
+}
+
+void *mem_pool_core_alloc(MEM_POOL_CORE *core, int index)
+{
+	MEM_POOL_CLASS *cls = &core->cls[index];
+	void *block = cls->free;
+	if (block != NULL) {
+		cls->free = *(void **)block;
+	} else {
+		if ((NULL == cls->next) || ((size_t)(cls->end - cls->next) < cls->size)) {
+			int const slab = core->commit(core);
+			if (slab < 0) {
+				return (NULL);
+			}
+			core->slab_class[slab] = (unsigned char)index;
+			cls->next = core->base + (size_t)slab * MEM_POOL_SLAB;
+			cls->end = cls->next + MEM_POOL_SLAB;
+			++cls->slabs;
+		}
+		block = cls->next;
+		cls->next += cls->size;
+	}
+	++cls->allocs;
+	if (++cls->used > cls->peak) {
+		cls->peak = cls->used;
+	}
+	return (block);
+}
+
+void mem_pool_core_free(MEM_POOL_CORE *core, int index, void *ptr)
+{
+	MEM_POOL_CLASS *cls = &core->cls[index];
+	*(void **)ptr = cls->free;
+	cls->free = ptr;
+	--cls->used;
+}
+
+int mem_pool_core_owns(MEM_POOL_CORE const *core, void const *ptr)
+{
+	return ((core->base != NULL) && ((size_t)((unsigned char const *)ptr - core->base) < (size_t)MEM_POOL_SLABS * MEM_POOL_SLAB));
+}
+
+int mem_pool_core_class_of(MEM_POOL_CORE const *core, void const *ptr)
+{
+	return (core->slab_class[(size_t)((unsigned char const *)ptr - core->base) / MEM_POOL_SLAB]);
+}
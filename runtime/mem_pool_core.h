@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef MEM_POOL_CORE_H_
+#define MEM_POOL_CORE_H_
+
+// no Windows headers (the pool core is also replayed on the host by tools/mtr_pool)
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_MEM_POOL
+
+#define MEM_POOL_MAX      1024     // largest pool block
+#define MEM_POOL_SLAB     0x10000  // bytes (allocation granularity)
+#define MEM_POOL_SLABS    512      // 32 MiB reserved
+#define MEM_POOL_CLASSES  18
+
+// block sizes of the size classes
+#define MEM_POOL_CLASS_SIZES \
+	8, 16, 24, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 640, 768, 1024
+
+typedef struct MEM_POOL_CLASS {
+	void          *free;  // free list (linked through the first pointer)
+	unsigned char *next;  // unused part of the current slab
+	unsigned char *end;
+	unsigned long  size;
+	unsigned long  allocs;
+	unsigned long  used;  // blocks
+	unsigned long  peak;
+	unsigned long  slabs;
+} MEM_POOL_CLASS;
+
+typedef struct MEM_POOL_CORE MEM_POOL_CORE;
+
+// commits the next slab of the region and returns its index (-1: exhausted),
+// called with the lock of one class held (slabs are shared by all classes)
+typedef int (*MEM_POOL_COMMIT)(MEM_POOL_CORE *core);
+
+struct MEM_POOL_CORE {
+	unsigned char   *base;  // MEM_POOL_SLABS * MEM_POOL_SLAB bytes (reserved)
+	MEM_POOL_COMMIT  commit;
+	unsigned char    slab_class[MEM_POOL_SLABS];
+	unsigned char    index[(MEM_POOL_MAX >> 3) + 1];  // (size + 7) / 8 -> class
+	MEM_POOL_CLASS   cls[MEM_POOL_CLASSES];
+};
+
+// the caller supplies the region, the slab commit, and one lock per class
+// (the functions with a class index require the lock of that class)
+void mem_pool_core_init(MEM_POOL_CORE *core, void *base, MEM_POOL_COMMIT commit);
+
+// size class of an allocation up to MEM_POOL_MAX bytes
+int mem_pool_core_class(MEM_POOL_CORE const *core, unsigned int size);
+// NULL if the region is exhausted
+void *mem_pool_core_alloc(MEM_POOL_CORE *core, int index);
+void mem_pool_core_free(MEM_POOL_CORE *core, int index, void *ptr);
+
+// range check of the region (no lock)
+int mem_pool_core_owns(MEM_POOL_CORE const *core, void const *ptr);
+// size class of a pool block (no lock)
+int mem_pool_core_class_of(MEM_POOL_CORE const *core, void const *ptr);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
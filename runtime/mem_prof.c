@@ -0,0 +1,615 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "mem_prof.h"
+
+#include "../common/kqf_app.h"
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                        Allocation site profiler
+//
+// Aggregates the heap usage per call site (return address of malloc, realloc,
+// and operator new) to find the subsystems of the game that churn the heap.
+// The sites are kept in an open-addressing hash table that only grows; it is
+// probed without a lock, and new sites are inserted under a lock (the return
+// address is published last). The site counters are updated with interlocked
+// operations. All tables are allocated with VirtualAlloc to stay out of the
+// heap that is observed.
+//
+// The report lists the sites sorted by the total of allocated bytes. Return
+// addresses inside the game image are written as RVA (+offset), which stays
+// comparable across runs and (mostly) across the game versions.
+//
+
+enum MEMPROF_ {
+	MEMPROF_SITES  = 4096,     // hash table size (power of two)
+	MEMPROF_OTHER  = MEMPROF_SITES,
+	MEMPROF_SHARDS = 16,       // live block tables (power of two)
+	MEMPROF_LIVE   = 0x1000,   // initial live block table size (power of two)
+	MEMPROF_HISTO  = 8,        // size classes: 16, 64, 256, 1K, 4K, 16K, 64K, more
+	MEMPROF_REPORT = 48        // sites per report
+};
+
+typedef struct PROF_SITE {
+	LONG /*volatile*/ ret;       // return address (0 = unused slot)
+	LONG /*volatile*/ count;     // allocations
+	LONG /*volatile*/ frees;
+	LONG /*volatile*/ live;      // bytes
+	LONG /*volatile*/ peak;      // live bytes
+	LONG /*volatile*/ bytes_lo;  // allocated in total
+	LONG /*volatile*/ bytes_hi;
+	LONG /*volatile*/ histo[MEMPROF_HISTO];
+	DWORD             last;      // live bytes at the last leak report
+} PROF_SITE;
+
+typedef struct PROF_LIVE {
+	DWORD ptr;   // 0 = unused slot
+	DWORD size;
+	DWORD site;  // index into s_site
+} PROF_LIVE;
+
+typedef struct PROF_SHARD {
+	CRITICAL_SECTION lock;
+	PROF_LIVE       *live;
+	DWORD            size;
+	DWORD            count;
+} PROF_SHARD;
+
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static int s_report_sites /* = 0 */;
+static int s_report_leaks /* = 0 */;
+static CRITICAL_SECTION s_site_lock /* = {0} */;
+static PROF_SITE *s_site /* = NULL */;  // MEMPROF_SITES + 1 (overflow)
+static DWORD s_sites /* = 0 */;
+static PROF_SHARD s_shard[MEMPROF_SHARDS] /* = {0} */;
+static LONG /*volatile*/ s_live_count /* = 0 */;
+static LONG /*volatile*/ s_live_bytes /* = 0 */;
+static LONG /*volatile*/ s_peak_bytes /* = 0 */;
+static LONG /*volatile*/ s_untracked /* = 0 */;
+static DWORD s_peak_commit /* = 0 */;  // sampled (without GetProcessMemoryInfo)
+static DWORD s_start /* = 0 */;
+
+static LONG /*volatile*/ s_reporting /* = 0 */;
+static PROF_SITE *s_copy /* = NULL */;  // MEMPROF_SITES + 1
+static PROF_SITE const **s_order /* = NULL */;
+
+static HANDLE s_stop /* = NULL */;
+static DWORD s_period /* = 0 */;
+
+
+static
+void *alloc_pages(SIZE_T size)
+{
+	return (VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+}
+
+static
+void free_pages(void **pages)
+{
+	if (*pages != NULL) {
+		VirtualFree(*pages, 0, MEM_RELEASE);
+		*pages = NULL;
+	}
+}
+
+static
+DWORD hash(DWORD key, DWORD mask)
+{
+	// Fibonacci hashing (the low bits of heap pointers and return addresses are poor)
+	return (((key >> 2) * 2654435761UL) >> 7) & mask;
+}
+
+static
+int size_class(DWORD size)
+{
+	int histo = 0;
+	if (size != 0) {
+		DWORD rest = (size - 1) >> 4;
+		while (rest && (histo < MEMPROF_HISTO - 1)) {
+			rest >>= 2;
+			++histo;
+		}
+	}
+	return (histo);
+}
+
+static
+void raise_peak(LONG /*volatile*/ *peak, LONG live)
+{
+	LONG old = *peak;
+	while (((DWORD)old < (DWORD)live) && (InterlockedCompareExchange(peak, live, old) != old)) {
+		old = *peak;
+	}
+}
+
+
+// site index of a return address
+static
+DWORD find_site(DWORD ret)
+{
+	DWORD i = hash(ret, MEMPROF_SITES - 1);
+	for (;;) {
+		DWORD const key = (DWORD)s_site[i].ret;
+		if (key == ret) {
+			return (i);
+		}
+		if (0 == key) {
+			break;
+		}
+		i = (i + 1) & (MEMPROF_SITES - 1);
+	}
+	// the slots before i are in use by other sites (nothing is ever removed)
+	EnterCriticalSection(&s_site_lock);
+	for (;;) {
+		PROF_SITE *site = &s_site[i];
+		if ((DWORD)site->ret == ret) {
+			break;
+		}
+		if (0 == site->ret) {
+			// keep the load below 3/4, the rest is accounted as one site
+			if (s_sites >= MEMPROF_SITES / 4 * 3) {
+				i = MEMPROF_OTHER;
+			} else {
+				++s_sites;
+				InterlockedExchange(&site->ret, (LONG)ret);
+			}
+			break;
+		}
+		i = (i + 1) & (MEMPROF_SITES - 1);
+	}
+	LeaveCriticalSection(&s_site_lock);
+	return (i);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                           Live block tables
+//
+// Every live block is mapped to its size and site, so that a release can be
+// charged to the site that allocated the block. The blocks are distributed by
+// address over independent tables with their own locks (threads allocating
+// at the same time rarely meet). Each table uses linear probing with backward
+// shift deletion and is doubled at a load of 3/4.
+//
+
+static
+PROF_SHARD *find_shard(DWORD ptr)
+{
+	return (&s_shard[(ptr >> 4) & (MEMPROF_SHARDS - 1)]);
+}
+
+// doubles the table (shard->lock has to be held)
+static
+int grow_live(PROF_SHARD *shard)
+{
+	DWORD const size = shard->size * 2;
+	PROF_LIVE *live = (PROF_LIVE *)alloc_pages(size * sizeof(PROF_LIVE));
+	DWORD i;
+	if (NULL == live) {
+		return (0);
+	}
+	for (i = 0; i < shard->size; ++i) {
+		if (shard->live[i].ptr != 0) {
+			DWORD j = hash(shard->live[i].ptr, size - 1);
+			while (live[j].ptr != 0) {
+				j = (j + 1) & (size - 1);
+			}
+			live[j] = shard->live[i];
+		}
+	}
+	VirtualFree(shard->live, 0, MEM_RELEASE);
+	shard->live = live;
+	shard->size = size;
+	return (1);
+}
+
+// slot of a live block or -1 (shard->lock has to be held)
+static
+LONG find_live(PROF_SHARD const *shard, DWORD ptr)
+{
+	DWORD const mask = shard->size - 1;
+	DWORD i = hash(ptr, mask);
+	while (shard->live[i].ptr != 0) {
+		if (shard->live[i].ptr == ptr) {
+			return ((LONG)i);
+		}
+		i = (i + 1) & mask;
+	}
+	return (-1);
+}
+
+// backward shift deletion, no tombstones (shard->lock has to be held)
+static
+void remove_live(PROF_SHARD *shard, DWORD i)
+{
+	PROF_LIVE *live = shard->live;
+	DWORD const mask = shard->size - 1;
+	DWORD j = i;
+	for (;;) {
+		DWORD home;
+		j = (j + 1) & mask;
+		if (0 == live[j].ptr) {
+			break;
+		}
+		home = hash(live[j].ptr, mask);
+		// move the entry up if its home slot is not in (i, j]
+		if (((j > i) && ((home <= i) || (home > j))) ||
+		    ((j < i) && ((home <= i) && (home > j)))) {
+			live[i] = live[j];
+			i = j;
+		}
+	}
+	live[i].ptr = 0;
+	--shard->count;
+}
+
+// charges a release to the site of the block (shard->lock has to be held)
+static
+void release(PROF_SHARD *shard, DWORD ptr)
+{
+	LONG const i = find_live(shard, ptr);
+	if (i >= 0) {
+		PROF_LIVE const *live = &shard->live[i];
+		PROF_SITE *site = &s_site[live->site];
+		InterlockedExchangeAdd(&site->live, -(LONG)live->size);
+		InterlockedIncrement(&site->frees);
+		InterlockedExchangeAdd(&s_live_bytes, -(LONG)live->size);
+		InterlockedDecrement(&s_live_count);
+		remove_live(shard, (DWORD)i);
+	}
+}
+
+
+void mem_prof_alloc(void const *ptr, unsigned int size, void const *ret)
+{
+	if (s_active && (ptr != NULL)) {
+		DWORD const error = GetLastError();
+		DWORD const index = find_site((DWORD)(ULONG_PTR)ret);
+		PROF_SITE *site = &s_site[index];
+		PROF_SHARD *shard = find_shard((DWORD)(ULONG_PTR)ptr);
+		LONG const lo = InterlockedExchangeAdd(&site->bytes_lo, (LONG)size);
+		if ((DWORD)lo + size < (DWORD)lo) {
+			InterlockedIncrement(&site->bytes_hi);
+		}
+		InterlockedIncrement(&site->count);
+		InterlockedIncrement(&site->histo[size_class(size)]);
+		EnterCriticalSection(&shard->lock);
+		// the address might have been freed without us (e.g. by the CRT itself)
+		release(shard, (DWORD)(ULONG_PTR)ptr);
+		if ((shard->count >= shard->size / 4 * 3) && !grow_live(shard)) {
+			InterlockedIncrement(&s_untracked);
+		} else {
+			DWORD i = hash((DWORD)(ULONG_PTR)ptr, shard->size - 1);
+			while (shard->live[i].ptr != 0) {
+				i = (i + 1) & (shard->size - 1);
+			}
+			shard->live[i].ptr = (DWORD)(ULONG_PTR)ptr;
+			shard->live[i].size = size;
+			shard->live[i].site = index;
+			++shard->count;
+			InterlockedIncrement(&s_live_count);
+			raise_peak(&site->peak, InterlockedExchangeAdd(&site->live, (LONG)size) + (LONG)size);
+			raise_peak(&s_peak_bytes, InterlockedExchangeAdd(&s_live_bytes, (LONG)size) + (LONG)size);
+		}
+		LeaveCriticalSection(&shard->lock);
+		SetLastError(error);
+	}
+}
+
+void mem_prof_free(void const *ptr)
+{
+	if (s_active && (ptr != NULL)) {
+		PROF_SHARD *shard = find_shard((DWORD)(ULONG_PTR)ptr);
+		EnterCriticalSection(&shard->lock);
+		release(shard, (DWORD)(ULONG_PTR)ptr);
+		LeaveCriticalSection(&shard->lock);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                                Reports
+//
+// The counters are copied without a lock (each of them is consistent, but not
+// all of them together). Only one report is written at a time; a report that
+// is requested while another one is written is skipped, which avoids waiting
+// for a thread that was terminated at process exit.
+//
+// The leak report (mem.leaks) is written at unload and on each world change.
+// It lists the sites with outstanding blocks and their growth since the last
+// leak report, which shows the memory that is kept across world transitions.
+//
+
+// PROCESS_MEMORY_COUNTERS (psapi.h)
+typedef struct MEMPROF_COUNTERS {
+	DWORD  cb;
+	DWORD  PageFaultCount;
+	SIZE_T PeakWorkingSetSize;
+	SIZE_T WorkingSetSize;
+	SIZE_T QuotaPeakPagedPoolUsage;
+	SIZE_T QuotaPagedPoolUsage;
+	SIZE_T QuotaPeakNonPagedPoolUsage;
+	SIZE_T QuotaNonPagedPoolUsage;
+	SIZE_T PagefileUsage;
+	SIZE_T PeakPagefileUsage;
+} MEMPROF_COUNTERS;
+
+typedef BOOL (WINAPI *PFNGETPROCESSMEMORYINFO)(HANDLE Process, MEMPROF_COUNTERS *ppsmemCounters, DWORD cb);
+
+static PFNGETPROCESSMEMORYINFO get_process_memory_info /* = NULL */;
+
+
+// K32GetProcessMemoryInfo (Windows 7 and newer) or psapi.dll (not freed)
+static
+void init_peak_commit(void)
+{
+	HMODULE module = GetModuleHandleA("kernel32.dll");
+	if (module != NULL) {
+		get_process_memory_info = (PFNGETPROCESSMEMORYINFO)GetProcAddress(module, "K32GetProcessMemoryInfo");
+	}
+	if (NULL == get_process_memory_info) {
+		module = LoadLibraryA("psapi.dll");
+		if (module != NULL) {
+			get_process_memory_info = (PFNGETPROCESSMEMORYINFO)GetProcAddress(module, "GetProcessMemoryInfo");
+		}
+	}
+}
+
+// peak of the committed private memory (the system tracks it on every commit,
+// otherwise only the samples at report time are known)
+static
+DWORD peak_commit(DWORD commit)
+{
+	MEMPROF_COUNTERS counters;
+	if (s_peak_commit < commit) {
+		s_peak_commit = commit;
+	}
+	counters.cb = sizeof(counters);
+	if (get_process_memory_info && get_process_memory_info(GetCurrentProcess(), &counters, sizeof(counters)) &&
+	    (s_peak_commit < (DWORD)counters.PeakPagefileUsage)) {
+		s_peak_commit = (DWORD)counters.PeakPagefileUsage;
+	}
+	return (s_peak_commit);
+}
+
+// committed private memory of the process (heaps, pools, and VirtualAlloc)
+static
+DWORD committed(void)
+{
+	DWORD total = 0;
+	unsigned char const *addr = NULL;
+	MEMORY_BASIC_INFORMATION mbi;
+	while (kqf_query_mem(addr, mbi)) {
+		if ((MEM_COMMIT == mbi.State) && (MEM_PRIVATE == mbi.Type)) {
+			total += (DWORD)mbi.RegionSize;
+		}
+		if ((unsigned char const *)mbi.BaseAddress + mbi.RegionSize <= addr) {
+			break;
+		}
+		addr = (unsigned char const *)mbi.BaseAddress + mbi.RegionSize;
+	}
+	return (total);
+}
+
+static
+DWORD site_kib(PROF_SITE const *site)
+{
+	return (((DWORD)site->bytes_hi << 22) | ((DWORD)site->bytes_lo >> 10));
+}
+
+// copies the used sites (s_reporting has to be set)
+static
+int copy_sites(void)
+{
+	int count = 0;
+	int i;
+	for (i = 0; i <= MEMPROF_SITES; ++i) {
+		if (s_site[i].count != 0) {
+			s_copy[count] = s_site[i];
+			s_order[count] = &s_copy[count];
+			++count;
+		}
+	}
+	return (count);
+}
+
+// shell sort, descending (s_reporting has to be set)
+static
+void sort_sites(int count, int by_live)
+{
+	int gap;
+	for (gap = count / 2; gap > 0; gap /= 2) {
+		int i;
+		for (i = gap; i < count; ++i) {
+			PROF_SITE const *site = s_order[i];
+			DWORD const key = by_live ? (DWORD)site->live : site_kib(site);
+			int j = i;
+			while ((j >= gap) && ((by_live ? (DWORD)s_order[j - gap]->live : site_kib(s_order[j - gap])) < key)) {
+				s_order[j] = s_order[j - gap];
+				j -= gap;
+			}
+			s_order[j] = site;
+		}
+	}
+}
+
+static
+char const *site_addr(PROF_SITE const *site, DWORD *addr)
+{
+	unsigned char const *base = (unsigned char const *)kqf_app.info.base;
+	unsigned char const *ret = (unsigned char const *)(ULONG_PTR)(DWORD)site->ret;
+	*addr = (DWORD)site->ret;
+	if (0 == site->ret) {
+		return ("*");  // overflow
+	}
+	if ((base != NULL) && (kqf_app.info.header != NULL) &&
+	    (ret >= base) && (ret < base + kqf_app.info.header->OptionalHeader.SizeOfImage)) {
+		*addr = (DWORD)(ret - base);
+		return ("+");
+	}
+	return (" ");
+}
+
+static
+void report_totals(char const *title, char const *reason, int count)
+{
+	DWORD const commit = committed();
+	DWORD const peak = peak_commit(commit);
+	kqf_log(KQF_LOGL_FORCE, "MemProf: %s (%s) after %lu s: %i sites, %li live blocks, %lu KiB live, %lu KiB peak, %li untracked, %lu KiB committed, %lu KiB peak committed\n",
+		title, reason, (GetTickCount() - s_start) / 1000, count, s_live_count,
+		(DWORD)s_live_bytes >> 10, (DWORD)s_peak_bytes >> 10, s_untracked, commit >> 10, peak >> 10);
+}
+
+void mem_prof_report(char const *reason)
+{
+	if (s_active && (0 == InterlockedCompareExchange(&s_reporting, 1, 0))) {
+		int const count = copy_sites();
+		int i;
+		sort_sites(count, 0);
+		report_totals("report", reason, count);
+		kqf_log(KQF_LOGL_FORCE, "MemProf:  site       allocs    frees total KiB live KiB peak KiB | <=16 <=64 <=256 <=1K <=4K <=16K <=64K more\n");
+		for (i = 0; (i < count) && (i < MEMPROF_REPORT); ++i) {
+			PROF_SITE const *site = s_order[i];
+			DWORD addr;
+			char const *rel = site_addr(site, &addr);
+			kqf_log(KQF_LOGL_FORCE, "MemProf: %s%08lx %8lu %8lu %9lu %8lu %8lu | %lu %lu %lu %lu %lu %lu %lu %lu\n",
+				rel, addr, site->count, site->frees,
+				site_kib(site), (DWORD)site->live >> 10, (DWORD)site->peak >> 10,
+				site->histo[0], site->histo[1], site->histo[2], site->histo[3],
+				site->histo[4], site->histo[5], site->histo[6], site->histo[7]);
+		}
+		kqf_flush_log();
+		InterlockedExchange(&s_reporting, 0);
+	}
+}
+
+void mem_prof_leaks(char const *reason)
+{
+	if (s_active && s_report_leaks && (0 == InterlockedCompareExchange(&s_reporting, 1, 0))) {
+		int const count = copy_sites();
+		int i;
+		sort_sites(count, 1);
+		report_totals("leaks", reason, count);
+		kqf_log(KQF_LOGL_FORCE, "MemProf:  site       blocks live bytes    growth\n");
+		for (i = 0; (i < count) && (i < MEMPROF_REPORT); ++i) {
+			PROF_SITE const *site = s_order[i];
+			LONG const growth = site->live - (LONG)site->last;
+			DWORD addr;
+			char const *rel = site_addr(site, &addr);
+			if (0 == site->live) {
+				break;
+			}
+			kqf_log(KQF_LOGL_FORCE, "MemProf: %s%08lx %8li %10lu %c%8lu\n",
+				rel, addr, site->count - site->frees, (DWORD)site->live,
+				(growth < 0) ? '-' : '+', (DWORD)((growth < 0) ? -growth : growth));
+		}
+		// growth since the last leak report (e.g. across a world change)
+		for (i = 0; i <= MEMPROF_SITES; ++i) {
+			s_site[i].last = (DWORD)s_site[i].live;
+		}
+		kqf_flush_log();
+		InterlockedExchange(&s_reporting, 0);
+	}
+}
+
+
+static
+DWORD WINAPI report_proc(LPVOID param)
+{
+	UNREFERENCED_PARAMETER(param);
+	while (WAIT_TIMEOUT == WaitForSingleObject(s_stop, s_period)) {
+		mem_prof_report("periodic");
+	}
+	return (0);
+}
+
+
+int init_mem_prof(int minutes, int leaks)
+{
+	int i;
+	if (s_active) {
+		return (1);
+	}
+	s_site = (PROF_SITE *)alloc_pages((MEMPROF_SITES + 1) * sizeof(PROF_SITE));
+	s_copy = (PROF_SITE *)alloc_pages((MEMPROF_SITES + 1) * sizeof(PROF_SITE));
+	s_order = (PROF_SITE const **)alloc_pages((MEMPROF_SITES + 1) * sizeof(PROF_SITE const *));
+	for (i = 0; i < MEMPROF_SHARDS; ++i) {
+		s_shard[i].live = (PROF_LIVE *)alloc_pages(MEMPROF_LIVE * sizeof(PROF_LIVE));
+		s_shard[i].size = MEMPROF_LIVE;
+	}
+	for (i = 0; (i < MEMPROF_SHARDS) && (s_shard[i].live != NULL); ++i)
+		;
+	if ((NULL == s_site) || (NULL == s_copy) || (NULL == s_order) || (i < MEMPROF_SHARDS)) {
+		kqf_log(KQF_LOGL_ERROR, "MemProf: failed to allocate tables (%#lx)\n", GetLastError());
+		free_pages((void **)&s_site);
+		free_pages((void **)&s_copy);
+		free_pages((void **)&s_order);
+		for (i = 0; i < MEMPROF_SHARDS; ++i) {
+			free_pages((void **)&s_shard[i].live);
+		}
+		return (0);
+	}
+	InitializeCriticalSection(&s_site_lock);
+	for (i = 0; i < MEMPROF_SHARDS; ++i) {
+		InitializeCriticalSection(&s_shard[i].lock);
+	}
+	init_peak_commit();
+	s_report_sites = (minutes >= 0);
+	s_report_leaks = leaks;
+	s_start = GetTickCount();
+	if (minutes > 0) {
+		s_period = (DWORD)minutes * 60000;
+		s_stop = CreateEventA(NULL, TRUE, FALSE, NULL);
+		if (s_stop != NULL) {
+			DWORD id;
+			HANDLE thread = CreateThread(NULL, 0, report_proc, NULL, 0, &id);
+			if (thread != NULL) {
+				CloseHandle(thread);
+			} else {
+				kqf_log(KQF_LOGL_WARNING, "MemProf: failed to create report thread (%#lx)\n", GetLastError());
+			}
+		}
+	}
+	InterlockedExchange(&s_active, 1);
+	kqf_log(KQF_LOGL_INFO, "MemProf: profiling allocation sites (report: %i, leaks: %i)\n", minutes, leaks);
+	return (1);
+}
+
+void free_mem_prof(void)
+{
+	if (s_active) {
+		if (s_stop != NULL) {
+			SetEvent(s_stop);
+		}
+		if (s_report_sites) {
+			mem_prof_report("unload");
+		}
+		mem_prof_leaks("unload");
+		// the tables stay valid, blocks might still be released after DLL_PROCESS_DETACH
+		InterlockedExchange(&s_active, 0);
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef MEM_PROF_H_
+#define MEM_PROF_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_MEM_PROFILE, KQF_CFGO_MEM_LEAKS
+
+// minutes: interval of the periodic site report (0 = only at unload, -1 = none)
+// leaks: report the outstanding blocks at unload and on world changes
+int init_mem_prof(int minutes, int leaks);
+void free_mem_prof(void);  // writes the final reports
+
+// record an allocation (ptr != NULL) or the release of a block (no-op if disabled)
+void mem_prof_alloc(void const *ptr, unsigned int size, void const *ret);
+void mem_prof_free(void const *ptr);
+
+// writes the allocation sites sorted by allocated bytes to the log
+void mem_prof_report(char const *reason);
+
+// writes the sites with outstanding blocks sorted by live bytes to the log
+void mem_prof_leaks(char const *reason);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
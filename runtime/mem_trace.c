@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "mem_trace.h"
+
+#include "../common/kqf_app.h"
+#include "../common/kqf_cfg.h"
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                         Binary allocation trace
+//
+// A kqf_log line per allocation (critical section, wvsprintf, and WriteFile)
+// slows the game down to a crawl and changes the heap behaviour that has to be
+// studied. Every thread gets its own ring buffer of 16-byte records instead;
+// the owner thread is the only writer of the head, the spill thread the only
+// writer of the tail, so recording needs neither a lock nor a system call
+// (apart from GetTickCount). The spill thread writes the buffers to disk
+// every 50 ms as blocks tagged with the thread id. Records that do not fit
+// into a full ring are counted and reported in the next block header. The
+// buffer of an exited thread (DLL_THREAD_DETACH) is handed to the next new
+// thread once the spill thread has written its remaining records, so the
+// number of buffers is bounded by the number of concurrent threads.
+// tools/mtr_stat.c summarizes a trace on the host (leaks, peaks, callers).
+//
+
+enum MEMTRACE_ {
+	MEMTRACE_RECORDS = 4096,  // per thread (64 KiB, power of two)
+	MEMTRACE_SPILL   = 50,    // ms
+	MEMTRACE_WAIT    = 2000   // ms (final spill, the spill thread might be gone)
+};
+
+typedef struct TRACE_BUFFER {
+	struct TRACE_BUFFER *next;
+	DWORD                thread;
+	LONG /*volatile*/    head;     // owner thread
+	LONG /*volatile*/    tail;     // spill thread
+	LONG /*volatile*/    dropped;
+	LONG /*volatile*/    exited;   // owner thread exited, reusable when spilled
+	MEM_TRACE_RECORD     record[MEMTRACE_RECORDS];
+} TRACE_BUFFER;
+
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static DWORD s_tls = TLS_OUT_OF_INDEXES;
+static LONG /*volatile*/ s_buffers /* = NULL */;  // TRACE_BUFFER *
+static LONG /*volatile*/ s_spilling /* = 0 */;
+static HANDLE s_file = INVALID_HANDLE_VALUE;
+static HANDLE s_stop /* = NULL */;
+static HANDLE s_thread /* = NULL */;
+static MEM_TRACE_RECORD s_spill[1 + MEMTRACE_RECORDS] /* = {0} */;
+
+
+// claims the spilled buffer of an exited thread
+static
+TRACE_BUFFER *reuse_buffer(void)
+{
+	TRACE_BUFFER *buf = (TRACE_BUFFER *)(ULONG_PTR)InterlockedCompareExchange(&s_buffers, 0, 0);
+	for (; buf != NULL; buf = buf->next) {
+		if (buf->exited && (1 == InterlockedCompareExchange(&buf->exited, 0, 1))) {
+			if ((InterlockedCompareExchange(&buf->tail, 0, 0) == buf->head) && !buf->dropped) {
+				// the spill thread only reads the thread id of pending records
+				buf->thread = GetCurrentThreadId();
+				return (buf);
+			}
+			InterlockedExchange(&buf->exited, 1);
+		}
+	}
+	return (NULL);
+}
+
+static
+TRACE_BUFFER *get_buffer(void)
+{
+	TRACE_BUFFER *buf = (TRACE_BUFFER *)TlsGetValue(s_tls);
+	if (NULL == buf) {
+		buf = reuse_buffer();
+		if (buf != NULL) {
+			TlsSetValue(s_tls, buf);
+			return (buf);
+		}
+		buf = (TRACE_BUFFER *)VirtualAlloc(NULL, sizeof(*buf), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (buf != NULL) {
+			LONG next;
+			buf->thread = GetCurrentThreadId();
+			do {
+				next = InterlockedCompareExchange(&s_buffers, 0, 0);
+				buf->next = (TRACE_BUFFER *)(ULONG_PTR)next;
+			} while (InterlockedCompareExchange(&s_buffers, (LONG)(ULONG_PTR)buf, next) != next);
+			TlsSetValue(s_tls, buf);
+		}
+	}
+	return (buf);
+}
+
+void mem_trace(MEM_TRACE_OP_ op, unsigned int size, void const *ptr, void const *ret)
+{
+	if (s_active) {
+		DWORD const error = GetLastError();
+		TRACE_BUFFER *buf = get_buffer();
+		if (buf != NULL) {
+			LONG const head = buf->head;
+			if (head - InterlockedCompareExchange(&buf->tail, 0, 0) >= MEMTRACE_RECORDS) {
+				InterlockedIncrement(&buf->dropped);
+			} else {
+				MEM_TRACE_RECORD *rec = &buf->record[head & (MEMTRACE_RECORDS - 1)];
+				rec->tick_op = (GetTickCount() << 4) | (DWORD)op;
+				rec->size = size;
+				rec->ptr = (DWORD)(ULONG_PTR)ptr;
+				rec->ret = (DWORD)(ULONG_PTR)ret;
+				// publish the record
+				InterlockedExchange(&buf->head, head + 1);
+			}
+		}
+		SetLastError(error);
+	}
+}
+
+
+void mem_trace_thread_exit(void)
+{
+	if (s_tls != TLS_OUT_OF_INDEXES) {
+		TRACE_BUFFER *buf = (TRACE_BUFFER *)TlsGetValue(s_tls);
+		if (buf != NULL) {
+			TlsSetValue(s_tls, NULL);
+			InterlockedExchange(&buf->exited, 1);
+		}
+	}
+}
+
+
+// takes the spill lock (the periodic spill never waits, the final spill waits
+// for a running spill, unless its thread was terminated at process exit)
+static
+int spill_lock(DWORD timeout)
+{
+	DWORD const begin = GetTickCount();
+	while (InterlockedCompareExchange(&s_spilling, 1, 0) != 0) {
+		if (GetTickCount() - begin >= timeout) {
+			return (timeout > 0);
+		}
+		Sleep(1);
+	}
+	return (1);
+}
+
+// write all pending records (only one thread at a time)
+static
+void spill(DWORD timeout)
+{
+	if (spill_lock(timeout)) {
+		TRACE_BUFFER *buf = (TRACE_BUFFER *)(ULONG_PTR)InterlockedCompareExchange(&s_buffers, 0, 0);
+		for (; buf != NULL; buf = buf->next) {
+			LONG const head = InterlockedCompareExchange(&buf->head, 0, 0);
+			LONG tail = buf->tail;
+			LONG const dropped = InterlockedExchange(&buf->dropped, 0);
+			if ((head != tail) || dropped) {
+				DWORD count = 0;
+				DWORD written;
+				s_spill[0].tick_op = (GetTickCount() << 4) | MEM_TRACE_BLOCK;
+				s_spill[0].ptr = buf->thread;
+				s_spill[0].ret = (DWORD)dropped;
+				while (tail != head) {
+					s_spill[1 + count++] = buf->record[tail++ & (MEMTRACE_RECORDS - 1)];
+				}
+				s_spill[0].size = count;
+				InterlockedExchange(&buf->tail, tail);
+				WriteFile(s_file, s_spill, (1 + count) * sizeof(s_spill[0]), &written, NULL);
+			}
+		}
+		InterlockedExchange(&s_spilling, 0);
+	}
+}
+
+static
+DWORD WINAPI spill_proc(LPVOID param)
+{
+	UNREFERENCED_PARAMETER(param);
+	while (WAIT_TIMEOUT == WaitForSingleObject(s_stop, MEMTRACE_SPILL)) {
+		spill(0);
+	}
+	spill(0);
+	return (0);
+}
+
+
+int init_mem_trace(void)
+{
+	char path[MAX_PATH];
+	MEM_TRACE_HEADER header;
+	DWORD written;
+	if (s_active) {
+		return (1);
+	}
+	s_tls = TlsAlloc();
+	if (TLS_OUT_OF_INDEXES == s_tls) {
+		kqf_log(KQF_LOGL_ERROR, "MemTrace: failed to allocate thread local storage (%#lx)\n", GetLastError());
+		return (0);
+	}
+	kqf_app_filepath("kq8fix.mtr", path);
+	s_file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == s_file) {
+		kqf_log(KQF_LOGL_ERROR, "MemTrace: failed to create '%s' (%#lx)\n", path, GetLastError());
+		TlsFree(s_tls), s_tls = TLS_OUT_OF_INDEXES;
+		return (0);
+	}
+	header.magic = MEM_TRACE_MAGIC;
+	header.version = 1;
+	header.record = sizeof(MEM_TRACE_RECORD);
+	header.base = (DWORD)(ULONG_PTR)kqf_app.info.base;
+	header.tick = GetTickCount();
+	header.process = GetCurrentProcessId();
+	header.reserved[0] = 0;
+	header.reserved[1] = 0;
+	WriteFile(s_file, &header, sizeof(header), &written, NULL);
+	s_stop = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (s_stop != NULL) {
+		DWORD id;
+		s_thread = CreateThread(NULL, 0, spill_proc, NULL, 0, &id);
+	}
+	if (NULL == s_thread) {
+		kqf_log(KQF_LOGL_ERROR, "MemTrace: failed to create spill thread (%#lx)\n", GetLastError());
+		if (s_stop != NULL) {
+			CloseHandle(s_stop), s_stop = NULL;
+		}
+		CloseHandle(s_file), s_file = INVALID_HANDLE_VALUE;
+		TlsFree(s_tls), s_tls = TLS_OUT_OF_INDEXES;
+		return (0);
+	}
+	InterlockedExchange(&s_active, 1);
+	kqf_log(KQF_LOGL_INFO, "MemTrace: recording to '%s'\n", path);
+	return (1);
+}
+
+void free_mem_trace(void)
+{
+	if (s_active) {
+		InterlockedExchange(&s_active, 0);
+		// the spill thread is gone at process exit (and can't exit under the loader lock)
+		SetEvent(s_stop);
+		spill(MEMTRACE_WAIT);
+		FlushFileBuffers(s_file);
+		kqf_log(KQF_LOGL_INFO, "MemTrace: stopped\n");
+	}
+}
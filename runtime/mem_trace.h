@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef MEM_TRACE_H_
+#define MEM_TRACE_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_MEM_TRACE
+
+// kq8fix.mtr: MEM_TRACE_HEADER, then blocks (MEM_TRACE_BLOCK + records)
+typedef enum MEM_TRACE_OP_ {
+	MEM_TRACE_MALLOC      = 1,   // ptr (NULL: failed), size
+	MEM_TRACE_FREE        = 2,   // ptr
+	MEM_TRACE_REALLOC_OLD = 3,   // ptr (followed by MEM_TRACE_REALLOC)
+	MEM_TRACE_REALLOC     = 4,   // ptr (NULL: failed or freed), size
+	MEM_TRACE_NEW         = 5,   // ptr (NULL: failed), size
+	MEM_TRACE_DELETE      = 6,   // ptr
+	MEM_TRACE_BLOCK       = 15   // size: records, ptr: thread id, ret: dropped
+} MEM_TRACE_OP_;
+
+#define MEM_TRACE_MAGIC 0x544D514BUL  // "KQMT"
+
+typedef struct MEM_TRACE_HEADER {
+	DWORD magic;
+	DWORD version;  // 1
+	DWORD record;   // sizeof(MEM_TRACE_RECORD)
+	DWORD base;     // game image base (return addresses)
+	DWORD tick;     // GetTickCount() at start
+	DWORD process;  // process id
+	DWORD reserved[2];
+} MEM_TRACE_HEADER;
+
+typedef struct MEM_TRACE_RECORD {
+	DWORD tick_op;  // GetTickCount() << 4 | MEM_TRACE_OP_
+	DWORD size;
+	DWORD ptr;
+	DWORD ret;      // return address of the caller
+} MEM_TRACE_RECORD;
+
+
+int init_mem_trace(void);
+void free_mem_trace(void);
+
+// record an allocation event of the calling thread
+void mem_trace(MEM_TRACE_OP_ op, unsigned int size, void const *ptr, void const *ret);
+
+// DLL_THREAD_DETACH (the buffer of the thread is reused)
+void mem_trace_thread_exit(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
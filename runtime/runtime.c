@@ -25,9 +25,12 @@
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
+#include "../common/kqf_mem.h"
 #include "../common/kqf_init.h"
 #include "../common/kqf_win.h"
 
+#include "cd_overlay.h"
+#include "file_cache.h"
 #include "hook_shim.h"
 #include "hook_talk.h"
 #include "hook_video.h"
@@ -35,6 +38,15 @@
 #include "hook_window.h"
 #include "hook_memory.h"
 #include "hook_gfx.h"
+#include "mem_frag.h"
+#include "mem_large.h"
+#include "mem_pool.h"
+#include "mem_prof.h"
+#include "mem_trace.h"
+#include "save_prof.h"
+#include "video_ext.h"
+#include "video_stat.h"
+#include "volume_cache.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -151,7 +163,18 @@ DWORD WINAPI crash_dump_save(LPVOID lpParameter)
 		HANDLE File = CreateFileA(crash_dump_file, GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 		if (File != INVALID_HANDLE_VALUE) {
 			MINIDUMP_TYPE const DumpType = kqf_get_opt(KQF_CFGO_CRASH_DUMP) - 1;
-			Saved = crash_dump_write(GetCurrentProcess(), GetCurrentProcessId(), File, DumpType, ExceptionParam, NULL, NULL);
+			MEM_FRAG_SNAPSHOT Snapshot;
+			MINIDUMP_USER_STREAM Stream;
+			MINIDUMP_USER_STREAM_INFORMATION UserStreamParam;
+			UserStreamParam.UserStreamCount = 0;
+			UserStreamParam.UserStreamArray = &Stream;
+			if (mem_frag_latest(&Snapshot)) {
+				Stream.Type = MEM_FRAG_STREAM;
+				Stream.BufferSize = sizeof(Snapshot);
+				Stream.Buffer = &Snapshot;
+				UserStreamParam.UserStreamCount = 1;
+			}
+			Saved = crash_dump_write(GetCurrentProcess(), GetCurrentProcessId(), File, DumpType, ExceptionParam, UserStreamParam.UserStreamCount ? &UserStreamParam : NULL, NULL);
 			CloseHandle(File);
 			if (Saved) {
 				InterlockedIncrement(&crash_dump_done);
@@ -194,8 +217,14 @@ LONG WINAPI crash_dump_proc(PEXCEPTION_POINTERS ExceptionInfo)
 			} else {
 				crash_dump_save(&ExceptionParam);
 			}
-			if (crash_dump_next && !IsBadCodePtr((FARPROC)crash_dump_next)) {
-				return (crash_dump_next(ExceptionInfo));
+			if (crash_dump_next) {
+				// no kqf_mem_executable (its lock might be held by the faulting thread)
+				MEMORY_BASIC_INFORMATION Info;
+				if ((VirtualQuery((LPCVOID)(ULONG_PTR)crash_dump_next, &Info, sizeof(Info)) == sizeof(Info)) &&
+				    (MEM_COMMIT == Info.State) && !(PAGE_GUARD & Info.Protect) &&
+				    ((PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY) & Info.Protect)) {
+					return (crash_dump_next(ExceptionInfo));
+				}
 			}
 		}
 	}
@@ -320,20 +349,21 @@ static
 DWORD patch_ptr(ULONG_PTR *old_ptr, ULONG_PTR new_ptr)
 {
 	DWORD status;
-	MEMORY_BASIC_INFORMATION info;
-	if (!kqf_query_mem(old_ptr, info)) {
+	KQF_MEM_REGION info;
+	if (!kqf_mem_query(old_ptr, &info)) {
 		status = GetLastError();
-	} else if (info.RegionSize < sizeof(ULONG_PTR)) {
+	} else if ((ULONG_PTR)(info.end - (unsigned char const *)old_ptr) < sizeof(ULONG_PTR)) {
 		status = ERROR_INVALID_ADDRESS;
 	} else {
-		DWORD read_only = info.Protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
-		if (read_only && !VirtualProtect(old_ptr, sizeof(*old_ptr), PAGE_EXECUTE_READWRITE, &info.Protect)) {
+		DWORD protect = info.protect;
+		DWORD read_only = protect & (PAGE_NOACCESS | PAGE_READONLY | PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_GUARD);
+		if (read_only && !VirtualProtect(old_ptr, sizeof(*old_ptr), PAGE_EXECUTE_READWRITE, &protect)) {
 			status = GetLastError();
 		} else {
 			*old_ptr = new_ptr;
 			FlushInstructionCache(GetCurrentProcess(), old_ptr, sizeof(*old_ptr));
 			if (read_only) {
-				VirtualProtect(old_ptr, sizeof(*old_ptr), info.Protect, &info.Protect);
+				VirtualProtect(old_ptr, sizeof(*old_ptr), protect, &protect);
 			}
 			status = ERROR_SUCCESS;
 		}
@@ -373,6 +403,8 @@ DWORD patch_import(ULONG_PTR old_ptr, ULONG_PTR new_ptr, const char *name)
 #define HOOK_IMPORT(m, p) patch_import((ULONG_PTR)p, (ULONG_PTR)(m##_##p), #p)
 #define UNHOOK_IMPORT(m, p) patch_import((ULONG_PTR)(m##_##p), (ULONG_PTR)p, #p)
 
+static HMODULE runtime_module /* = NULL */;  // DllMain
+
 extern
 void (__cdecl *_imp____set_app_type)(int at);
 void  __cdecl MSVCRT___set_app_type (int at)
@@ -397,6 +429,63 @@ void  __cdecl MSVCRT___set_app_type (int at)
 			kqf_log(KQF_LOGL_NOTICE, "runtime: loaded by '%s' in '%s' (game: %i, base: %#08lx)\n", kqf_app.name, kqf_app.path, kqf_app.info.version, kqf_app.inst);
 		}
 		crash_dump_init();
+		if (!init_file_cache(kqf_get_opt(KQF_CFGO_FILE_WATCH))) {
+			kqf_set_opt(KQF_CFGO_FILE_WATCH, KQF_OPT_BOOL_FALSE);
+		}
+		init_volume_cache();
+		if (kqf_get_opt(KQF_CFGO_SAVE_PROFILE)) {
+			if (!init_save_prof()) {
+				kqf_set_opt(KQF_CFGO_SAVE_PROFILE, KQF_OPT_BOOL_FALSE);
+			}
+		}
+		if (kqf_get_opt(KQF_CFGO_SAVE_PREFETCH)) {
+			if (!init_save_prefetch()) {
+				kqf_set_opt(KQF_CFGO_SAVE_PREFETCH, KQF_OPT_BOOL_FALSE);
+			}
+		}
+		if (!kqf_get_opt(KQF_CFGO_CDROM_FAKE)) {
+			init_cdrom_detect();
+		}
+		if (kqf_get_opt(KQF_CFGO_CDROM_OVERLAY)) {
+			if (!kqf_get_opt(KQF_CFGO_CDROM_FAKE) || !init_cdrom_overlay()) {
+				kqf_set_opt(KQF_CFGO_CDROM_OVERLAY, KQF_OPT_BOOL_FALSE);
+			}
+		}
+		if (kqf_get_opt(KQF_CFGO_MEM_TRACE)) {
+			if (!init_mem_trace()) {
+				kqf_set_opt(KQF_CFGO_MEM_TRACE, KQF_OPT_BOOL_FALSE);
+			}
+		}
+		if (!kqf_get_opt(KQF_CFGO_MEM_TRACE) && (runtime_module != NULL)) {
+			// DLL_THREAD_DETACH is only required to reuse the trace buffers
+			DisableThreadLibraryCalls(runtime_module);
+		}
+		if (kqf_get_opt(KQF_CFGO_MEM_SAMPLE)) {
+			if (!init_mem_frag((unsigned int)kqf_get_opt(KQF_CFGO_MEM_SAMPLE))) {
+				kqf_set_opt(KQF_CFGO_MEM_SAMPLE, KQF_OPT_MEM_SAMPLE_NONE);
+			}
+		}
+		if (kqf_get_opt(KQF_CFGO_MEM_LARGE)) {
+			if (!init_mem_large((unsigned int)kqf_get_opt(KQF_CFGO_MEM_LARGE) * 0x10000)) {
+				kqf_set_opt(KQF_CFGO_MEM_LARGE, KQF_OPT_MEM_LARGE_NONE);
+			}
+		}
+		if (kqf_get_opt(KQF_CFGO_MEM_POOL)) {
+			if (!init_mem_pool()) {
+				kqf_set_opt(KQF_CFGO_MEM_POOL, KQF_OPT_BOOL_FALSE);
+			}
+		}
+		if (kqf_get_opt(KQF_CFGO_MEM_PROFILE) || kqf_get_opt(KQF_CFGO_MEM_LEAKS)) {
+			if (!init_mem_prof(kqf_get_opt(KQF_CFGO_MEM_PROFILE) - KQF_OPT_MEM_PROFILE_UNLOAD, kqf_get_opt(KQF_CFGO_MEM_LEAKS))) {
+				kqf_set_opt(KQF_CFGO_MEM_PROFILE, KQF_OPT_MEM_PROFILE_NONE);
+				kqf_set_opt(KQF_CFGO_MEM_LEAKS, KQF_OPT_BOOL_FALSE);
+			}
+		}
+		if (kqf_get_opt(KQF_CFGO_VIDEO_PREWARM)) {
+			if (!init_video_prewarm(kqf_get_opt(KQF_CFGO_VIDEO_PLAYER))) {
+				kqf_set_opt(KQF_CFGO_VIDEO_PREWARM, KQF_OPT_BOOL_FALSE);
+			}
+		}
 		/*HMODULE hMciavi = LoadLibraryA("mciavi32.dll");
 		if (hMciavi) {
 			kqf_log(KQF_LOGL_NOTICE, "Successfully loaded mciavi32.dll\n");
@@ -419,12 +508,17 @@ void  __cdecl MSVCRT___set_app_type (int at)
 					HOOK_IMPORT(USER32, UnhookWindowsHookEx);
 				}
 			}
-			if (tracing || kqf_get_opt(KQF_CFGO_SHIM_UNMAP)) {
-				if (tracing) {
-					HOOK_IMPORT(KERNEL32, MapViewOfFile);
+			if (tracing || kqf_get_opt(KQF_CFGO_SHIM_UNMAP) ||
+			    kqf_get_opt(KQF_CFGO_SAVE_PROFILE) || kqf_get_opt(KQF_CFGO_SAVE_PREFETCH)) {
+				if (kqf_get_opt(KQF_CFGO_SHIM_UNMAP)) {
+					init_view_map();
 				}
+				HOOK_IMPORT(KERNEL32, MapViewOfFile);
 				HOOK_IMPORT(KERNEL32, UnmapViewOfFile);
 			}
+			if (tracing || kqf_get_opt(KQF_CFGO_SAVE_PREFETCH)) {
+				HOOK_IMPORT(KERNEL32, CreateFileMappingA);
+			}
 			if (tracing ||
 			    kqf_get_opt(KQF_CFGO_SHIM_GDFS) ||
 			    kqf_get_opt(KQF_CFGO_CDROM_SIZE) ||
@@ -434,13 +528,15 @@ void  __cdecl MSVCRT___set_app_type (int at)
 			if (tracing || kqf_get_opt(KQF_CFGO_SHIM_GMEM)) {
 				HOOK_IMPORT(KERNEL32, GlobalMemoryStatus);
 			}
-			if (tracing || kqf_get_opt(KQF_CFGO_SHIM_RMDIR)) {
-				if (tracing) {
+			if (tracing || kqf_get_opt(KQF_CFGO_SHIM_RMDIR) || kqf_get_opt(KQF_CFGO_CDROM_OVERLAY)) {
+				if (tracing || kqf_get_opt(KQF_CFGO_CDROM_OVERLAY)) {
 					HOOK_IMPORT(KERNEL32, FindFirstFileA);
 				}
 				HOOK_IMPORT(KERNEL32, FindNextFileA);
 				HOOK_IMPORT(KERNEL32, FindClose);
-				HOOK_IMPORT(KERNEL32, RemoveDirectoryA);
+				if (tracing || kqf_get_opt(KQF_CFGO_SHIM_RMDIR)) {
+					HOOK_IMPORT(KERNEL32, RemoveDirectoryA);
+				}
 			}
 			if (kqf_get_opt(KQF_CFGO_SHIM_FIND)) {
 				if (!init_find_shim()) {
@@ -479,7 +575,7 @@ void  __cdecl MSVCRT___set_app_type (int at)
 			{
 				HOOK_IMPORT(KERNEL32, GetPrivateProfileStringA);
 			}
-			if (tracing || kqf_get_opt(KQF_CFGO_CDROM_FAKE)) {
+			if (tracing || kqf_get_opt(KQF_CFGO_CDROM_FAKE) || kqf_get_opt(KQF_CFGO_MEM_LEAKS)) {
 				{
 					// Limit log level to errors because only KQMOE_VERSION_11FG and
 					// KQMOE_VERSION_13FGIS are importing these three API functions.
@@ -495,6 +591,18 @@ void  __cdecl MSVCRT___set_app_type (int at)
 				HOOK_IMPORT(KERNEL32, GetFileSize);
 				HOOK_IMPORT(KERNEL32, CloseHandle);
 			}
+			if (tracing || kqf_get_opt(KQF_CFGO_CDROM_OVERLAY)) {
+				HOOK_IMPORT(KERNEL32, GetFileAttributesA);
+			}
+			if (kqf_get_opt(KQF_CFGO_SAVE_PROFILE) || kqf_get_opt(KQF_CFGO_SAVE_PREFETCH)) {
+				HOOK_IMPORT(KERNEL32, CreateFileA);
+				HOOK_IMPORT(KERNEL32, CloseHandle);
+			}
+			if (kqf_get_opt(KQF_CFGO_SAVE_PROFILE)) {
+				HOOK_IMPORT(KERNEL32, ReadFile);
+				HOOK_IMPORT(KERNEL32, WriteFile);
+				HOOK_IMPORT(KERNEL32, FlushFileBuffers);
+			}
 			if (tracing) {
 				HOOK_IMPORT(GDI32, CreatePalette);
 				HOOK_IMPORT(GDI32, SelectPalette);
@@ -510,6 +618,8 @@ void  __cdecl MSVCRT___set_app_type (int at)
 			if (kqf_get_opt(KQF_CFGO_TEXT_HEBREW_RTL)) {
 				//init_rtl_text();
 			}
+			// write access to copy-on-write pages changes the protection
+			kqf_mem_refresh();
 		}
 		apply_single_proc();
 		kqf_log(KQF_LOGL_NOTICE, "runtime: init done\n");
@@ -548,9 +658,11 @@ BOOL APIENTRY DllMain(HMODULE Module, DWORD Reason, LPVOID Reserved)
 	UNREFERENCED_PARAMETER(Reserved);
 	switch (Reason) {
 	case DLL_PROCESS_ATTACH:
-		if (Module != NULL) {
-			DisableThreadLibraryCalls(Module);
-		}
+		// the thread notifications are disabled after the options are loaded
+		runtime_module = Module;
+		break;
+	case DLL_THREAD_DETACH:
+		mem_trace_thread_exit();
 		break;
 	case DLL_PROCESS_DETACH:
 		if (runtime_active) {
@@ -565,6 +677,10 @@ BOOL APIENTRY DllMain(HMODULE Module, DWORD Reason, LPVOID Reserved)
 				UNHOOK_IMPORT(GDI32, RealizePalette);
 				UNHOOK_IMPORT(GDI32, SelectPalette);
 				UNHOOK_IMPORT(GDI32, CreatePalette);
+				UNHOOK_IMPORT(KERNEL32, GetFileAttributesA);
+				UNHOOK_IMPORT(KERNEL32, FlushFileBuffers);
+				UNHOOK_IMPORT(KERNEL32, WriteFile);
+				UNHOOK_IMPORT(KERNEL32, ReadFile);
 				UNHOOK_IMPORT(KERNEL32, CloseHandle);
 				UNHOOK_IMPORT(KERNEL32, GetFileSize);
 				UNHOOK_IMPORT(KERNEL32, CreateFileA);
@@ -602,11 +718,26 @@ BOOL APIENTRY DllMain(HMODULE Module, DWORD Reason, LPVOID Reserved)
 				UNHOOK_IMPORT(KERNEL32, GetDiskFreeSpaceA);
 				UNHOOK_IMPORT(KERNEL32, UnmapViewOfFile);
 				UNHOOK_IMPORT(KERNEL32, MapViewOfFile);
+				UNHOOK_IMPORT(KERNEL32, CreateFileMappingA);
+				free_view_map();
 				UNHOOK_IMPORT(USER32, UnhookWindowsHookEx);
 				UNHOOK_IMPORT(USER32, SetWindowsHookExA);
 				UNHOOK_IMPORT(KERNEL32, OutputDebugStringA);
 				//cleanup_rtl_text();
 			}
+			free_video_prewarm();
+			free_video_stat();
+			free_save_prefetch();
+			free_save_prof();
+			free_mem_prof();
+			free_mem_pool();
+			free_mem_large();
+			free_mem_frag();
+			free_mem_trace();
+			free_cd_overlay();
+			free_cdrom_detect();
+			free_volume_cache();
+			free_file_cache();
 			kqf_log(KQF_LOGL_NOTICE, "runtime: unload done\n");
 			kqf_close_log();
 		}
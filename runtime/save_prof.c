@@ -0,0 +1,633 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "save_prof.h"
+
+#include "../common/kqf_log.h"
+#include "../common/kqf_mem.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                          Savegame I/O profiler
+//
+// Loading a savegame opens the file, maps it, and parses the views (that are
+// unmapped by the StreamIO cleanup, including the ignored subchunk unmaps).
+// Saving creates and writes the file. An operation starts with the first
+// CreateFileA of a savegame path (see is_save_path) and ends when all its
+// files are closed and all views mapped during the operation are unmapped
+// (the file handle might be closed before the view is mapped, so a load
+// without views is only ended by the next operation, with the time of its
+// last event).
+// The time spent in the hooked calls is summed up per operation: open, io
+// (ReadFile, WriteFile, and FlushFileBuffers on the savegame handles), map,
+// and unmap; the rest of the wall time ("other") is parsing and serializing
+// in memory (including the page faults of the mapped views). Each
+// operation is logged with the mapped size and the view lifetimes, and the
+// session totals are logged at unload.
+//
+
+enum SAVEPROF_ {
+	SAVEPROF_HANDLES = 8,
+	SAVEPROF_VIEWS   = 32
+};
+
+static struct SAVEPROF_OP {
+	int     active;
+	int     write;
+	LONGLONG start;                  // save_prof_clock
+	LONGLONG last;                   // save_prof_clock (last event)
+	DWORD   files;
+	DWORD   views;
+	DWORD   kib;                     // mapped
+	DWORD   prefetch_kib;            // read ahead (save.prefetch)
+	DWORD   ignored;                 // subchunk unmaps
+	DWORD   open_us;
+	DWORD   io_us;
+	DWORD   io_kib;                  // read and written
+	DWORD   map_us;
+	DWORD   unmap_us;
+	DWORD   life_sum;                // ms
+	DWORD   life_max;                // ms
+	DWORD   lifetimes;
+	int     handles;
+	int     live;
+	HANDLE  handle[SAVEPROF_HANDLES];
+	LPCVOID view[SAVEPROF_VIEWS];
+	LONGLONG view_time[SAVEPROF_VIEWS];  // save_prof_clock
+	CHAR    path[MAX_PATH];
+} s_op /* = {0} */;
+
+static struct SAVEPROF_TOTAL {
+	DWORD count;
+	DWORD sum;                       // ms
+	DWORD max;                       // ms
+} s_total[2] /* = {0} */;            // load, save
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static LONG /*volatile*/ s_busy /* = 0 */;  // s_op.active (checked without s_lock)
+static DWORD s_ignored /* = 0 */;
+static LARGE_INTEGER s_freq;
+static CRITICAL_SECTION s_lock;
+
+
+// case-insensitive prefix match
+static
+int has_prefix(char const *name, char const *prefix)
+{
+	for (; *prefix; ++name, ++prefix) {
+		if ((*name | 0x20) != *prefix) {
+			return (0);
+		}
+	}
+	return (1);
+}
+
+// the savegame folder (save, saves, savegame, savegames) or file (save*, *.sav);
+// only the file name and its folder are checked, so that an installation below
+// e.g. "Saved Games" does not turn every file into a savegame
+static
+int is_save_path(char const *path)
+{
+	static char const *const folders[] = {"save", "saves", "savegame", "savegames"};
+	char const *folder = path;
+	char const *name = path;
+	char const *ext = NULL;
+	char const *pos;
+	int i;
+	for (pos = path; *pos; ++pos) {
+		if (('\\' == *pos) || ('/' == *pos)) {
+			folder = name;
+			name = pos + 1;
+			ext = NULL;
+		} else if ('.' == *pos) {
+			ext = pos;
+		}
+	}
+	if (has_prefix(name, "save") || (ext && (0 == lstrcmpiA(ext, ".sav")))) {
+		return (1);
+	}
+	for (i = 0; (folder < name) && (i < ARRAYSIZE(folders)); ++i) {
+		// without the separator
+		if ((lstrlenA(folders[i]) == name - folder - 1) && has_prefix(folder, folders[i])) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+// microseconds between two save_prof_clock values (the difference is converted,
+// no 64-bit division in the runtime)
+static
+DWORD elapsed_us(LONGLONG from, LONGLONG to)
+{
+	return ((to > from) ? (DWORD)((double)(to - from) * 1000000.0 / (double)s_freq.QuadPart) : 0);
+}
+
+// logs and resets the operation if it is complete (s_lock has to be held)
+static
+void end_operation(int force)
+{
+	struct SAVEPROF_TOTAL *total = &s_total[s_op.write ? 1 : 0];
+	DWORD wall;
+	DWORD other;
+	DWORD ms;
+	if (!s_op.active || (!force && (s_op.handles || s_op.live))) {
+		return;
+	}
+	wall = elapsed_us(s_op.start, s_op.last);
+	other = wall - s_op.open_us - s_op.io_us - s_op.map_us - s_op.unmap_us;
+	if (other > wall) {
+		other = 0;
+	}
+	ms = wall / 1000;
+	kqf_log(KQF_LOGL_INFO, "SaveProf: %s '%s'%s %lu.%lu ms: open %lu.%lu, io %lu.%lu, map %lu.%lu, unmap %lu.%lu, other %lu.%lu ms; %lu files, io %lu KiB, %lu views %lu KiB (%lu KiB read ahead), lifetime avg %lu max %lu ms, %lu subchunks ignored\n",
+		s_op.write ? "save" : "load", s_op.path, (s_op.handles || s_op.live) ? " (incomplete)" : "",
+		ms, (wall / 100) % 10,
+		s_op.open_us / 1000, (s_op.open_us / 100) % 10,
+		s_op.io_us / 1000, (s_op.io_us / 100) % 10,
+		s_op.map_us / 1000, (s_op.map_us / 100) % 10,
+		s_op.unmap_us / 1000, (s_op.unmap_us / 100) % 10,
+		other / 1000, (other / 100) % 10,
+		s_op.files, s_op.io_kib, s_op.views, s_op.kib, s_op.prefetch_kib,
+		s_op.lifetimes ? s_op.life_sum / s_op.lifetimes : 0UL, s_op.life_max, s_op.ignored);
+	++total->count;
+	total->sum += ms;
+	if (ms > total->max) {
+		total->max = ms;
+	}
+	s_ignored += s_op.ignored;
+	ZeroMemory(&s_op, sizeof(s_op));
+	InterlockedExchange(&s_busy, 0);
+}
+
+// the operation might be active (the caller has to check s_op under s_lock)
+static
+int is_busy(void)
+{
+	return (s_active && InterlockedCompareExchange(&s_busy, 0, 0));
+}
+
+
+int init_save_prof(void)
+{
+	if (!s_active) {
+		if (!QueryPerformanceFrequency(&s_freq) || (s_freq.QuadPart <= 0)) {
+			kqf_log(KQF_LOGL_ERROR, "SaveProf: no performance counter\n");
+			return (0);
+		}
+		InitializeCriticalSection(&s_lock);
+		InterlockedExchange(&s_active, 1);
+	}
+	return (1);
+}
+
+void free_save_prof(void)
+{
+	if (s_active) {
+		EnterCriticalSection(&s_lock);
+		end_operation(1);
+		LeaveCriticalSection(&s_lock);
+		if (s_total[0].count || s_total[1].count) {
+			kqf_log(KQF_LOGL_FORCE, "SaveProf: %lu loads (avg %lu ms, max %lu ms), %lu saves (avg %lu ms, max %lu ms), %lu subchunk unmaps ignored\n",
+				s_total[0].count, s_total[0].count ? s_total[0].sum / s_total[0].count : 0UL, s_total[0].max,
+				s_total[1].count, s_total[1].count ? s_total[1].sum / s_total[1].count : 0UL, s_total[1].max,
+				s_ignored);
+		}
+	}
+}
+
+LONGLONG save_prof_clock(void)
+{
+	LARGE_INTEGER now;
+	if (!s_active) {
+		return (0);
+	}
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart);
+}
+
+void save_prof_open(char const *path, HANDLE file, DWORD access, LONGLONG start)
+{
+	LONGLONG now;
+	if (!s_active || !is_save_path(path)) {
+		return;
+	}
+	now = save_prof_clock();
+	EnterCriticalSection(&s_lock);
+	if (!s_op.handles && !s_op.live) {
+		// previous load without views
+		end_operation(1);
+	}
+	if (!s_op.active) {
+		s_op.active = 1;
+		s_op.start = start;
+		lstrcpynA(s_op.path, path, ARRAYSIZE(s_op.path));
+		InterlockedExchange(&s_busy, 1);
+	}
+	if (GENERIC_WRITE & access) {
+		s_op.write = 1;
+	}
+	++s_op.files;
+	s_op.open_us += elapsed_us(start, now);
+	s_op.last = now;
+	if (s_op.handles < SAVEPROF_HANDLES) {
+		s_op.handle[s_op.handles++] = file;
+	}
+	LeaveCriticalSection(&s_lock);
+}
+
+void save_prof_close(HANDLE file)
+{
+	int i;
+	if (!is_busy()) {
+		return;
+	}
+	EnterCriticalSection(&s_lock);
+	for (i = 0; i < s_op.handles; ++i) {
+		if (s_op.handle[i] == file) {
+			s_op.handle[i] = s_op.handle[--s_op.handles];
+			s_op.last = save_prof_clock();
+			if (s_op.write || s_op.views) {
+				end_operation(0);
+			}
+			break;
+		}
+	}
+	LeaveCriticalSection(&s_lock);
+}
+
+void save_prof_io(HANDLE file, DWORD bytes, LONGLONG start)
+{
+	LONGLONG now;
+	int i;
+	if (!is_busy()) {
+		return;
+	}
+	now = save_prof_clock();
+	EnterCriticalSection(&s_lock);
+	for (i = 0; i < s_op.handles; ++i) {
+		if (s_op.handle[i] == file) {
+			s_op.io_us += elapsed_us(start, now);
+			s_op.io_kib += (bytes + 1023) / 1024;
+			s_op.last = now;
+			break;
+		}
+	}
+	LeaveCriticalSection(&s_lock);
+}
+
+void save_prof_map(LPCVOID view, SIZE_T size, LONGLONG start)
+{
+	LONGLONG now;
+	if (!is_busy()) {
+		return;
+	}
+	now = save_prof_clock();
+	if (0 == size) {
+		KQF_MEM_REGION mem;
+		if (kqf_mem_query(view, &mem)) {
+			size = (SIZE_T)(mem.end - (unsigned char const *)view);
+		}
+	}
+	EnterCriticalSection(&s_lock);
+	if (s_op.active) {
+		++s_op.views;
+		s_op.last = now;
+		s_op.kib += (DWORD)((size + 1023) / 1024);
+		s_op.map_us += elapsed_us(start, now);
+		if (s_op.live < SAVEPROF_VIEWS) {
+			s_op.view[s_op.live] = view;
+			s_op.view_time[s_op.live] = now;
+			++s_op.live;
+		}
+	}
+	LeaveCriticalSection(&s_lock);
+}
+
+void save_prof_unmap(LPCVOID view, int ignored, LONGLONG start)
+{
+	LONGLONG now;
+	int i;
+	if (!is_busy()) {
+		return;
+	}
+	now = save_prof_clock();
+	EnterCriticalSection(&s_lock);
+	if (!s_op.active) {
+		// ended in the meantime
+	} else if (ignored) {
+		++s_op.ignored;
+	} else {
+		for (i = 0; i < s_op.live; ++i) {
+			if (s_op.view[i] == view) {
+				DWORD const life = elapsed_us(s_op.view_time[i], now) / 1000;
+				s_op.life_sum += life;
+				if (life > s_op.life_max) {
+					s_op.life_max = life;
+				}
+				++s_op.lifetimes;
+				s_op.unmap_us += elapsed_us(start, now);
+				s_op.last = now;
+				--s_op.live;
+				s_op.view[i] = s_op.view[s_op.live];
+				s_op.view_time[i] = s_op.view_time[s_op.live];
+				end_operation(0);
+				break;
+			}
+		}
+	}
+	LeaveCriticalSection(&s_lock);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                           Savegame read-ahead
+//
+// A savegame is mapped and then parsed front to back, which causes one page
+// fault (and one small read) per page on cold storage. With save.prefetch the
+// views of savegame files are read ahead. The handles of savegame files are
+// remembered when they are opened (is_save_path in the CreateFileA hook), and
+// so are the file mappings created from them (CreateFileMappingA hook), so a
+// view is only looked up in two small tables without a system call. Handles
+// are forgotten in the CloseHandle hook. The views of known mappings are read
+// ahead: PrefetchVirtualMemory (Windows 8 and newer) queues large reads for
+// the whole view, otherwise the view is queued for a single background thread
+// that reads it with ReadProcessMemory (that fails instead of raising an access
+// violation if the game unmaps the view in the meantime). Views are dropped if
+// the queue is full, so there is never more than one reader and the game is
+// not slowed down by many parallel reads. The read-ahead size is reported in
+// the savegame profile (save.profile), so the load times can be compared.
+//
+
+#define SAVE_PREFETCH_CHUNK 0x10000
+#define SAVE_PREFETCH_QUEUE 8
+#define SAVE_PREFETCH_HANDLES 8
+
+typedef struct SAVE_PREFETCH_RANGE {
+	PVOID  VirtualAddress;
+	SIZE_T NumberOfBytes;
+} SAVE_PREFETCH_RANGE;
+
+typedef BOOL (WINAPI *PFNPREFETCHVIRTUALMEMORY)(HANDLE hProcess, ULONG_PTR NumberOfEntries, SAVE_PREFETCH_RANGE *VirtualAddresses, ULONG Flags);
+
+static PFNPREFETCHVIRTUALMEMORY prefetch_virtual_memory /* = NULL */;
+static LONG /*volatile*/ s_prefetch_active /* = 0 */;
+static LONG /*volatile*/ s_prefetch_stop /* = 0 */;
+static LONG /*volatile*/ s_prefetch_views /* = 0 */;
+static LONG /*volatile*/ s_prefetch_dropped /* = 0 */;
+static HANDLE s_prefetch_wake /* = NULL */;
+static CRITICAL_SECTION s_prefetch_lock;
+static SAVE_PREFETCH_RANGE s_prefetch_queue[SAVE_PREFETCH_QUEUE] /* = {0} */;
+static int s_prefetch_head /* = 0 */;
+static int s_prefetch_count /* = 0 */;
+static HANDLE s_prefetch_files[SAVE_PREFETCH_HANDLES] /* = {NULL} */;
+static HANDLE s_prefetch_mappings[SAVE_PREFETCH_HANDLES] /* = {NULL} */;
+static LONG /*volatile*/ s_prefetch_handles /* = 0 */;
+
+
+// index of the handle in the table (-1 if not found), caller holds the lock
+static
+int prefetch_find(HANDLE const *table, HANDLE handle)
+{
+	int index;
+	for (index = 0; index < SAVE_PREFETCH_HANDLES; ++index) {
+		if (table[index] == handle) {
+			return (index);
+		}
+	}
+	return (-1);
+}
+
+// adds the handle to the table (ignored if the table is full)
+static
+void prefetch_remember(HANDLE *table, HANDLE handle)
+{
+	int index;
+	EnterCriticalSection(&s_prefetch_lock);
+	if ((prefetch_find(table, handle) < 0) && ((index = prefetch_find(table, NULL)) >= 0)) {
+		table[index] = handle;
+		InterlockedIncrement(&s_prefetch_handles);
+	}
+	LeaveCriticalSection(&s_prefetch_lock);
+}
+
+
+static
+int prefetch_next(SAVE_PREFETCH_RANGE *range)
+{
+	int result = 0;
+	EnterCriticalSection(&s_prefetch_lock);
+	if (s_prefetch_count > 0) {
+		*range = s_prefetch_queue[s_prefetch_head];
+		s_prefetch_head = (s_prefetch_head + 1) % SAVE_PREFETCH_QUEUE;
+		--s_prefetch_count;
+		result = 1;
+	}
+	LeaveCriticalSection(&s_prefetch_lock);
+	return (result);
+}
+
+static
+DWORD WINAPI prefetch_proc(LPVOID param)
+{
+	LPVOID const buffer = param;
+	while (!s_prefetch_stop && (WAIT_OBJECT_0 == WaitForSingleObject(s_prefetch_wake, INFINITE))) {
+		SAVE_PREFETCH_RANGE range;
+		while (!s_prefetch_stop && prefetch_next(&range)) {
+			SIZE_T offset;
+			for (offset = 0; (offset < range.NumberOfBytes) && !s_prefetch_stop; offset += SAVE_PREFETCH_CHUNK) {
+				SIZE_T bytes = range.NumberOfBytes - offset;
+				if (bytes > SAVE_PREFETCH_CHUNK) {
+					bytes = SAVE_PREFETCH_CHUNK;
+				}
+				if (!ReadProcessMemory(GetCurrentProcess(), (unsigned char *)range.VirtualAddress + offset, buffer, bytes, &bytes)) {
+					break;
+				}
+			}
+		}
+	}
+	return (0);
+}
+
+// queues the view for the reader thread (0 if the queue is full)
+static
+int prefetch_queue(SAVE_PREFETCH_RANGE const *range)
+{
+	int result = 0;
+	if (NULL == s_prefetch_wake) {
+		return (0);
+	}
+	EnterCriticalSection(&s_prefetch_lock);
+	if (s_prefetch_count < SAVE_PREFETCH_QUEUE) {
+		s_prefetch_queue[(s_prefetch_head + s_prefetch_count) % SAVE_PREFETCH_QUEUE] = *range;
+		++s_prefetch_count;
+		result = 1;
+	}
+	LeaveCriticalSection(&s_prefetch_lock);
+	if (result) {
+		SetEvent(s_prefetch_wake);
+	} else {
+		InterlockedIncrement(&s_prefetch_dropped);
+	}
+	return (result);
+}
+
+static
+int init_prefetch_thread(void)
+{
+	DWORD id;
+	HANDLE thread = NULL;
+	LPVOID const buffer = VirtualAlloc(NULL, SAVE_PREFETCH_CHUNK, MEM_COMMIT, PAGE_READWRITE);
+	if (buffer != NULL) {
+		s_prefetch_wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+		if (s_prefetch_wake != NULL) {
+			thread = CreateThread(NULL, 0, prefetch_proc, buffer, 0, &id);
+			if (NULL == thread) {
+				CloseHandle(s_prefetch_wake);
+				s_prefetch_wake = NULL;
+			}
+		}
+		if (NULL == thread) {
+			VirtualFree(buffer, 0, MEM_RELEASE);
+		}
+	}
+	if (NULL == thread) {
+		kqf_log(KQF_LOGL_ERROR, "SaveProf: failed to create read-ahead thread (%#lx)\n", GetLastError());
+		return (0);
+	}
+	CloseHandle(thread);
+	return (1);
+}
+
+
+int init_save_prefetch(void)
+{
+	HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+	if (kernel32 != NULL) {
+		prefetch_virtual_memory = (PFNPREFETCHVIRTUALMEMORY)GetProcAddress(kernel32, "PrefetchVirtualMemory");
+	}
+	InitializeCriticalSection(&s_prefetch_lock);
+	// also the fallback if PrefetchVirtualMemory fails
+	if (!init_prefetch_thread() && (NULL == prefetch_virtual_memory)) {
+		DeleteCriticalSection(&s_prefetch_lock);
+		return (0);
+	}
+	InterlockedExchange(&s_prefetch_active, 1);
+	kqf_log(KQF_LOGL_INFO, "SaveProf: read-ahead with %s\n", prefetch_virtual_memory ? "PrefetchVirtualMemory" : "background thread");
+	return (1);
+}
+
+void free_save_prefetch(void)
+{
+	// the thread is not joined (loader lock)
+	InterlockedExchange(&s_prefetch_active, 0);
+	InterlockedExchange(&s_prefetch_stop, 1);
+	if (s_prefetch_wake != NULL) {
+		SetEvent(s_prefetch_wake);
+	}
+	if (s_prefetch_views || s_prefetch_dropped) {
+		kqf_log(KQF_LOGL_INFO, "SaveProf: %li savegame views read ahead, %li dropped (queue full)\n", s_prefetch_views, s_prefetch_dropped);
+	}
+}
+
+void save_prefetch_open(char const *path, HANDLE file)
+{
+	if (s_prefetch_active && (file != INVALID_HANDLE_VALUE) && path && is_save_path(path)) {
+		prefetch_remember(s_prefetch_files, file);
+	}
+}
+
+void save_prefetch_mapping(HANDLE file, HANDLE mapping)
+{
+	int known;
+	if (!s_prefetch_active || !s_prefetch_handles || (NULL == mapping)) {
+		return;
+	}
+	EnterCriticalSection(&s_prefetch_lock);
+	known = (prefetch_find(s_prefetch_files, file) >= 0);
+	LeaveCriticalSection(&s_prefetch_lock);
+	if (known) {
+		prefetch_remember(s_prefetch_mappings, mapping);
+	}
+}
+
+void save_prefetch_close(HANDLE handle)
+{
+	int index;
+	if (!s_prefetch_active || !s_prefetch_handles || (NULL == handle)) {
+		return;
+	}
+	EnterCriticalSection(&s_prefetch_lock);
+	if ((index = prefetch_find(s_prefetch_files, handle)) >= 0) {
+		s_prefetch_files[index] = NULL;
+		InterlockedDecrement(&s_prefetch_handles);
+	} else if ((index = prefetch_find(s_prefetch_mappings, handle)) >= 0) {
+		s_prefetch_mappings[index] = NULL;
+		InterlockedDecrement(&s_prefetch_handles);
+	}
+	LeaveCriticalSection(&s_prefetch_lock);
+}
+
+void save_prefetch(HANDLE mapping, LPCVOID view, SIZE_T size)
+{
+	SAVE_PREFETCH_RANGE range;
+	BOOL queued = FALSE;
+	int known;
+	DWORD error;
+	if (!s_prefetch_active || !s_prefetch_handles) {
+		return;
+	}
+	EnterCriticalSection(&s_prefetch_lock);
+	known = (prefetch_find(s_prefetch_mappings, mapping) >= 0);
+	LeaveCriticalSection(&s_prefetch_lock);
+	if (!known) {
+		return;
+	}
+	error = GetLastError();
+	if (0 == size) {
+		KQF_MEM_REGION mem;
+		if (kqf_mem_query(view, &mem)) {
+			size = (SIZE_T)(mem.end - (unsigned char const *)view);
+		}
+	}
+	range.VirtualAddress = (PVOID)view;
+	range.NumberOfBytes = size;
+	if (size && prefetch_virtual_memory) {
+		queued = prefetch_virtual_memory(GetCurrentProcess(), 1, &range, 0);
+	}
+	if (size && !queued) {
+		queued = prefetch_queue(&range);
+	}
+	if (queued) {
+		InterlockedIncrement(&s_prefetch_views);
+		kqf_log(KQF_LOGL_DEBUG, "SaveProf: read-ahead %lu KiB of view %#08lx (mapping %#08lx)\n", (DWORD)(size / 1024), view, mapping);
+		if (s_active) {
+			EnterCriticalSection(&s_lock);
+			if (s_op.active) {
+				s_op.prefetch_kib += (DWORD)((size + 1023) / 1024);
+			}
+			LeaveCriticalSection(&s_lock);
+		}
+	}
+	SetLastError(error);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SAVE_PROF_H_
+#define SAVE_PROF_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_SAVE_PROFILE
+
+int init_save_prof(void);
+void free_save_prof(void);  // logs the session totals
+
+// performance counter (0 if not active), the differences are converted to us
+LONGLONG save_prof_clock(void);
+
+// CreateFileA/CloseHandle of a savegame file (start = save_prof_clock() before the call)
+void save_prof_open(char const *path, HANDLE file, DWORD access, LONGLONG start);
+void save_prof_close(HANDLE file);
+
+// ReadFile/WriteFile/FlushFileBuffers (only the savegame handles are counted)
+void save_prof_io(HANDLE file, DWORD bytes, LONGLONG start);
+
+// views mapped during a savegame operation (size 0 = whole file)
+void save_prof_map(LPCVOID view, SIZE_T size, LONGLONG start);
+void save_prof_unmap(LPCVOID view, int ignored, LONGLONG start);
+
+
+// KQF_CFGO_SAVE_PREFETCH
+
+int init_save_prefetch(void);
+void free_save_prefetch(void);
+
+// remembers savegame file handles (CreateFileA) and their mappings
+void save_prefetch_open(char const *path, HANDLE file);
+void save_prefetch_mapping(HANDLE file, HANDLE mapping);
+// forgets a file or mapping handle (CloseHandle)
+void save_prefetch_close(HANDLE handle);
+// reads the view ahead if it is a savegame mapping (size 0 = whole file)
+void save_prefetch(HANDLE mapping, LPCVOID view, SIZE_T size);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
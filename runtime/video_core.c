@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "video_core.h"
+
+#include <string.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                       In-process video frame queue
+//
+// The decoder thread (video_dec.c) fills the frames ahead of time, the game
+// thread (video_out.c) picks the frame that is due at its clock and presents
+// it. If the presenter falls behind, due frames are skipped (counted as
+// dropped) instead of slowing down the video; if the decoder falls behind,
+// the last frame stays on the screen. The times are milliseconds of the video
+// (no 64-bit arithmetic). This part has no Windows dependencies and is checked
+// on the host with "make -C tools check".
+//
+
+void video_queue_init(VIDEO_QUEUE *queue, void *pixels, unsigned long frame_bytes)
+{
+	unsigned int i;
+	memset(queue, 0, sizeof(*queue));
+	queue->current = -1;
+	for (i = 0; i < VIDEO_QUEUE_FRAMES; ++i) {
+		queue->frame[i].pixels = (unsigned char *)pixels + (unsigned long)i * frame_bytes;
+	}
+}
+
+VIDEO_FRAME *video_queue_back(VIDEO_QUEUE *queue)
+{
+	// the slot before head is the presented frame
+	if (queue->count + (queue->current >= 0) >= VIDEO_QUEUE_FRAMES) {
+		return (NULL);
+	}
+	return (&queue->frame[(queue->head + queue->count) % VIDEO_QUEUE_FRAMES]);
+}
+
+void video_queue_push(VIDEO_QUEUE *queue, long time)
+{
+	queue->frame[(queue->head + queue->count) % VIDEO_QUEUE_FRAMES].time = time;
+	++queue->count;
+}
+
+VIDEO_FRAME const *video_queue_pick(VIDEO_QUEUE *queue, long clock)
+{
+	int picked = 0;
+	while ((queue->count > 0) && (queue->frame[queue->head].time <= clock)) {
+		if (picked) {
+			++queue->dropped;
+		}
+		queue->current = (int)queue->head;
+		queue->head = (queue->head + 1) % VIDEO_QUEUE_FRAMES;
+		--queue->count;
+		picked = 1;
+	}
+	if (!picked) {
+		return (NULL);
+	}
+	++queue->presented;
+	return (&queue->frame[queue->current]);
+}
+
+long video_queue_next(VIDEO_QUEUE const *queue)
+{
+	return ((queue->count > 0) ? queue->frame[queue->head].time : -1);
+}
+
+VIDEO_FRAME const *video_queue_current(VIDEO_QUEUE const *queue)
+{
+	return ((queue->current >= 0) ? &queue->frame[queue->current] : NULL);
+}
+
+
+void video_fit(int src_width, int src_height, int dst_width, int dst_height, VIDEO_RECT *dst)
+{
+	dst->left = 0;
+	dst->top = 0;
+	dst->right = dst_width;
+	dst->bottom = dst_height;
+	if ((src_width > 0) && (src_height > 0)) {
+		// no 64-bit integer helpers in the runtime (msvcrt42)
+		if ((double)dst_width * src_height > (double)dst_height * src_width) {
+			int const width = (int)((double)dst_height * src_width / src_height);
+			dst->left = (dst_width - width) / 2;
+			dst->right = dst->left + width;
+		} else {
+			int const height = (int)((double)dst_width * src_height / src_width);
+			dst->top = (dst_height - height) / 2;
+			dst->bottom = dst->top + height;
+		}
+	}
+}
+
+void video_copy_rows(void *dst, void const *src, long stride, unsigned long row_bytes, unsigned long rows)
+{
+	unsigned char *to = (unsigned char *)dst;
+	unsigned char const *from = (unsigned char const *)src;
+	unsigned long row;
+	if (stride < 0) {
+		// the first row in memory is the bottom row
+		from += (rows - 1) * (unsigned long)-stride;
+	}
+	for (row = 0; row < rows; ++row) {
+		memcpy(to, from, row_bytes);
+		to += row_bytes;
+		from += stride;
+	}
+}
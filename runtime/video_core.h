@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VIDEO_CORE_H_
+#define VIDEO_CORE_H_
+
+// no Windows headers (the frame queue is also tested on the host by tools/vfq_check)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_VIDEO_PLAYER (KQF_OPT_VIDEO_PLAYER_INTERNAL)
+
+#define VIDEO_QUEUE_FRAMES 8  // decoded frames (including the presented one)
+
+typedef struct VIDEO_FRAME {
+	void     *pixels;  // top-down 32-bit rows
+	long      time;    // presentation time (ms)
+} VIDEO_FRAME;
+
+// Ring of decoded frames between one decoder and one presenter (not locked,
+// the caller serializes the calls). The presented frame stays valid until a
+// later frame is picked, it is never handed out to the decoder.
+typedef struct VIDEO_QUEUE {
+	VIDEO_FRAME   frame[VIDEO_QUEUE_FRAMES];
+	unsigned int  head;       // oldest waiting frame
+	unsigned int  count;      // waiting frames
+	int           current;    // presented frame (-1: none)
+	unsigned long presented;
+	unsigned long dropped;    // late frames that were never presented
+} VIDEO_QUEUE;
+
+// splits the buffer (VIDEO_QUEUE_FRAMES * frame_bytes) into the frames
+void video_queue_init(VIDEO_QUEUE *queue, void *pixels, unsigned long frame_bytes);
+
+// frame for the decoder to fill (NULL if the queue is full)
+VIDEO_FRAME *video_queue_back(VIDEO_QUEUE *queue);
+// appends the filled frame (time: presentation time)
+void video_queue_push(VIDEO_QUEUE *queue, long time);
+
+// the latest waiting frame that is due at the clock (earlier due frames are
+// dropped), NULL if no new frame is due yet
+VIDEO_FRAME const *video_queue_pick(VIDEO_QUEUE *queue, long clock);
+// presentation time of the next waiting frame (-1 if none)
+long video_queue_next(VIDEO_QUEUE const *queue);
+// the presented frame (NULL if none)
+VIDEO_FRAME const *video_queue_current(VIDEO_QUEUE const *queue);
+
+
+typedef struct VIDEO_RECT {
+	int left;
+	int top;
+	int right;
+	int bottom;
+} VIDEO_RECT;
+
+// centered destination of the source size in the target (aspect ratio kept)
+void video_fit(int src_width, int src_height, int dst_width, int dst_height, VIDEO_RECT *dst);
+
+// copies rows into a top-down frame (negative stride: bottom-up source)
+void video_copy_rows(void *dst, void const *src, long stride, unsigned long row_bytes, unsigned long rows);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// The Media Foundation declarations require Windows 7 as target version, so
+// this file does not use kqf_win.h (and has no logging). Everything is loaded
+// at run time, the runtime still loads on systems without Media Foundation.
+#define WINVER       0x0601
+#define _WIN32_WINNT 0x0601
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define COBJMACROS
+
+#pragma warning(push, 1)
+# include <windows.h>
+# include <objbase.h>
+// defines the (selectany) GUIDs of the following headers (no mfuuid.lib)
+# include <initguid.h>
+# include <mfapi.h>
+# include <mfidl.h>
+# include <mfreadwrite.h>
+# include <mferror.h>
+#pragma warning(pop)
+
+#include "video_dec.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                     Media Foundation video decoder
+//
+// The source reader demultiplexes the file and decodes the streams with the
+// system decoders (H.264 and AAC on a stock Windows 7 and later). Its video
+// processing converts the frames to 32-bit RGB and the audio is converted to
+// 16-bit PCM, so the presenter (video_out.c) needs no format handling. The
+// reader is used synchronously on the decoder thread of the presenter, the
+// samples are read in file order from all selected streams.
+//
+
+#define NO_STREAM ((DWORD)-1)
+
+typedef HRESULT (WINAPI *PFNCOINITIALIZEEX)(LPVOID pvReserved, DWORD dwCoInit);
+typedef void (WINAPI *PFNCOUNINITIALIZE)(void);
+typedef HRESULT (WINAPI *PFNMFSTARTUP)(ULONG Version, DWORD dwFlags);
+typedef HRESULT (WINAPI *PFNMFSHUTDOWN)(void);
+typedef HRESULT (WINAPI *PFNMFCREATEATTRIBUTES)(IMFAttributes **ppMFAttributes, UINT32 cInitialSize);
+typedef HRESULT (WINAPI *PFNMFCREATEMEDIATYPE)(IMFMediaType **ppMFType);
+typedef HRESULT (WINAPI *PFNMFCREATESOURCEREADERFROMURL)(LPCWSTR pwszURL, IMFAttributes *pAttributes, IMFSourceReader **ppSourceReader);
+
+static struct VIDEO_DEC_API {
+	LONG /*volatile*/              loaded;  // 1 = available, -1 = not available
+	PFNCOINITIALIZEEX              co_initialize_ex;
+	PFNCOUNINITIALIZE              co_uninitialize;
+	PFNMFSTARTUP                   startup;
+	PFNMFSHUTDOWN                  shutdown;
+	PFNMFCREATEATTRIBUTES          create_attributes;
+	PFNMFCREATEMEDIATYPE           create_media_type;
+	PFNMFCREATESOURCEREADERFROMURL create_source_reader;
+	int                            libraries;
+} s_mf /* = {0} */;
+
+struct VIDEO_DEC {
+	IMFSourceReader *reader;
+	DWORD            video;  // stream index
+	DWORD            audio;  // stream index (NO_STREAM: none)
+	int              video_end;
+	int              audio_end;
+	int              ended;
+	int              com;    // CoInitializeEx succeeded
+	int              mf;     // MFStartup succeeded
+	VIDEO_DEC_INFO   info;
+};
+
+
+int video_dec_load(void)
+{
+	if (0 == s_mf.loaded) {
+		HMODULE const ole32 = LoadLibraryA("ole32.dll");
+		HMODULE const mfplat = LoadLibraryA("mfplat.dll");
+		HMODULE const mfreadwrite = LoadLibraryA("mfreadwrite.dll");
+		int libraries = 0;
+		if (ole32 != NULL) {
+			s_mf.co_initialize_ex = (PFNCOINITIALIZEEX)GetProcAddress(ole32, "CoInitializeEx");
+			s_mf.co_uninitialize = (PFNCOUNINITIALIZE)GetProcAddress(ole32, "CoUninitialize");
+			++libraries;
+		}
+		if (mfplat != NULL) {
+			s_mf.startup = (PFNMFSTARTUP)GetProcAddress(mfplat, "MFStartup");
+			s_mf.shutdown = (PFNMFSHUTDOWN)GetProcAddress(mfplat, "MFShutdown");
+			s_mf.create_attributes = (PFNMFCREATEATTRIBUTES)GetProcAddress(mfplat, "MFCreateAttributes");
+			s_mf.create_media_type = (PFNMFCREATEMEDIATYPE)GetProcAddress(mfplat, "MFCreateMediaType");
+			++libraries;
+		}
+		if (mfreadwrite != NULL) {
+			s_mf.create_source_reader = (PFNMFCREATESOURCEREADERFROMURL)GetProcAddress(mfreadwrite, "MFCreateSourceReaderFromURL");
+			++libraries;
+		}
+		// the H.264 decoder is loaded on demand by the reader (kept for the start latency)
+		if (LoadLibraryA("msmpeg2vdec.dll") != NULL) {
+			++libraries;
+		}
+		s_mf.libraries = libraries;
+		InterlockedExchange(&s_mf.loaded, (s_mf.co_initialize_ex && s_mf.co_uninitialize && s_mf.startup &&
+			s_mf.shutdown && s_mf.create_attributes && s_mf.create_media_type && s_mf.create_source_reader) ? 1 : -1);
+	}
+	return ((s_mf.loaded > 0) ? s_mf.libraries : 0);
+}
+
+
+// selects the first video and the first audio stream
+static
+HRESULT select_streams(VIDEO_DEC *dec)
+{
+	DWORD i;
+	HRESULT hr = IMFSourceReader_SetStreamSelection(dec->reader, (DWORD)MF_SOURCE_READER_ALL_STREAMS, FALSE);
+	if (FAILED(hr)) {
+		return (hr);
+	}
+	for (i = 0; ; ++i) {
+		IMFMediaType *type;
+		GUID major;
+		// MF_E_INVALIDSTREAMNUMBER after the last stream
+		if (FAILED(IMFSourceReader_GetNativeMediaType(dec->reader, i, 0, &type))) {
+			break;
+		}
+		if (SUCCEEDED(IMFMediaType_GetMajorType(type, &major))) {
+			if ((NO_STREAM == dec->video) && IsEqualGUID(&major, &MFMediaType_Video)) {
+				dec->video = i;
+			} else if ((NO_STREAM == dec->audio) && IsEqualGUID(&major, &MFMediaType_Audio)) {
+				dec->audio = i;
+			}
+		}
+		IMFMediaType_Release(type);
+	}
+	if (NO_STREAM == dec->video) {
+		return (MF_E_INVALIDSTREAMNUMBER);
+	}
+	hr = IMFSourceReader_SetStreamSelection(dec->reader, dec->video, TRUE);
+	if (SUCCEEDED(hr) && (dec->audio != NO_STREAM) &&
+		FAILED(IMFSourceReader_SetStreamSelection(dec->reader, dec->audio, TRUE))) {
+		dec->audio = NO_STREAM;
+	}
+	return (hr);
+}
+
+// sets the output format of the stream and returns the resulting media type
+static
+HRESULT set_output(VIDEO_DEC *dec, DWORD stream, GUID const *major, GUID const *subtype, UINT32 bits, IMFMediaType **current)
+{
+	IMFMediaType *type = NULL;
+	HRESULT hr = s_mf.create_media_type(&type);
+	if (SUCCEEDED(hr)) {
+		hr = IMFMediaType_SetGUID(type, &MF_MT_MAJOR_TYPE, major);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = IMFMediaType_SetGUID(type, &MF_MT_SUBTYPE, subtype);
+	}
+	if (SUCCEEDED(hr) && bits) {
+		hr = IMFMediaType_SetUINT32(type, &MF_MT_AUDIO_BITS_PER_SAMPLE, bits);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = IMFSourceReader_SetCurrentMediaType(dec->reader, stream, NULL, type);
+	}
+	if (type != NULL) {
+		IMFMediaType_Release(type);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = IMFSourceReader_GetCurrentMediaType(dec->reader, stream, current);
+	}
+	return (hr);
+}
+
+// frame size and stride of the current video output
+static
+HRESULT get_video_format(VIDEO_DEC *dec, unsigned int *width, unsigned int *height, long *stride)
+{
+	IMFMediaType *type;
+	UINT64 size;
+	UINT32 pitch;
+	HRESULT hr = IMFSourceReader_GetCurrentMediaType(dec->reader, dec->video, &type);
+	if (FAILED(hr)) {
+		return (hr);
+	}
+	hr = IMFMediaType_GetUINT64(type, &MF_MT_FRAME_SIZE, &size);
+	if (SUCCEEDED(hr)) {
+		*width = (unsigned int)(size >> 32);
+		*height = (unsigned int)(size & 0xFFFFFFFFU);
+		// RGB without default stride is top-down (MFGetStrideForBitmapInfoHeader)
+		if (FAILED(IMFMediaType_GetUINT32(type, &MF_MT_DEFAULT_STRIDE, &pitch))) {
+			pitch = *width * 4;
+		}
+		*stride = (long)(INT32)pitch;
+		if ((0 == *width) || (0 == *height) || (*width > 4096) || (*height > 4096)) {
+			hr = MF_E_INVALIDMEDIATYPE;
+		}
+	}
+	IMFMediaType_Release(type);
+	return (hr);
+}
+
+static
+HRESULT set_formats(VIDEO_DEC *dec)
+{
+	IMFMediaType *type;
+	PROPVARIANT var;
+	HRESULT hr = set_output(dec, dec->video, &MFMediaType_Video, &MFVideoFormat_RGB32, 0, &type);
+	if (FAILED(hr)) {
+		return (hr);
+	}
+	IMFMediaType_Release(type);
+	hr = get_video_format(dec, &dec->info.width, &dec->info.height, &dec->info.stride);
+	if (FAILED(hr)) {
+		return (hr);
+	}
+	if ((dec->audio != NO_STREAM) &&
+		SUCCEEDED(set_output(dec, dec->audio, &MFMediaType_Audio, &MFAudioFormat_PCM, 16, &type))) {
+		UINT32 channels = 0;
+		UINT32 rate = 0;
+		IMFMediaType_GetUINT32(type, &MF_MT_AUDIO_NUM_CHANNELS, &channels);
+		IMFMediaType_GetUINT32(type, &MF_MT_AUDIO_SAMPLES_PER_SECOND, &rate);
+		IMFMediaType_Release(type);
+		dec->info.channels = channels;
+		dec->info.rate = rate;
+	}
+	if ((0 == dec->info.channels) || (0 == dec->info.rate)) {
+		// the video is played without sound
+		if (dec->audio != NO_STREAM) {
+			IMFSourceReader_SetStreamSelection(dec->reader, dec->audio, FALSE);
+		}
+		dec->audio = NO_STREAM;
+		dec->info.channels = 0;
+		dec->info.rate = 0;
+	}
+	PropVariantInit(&var);
+	if (SUCCEEDED(IMFSourceReader_GetPresentationAttribute(dec->reader, (DWORD)MF_SOURCE_READER_MEDIASOURCE, &MF_PD_DURATION, &var)) &&
+		(VT_UI8 == var.vt)) {
+		dec->info.duration = (unsigned long)((double)var.uhVal.QuadPart / 10000.0);
+	}
+	return (S_OK);
+}
+
+
+long video_dec_open(char const *path, VIDEO_DEC **result, VIDEO_DEC_INFO *info)
+{
+	WCHAR url[MAX_PATH];
+	IMFAttributes *attributes = NULL;
+	VIDEO_DEC *dec;
+	HRESULT hr;
+	*result = NULL;
+	if (!video_dec_load()) {
+		return (HRESULT_FROM_WIN32(ERROR_MOD_NOT_FOUND));
+	}
+	dec = (VIDEO_DEC *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*dec));
+	if (NULL == dec) {
+		return (E_OUTOFMEMORY);
+	}
+	dec->video = NO_STREAM;
+	dec->audio = NO_STREAM;
+	hr = s_mf.co_initialize_ex(NULL, COINIT_MULTITHREADED);
+	dec->com = SUCCEEDED(hr);
+	if (RPC_E_CHANGED_MODE == hr) {
+		// the reader works in the apartment of the thread
+		hr = S_OK;
+	}
+	if (SUCCEEDED(hr)) {
+		hr = s_mf.startup(MF_VERSION, MFSTARTUP_LITE);
+		dec->mf = SUCCEEDED(hr);
+	}
+	if (SUCCEEDED(hr) && !MultiByteToWideChar(CP_ACP, 0, path, -1, url, MAX_PATH)) {
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	if (SUCCEEDED(hr)) {
+		hr = s_mf.create_attributes(&attributes, 1);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = IMFAttributes_SetUINT32(attributes, &MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = s_mf.create_source_reader(url, attributes, &dec->reader);
+	}
+	if (attributes != NULL) {
+		IMFAttributes_Release(attributes);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = select_streams(dec);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = set_formats(dec);
+	}
+	if (FAILED(hr)) {
+		video_dec_close(dec);
+		return (hr);
+	}
+	*info = dec->info;
+	*result = dec;
+	return (S_OK);
+}
+
+long video_dec_read(VIDEO_DEC *dec, VIDEO_DEC_SAMPLE *result)
+{
+	IMFSample *sample = NULL;
+	IMFMediaBuffer *buffer = NULL;
+	LONGLONG time = 0;
+	DWORD stream = NO_STREAM;
+	DWORD flags = 0;
+	BYTE *data;
+	DWORD length;
+	HRESULT hr;
+	ZeroMemory(result, sizeof(*result));
+	if (dec->ended) {
+		result->kind = VIDEO_DEC_END;
+		return (S_OK);
+	}
+	hr = IMFSourceReader_ReadSample(dec->reader, (DWORD)MF_SOURCE_READER_ANY_STREAM, 0, &stream, &flags, &time, &sample);
+	if (FAILED(hr)) {
+		return (hr);
+	}
+	if (MF_SOURCE_READERF_ERROR & flags) {
+		hr = E_FAIL;
+	}
+	if (MF_SOURCE_READERF_ENDOFSTREAM & flags) {
+		if (stream == dec->video) {
+			dec->video_end = 1;
+		} else if (stream == dec->audio) {
+			dec->audio_end = 1;
+		}
+		if (dec->video_end && ((NO_STREAM == dec->audio) || dec->audio_end)) {
+			dec->ended = 1;
+			result->kind = VIDEO_DEC_END;
+		}
+	}
+	if (SUCCEEDED(hr) && (MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED & flags) && (stream == dec->video)) {
+		unsigned int width, height;
+		long stride;
+		// the frame buffers of the presenter have the size of the first format
+		hr = get_video_format(dec, &width, &height, &stride);
+		if (SUCCEEDED(hr) && ((width != dec->info.width) || (height != dec->info.height))) {
+			hr = MF_E_INVALIDMEDIATYPE;
+		}
+		if (SUCCEEDED(hr)) {
+			dec->info.stride = stride;
+		}
+	}
+	if (FAILED(hr) || (NULL == sample)) {
+		if (sample != NULL) {
+			IMFSample_Release(sample);
+		}
+		return (hr);
+	}
+	hr = IMFSample_ConvertToContiguousBuffer(sample, &buffer);
+	IMFSample_Release(sample);
+	if (FAILED(hr)) {
+		return (hr);
+	}
+	hr = IMFMediaBuffer_Lock(buffer, &data, NULL, &length);
+	if (FAILED(hr)) {
+		IMFMediaBuffer_Release(buffer);
+		return (hr);
+	}
+	result->kind = (stream == dec->video) ? VIDEO_DEC_FRAME : VIDEO_DEC_AUDIO;
+	// 100 ns units (no 64-bit division in the runtime)
+	result->time = (long)((double)time / 10000.0);
+	result->data = data;
+	result->size = length;
+	result->stride = dec->info.stride;
+	result->buffer = buffer;
+	return (S_OK);
+}
+
+void video_dec_done(VIDEO_DEC_SAMPLE *sample)
+{
+	if (sample->buffer != NULL) {
+		IMFMediaBuffer *buffer = (IMFMediaBuffer *)sample->buffer;
+		IMFMediaBuffer_Unlock(buffer);
+		IMFMediaBuffer_Release(buffer);
+		sample->buffer = NULL;
+	}
+}
+
+void video_dec_close(VIDEO_DEC *dec)
+{
+	if (dec != NULL) {
+		if (dec->reader != NULL) {
+			IMFSourceReader_Release(dec->reader);
+		}
+		if (dec->mf) {
+			s_mf.shutdown();
+		}
+		if (dec->com) {
+			s_mf.co_uninitialize();
+		}
+		HeapFree(GetProcessHeap(), 0, dec);
+	}
+}
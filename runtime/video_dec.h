@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VIDEO_DEC_H_
+#define VIDEO_DEC_H_
+
+// no Windows headers (video_dec.c needs the Windows 7 SDK declarations)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// KQF_CFGO_VIDEO_PLAYER (KQF_OPT_VIDEO_PLAYER_INTERNAL)
+
+typedef struct VIDEO_DEC VIDEO_DEC;
+
+typedef struct VIDEO_DEC_INFO {
+	unsigned int  width;
+	unsigned int  height;
+	long          stride;    // bytes per row (negative: bottom-up)
+	unsigned long duration;  // ms (0: unknown)
+	unsigned int  channels;  // 16-bit PCM (0: no audio)
+	unsigned long rate;
+} VIDEO_DEC_INFO;
+
+typedef enum VIDEO_DEC_KIND_ {
+	VIDEO_DEC_NONE,   // gap in a stream (nothing to present)
+	VIDEO_DEC_FRAME,  // 32-bit RGB frame
+	VIDEO_DEC_AUDIO,  // PCM samples
+	VIDEO_DEC_END     // all streams ended
+} VIDEO_DEC_KIND_;
+
+typedef struct VIDEO_DEC_SAMPLE {
+	int            kind;    // VIDEO_DEC_KIND_
+	long           time;    // ms
+	void const    *data;
+	unsigned long  size;    // bytes
+	long           stride;  // VIDEO_DEC_FRAME (negative: bottom-up)
+	void          *buffer;  // locked media buffer
+} VIDEO_DEC_SAMPLE;
+
+// loads Media Foundation (returns the number of loaded libraries, they stay
+// loaded); 0 if it is not available (before Windows 7)
+int video_dec_load(void);
+
+// all calls for one decoder have to be made by the same thread (the thread
+// joins the multithreaded COM apartment), the results are HRESULT values
+long video_dec_open(char const *path, VIDEO_DEC **dec, VIDEO_DEC_INFO *info);
+long video_dec_read(VIDEO_DEC *dec, VIDEO_DEC_SAMPLE *sample);
+void video_dec_done(VIDEO_DEC_SAMPLE *sample);  // unlocks the sample data
+void video_dec_close(VIDEO_DEC *dec);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,844 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "video_ext.h"
+
+#include "../common/kqf_app.h"
+#include "../common/kqf_cfg.h"
+#include "../common/kqf_log.h"
+#include "file_cache.h"
+#include "video_dec.h"
+#include "video_stat.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                        External player backends
+//
+// The backend is selected with video.player (2 and above). Each backend has
+// its own section in kq8fix.ini (e.g. [video.vlc]) to override the defaults:
+//   exe   = executable (App Paths/PATH are searched, empty = registered player)
+//   args  = arguments, each %s is replaced by the file name
+//   class = window class substrings separated by '|'
+//   title = window title substrings separated by '|'
+// Backends with native fullscreen and play-and-exit arguments are only brought
+// to the front and the end of their process is the end of the video; for the
+// registered player (video.player=0) the window is made fullscreen with the
+// old style changes and simulated input. There is no separate backend for the
+// UWP Media Player: it cannot be started with a file from a path without COM
+// activation, so video.player=3 is the registered player (the Media Player on
+// a stock Windows 11).
+//
+
+typedef struct VIDEO_BACKEND {
+	int         player;   // KQF_OPT_VIDEO_PLAYER_
+	char const *name;     // kq8fix.ini section "video.<name>"
+	char const *exe;
+	char const *args;
+	char const *classes;
+	char const *titles;
+	char const *folder;   // default installation folder in the program files
+	int         native;   // starts fullscreen and exits at the end
+} VIDEO_BACKEND;
+
+static VIDEO_BACKEND const video_backends[] = {
+	{KQF_OPT_VIDEO_PLAYER_SHELL, "shell", "", "",
+		"ApplicationFrameWindow|MediaPlayer|VLC", "Media Player|Movies & TV|Films & TV|.avi|VLC", NULL, 0},
+	{KQF_OPT_VIDEO_PLAYER_WMP, "wmp", "wmplayer.exe", "/play /close /fullscreen \"%s\"",
+		"WMPlayerApp", "Windows Media Player", "Windows Media Player", 1},
+	{KQF_OPT_VIDEO_PLAYER_VLC, "vlc", "vlc.exe", "--fullscreen --play-and-exit --no-video-title-show \"%s\"",
+		"Qt5QWindowIcon|Qt6QWindowIcon|VLC", "VLC media player", "VideoLAN\\VLC", 1},
+	{KQF_OPT_VIDEO_PLAYER_MPV, "mpv", "mpv.exe", "--fs --keep-open=no --force-window=yes \"%s\"",
+		"mpv", "mpv", "mpv", 1}
+};
+
+typedef struct VIDEO_PLAYER {
+	char const *name;
+	char exe[MAX_PATH];
+	char args[256];
+	char classes[256];
+	char titles[256];
+	char const *folder;
+	int  native;
+} VIDEO_PLAYER;
+
+
+static
+void load_player(int player, VIDEO_PLAYER *result)
+{
+	char path[MAX_PATH];
+	char section[32];
+	VIDEO_BACKEND const *backend = &video_backends[0];
+	int i;
+	for (i = 0; i < ARRAYSIZE(video_backends); ++i) {
+		if (video_backends[i].player == player) {
+			backend = &video_backends[i];
+			break;
+		}
+	}
+	kqf_app_filepath("kq8fix.ini", path);
+	wsprintfA(section, "video.%s", backend->name);
+	result->name = backend->name;
+	GetPrivateProfileStringA(section, "exe", backend->exe, result->exe, sizeof(result->exe), path);
+	GetPrivateProfileStringA(section, "args", backend->args, result->args, sizeof(result->args), path);
+	GetPrivateProfileStringA(section, "class", backend->classes, result->classes, sizeof(result->classes), path);
+	GetPrivateProfileStringA(section, "title", backend->titles, result->titles, sizeof(result->titles), path);
+	result->folder = backend->folder;
+	result->native = backend->native && (result->exe[0] != '\0');
+}
+
+// replaces each %s with the file name (quoted file name appended if none)
+static
+void format_args(char *dst, unsigned int size, char const *args, char const *file)
+{
+	unsigned int len = 0;
+	int used = 0;
+	while (*args && (len + 1 < size)) {
+		if (('%' == args[0]) && ('s' == args[1])) {
+			char const *src = file;
+			while (*src && (len + 1 < size)) {
+				dst[len++] = *src++;
+			}
+			args += 2;
+			used = 1;
+		} else {
+			dst[len++] = *args++;
+		}
+	}
+	dst[len] = '\0';
+	if (!used && (len + lstrlenA(file) + 4 <= size)) {
+		wsprintfA(&dst[len], (len > 0) ? " \"%s\"" : "\"%s\"", file);
+	}
+}
+
+// case-sensitive substring match against a '|' separated list
+static
+int match_list(char const *text, char const *list)
+{
+	while (*list) {
+		char item[64];
+		unsigned int len = 0;
+		while (*list && (*list != '|')) {
+			if (len + 1 < sizeof(item)) {
+				item[len++] = *list;
+			}
+			++list;
+		}
+		item[len] = '\0';
+		if (*list) {
+			++list;
+		}
+		if ((len > 0) && strstr(text, item)) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                            Player pre-warming
+//
+// The first video waits for the cold start of the player (the executable and
+// its libraries are read from disk, a UWP app has to be activated). With
+// video.prewarm a background thread reads the player executable and the
+// libraries in its folder once at startup, so that the first launch is served
+// from the file cache. Starting the player itself would show a window or
+// leave a process behind, so only the files are primed. For the in-process
+// player Media Foundation and the H.264 decoder are loaded. The launches are
+// logged as cold (first launch, not primed), primed (first launch after
+// pre-warming), or warm.
+//
+
+enum VIDEO_PREWARM_ {
+	VIDEO_PREWARM_BLOCK = 0x10000,   // read size
+	VIDEO_PREWARM_LIMIT = 0x4000000  // 64 MiB per player
+};
+
+static LONG /*volatile*/ s_prewarmed /* = 0 */;
+static LONG /*volatile*/ s_prewarm_stop /* = 0 */;
+static LONG s_launches /* = 0 */;
+
+
+// searches the executable in the PATH and in the default installation folder
+static
+int find_player(VIDEO_PLAYER const *player, char path[MAX_PATH])
+{
+	static char const *const roots[] = {"%ProgramW6432%", "%ProgramFiles%", "%ProgramFiles(x86)%"};
+	char name[MAX_PATH];
+	char *file;
+	int i;
+	if ('\0' == player->exe[0]) {
+		// registered player for the game videos
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA("*_1.avi", &data);
+		if (INVALID_HANDLE_VALUE == find) {
+			return (0);
+		}
+		FindClose(find);
+		return ((INT_PTR)FindExecutableA(data.cFileName, NULL, path) > 32);
+	}
+	if (SearchPathA(NULL, player->exe, NULL, MAX_PATH, path, &file)) {
+		return (1);
+	}
+	for (i = 0; player->folder && (i < ARRAYSIZE(roots)); ++i) {
+		wsprintfA(name, "%s\\%s\\%s", roots[i], player->folder, player->exe);
+		if ((ExpandEnvironmentStringsA(name, path, MAX_PATH) - 1 < MAX_PATH) &&
+			(path[0] != '%') && file_cache_exists(path)) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+static
+DWORD prime_file(char const *path, void *buffer, DWORD limit)
+{
+	DWORD total = 0;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file != INVALID_HANDLE_VALUE) {
+		DWORD read;
+		while ((total < limit) && !s_prewarm_stop &&
+			ReadFile(file, buffer, VIDEO_PREWARM_BLOCK, &read, NULL) && (read > 0)) {
+			total += read;
+		}
+		CloseHandle(file);
+	}
+	return (total);
+}
+
+static
+DWORD WINAPI prewarm_proc(LPVOID param)
+{
+	int const backend = (int)(INT_PTR)param;
+	LARGE_INTEGER start;
+	VIDEO_PLAYER player;
+	char path[MAX_PATH];
+	DWORD total = 0;
+	DWORD files = 0;
+	void *buffer;
+	QueryPerformanceCounter(&start);
+	if (KQF_OPT_VIDEO_PLAYER_INTERNAL == backend) {
+		// Media Foundation and the H.264 decoder remain loaded
+		files = (DWORD)video_dec_load();
+		InterlockedExchange(&s_prewarmed, 1);
+		kqf_log(KQF_LOGL_INFO, "video: prewarm Media Foundation (%lu modules) in %lu ms\n", files, video_stat_ms(&start, NULL));
+		return (0);
+	}
+	load_player(backend, &player);
+	if (!find_player(&player, path)) {
+		kqf_log(KQF_LOGL_WARNING, "video: prewarm %s failed, executable '%s' not found\n", player.name, player.exe);
+		return (0);
+	}
+	buffer = VirtualAlloc(NULL, VIDEO_PREWARM_BLOCK, MEM_COMMIT, PAGE_READWRITE);
+	if (buffer != NULL) {
+		char *name = path + lstrlenA(path);
+		WIN32_FIND_DATAA data;
+		HANDLE find;
+		total = prime_file(path, buffer, VIDEO_PREWARM_LIMIT);
+		++files;
+		while ((name > path) && (name[-1] != '\\')) {
+			--name;
+		}
+		if ((name - path) + sizeof("*.dll") <= MAX_PATH) {
+			lstrcpyA(name, "*.dll");
+			find = FindFirstFileA(path, &data);
+			if (find != INVALID_HANDLE_VALUE) {
+				do {
+					if (!(FILE_ATTRIBUTE_DIRECTORY & data.dwFileAttributes) &&
+						((name - path) + lstrlenA(data.cFileName) < MAX_PATH)) {
+						lstrcpyA(name, data.cFileName);
+						total += prime_file(path, buffer, VIDEO_PREWARM_LIMIT - total);
+						++files;
+					}
+				} while ((total < VIDEO_PREWARM_LIMIT) && !s_prewarm_stop && FindNextFileA(find, &data));
+				FindClose(find);
+			}
+		}
+		VirtualFree(buffer, 0, MEM_RELEASE);
+	}
+	InterlockedExchange(&s_prewarmed, 1);
+	kqf_log(KQF_LOGL_INFO, "video: prewarm %s read %lu KiB from %lu files in %lu ms\n", player.name, total / 1024, files, video_stat_ms(&start, NULL));
+	return (0);
+}
+
+
+int init_video_prewarm(int backend)
+{
+	DWORD id;
+	HANDLE thread = CreateThread(NULL, 0, prewarm_proc, (LPVOID)(INT_PTR)backend, 0, &id);
+	if (NULL == thread) {
+		kqf_log(KQF_LOGL_ERROR, "video: failed to create prewarm thread (%#lx)\n", GetLastError());
+		return (0);
+	}
+	SetThreadPriority(thread, THREAD_PRIORITY_BELOW_NORMAL);
+	CloseHandle(thread);
+	return (1);
+}
+
+void free_video_prewarm(void)
+{
+	// the thread is not joined (loader lock)
+	InterlockedExchange(&s_prewarm_stop, 1);
+}
+
+// cold, primed, or warm (for the hand-off measurements)
+static
+char const *launch_state(void)
+{
+	if (s_launches++ > 0) {
+		return ("warm");
+	}
+	return (s_prewarmed ? "primed" : "cold");
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                     External video player window
+//
+// The video is handed over to the player with ShellExecuteEx. The first
+// top-level window that matches the player (class or title) is taken. Matching
+// windows that are already open before the launch (e.g. an unrelated browser
+// tab titled '.avi') are remembered and ignored, unless they belong to the
+// launched process or are shown again after the launch. Instead of
+// waiting three seconds and polling all top-level windows twice a second,
+// WinEvent hooks (EVENT_OBJECT_SHOW, EVENT_SYSTEM_FOREGROUND) report each new
+// window while the thread pumps its sent messages, so the player window is
+// found as soon as it is shown. SetWinEventHook is loaded dynamically (it is
+// missing on Windows 95), the periodic enumeration remains as fallback.
+// The end of the playback is detected the same way: the thread blocks on the
+// player process (ShellExecuteEx) and an EVENT_OBJECT_DESTROY hook for the
+// player window. Players hide their window between files or while switching
+// to fullscreen, so EVENT_OBJECT_HIDE only ends the wait if there is no
+// process to wait for (the launched process handed the video over to another
+// process, e.g. a running player or the UWP frame host).
+//
+
+#ifndef EVENT_SYSTEM_FOREGROUND
+# define EVENT_SYSTEM_FOREGROUND 0x0003
+#endif
+#ifndef EVENT_OBJECT_DESTROY
+# define EVENT_OBJECT_DESTROY 0x8001
+#endif
+#ifndef EVENT_OBJECT_SHOW
+# define EVENT_OBJECT_SHOW 0x8002
+#endif
+#ifndef EVENT_OBJECT_HIDE
+# define EVENT_OBJECT_HIDE 0x8003
+#endif
+#ifndef WINEVENT_SKIPOWNPROCESS
+# define WINEVENT_SKIPOWNPROCESS 0x0002
+#endif
+#ifndef OBJID_WINDOW
+# define OBJID_WINDOW 0
+#endif
+#ifndef CHILDID_SELF
+# define CHILDID_SELF 0
+#endif
+
+enum VIDEO_FIND_ {
+	VIDEO_FIND_TIMEOUT = 15000,  // ms
+	VIDEO_FIND_SLICE   = 50,     // ms (message pump)
+	VIDEO_FIND_POLL    = 250,    // ms (without WinEvent hooks)
+	VIDEO_FIND_HOOKS   = 2,
+	VIDEO_FIND_SEEN    = 16,     // matching windows before the launch
+	VIDEO_WAIT_TIMEOUT = 600000  // ms (10 minutes)
+};
+
+typedef VOID (CALLBACK *VIDEO_EVENT_PROC)(HANDLE hWinEventHook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime);
+typedef HANDLE (WINAPI *PFNSETWINEVENTHOOK)(DWORD eventMin, DWORD eventMax, HMODULE hmodWinEventProc, VIDEO_EVENT_PROC pfnWinEventProc, DWORD idProcess, DWORD idThread, DWORD dwFlags);
+typedef BOOL (WINAPI *PFNUNHOOKWINEVENT)(HANDLE hWinEventHook);
+typedef DWORD (WINAPI *PFNGETPROCESSID)(HANDLE Process);
+
+static struct VIDEO_FIND {
+	PFNSETWINEVENTHOOK  set_hook;
+	PFNUNHOOKWINEVENT   unhook;
+	PFNGETPROCESSID     get_pid;
+	HANDLE              hook[VIDEO_FIND_HOOKS];
+	VIDEO_PLAYER const *player;
+	HWND                main;
+	HWND                found;
+	DWORD               pid;    // launched process (0 = unknown)
+	int                 seen;
+	HWND                seen_window[VIDEO_FIND_SEEN];
+	DWORD               event;  // 0 = enumeration
+	char const         *state;  // launch_state()
+	LARGE_INTEGER       start;
+} video_find /* = {0} */;
+
+static struct VIDEO_WAIT {
+	HWND  window;
+	DWORD closed;  // EVENT_OBJECT_DESTROY/HIDE
+	int   hide;    // EVENT_OBJECT_HIDE ends the wait (no player process)
+} video_wait /* = {0} */;
+
+
+static
+int is_video_window(HWND hwnd)
+{
+	char text[256];
+	if ((hwnd == video_find.main) || (GetParent(hwnd) != NULL) || !IsWindowVisible(hwnd)) {
+		return (0);
+	}
+	if (GetClassNameA(hwnd, text, sizeof(text)) && match_list(text, video_find.player->classes)) {
+		return (1);
+	}
+	if (GetWindowTextA(hwnd, text, sizeof(text)) && match_list(text, video_find.player->titles)) {
+		return (1);
+	}
+	return (0);
+}
+
+// windows that matched before the launch are only taken if they belong to the
+// launched process or have been shown again (EVENT_OBJECT_SHOW)
+static
+int is_new_window(HWND hwnd, DWORD event)
+{
+	DWORD pid = 0;
+	int i;
+	if (EVENT_OBJECT_SHOW == event) {
+		return (1);
+	}
+	if (video_find.pid && GetWindowThreadProcessId(hwnd, &pid) && (pid == video_find.pid)) {
+		return (1);
+	}
+	for (i = 0; i < video_find.seen; ++i) {
+		if (video_find.seen_window[i] == hwnd) {
+			return (0);
+		}
+	}
+	return (1);
+}
+
+// the window belongs to another process than the launched one
+static
+int is_handed_over(HWND hwnd)
+{
+	DWORD pid = 0;
+	return ((hwnd != NULL) && video_find.pid && GetWindowThreadProcessId(hwnd, &pid) && (pid != video_find.pid));
+}
+
+static
+VOID CALLBACK video_find_event(HANDLE hWinEventHook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime)
+{
+	UNREFERENCED_PARAMETER(hWinEventHook);
+	UNREFERENCED_PARAMETER(idEventThread);
+	UNREFERENCED_PARAMETER(dwmsEventTime);
+	if ((NULL == video_find.found) && hwnd && (OBJID_WINDOW == idObject) && (CHILDID_SELF == idChild) &&
+		is_video_window(hwnd) && is_new_window(hwnd, event)) {
+		video_find.found = hwnd;
+		video_find.event = event;
+	}
+}
+
+static
+BOOL CALLBACK video_find_enum(HWND hwnd, LPARAM lParam)
+{
+	UNREFERENCED_PARAMETER(lParam);
+	if (is_video_window(hwnd) && is_new_window(hwnd, 0)) {
+		video_find.found = hwnd;
+		video_find.event = 0;
+		return (FALSE);
+	}
+	return (TRUE);
+}
+
+static
+BOOL CALLBACK video_seen_enum(HWND hwnd, LPARAM lParam)
+{
+	UNREFERENCED_PARAMETER(lParam);
+	if (is_video_window(hwnd)) {
+		video_find.seen_window[video_find.seen++] = hwnd;
+	}
+	return (video_find.seen < VIDEO_FIND_SEEN);
+}
+
+// remembers the matching windows and installs the WinEvent hooks before the
+// player is started (state: launch_state() of the request)
+static
+void video_find_begin(HWND main, VIDEO_PLAYER const *player, char const *state)
+{
+	if (NULL == video_find.set_hook) {
+		HMODULE user32 = GetModuleHandleA("user32.dll");
+		HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+		if (user32 != NULL) {
+			video_find.set_hook = (PFNSETWINEVENTHOOK)GetProcAddress(user32, "SetWinEventHook");
+			video_find.unhook = (PFNUNHOOKWINEVENT)GetProcAddress(user32, "UnhookWinEvent");
+		}
+		if (kernel32 != NULL) {
+			video_find.get_pid = (PFNGETPROCESSID)GetProcAddress(kernel32, "GetProcessId");
+		}
+	}
+	video_find.player = player;
+	video_find.main = main;
+	video_find.found = NULL;
+	video_find.event = 0;
+	video_find.pid = 0;
+	video_find.seen = 0;
+	EnumWindows(video_seen_enum, 0);
+	if (video_find.seen > 0) {
+		kqf_log(KQF_LOGL_DEBUG, "video: ignoring %d %s window(s) opened before the launch\n", video_find.seen, player->name);
+	}
+	video_find.hook[0] = NULL;
+	video_find.hook[1] = NULL;
+	if (video_find.set_hook && video_find.unhook) {
+		DWORD const flags = WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS;
+		video_find.hook[0] = video_find.set_hook(EVENT_OBJECT_SHOW, EVENT_OBJECT_SHOW, NULL, video_find_event, 0, 0, flags);
+		video_find.hook[1] = video_find.set_hook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, video_find_event, 0, 0, flags);
+	}
+	video_find.state = state;
+	QueryPerformanceCounter(&video_find.start);
+}
+
+static
+void video_find_unhook(void)
+{
+	int i;
+	for (i = 0; i < VIDEO_FIND_HOOKS; ++i) {
+		if (video_find.hook[i] != NULL) {
+			video_find.unhook(video_find.hook[i]);
+			video_find.hook[i] = NULL;
+		}
+	}
+}
+
+// pumps the sent messages (WinEvents) until a player window is found (or the
+// process ends, if exits is set)
+static
+HWND video_find_end(HANDLE process, int exits, DWORD timeout)
+{
+	int const hooked = (video_find.hook[0] != NULL) || (video_find.hook[1] != NULL);
+	DWORD const count = (exits && (process != NULL)) ? 1 : 0;
+	DWORD const begin = GetTickCount();
+	DWORD elapsed = 0;
+	if ((process != NULL) && video_find.get_pid) {
+		video_find.pid = video_find.get_pid(process);
+	}
+	// the launched player might have shown its window already
+	EnumWindows(video_find_enum, 0);
+	while ((NULL == video_find.found) && (elapsed < timeout)) {
+		MSG msg;
+		DWORD const slice = hooked ? VIDEO_FIND_SLICE : VIDEO_FIND_POLL;
+		if (WAIT_OBJECT_0 == MsgWaitForMultipleObjects(count, &process, FALSE, (timeout - elapsed < slice) ? timeout - elapsed : slice, QS_ALLINPUT)) {
+			break;
+		}
+		// dispatches the WinEvents (sent messages), the game messages remain queued
+		PeekMessageA(&msg, NULL, 0, 0, PM_NOREMOVE);
+		if (!hooked && (NULL == video_find.found)) {
+			EnumWindows(video_find_enum, 0);
+		}
+		elapsed = GetTickCount() - begin;
+	}
+	video_find_unhook();
+	if (video_find.found) {
+		kqf_log(KQF_LOGL_INFO, "video: %s hand-off after %lu ms, %s (window %#08lx, event %#lx)\n", video_find.player->name, video_stat_ms(&video_find.start, NULL), video_find.state, video_find.found, video_find.event);
+	} else if (elapsed < timeout) {
+		kqf_log(KQF_LOGL_INFO, "video: %s exited after %lu ms without a window, %s\n", video_find.player->name, video_stat_ms(&video_find.start, NULL), video_find.state);
+	} else {
+		kqf_log(KQF_LOGL_WARNING, "video: no %s window after %lu ms, %s\n", video_find.player->name, video_stat_ms(&video_find.start, NULL), video_find.state);
+	}
+	return (video_find.found);
+}
+
+static
+VOID CALLBACK video_wait_event(HANDLE hWinEventHook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime)
+{
+	UNREFERENCED_PARAMETER(hWinEventHook);
+	UNREFERENCED_PARAMETER(idEventThread);
+	UNREFERENCED_PARAMETER(dwmsEventTime);
+	if ((hwnd == video_wait.window) && (OBJID_WINDOW == idObject) && (CHILDID_SELF == idChild) &&
+		((EVENT_OBJECT_DESTROY == event) || (video_wait.hide && (EVENT_OBJECT_HIDE == event)))) {
+		video_wait.closed = event;
+	}
+}
+
+// waits for the end of the playback (player process terminated or player
+// window destroyed), the process is only used if it owns the window; a hidden
+// window only ends the wait if the player process is unknown (shell or UWP
+// launch, handed over to another process), returns 0 on timeout
+static
+int video_wait_end(HWND window, HANDLE process, DWORD timeout)
+{
+	HANDLE hook = NULL;
+	DWORD const begin = GetTickCount();
+	DWORD elapsed = 0;
+	DWORD count = 0;
+	char const *reason = "timeout";
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	video_wait.window = window;
+	video_wait.closed = 0;
+	if (window != NULL) {
+		DWORD pid = 0;
+		DWORD const tid = GetWindowThreadProcessId(window, &pid);
+		if (video_find.set_hook && video_find.unhook) {
+			hook = video_find.set_hook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_HIDE, NULL, video_wait_event, pid, tid, WINEVENT_OUTOFCONTEXT);
+		}
+		if (process != NULL) {
+			if (video_find.pid && (video_find.pid != pid)) {
+				kqf_log(KQF_LOGL_DEBUG, "video: handed over to process %lu\n", pid);
+				process = NULL;
+			}
+		}
+	}
+	if (process != NULL) {
+		count = 1;
+	}
+	video_wait.hide = !count;
+	while (elapsed < timeout) {
+		MSG msg;
+		DWORD const slice = hook ? timeout - elapsed : ((timeout - elapsed < 500) ? timeout - elapsed : 500);
+		if (WAIT_OBJECT_0 == MsgWaitForMultipleObjects(count, &process, FALSE, slice, QS_ALLINPUT)) {
+			reason = "process";
+			break;
+		}
+		// dispatches the WinEvents (sent messages), the game messages remain queued
+		PeekMessageA(&msg, NULL, 0, 0, PM_NOREMOVE);
+		if (video_wait.closed) {
+			reason = (EVENT_OBJECT_DESTROY == video_wait.closed) ? "destroyed" : "hidden";
+			break;
+		}
+		if (window && !(IsWindow(window) && (count || IsWindowVisible(window)))) {
+			reason = "closed";
+			break;
+		}
+		if (!window && !count) {
+			break;
+		}
+		elapsed = GetTickCount() - begin;
+	}
+	if (hook != NULL) {
+		video_find.unhook(hook);
+	}
+	video_wait.window = NULL;
+	kqf_log(KQF_LOGL_INFO, "video: finished after %lu ms (%s)\n", video_stat_ms(&start, NULL), reason);
+	return (elapsed < timeout);
+}
+
+
+// players without fullscreen arguments (registered player, UWP app)
+static
+void force_fullscreen(HWND videoWnd)
+{
+	char className[256] = {0};
+	GetClassNameA(videoWnd, className, sizeof(className) - 1);
+	// Check if it's legacy Media Player vs Windows 11 Media Player
+	BOOL isLegacyPlayer = !strstr(className, "ApplicationFrameWindow");
+
+	if (isLegacyPlayer) {
+		kqf_log(KQF_LOGL_DEBUG, "Detected legacy Media Player - using enhanced fullscreen scaling\n");
+
+		// For legacy Media Player, we need to:
+		// 1. Set window to fullscreen size
+		// 2. Send specific commands to scale video content
+
+		// Get screen dimensions
+		int screenWidth = GetSystemMetrics(SM_CXSCREEN);
+		int screenHeight = GetSystemMetrics(SM_CYSCREEN);
+
+		// First bring to front
+		SetForegroundWindow(videoWnd);
+		BringWindowToTop(videoWnd);
+
+		// Set window to exact screen size (borderless fullscreen)
+		SetWindowPos(videoWnd, HWND_TOP, 0, 0, screenWidth, screenHeight, 
+			SWP_SHOWWINDOW | SWP_FRAMECHANGED);
+
+		// Force window style to borderless
+		LONG style = GetWindowLongA(videoWnd, GWL_STYLE);
+		SetWindowLongA(videoWnd, GWL_STYLE, style & ~(WS_CAPTION | WS_THICKFRAME | WS_MINIMIZE | WS_MAXIMIZE | WS_SYSMENU));
+
+		// Apply the style change
+		SetWindowPos(videoWnd, NULL, 0, 0, 0, 0, 
+			SWP_FRAMECHANGED | SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER);
+
+		Sleep(100);
+
+		// Try to send fullscreen command via keyboard shortcut (Alt+Enter is common)
+		SetFocus(videoWnd);
+		keybd_event(VK_MENU, 0, 0, 0);          // Alt down
+		keybd_event(VK_RETURN, 0, 0, 0);        // Enter down
+		keybd_event(VK_RETURN, 0, KEYEVENTF_KEYUP, 0); // Enter up
+		keybd_event(VK_MENU, 0, KEYEVENTF_KEYUP, 0);   // Alt up
+
+		Sleep(100);
+
+		// Double-click on video area to trigger fullscreen (common in legacy players)
+		RECT windowRect;
+		if (GetWindowRect(videoWnd, &windowRect)) {
+			int centerX = (windowRect.left + windowRect.right) / 2;
+			int centerY = (windowRect.top + windowRect.bottom) / 2;
+
+			SetCursorPos(centerX, centerY);
+			mouse_event(MOUSEEVENTF_LEFTDOWN, 0, 0, 0, 0);
+			mouse_event(MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
+			Sleep(50);
+			mouse_event(MOUSEEVENTF_LEFTDOWN, 0, 0, 0, 0);
+			mouse_event(MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
+		}
+
+	} else {
+		kqf_log(KQF_LOGL_DEBUG, "Detected Windows 11 UWP Media Player - using standard activation\n");
+
+		// Standard approach for Windows 11 Media Player
+		SetForegroundWindow(videoWnd);
+		BringWindowToTop(videoWnd);
+		ShowWindow(videoWnd, SW_SHOWMAXIMIZED);
+	}
+
+	kqf_log(KQF_LOGL_DEBUG, "Final Video Window: %#08lx\n", videoWnd);
+
+	SetFocus(videoWnd);
+	UpdateWindow(videoWnd);
+	//SetForegroundWindow(videoWnd);
+	// Force maximize the video window with multiple aggressive attempts
+	
+	
+	kqf_log(KQF_LOGL_DEBUG, "Maximizing video window with aggressive methods\n");
+	
+	// Method 1: Standard approach
+	ShowWindow(videoWnd, SW_RESTORE);
+	Sleep(50);
+	ShowWindow(videoWnd, SW_SHOWMAXIMIZED);
+	//SetForegroundWindow(videoWnd);
+	BringWindowToTop(videoWnd);
+	
+	// Method 2: Use SetWindowPos for more control
+	
+	Sleep(100);
+	SetWindowPos(videoWnd, HWND_TOPMOST, 0, 0, 0, 0, 
+		SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW);
+	SetWindowPos(videoWnd, HWND_NOTOPMOST, 0, 0, 0, 0, 
+		SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW);
+	
+	// Method 3: Get screen dimensions and force fullscreen
+	
+
+	
+	int screenWidth = GetSystemMetrics(SM_CXSCREEN);
+	int screenHeight = GetSystemMetrics(SM_CYSCREEN);
+	SetWindowPos(videoWnd, HWND_TOP, 0, 0, screenWidth, screenHeight, 
+		SWP_SHOWWINDOW);
+	
+	
+	// Method 4: Final maximize attempt
+	
+	Sleep(100);
+	ShowWindow(videoWnd, SW_SHOWMAXIMIZED);
+	//SetForegroundWindow(videoWnd);
+	SwitchToThisWindow(videoWnd, TRUE);
+	
+	
+	kqf_log(KQF_LOGL_DEBUG, "Completed maximize attempts\n");
+}
+
+
+// the launch state is taken once per request (not again for the fallback)
+static
+int video_ext_launch(HWND main, char const *path, int backend, char const *state)
+{
+	VIDEO_PLAYER player;
+	SHELLEXECUTEINFOA exec;
+	char command[MAX_PATH + 2];
+	char args[MAX_PATH + 256];
+	HWND videoWnd;
+	int native;
+	int ended = 1;
+	load_player(backend, &player);
+	video_stat_player(player.name);
+	ZeroMemory(&exec, sizeof(exec));
+	exec.cbSize = sizeof(exec);
+	exec.fMask = SEE_MASK_NOCLOSEPROCESS;
+	exec.nShow = SW_NORMAL;
+	if (player.exe[0] != '\0') {
+		format_args(args, sizeof(args), player.args, path);
+		exec.lpFile = player.exe;
+		exec.lpParameters = args;
+	} else {
+		wsprintfA(command, "\"%s\"", path);
+		exec.lpVerb = "open";
+		exec.lpFile = command;
+	}
+	video_find_begin(main, &player, state);
+	if (!ShellExecuteExA(&exec)) {
+		video_stat_fail(VIDEO_FAIL_LAUNCH);
+		kqf_log(KQF_LOGL_WARNING, "video: failed to start %s '%s' (%#lx)\n", player.name, exec.lpFile, GetLastError());
+		if (player.exe[0] != '\0') {
+			// fall back to the registered player
+			video_find_unhook();
+			return (video_ext_launch(main, path, KQF_OPT_VIDEO_PLAYER_SHELL, state));
+		}
+		exec.hProcess = NULL;
+	}
+	kqf_log(KQF_LOGL_DEBUG, " Result code: %d (process %#08lx)\n", (INT_PTR)exec.hInstApp, exec.hProcess);
+	video_stat_phase(VIDEO_PHASE_LAUNCH);
+
+	native = player.native && (exec.hProcess != NULL);
+	videoWnd = video_find_end(exec.hProcess, native, VIDEO_FIND_TIMEOUT);
+	video_stat_phase(VIDEO_PHASE_FIND);
+	if (native) {
+		// the playback ends with the process, the window search only logs the
+		// hand-off; the window is waited for if the video was handed over to
+		// a running player (video_wait_end ignores the process then)
+		if (videoWnd) {
+			SetForegroundWindow(videoWnd);
+			BringWindowToTop(videoWnd);
+		}
+		video_stat_phase(VIDEO_PHASE_FULLSCREEN);
+		ended = video_wait_end(is_handed_over(videoWnd) ? videoWnd : NULL, exec.hProcess, VIDEO_WAIT_TIMEOUT);
+	} else if (videoWnd) {
+		if (player.native) {
+			SetForegroundWindow(videoWnd);
+			BringWindowToTop(videoWnd);
+		} else {
+			force_fullscreen(videoWnd);
+		}
+		video_stat_phase(VIDEO_PHASE_FULLSCREEN);
+		// Wait for video window to close with timeout
+		ended = video_wait_end(videoWnd, exec.hProcess, VIDEO_WAIT_TIMEOUT);
+		kqf_log(KQF_LOGL_DEBUG, "Video window closed!\n");
+	} else if (exec.hProcess != NULL) {
+		// No known window, but the player process is still known
+		video_stat_fail(VIDEO_FAIL_WINDOW);
+		ended = video_wait_end(NULL, exec.hProcess, VIDEO_WAIT_TIMEOUT);
+	} else {
+		// Fallback: wait a reasonable time if no window was found
+		video_stat_fail(VIDEO_FAIL_WINDOW);
+		kqf_log(KQF_LOGL_DEBUG, "No video window found, waiting 1 second\n");
+		Sleep(1000);
+	}
+	video_stat_phase(VIDEO_PHASE_PLAYBACK);
+	if (!ended) {
+		video_stat_fail(VIDEO_FAIL_TIMEOUT);
+	}
+	if (exec.hProcess != NULL) {
+		CloseHandle(exec.hProcess);
+	}
+	return ((videoWnd != NULL) || native);
+}
+
+int video_ext_play(HWND main, char const *path, int backend)
+{
+	return (video_ext_launch(main, path, backend, launch_state()));
+}
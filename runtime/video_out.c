@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "video_out.h"
+
+#include "../common/kqf_log.h"
+#include "video_core.h"
+#include "video_dec.h"
+#include "video_stat.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                        In-process video playback
+//
+// Starting an external player costs seconds (process start-up, activation and
+// the search for its window) and it needs simulated input to get fullscreen.
+// The video is decoded in-process instead: a decoder thread reads the file
+// with Media Foundation (video_dec.c), converts the frames into the portable
+// frame queue (video_core.c) and feeds the sound to a paused waveOut device.
+// The game thread only presents: it waits for the first frame, starts the
+// clock and the sound together, and draws the frame that is due into a
+// borderless child window that covers the client area of the game window
+// (aspect ratio preserved). The keyboard focus stays on the game window, all
+// keyboard and mouse input of the thread is removed before anything else is
+// dispatched (Escape, Space, Enter, or a mouse click skips the video), paint
+// requests of the game are validated, and all other messages remain queued.
+//
+
+enum VIDEO_OUT_ {
+	VIDEO_OUT_OPEN    = 5000,    // ms (wait for the decoder)
+	VIDEO_OUT_PREROLL = 2000,    // ms (start without a decoded frame)
+	VIDEO_OUT_SLICE   = 100,     // ms (stop and audio check)
+	VIDEO_OUT_MARGIN  = 5000,    // ms (added to the video length)
+	VIDEO_OUT_TIMEOUT = 600000,  // ms (unknown length)
+	VIDEO_OUT_BLOCKS  = 32,      // audio buffers
+	VIDEO_OUT_BLOCK   = 0x4000   // bytes per audio buffer
+};
+
+// shared by the game thread and the decoder thread (the last one frees it)
+typedef struct VIDEO_OUT {
+	LONG /*volatile*/ refs;
+	LONG /*volatile*/ stop;
+	LONG /*volatile*/ ended;
+	HRESULT           hr;       // decoder open result
+	HANDLE            opened;   // manual-reset (hr and info valid)
+	HANDLE            frame;    // auto-reset (frame pushed or ended)
+	HANDLE            space;    // auto-reset (frame picked)
+	HANDLE            audio;    // auto-reset (waveOut buffer done)
+	CRITICAL_SECTION  lock;     // queue
+	VIDEO_QUEUE       queue;
+	VIDEO_DEC_INFO    info;
+	void             *pixels;
+	HWAVEOUT          wave;
+	WAVEHDR           block[VIDEO_OUT_BLOCKS];
+	char             *samples;
+	unsigned int      fill;     // audio buffer being filled
+	BITMAPINFO        bmi;
+	VIDEO_RECT        dst;
+	char              path[MAX_PATH];
+} VIDEO_OUT;
+
+static ATOM s_video_class /* = 0 */;
+
+
+static
+void release_out(VIDEO_OUT *out)
+{
+	unsigned int i;
+	if (InterlockedDecrement(&out->refs) != 0) {
+		return;
+	}
+	if (out->wave != NULL) {
+		waveOutReset(out->wave);
+		for (i = 0; i < VIDEO_OUT_BLOCKS; ++i) {
+			waveOutUnprepareHeader(out->wave, &out->block[i], sizeof(out->block[i]));
+		}
+		waveOutClose(out->wave);
+	}
+	if (out->samples != NULL) {
+		VirtualFree(out->samples, 0, MEM_RELEASE);
+	}
+	if (out->pixels != NULL) {
+		VirtualFree(out->pixels, 0, MEM_RELEASE);
+	}
+	CloseHandle(out->audio);
+	CloseHandle(out->space);
+	CloseHandle(out->frame);
+	CloseHandle(out->opened);
+	DeleteCriticalSection(&out->lock);
+	HeapFree(GetProcessHeap(), 0, out);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// decoder thread
+//
+
+static
+int open_audio(VIDEO_OUT *out)
+{
+	WAVEFORMATEX format;
+	unsigned int i;
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = (WORD)out->info.channels;
+	format.nSamplesPerSec = out->info.rate;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = (WORD)(format.nChannels * 2);
+	format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+	format.cbSize = 0;
+	out->samples = (char *)VirtualAlloc(NULL, VIDEO_OUT_BLOCKS * VIDEO_OUT_BLOCK, MEM_COMMIT, PAGE_READWRITE);
+	if (NULL == out->samples) {
+		return (0);
+	}
+	if (waveOutOpen(&out->wave, WAVE_MAPPER, &format, (DWORD_PTR)out->audio, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+		out->wave = NULL;
+		return (0);
+	}
+	// started by the presenter together with the clock
+	waveOutPause(out->wave);
+	for (i = 0; i < VIDEO_OUT_BLOCKS; ++i) {
+		out->block[i].lpData = out->samples + i * VIDEO_OUT_BLOCK;
+		out->block[i].dwBufferLength = VIDEO_OUT_BLOCK;
+		waveOutPrepareHeader(out->wave, &out->block[i], sizeof(out->block[i]));
+	}
+	return (1);
+}
+
+// queues the audio buffer being filled
+static
+void write_audio(VIDEO_OUT *out)
+{
+	WAVEHDR *const block = &out->block[out->fill];
+	if (block->dwUser != 0) {
+		block->dwBufferLength = (DWORD)block->dwUser;
+		block->dwUser = 0;
+		waveOutWrite(out->wave, block, sizeof(*block));
+		out->fill = (out->fill + 1) % VIDEO_OUT_BLOCKS;
+	}
+}
+
+// dwUser is the number of filled bytes of a buffer that is not queued
+static
+void queue_audio(VIDEO_OUT *out, char const *data, unsigned long size)
+{
+	unsigned long const align = out->info.channels * 2;
+	while ((size > 0) && !out->stop) {
+		WAVEHDR *const block = &out->block[out->fill];
+		unsigned long part;
+		if (WHDR_INQUEUE & block->dwFlags) {
+			WaitForSingleObject(out->audio, VIDEO_OUT_SLICE);
+			continue;
+		}
+		// whole sample frames per buffer
+		part = (VIDEO_OUT_BLOCK - (unsigned long)block->dwUser) / align * align;
+		if (0 == part) {
+			write_audio(out);
+			continue;
+		}
+		if (part > size) {
+			part = size;
+		}
+		CopyMemory(block->lpData + block->dwUser, data, part);
+		block->dwUser += part;
+		data += part;
+		size -= part;
+	}
+}
+
+static
+void queue_frame(VIDEO_OUT *out, VIDEO_DEC_SAMPLE const *sample)
+{
+	unsigned long const row_bytes = out->info.width * 4;
+	unsigned long const pitch = (unsigned long)((sample->stride < 0) ? -sample->stride : sample->stride);
+	if ((pitch < row_bytes) || (sample->size < pitch * (out->info.height - 1) + row_bytes)) {
+		return;
+	}
+	while (!out->stop) {
+		VIDEO_FRAME *back;
+		EnterCriticalSection(&out->lock);
+		back = video_queue_back(&out->queue);
+		LeaveCriticalSection(&out->lock);
+		if (back != NULL) {
+			// the slot is not touched by the presenter until it is pushed
+			video_copy_rows(back->pixels, sample->data, sample->stride, row_bytes, out->info.height);
+			EnterCriticalSection(&out->lock);
+			video_queue_push(&out->queue, sample->time);
+			LeaveCriticalSection(&out->lock);
+			SetEvent(out->frame);
+			break;
+		}
+		WaitForSingleObject(out->space, VIDEO_OUT_SLICE);
+	}
+}
+
+static
+DWORD WINAPI decode_proc(LPVOID param)
+{
+	VIDEO_OUT *const out = (VIDEO_OUT *)param;
+	VIDEO_DEC *dec;
+	// the presenter may give up waiting (out->hr is its result then)
+	HRESULT hr = video_dec_open(out->path, &dec, &out->info);
+	if (SUCCEEDED(hr)) {
+		unsigned long const frame_bytes = out->info.width * out->info.height * 4;
+		out->pixels = VirtualAlloc(NULL, VIDEO_QUEUE_FRAMES * frame_bytes, MEM_COMMIT, PAGE_READWRITE);
+		if (NULL == out->pixels) {
+			hr = E_OUTOFMEMORY;
+			video_dec_close(dec);
+		} else {
+			video_queue_init(&out->queue, out->pixels, frame_bytes);
+			if (out->info.channels && !open_audio(out)) {
+				// the video is played without sound
+				out->info.channels = 0;
+			}
+		}
+	}
+	out->hr = hr;
+	SetEvent(out->opened);
+	if (SUCCEEDED(hr)) {
+		while (!out->stop) {
+			VIDEO_DEC_SAMPLE sample;
+			hr = video_dec_read(dec, &sample);
+			if (FAILED(hr)) {
+				kqf_log(KQF_LOGL_WARNING, "video: decoding failed (%#lx)\n", hr);
+				break;
+			}
+			if (VIDEO_DEC_FRAME == sample.kind) {
+				queue_frame(out, &sample);
+			} else if ((VIDEO_DEC_AUDIO == sample.kind) && out->info.channels) {
+				queue_audio(out, (char const *)sample.data, sample.size);
+			}
+			video_dec_done(&sample);
+			if (VIDEO_DEC_END == sample.kind) {
+				break;
+			}
+		}
+		if (out->info.channels) {
+			write_audio(out);
+		}
+		video_dec_close(dec);
+	}
+	InterlockedExchange(&out->ended, 1);
+	SetEvent(out->frame);
+	release_out(out);
+	return (0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// presenter (game thread)
+//
+
+static
+void draw_frame(VIDEO_OUT *out, HDC dc, VIDEO_FRAME const *frame)
+{
+	RECT client;
+	GetClientRect(WindowFromDC(dc), &client);
+	// black bars (the frame is drawn over the rest)
+	if (out->dst.left > 0) {
+		PatBlt(dc, 0, 0, out->dst.left, client.bottom, BLACKNESS);
+		PatBlt(dc, out->dst.right, 0, client.right - out->dst.right, client.bottom, BLACKNESS);
+	}
+	if (out->dst.top > 0) {
+		PatBlt(dc, 0, 0, client.right, out->dst.top, BLACKNESS);
+		PatBlt(dc, 0, out->dst.bottom, client.right, client.bottom - out->dst.bottom, BLACKNESS);
+	}
+	if (frame != NULL) {
+		SetStretchBltMode(dc, COLORONCOLOR);
+		StretchDIBits(dc, out->dst.left, out->dst.top, out->dst.right - out->dst.left, out->dst.bottom - out->dst.top,
+			0, 0, (int)out->info.width, (int)out->info.height, frame->pixels, &out->bmi, DIB_RGB_COLORS, SRCCOPY);
+	} else {
+		PatBlt(dc, out->dst.left, out->dst.top, out->dst.right - out->dst.left, out->dst.bottom - out->dst.top, BLACKNESS);
+	}
+}
+
+static
+LRESULT CALLBACK video_proc(HWND window, UINT message, WPARAM wparam, LPARAM lparam)
+{
+	switch (message) {
+	case WM_ERASEBKGND:
+		return (1);
+	case WM_PAINT:
+		{
+			VIDEO_OUT *const out = (VIDEO_OUT *)GetWindowLongA(window, GWL_USERDATA);
+			PAINTSTRUCT paint;
+			HDC const dc = BeginPaint(window, &paint);
+			if (dc != NULL) {
+				if (out != NULL) {
+					// only the game thread changes the presented frame
+					draw_frame(out, dc, video_queue_current(&out->queue));
+				} else {
+					FillRect(dc, &paint.rcPaint, (HBRUSH)GetStockObject(BLACK_BRUSH));
+				}
+				EndPaint(window, &paint);
+			}
+		}
+		return (0);
+	}
+	return (DefWindowProcA(window, message, wparam, lparam));
+}
+
+static
+HWND create_window(VIDEO_OUT *out, HWND parent)
+{
+	HINSTANCE const instance = (HINSTANCE)GetWindowLongA(parent, GWL_HINSTANCE);
+	RECT client;
+	HWND window;
+	if (!GetClientRect(parent, &client)) {
+		return (NULL);
+	}
+	if (0 == s_video_class) {
+		WNDCLASSA wc;
+		ZeroMemory(&wc, sizeof(wc));
+		wc.lpfnWndProc = video_proc;
+		wc.hInstance = instance;
+		wc.hCursor = NULL;
+		wc.hbrBackground = NULL;
+		wc.lpszClassName = "kq8fix_video";
+		s_video_class = RegisterClassA(&wc);
+		if (0 == s_video_class) {
+			return (NULL);
+		}
+	}
+	video_fit((int)out->info.width, (int)out->info.height, client.right, client.bottom, &out->dst);
+	out->bmi.bmiHeader.biSize = sizeof(out->bmi.bmiHeader);
+	out->bmi.bmiHeader.biWidth = (LONG)out->info.width;
+	out->bmi.bmiHeader.biHeight = -(LONG)out->info.height;  // top-down
+	out->bmi.bmiHeader.biPlanes = 1;
+	out->bmi.bmiHeader.biBitCount = 32;
+	out->bmi.bmiHeader.biCompression = BI_RGB;
+	// disabled: mouse input goes to the game window (removed by the loop)
+	window = CreateWindowExA(0, MAKEINTATOM(s_video_class), NULL, WS_CHILD | WS_DISABLED | WS_CLIPSIBLINGS,
+		0, 0, client.right, client.bottom, parent, NULL, instance, NULL);
+	if (window != NULL) {
+		SetWindowLongA(window, GWL_USERDATA, (LONG)out);
+		SetWindowPos(window, HWND_TOP, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_SHOWWINDOW);
+	}
+	return (window);
+}
+
+static
+int skip_input(MSG const *msg)
+{
+	switch (msg->message) {
+	case WM_KEYDOWN:
+		return ((VK_ESCAPE == msg->wParam) || (VK_SPACE == msg->wParam) || (VK_RETURN == msg->wParam));
+	case WM_LBUTTONDOWN:
+	case WM_RBUTTONDOWN:
+	case WM_NCLBUTTONDOWN:
+	case WM_NCRBUTTONDOWN:
+		return (1);
+	}
+	return (0);
+}
+
+// removes the input of all windows of the thread (before the video window
+// messages are dispatched), returns non-zero to skip the video
+static
+int pump_messages(HWND window)
+{
+	MSG msg;
+	int skip = 0;
+	while (PeekMessageA(&msg, NULL, WM_KEYFIRST, WM_KEYLAST, PM_REMOVE)) {
+		skip |= skip_input(&msg);
+	}
+	while (PeekMessageA(&msg, NULL, WM_MOUSEFIRST, WM_MOUSELAST, PM_REMOVE)) {
+		skip |= skip_input(&msg);
+	}
+	while (PeekMessageA(&msg, NULL, WM_NCMOUSEMOVE, WM_NCMBUTTONDBLCLK, PM_REMOVE)) {
+		skip |= skip_input(&msg);
+	}
+	while (PeekMessageA(&msg, window, 0, 0, PM_REMOVE)) {
+		DispatchMessageA(&msg);
+	}
+	while (PeekMessageA(&msg, NULL, WM_PAINT, WM_PAINT, PM_REMOVE)) {
+		ValidateRect(msg.hwnd, NULL);
+	}
+	return (skip);
+}
+
+static
+int audio_idle(VIDEO_OUT const *out)
+{
+	unsigned int i;
+	for (i = 0; (out->wave != NULL) && (i < VIDEO_OUT_BLOCKS); ++i) {
+		if (WHDR_INQUEUE & out->block[i].dwFlags) {
+			return (0);
+		}
+	}
+	return (1);
+}
+
+
+int video_out_play(HWND parent, char const *path)
+{
+	VIDEO_OUT *out;
+	HANDLE thread;
+	HWND window;
+	DWORD id;
+	DWORD timeout;
+	HRESULT hr;
+	int started = 0;
+	int presented = 0;
+	char const *reason = "finished";
+	LARGE_INTEGER start;
+	LARGE_INTEGER begin;
+	QueryPerformanceCounter(&start);
+	video_stat_player("internal");
+	if (NULL == parent) {
+		return (0);
+	}
+	out = (VIDEO_OUT *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*out));
+	if (NULL == out) {
+		return (0);
+	}
+	if (!GetFullPathNameA(path, MAX_PATH, out->path, NULL)) {
+		lstrcpynA(out->path, path, MAX_PATH);
+	}
+	out->refs = 2;
+	out->opened = CreateEventA(NULL, TRUE, FALSE, NULL);
+	out->frame = CreateEventA(NULL, FALSE, FALSE, NULL);
+	out->space = CreateEventA(NULL, FALSE, FALSE, NULL);
+	out->audio = CreateEventA(NULL, FALSE, FALSE, NULL);
+	InitializeCriticalSection(&out->lock);
+	thread = ((out->opened != NULL) && (out->frame != NULL) && (out->space != NULL) && (out->audio != NULL)) ?
+		CreateThread(NULL, 0, decode_proc, out, 0, &id) : NULL;
+	if (NULL == thread) {
+		kqf_log(KQF_LOGL_ERROR, "video: failed to create decoder thread (%#lx)\n", GetLastError());
+		out->refs = 1;
+		release_out(out);
+		video_stat_fail(VIDEO_FAIL_LAUNCH);
+		return (0);
+	}
+	if (WaitForSingleObject(out->opened, VIDEO_OUT_OPEN) == WAIT_OBJECT_0) {
+		hr = out->hr;
+	} else {
+		kqf_log(KQF_LOGL_WARNING, "video: opening '%s' timed out\n", out->path);
+		hr = E_ABORT;
+	}
+	window = SUCCEEDED(hr) ? create_window(out, parent) : NULL;
+	if (NULL == window) {
+		if (SUCCEEDED(hr)) {
+			kqf_log(KQF_LOGL_WARNING, "video: failed to create the video window (%#lx)\n", GetLastError());
+		} else {
+			kqf_log(KQF_LOGL_WARNING, "video: failed to open '%s' (%#lx)\n", out->path, hr);
+		}
+		InterlockedExchange(&out->stop, 1);
+		SetEvent(out->space);
+		SetEvent(out->audio);
+		CloseHandle(thread);
+		release_out(out);
+		video_stat_fail(VIDEO_FAIL_LAUNCH);
+		return (0);
+	}
+	timeout = out->info.duration ? out->info.duration + VIDEO_OUT_MARGIN : VIDEO_OUT_TIMEOUT;
+	kqf_log(KQF_LOGL_INFO, "video: playing '%s' in-process (%ux%u, %lu ms, %u channels), opened after %lu ms\n",
+		out->path, out->info.width, out->info.height, out->info.duration, out->info.channels, video_stat_ms(&start, NULL));
+
+	begin = start;
+	for (;;) {
+		VIDEO_FRAME const *frame = NULL;
+		DWORD wait = VIDEO_OUT_SLICE;
+		int ended;
+		if (pump_messages(window)) {
+			reason = "skipped";
+			break;
+		}
+		EnterCriticalSection(&out->lock);
+		ended = (0 != out->ended) && (0 == out->queue.count);
+		if (!started && ((out->queue.count > 0) || out->ended || (video_stat_ms(&start, NULL) >= VIDEO_OUT_PREROLL))) {
+			// sound and clock start together
+			QueryPerformanceCounter(&begin);
+			if (out->wave != NULL) {
+				waveOutRestart(out->wave);
+			}
+			started = 1;
+		}
+		if (started) {
+			long const clock = (long)video_stat_ms(&begin, NULL);
+			long next;
+			frame = video_queue_pick(&out->queue, clock);
+			next = video_queue_next(&out->queue);
+			if ((next >= 0) && (next - clock < (long)wait)) {
+				wait = (next > clock) ? (DWORD)(next - clock) : 0;
+			}
+		}
+		LeaveCriticalSection(&out->lock);
+		if (frame != NULL) {
+			HDC const dc = GetDC(window);
+			SetEvent(out->space);
+			if (dc != NULL) {
+				draw_frame(out, dc, frame);
+				ReleaseDC(window, dc);
+			}
+			if (!presented) {
+				presented = 1;
+				video_stat_phase(VIDEO_PHASE_LAUNCH);
+				kqf_log(KQF_LOGL_INFO, "video: first frame after %lu ms\n", video_stat_ms(&start, NULL));
+			}
+		}
+		if (ended && audio_idle(out)) {
+			break;
+		}
+		if (started && (video_stat_ms(&begin, NULL) >= timeout)) {
+			reason = "timeout";
+			video_stat_fail(VIDEO_FAIL_TIMEOUT);
+			break;
+		}
+		MsgWaitForMultipleObjects(1, &out->frame, FALSE, wait, QS_ALLINPUT);
+	}
+	if (!presented) {
+		video_stat_phase(VIDEO_PHASE_LAUNCH);
+	}
+	video_stat_phase(VIDEO_PHASE_PLAYBACK);
+	InterlockedExchange(&out->stop, 1);
+	SetEvent(out->space);
+	SetEvent(out->audio);
+	if (out->wave != NULL) {
+		// returns the queued buffers, the decoder thread cannot block on them
+		waveOutReset(out->wave);
+	}
+	if (WaitForSingleObject(thread, VIDEO_OUT_OPEN) != WAIT_OBJECT_0) {
+		kqf_log(KQF_LOGL_WARNING, "video: decoder thread did not stop\n");
+	}
+	CloseHandle(thread);
+	DestroyWindow(window);
+	InvalidateRect(parent, NULL, TRUE);
+	video_stat_phase(VIDEO_PHASE_RESTORE);
+	kqf_log(KQF_LOGL_INFO, "video: playback %s after %lu ms (%lu frames, %lu dropped)\n",
+		reason, video_stat_ms(&start, NULL), out->queue.presented, out->queue.dropped);
+	release_out(out);
+	return (1);
+}
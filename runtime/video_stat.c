@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "video_stat.h"
+
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                          Video hand-off timing
+//
+// Each video passes through the same phases (hide the game window, start the
+// player, find its window, make it fullscreen, wait for the end, and restore
+// the game window). The phases are timed with the performance counter and
+// reported per video; the durations are collected in a coarse histogram
+// (1-3-10 steps) per phase and logged with the failure counters at unload,
+// so that players and machines can be compared. All calls are made by the
+// game thread during the (blocking) video playback, no locking is required.
+//
+
+#define VIDEO_STAT_BINS 8
+
+static DWORD const bin_limit[VIDEO_STAT_BINS - 1] = {10, 30, 100, 300, 1000, 3000, 10000};
+
+static char const *const phase_name[VIDEO_PHASE_COUNT] = {
+	"hide", "launch", "find", "fullscreen", "playback", "restore"
+};
+static char const *const fail_name[VIDEO_FAIL_COUNT] = {
+	"launch", "window", "timeout", "foreground"
+};
+
+static struct VIDEO_STAT_PHASE {
+	DWORD count;
+	DWORD bin[VIDEO_STAT_BINS];
+	DWORD min;
+	DWORD max;
+	DWORD sum_lo;  // ms (wvsprintf has no 64-bit support)
+	DWORD sum_hi;
+} s_phase[VIDEO_PHASE_COUNT] /* = {0} */;
+
+static DWORD s_fail[VIDEO_FAIL_COUNT] /* = {0} */;
+static DWORD s_videos /* = 0 */;
+
+static struct VIDEO_STAT_CURRENT {
+	int           active;
+	char const   *file;
+	char const   *player;
+	LARGE_INTEGER start;
+	LARGE_INTEGER last;
+	DWORD         ms[VIDEO_PHASE_COUNT];
+	unsigned int  done;   // phase mask
+	unsigned int  fail;   // failure mask
+} s_cur /* = {0} */;
+
+
+DWORD video_stat_ms(LARGE_INTEGER const *from, LARGE_INTEGER const *to)
+{
+	LARGE_INTEGER freq, now;
+	if (!QueryPerformanceFrequency(&freq) || (freq.QuadPart <= 0)) {
+		return (0);
+	}
+	if (NULL == to) {
+		QueryPerformanceCounter(&now);
+		to = &now;
+	}
+	return ((DWORD)((double)(to->QuadPart - from->QuadPart) * 1000.0 / (double)freq.QuadPart));
+}
+
+static
+void collect(VIDEO_PHASE_ phase, DWORD ms)
+{
+	struct VIDEO_STAT_PHASE *stat = &s_phase[phase];
+	int bin = 0;
+	while ((bin < VIDEO_STAT_BINS - 1) && (ms >= bin_limit[bin])) {
+		++bin;
+	}
+	++stat->bin[bin];
+	if ((0 == stat->count) || (ms < stat->min)) {
+		stat->min = ms;
+	}
+	if (ms > stat->max) {
+		stat->max = ms;
+	}
+	++stat->count;
+	stat->sum_lo += ms;
+	if (stat->sum_lo < ms) {
+		++stat->sum_hi;
+	}
+}
+
+
+void video_stat_begin(char const *file)
+{
+	ZeroMemory(&s_cur, sizeof(s_cur));
+	s_cur.active = 1;
+	s_cur.file = file;
+	s_cur.player = "-";
+	QueryPerformanceCounter(&s_cur.start);
+	s_cur.last = s_cur.start;
+}
+
+void video_stat_player(char const *name)
+{
+	if (s_cur.active) {
+		s_cur.player = name;
+	}
+}
+
+void video_stat_phase(VIDEO_PHASE_ phase)
+{
+	if (s_cur.active) {
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		s_cur.ms[phase] += video_stat_ms(&s_cur.last, &now);
+		s_cur.done |= 1U << phase;
+		s_cur.last = now;
+	}
+}
+
+void video_stat_fail(VIDEO_FAIL_ fail)
+{
+	if (s_cur.active) {
+		s_cur.fail |= 1U << fail;
+	}
+}
+
+void video_stat_end(void)
+{
+	LARGE_INTEGER now;
+	char fails[64];
+	int i;
+	if (!s_cur.active) {
+		return;
+	}
+	QueryPerformanceCounter(&now);
+	fails[0] = '\0';
+	for (i = 0; i < VIDEO_PHASE_COUNT; ++i) {
+		if (s_cur.done & (1U << i)) {
+			collect((VIDEO_PHASE_)i, s_cur.ms[i]);
+		}
+	}
+	for (i = 0; i < VIDEO_FAIL_COUNT; ++i) {
+		if (s_cur.fail & (1U << i)) {
+			++s_fail[i];
+			lstrcatA(fails, " ");
+			lstrcatA(fails, fail_name[i]);
+		}
+	}
+	++s_videos;
+	kqf_log(KQF_LOGL_INFO, "video: '%s' (%s) total %lu ms: hide %lu, launch %lu, find %lu, fullscreen %lu, playback %lu, restore %lu%s%s\n",
+		s_cur.file, s_cur.player, video_stat_ms(&s_cur.start, &now),
+		s_cur.ms[VIDEO_PHASE_HIDE], s_cur.ms[VIDEO_PHASE_LAUNCH], s_cur.ms[VIDEO_PHASE_FIND],
+		s_cur.ms[VIDEO_PHASE_FULLSCREEN], s_cur.ms[VIDEO_PHASE_PLAYBACK], s_cur.ms[VIDEO_PHASE_RESTORE],
+		fails[0] ? ", failed:" : "", fails);
+	s_cur.active = 0;
+}
+
+void free_video_stat(void)
+{
+	int i;
+	if (0 == s_videos) {
+		return;
+	}
+	kqf_log(KQF_LOGL_FORCE, "video: %lu videos, failures: launch %lu, window %lu, timeout %lu, foreground %lu\n",
+		s_videos, s_fail[VIDEO_FAIL_LAUNCH], s_fail[VIDEO_FAIL_WINDOW], s_fail[VIDEO_FAIL_TIMEOUT], s_fail[VIDEO_FAIL_FOREGROUND]);
+	kqf_log(KQF_LOGL_FORCE, "video: phase        <10ms <30ms <0.1s <0.3s   <1s   <3s  <10s  more     min     avg     max\n");
+	for (i = 0; i < VIDEO_PHASE_COUNT; ++i) {
+		struct VIDEO_STAT_PHASE const *stat = &s_phase[i];
+		DWORD avg = 0;
+		if (0 == stat->count) {
+			continue;
+		}
+		if (0 == stat->sum_hi) {
+			avg = stat->sum_lo / stat->count;
+		} else {
+			avg = (DWORD)((((double)stat->sum_hi * 4294967296.0) + (double)stat->sum_lo) / (double)stat->count);
+		}
+		kqf_log(KQF_LOGL_FORCE, "video: %-10s %6lu%6lu%6lu%6lu%6lu%6lu%6lu%6lu%8lu%8lu%8lu\n", phase_name[i],
+			stat->bin[0], stat->bin[1], stat->bin[2], stat->bin[3], stat->bin[4], stat->bin[5], stat->bin[6], stat->bin[7],
+			stat->min, avg, stat->max);
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef VIDEO_STAT_H_
+#define VIDEO_STAT_H_
+
+#include "../common/kqf_win.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef enum VIDEO_PHASE_ {
+	VIDEO_PHASE_HIDE,        // hide the game window
+	VIDEO_PHASE_LAUNCH,      // start the player (or open the decoder)
+	VIDEO_PHASE_FIND,        // wait for the player window
+	VIDEO_PHASE_FULLSCREEN,  // activate/maximize the player window
+	VIDEO_PHASE_PLAYBACK,    // wait for the end of the video
+	VIDEO_PHASE_RESTORE,     // restore and re-activate the game window
+	VIDEO_PHASE_COUNT
+} VIDEO_PHASE_;
+
+typedef enum VIDEO_FAIL_ {
+	VIDEO_FAIL_LAUNCH,       // player could not be started
+	VIDEO_FAIL_WINDOW,       // no player window found
+	VIDEO_FAIL_TIMEOUT,      // end of the video not detected
+	VIDEO_FAIL_FOREGROUND,   // game window not in the foreground again
+	VIDEO_FAIL_COUNT
+} VIDEO_FAIL_;
+
+// per video (game thread only)
+void video_stat_begin(char const *file);
+void video_stat_player(char const *name);
+void video_stat_phase(VIDEO_PHASE_ phase);  // ends the phase (time since the last call)
+void video_stat_fail(VIDEO_FAIL_ fail);
+void video_stat_end(void);  // logs the video report
+
+// ms between two QueryPerformanceCounter values (to NULL: now, 0 without counter)
+DWORD video_stat_ms(LARGE_INTEGER const *from, LARGE_INTEGER const *to);
+
+// logs the session histogram (at unload)
+void free_video_stat(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "volume_cache.h"
+
+#include "../common/kqf_cfg.h"
+#include "../common/kqf_log.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                         Volume information cache
+//
+// The game queries the free disk space before every new game and every world
+// unpack, and the drive type and volume information during the CD-ROM checks.
+// Each query goes to the file system driver and blocks on empty CD-ROM drives
+// and slow network shares. The results (including failures) are cached per
+// root path: the drive type for the session (unless the root does not exist or
+// the type is unknown, a virtual drive might be mounted later), the cluster
+// geometry with the free clusters for VOLCACHE_SPACE_TTL milliseconds, and
+// the label and serial number for VOLCACHE_INFO_TTL milliseconds (media
+// change). Failures on removable and CD-ROM drives (no media) are only kept
+// for VOLCACHE_MEDIA_TTL milliseconds, so an inserted disc is seen by the
+// next check of the game, but a polling loop does not spin up the drive on
+// every call. The CD-ROM size rewriting (cdrom.size) and the 2 GiB clamp (shim.gdfs) are applied once per
+// refresh and the callers get the adjusted values. A NULL root path is mapped
+// to the root of the current drive (other paths are not cached).
+//
+
+enum VOLCACHE_ {
+	VOLCACHE_SLOTS     = 8,
+	VOLCACHE_SPACE_TTL = 2000,   // ms
+	VOLCACHE_INFO_TTL  = 10000,  // ms
+	VOLCACHE_MEDIA_TTL = 500     // ms (failures on removable and CD-ROM drives)
+};
+
+typedef struct VOLCACHE_ENTRY {
+	CHAR  root[MAX_PATH];        // "" = unused
+	DWORD used;                  // GetTickCount() of the last lookup
+	int   type_valid;
+	UINT  type;
+	int   space_valid;
+	DWORD space_tick;
+	DWORD space_ttl;
+	BOOL  space_result;
+	DWORD space_error;
+	DWORD space[4];              // sectors/cluster, bytes/sector, free clusters, total clusters
+	int   info_valid;
+	DWORD info_tick;
+	DWORD info_ttl;
+	BOOL  info_result;
+	DWORD info_error;
+	DWORD serial;
+	DWORD max_component;
+	DWORD flags;
+	CHAR  label[MAX_PATH + 1];
+	CHAR  file_system[MAX_PATH + 1];
+} VOLCACHE_ENTRY;
+
+static LONG /*volatile*/ s_active /* = 0 */;
+static LONG /*volatile*/ s_hits /* = 0 */;
+static LONG /*volatile*/ s_misses /* = 0 */;
+static CRITICAL_SECTION s_lock;
+static VOLCACHE_ENTRY s_entry[VOLCACHE_SLOTS] /* = {0} */;
+
+
+// cache key for the root path (0 = not cached)
+static
+int volume_key(LPCSTR root, CHAR key[MAX_PATH])
+{
+	if (!s_active) {
+		return (0);
+	}
+	if (NULL == root) {
+		CHAR path[MAX_PATH];
+		DWORD const len = GetCurrentDirectoryA(ARRAYSIZE(path), path);
+		if ((len < 3) || (len >= ARRAYSIZE(path)) || (path[1] != ':') || (path[2] != '\\')) {
+			return (0);
+		}
+		lstrcpynA(key, path, 4);
+		return (1);
+	}
+	if (lstrlenA(root) >= MAX_PATH) {
+		return (0);
+	}
+	lstrcpyA(key, root);
+	return (1);
+}
+
+// entry for the key (s_lock has to be held, create replaces the oldest entry)
+static
+VOLCACHE_ENTRY *volume_entry(LPCSTR key, int create)
+{
+	VOLCACHE_ENTRY *slot = &s_entry[0];
+	int i;
+	for (i = 0; i < VOLCACHE_SLOTS; ++i) {
+		VOLCACHE_ENTRY *entry = &s_entry[i];
+		if (entry->root[0] && (0 == lstrcmpiA(entry->root, key))) {
+			entry->used = GetTickCount();
+			return (entry);
+		}
+		if (!entry->root[0] || (slot->root[0] && (entry->used - slot->used > 0x7FFFFFFFUL))) {
+			// free slot or the oldest one
+			slot = entry;
+		}
+	}
+	if (!create) {
+		return (NULL);
+	}
+	ZeroMemory(slot, sizeof(*slot));
+	lstrcpyA(slot->root, key);
+	slot->used = GetTickCount();
+	return (slot);
+}
+
+// lifetime of a query result (failures on drives with removable media are short)
+static
+DWORD volume_ttl(LPCSTR key, BOOL result, DWORD ttl)
+{
+	if (!result) {
+		UINT const type = volume_cache_type(key);
+		if ((DRIVE_REMOVABLE == type) || (DRIVE_CDROM == type)) {
+			return (VOLCACHE_MEDIA_TTL);
+		}
+	}
+	return (ttl);
+}
+
+static
+BOOL query_space(LPCSTR root, DWORD space[4], LPDWORD error)
+{
+	BOOL result;
+	DWORD mode =
+		SetErrorMode(SEM_NOOPENFILEERRORBOX);
+		SetErrorMode(SEM_NOOPENFILEERRORBOX | mode);
+	ZeroMemory(space, 4 * sizeof(DWORD));
+	result = GetDiskFreeSpaceA(root, &space[0], &space[1], &space[2], &space[3]);
+	*error = result ? ERROR_SUCCESS : GetLastError();
+	SetErrorMode(mode);
+	if (kqf_get_opt(KQF_CFGO_CDROM_SIZE) && result && (DRIVE_CDROM == volume_cache_type(root))) {
+		DWORD TotalBytes = space[3] * space[0] * space[1];
+		if (space[2]) {
+			kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: number of free clusters overridden for CD-ROM ('%s')\n", root ? root : "");
+			space[2] = 0;
+		}
+		if ((TotalBytes < 670 * 1024*1024) || (685 * 1024*1024 < TotalBytes)) {
+			kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: total number of clusters overridden for CD-ROM ('%s')\n", root ? root : "");
+			space[0] = 16;
+			space[1] = 2048;
+			space[3] = (670 * 1024*1024) / 2048 / 16;
+		}
+	}
+	if (kqf_get_opt(KQF_CFGO_SHIM_GDFS) && result && space[0] && space[1]) {
+		DWORD ClusterLimit = MAXLONG / space[0] / space[1];
+		if (space[2] > ClusterLimit) {
+			kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: number of free clusters limited to 2 GiB (%lu,%lu,'%s')\n", space[2], ClusterLimit, root ? root : "");
+			space[2] = ClusterLimit;
+		}
+		if (space[3] > ClusterLimit) {
+			kqf_log(KQF_LOGL_INFO, "GetDiskFreeSpaceA: total number of clusters limited to 2 GiB (%lu,%lu,'%s')\n", space[3], ClusterLimit, root ? root : "");
+			space[3] = ClusterLimit;
+		}
+	}
+	return (result);
+}
+
+
+int init_volume_cache(void)
+{
+	if (!s_active) {
+		InitializeCriticalSection(&s_lock);
+		InterlockedExchange(&s_active, 1);
+	}
+	return (1);
+}
+
+void free_volume_cache(void)
+{
+	if (s_active) {
+		kqf_log(KQF_LOGL_INFO, "VolumeCache: %li hits, %li misses\n", s_hits, s_misses);
+	}
+}
+
+UINT volume_cache_type(LPCSTR lpRootPathName)
+{
+	CHAR key[MAX_PATH];
+	VOLCACHE_ENTRY *entry;
+	UINT result;
+	if (!volume_key(lpRootPathName, key)) {
+		return (GetDriveTypeA(lpRootPathName));
+	}
+	EnterCriticalSection(&s_lock);
+	entry = volume_entry(key, 0);
+	if (entry && entry->type_valid) {
+		result = entry->type;
+		LeaveCriticalSection(&s_lock);
+		InterlockedIncrement(&s_hits);
+		return (result);
+	}
+	LeaveCriticalSection(&s_lock);
+	InterlockedIncrement(&s_misses);
+
+	// the query is not made under the lock (optical and network drives might block)
+	result = GetDriveTypeA(key);
+	if ((DRIVE_UNKNOWN == result) || (DRIVE_NO_ROOT_DIR == result)) {
+		return (result);
+	}
+	EnterCriticalSection(&s_lock);
+	entry = volume_entry(key, 1);
+	entry->type = result;
+	entry->type_valid = 1;
+	LeaveCriticalSection(&s_lock);
+	return (result);
+}
+
+BOOL volume_cache_space(LPCSTR lpRootPathName, LPDWORD lpSectorsPerCluster, LPDWORD lpBytesPerSector, LPDWORD lpNumberOfFreeClusters, LPDWORD lpTotalNumberOfClusters)
+{
+	CHAR key[MAX_PATH];
+	VOLCACHE_ENTRY *entry;
+	DWORD space[4];
+	DWORD error;
+	BOOL result;
+	if (!volume_key(lpRootPathName, key)) {
+		result = query_space(lpRootPathName, space, &error);
+	} else {
+		EnterCriticalSection(&s_lock);
+		entry = volume_entry(key, 0);
+		if (entry && entry->space_valid && (GetTickCount() - entry->space_tick < entry->space_ttl)) {
+			result = entry->space_result;
+			error = entry->space_error;
+			CopyMemory(space, entry->space, sizeof(space));
+			LeaveCriticalSection(&s_lock);
+			InterlockedIncrement(&s_hits);
+		} else {
+			DWORD ttl;
+			LeaveCriticalSection(&s_lock);
+			InterlockedIncrement(&s_misses);
+			result = query_space(key, space, &error);
+			ttl = volume_ttl(key, result, VOLCACHE_SPACE_TTL);
+			EnterCriticalSection(&s_lock);
+			entry = volume_entry(key, 1);
+			entry->space_result = result;
+			entry->space_error = error;
+			CopyMemory(entry->space, space, sizeof(space));
+			entry->space_tick = GetTickCount();
+			entry->space_ttl = ttl;
+			entry->space_valid = 1;
+			LeaveCriticalSection(&s_lock);
+		}
+	}
+	if (lpSectorsPerCluster)     *lpSectorsPerCluster     = space[0];
+	if (lpBytesPerSector)        *lpBytesPerSector        = space[1];
+	if (lpNumberOfFreeClusters)  *lpNumberOfFreeClusters  = space[2];
+	if (lpTotalNumberOfClusters) *lpTotalNumberOfClusters = space[3];
+	SetLastError(error);
+	return (result);
+}
+
+BOOL volume_cache_info(LPCSTR lpRootPathName, LPSTR lpVolumeNameBuffer, DWORD nVolumeNameSize, LPDWORD lpVolumeSerialNumber, LPDWORD lpMaximumComponentLength, LPDWORD lpFileSystemFlags, LPSTR lpFileSystemNameBuffer, DWORD nFileSystemNameSize)
+{
+	CHAR key[MAX_PATH];
+	VOLCACHE_ENTRY *entry;
+	VOLCACHE_ENTRY info;
+	if (!volume_key(lpRootPathName, key)) {
+		return (GetVolumeInformationA(lpRootPathName, lpVolumeNameBuffer, nVolumeNameSize, lpVolumeSerialNumber, lpMaximumComponentLength, lpFileSystemFlags, lpFileSystemNameBuffer, nFileSystemNameSize));
+	}
+	EnterCriticalSection(&s_lock);
+	entry = volume_entry(key, 0);
+	if (entry && entry->info_valid && (GetTickCount() - entry->info_tick < entry->info_ttl)) {
+		CopyMemory(&info, entry, sizeof(info));
+		LeaveCriticalSection(&s_lock);
+		InterlockedIncrement(&s_hits);
+	} else {
+		DWORD mode;
+		LeaveCriticalSection(&s_lock);
+		InterlockedIncrement(&s_misses);
+		ZeroMemory(&info, sizeof(info));
+		mode = SetErrorMode(SEM_NOOPENFILEERRORBOX);
+		SetErrorMode(SEM_NOOPENFILEERRORBOX | mode);
+		info.info_result = GetVolumeInformationA(key, info.label, ARRAYSIZE(info.label), &info.serial, &info.max_component, &info.flags, info.file_system, ARRAYSIZE(info.file_system));
+		info.info_error = info.info_result ? ERROR_SUCCESS : GetLastError();
+		SetErrorMode(mode);
+		info.info_ttl = volume_ttl(key, info.info_result, VOLCACHE_INFO_TTL);
+		EnterCriticalSection(&s_lock);
+		entry = volume_entry(key, 1);
+		entry->info_result = info.info_result;
+		entry->info_error = info.info_error;
+		entry->serial = info.serial;
+		entry->max_component = info.max_component;
+		entry->flags = info.flags;
+		lstrcpyA(entry->label, info.label);
+		lstrcpyA(entry->file_system, info.file_system);
+		entry->info_tick = GetTickCount();
+		entry->info_ttl = info.info_ttl;
+		entry->info_valid = 1;
+		LeaveCriticalSection(&s_lock);
+	}
+	if (info.info_result) {
+		if (lpVolumeNameBuffer && nVolumeNameSize)
+			lstrcpynA(lpVolumeNameBuffer, info.label, nVolumeNameSize);
+		if (lpVolumeSerialNumber)
+			*lpVolumeSerialNumber = info.serial;
+		if (lpMaximumComponentLength)
+			*lpMaximumComponentLength = info.max_component;
+		if (lpFileSystemFlags)
+			*lpFileSystemFlags = info.flags;
+		if (lpFileSystemNameBuffer && nFileSystemNameSize)
+			lstrcpynA(lpFileSystemNameBuffer, info.file_system, nFileSystemNameSize);
+	}
+	SetLastError(info.info_error);
+	return (info.info_result);
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// single translation unit for the custom build step
+#include "../common/kqf_pak.c"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                         Shim runtime packer
+//
+// Build tool (custom build step of the setup project, compiled on the fly):
+//   kqfpack <kq8fix.dll> <kq8fix.pak>
+// Writes the KQF_PAK_ payload that is embedded as IDX_RUNTIME. Blocks that do
+// not get smaller are stored.
+//
+
+typedef LONG (NTAPI *RTLGETCOMPRESSIONWORKSPACESIZE)(USHORT, PULONG, PULONG);
+typedef LONG (NTAPI *RTLCOMPRESSBUFFER)(USHORT, PUCHAR, ULONG, PUCHAR, ULONG, ULONG, PULONG, PVOID);
+
+
+static
+int fail(char const *text, char const *name)
+{
+	char msg[MAX_PATH + 128];
+	DWORD written;
+	wsprintfA(msg, "kqfpack: %s '%s' (%#lx)\r\n", text, name, GetLastError());
+	WriteFile(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenA(msg), &written, NULL);
+	return (1);
+}
+
+static
+int write_all(HANDLE file, void const *data, DWORD size)
+{
+	DWORD written = 0;
+	return (WriteFile(file, data, size, &written, NULL) && (written == size));
+}
+
+int main(int argc, char *argv[])
+{
+	int result = 1;
+	HANDLE file;
+	DWORD size;
+	unsigned char *data;
+	RTLGETCOMPRESSIONWORKSPACESIZE RtlGetCompressionWorkSpaceSize;
+	RTLCOMPRESSBUFFER RtlCompressBuffer;
+	HMODULE ntdll = GetModuleHandleA("NTDLL.dll");
+	if (argc != 3) {
+		return (fail("usage: kqfpack <input> <output>", ""));
+	}
+	RtlGetCompressionWorkSpaceSize = (RTLGETCOMPRESSIONWORKSPACESIZE)GetProcAddress(ntdll, "RtlGetCompressionWorkSpaceSize");
+	RtlCompressBuffer = (RTLCOMPRESSBUFFER)GetProcAddress(ntdll, "RtlCompressBuffer");
+	if ((NULL == RtlGetCompressionWorkSpaceSize) || (NULL == RtlCompressBuffer)) {
+		return (fail("compression not supported", "NTDLL.dll"));
+	}
+	file = CreateFileA(argv[1], GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (INVALID_HANDLE_VALUE == file) {
+		return (fail("failed to open", argv[1]));
+	}
+	size = GetFileSize(file, NULL);
+	data = (unsigned char *)VirtualAlloc(NULL, size + 1, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if ((NULL == data) || !ReadFile(file, data, size, &size, NULL)) {
+		CloseHandle(file);
+		return (fail("failed to read", argv[1]));
+	}
+	CloseHandle(file);
+	file = CreateFileA(argv[2], GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == file) {
+		return (fail("failed to create", argv[2]));
+	}
+	{
+		USHORT const format = COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_MAXIMUM;
+		ULONG work_size = 0;
+		ULONG frag_size = 0;
+		PVOID work;
+		static unsigned char packed[KQF_PAK_CHUNK];
+		KQF_PAK_HEADER header;
+		header.magic = KQF_PAK_MAGIC;
+		header.size = size;
+		header.crc = kqf_pak_crc(0, data, size);
+		header.blocks = (size + KQF_PAK_CHUNK - 1) / KQF_PAK_CHUNK;
+		RtlGetCompressionWorkSpaceSize(format, &work_size, &frag_size);
+		work = VirtualAlloc(NULL, work_size + 1, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if ((work != NULL) && write_all(file, &header, sizeof(header))) {
+			DWORD pos;
+			DWORD total = sizeof(header);
+			for (pos = 0; pos < size; pos += KQF_PAK_CHUNK) {
+				KQF_PAK_BLOCK block;
+				void const *out = packed;
+				block.size = (size - pos < KQF_PAK_CHUNK) ? (size - pos) : KQF_PAK_CHUNK;
+				block.packed = 0;
+				if ((RtlCompressBuffer(format, &data[pos], block.size, packed, block.size,
+				    4096, &block.packed, work) < 0) || (block.packed >= block.size)) {
+					block.packed = block.size;
+					out = &data[pos];
+				}
+				if (!write_all(file, &block, sizeof(block)) || !write_all(file, out, block.packed))
+					break;
+				total += sizeof(block) + block.packed;
+			}
+			if (pos >= size) {
+				wsprintfA((char *)packed, "kqfpack: %lu -> %lu bytes, crc %08lX\r\n", size, total, header.crc);
+				write_all(GetStdHandle(STD_OUTPUT_HANDLE), packed, lstrlenA((char *)packed));
+				result = 0;
+			}
+		}
+	}
+	CloseHandle(file);
+	if (result != 0) {
+		DeleteFileA(argv[2]);
+		return (fail("failed to write", argv[2]));
+	}
+	return (result);
+}
@@ -24,9 +24,14 @@
 #include "../common/kqf_app.h"
 #include "../common/kqf_cfg.h"
 #include "../common/kqf_log.h"
+#include "../common/kqf_pak.h"
 #include "../common/kqf_init.h"
 #include "../common/kqf_win.h"
 
+#pragma warning(push, 1)
+# include <stdarg.h>
+#pragma warning(pop)
+
 
 typedef struct EDITCOOKIE {
 	BYTE const *data;
@@ -124,69 +129,184 @@ int error_msg(HWND dlg, UINT id, UINT type, DWORD error)
 }
 
 
+// existing file is a newer release of the shim runtime (version resource only)
 static
-DWORD extract_hook(HWND dlg)
+int newer_hook(char const path[MAX_PATH])
 {
-	char path[MAX_PATH];
-	kqf_app_filepath(KQMOE_RT_FIXNEW, path);
-	{
-		HMODULE hook = LoadLibraryA(path);
-		if (hook != NULL) {
-			DLLGETVERSIONPROC DllGetVersion = (DLLGETVERSIONPROC)GetProcAddress(hook, "DllGetVersion");
-			if (NULL == DllGetVersion) {
-				kqf_log(KQF_LOGL_NOTICE, "extract_hook: shim runtime version callback missing\n");
+	int result = 0;
+	DWORD handle = 0;
+	DWORD size = GetFileVersionInfoSizeA(path, &handle);
+	if (size > 0) {
+		LPVOID data = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (data != NULL) {
+			VS_FIXEDFILEINFO *info = NULL;
+			UINT length = 0;
+			if (GetFileVersionInfoA(path, handle, size, data) &&
+			    VerQueryValueA(data, "\\", (LPVOID *)&info, &length) &&
+			    (info != NULL) && (length >= sizeof(*info))) {
+				DWORD const ms = MAKELONG(KQF_VERF_MINOR, KQF_VERF_MAJOR);
+				kqf_log(KQF_LOGL_INFO, "extract_hook: shim runtime already exists (%u.%u.%u.%u)\n",
+					HIWORD(info->dwFileVersionMS), LOWORD(info->dwFileVersionMS),
+					HIWORD(info->dwFileVersionLS), LOWORD(info->dwFileVersionLS));
+				result = (LOWORD(info->dwFileVersionLS) == KQF_VERF_FLAGS) && (
+					(info->dwFileVersionMS > ms) || ((info->dwFileVersionMS == ms) &&
+					(HIWORD(info->dwFileVersionLS) > KQF_VERF_PATCH)));
+			}
+			VirtualFree(data, 0, MEM_RELEASE);
+		}
+	}
+	return (result);
+}
+
+// existing file has the same size and CRC-32 as the payload
+static
+int same_hook(char const path[MAX_PATH], KQF_PAK_HEADER const *pak)
+{
+	int result = 0;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file != INVALID_HANDLE_VALUE) {
+		if (GetFileSize(file, NULL) == pak->size) {
+			if (0 == pak->size) {
+				result = 1;
 			} else {
-				DLLVERSIONINFO2 ver = {{sizeof(DLLVERSIONINFO2), 0, 0, 0, 0}, 0, 0};
-				if (S_OK == DllGetVersion(&ver.info1)) {
-					kqf_log(KQF_LOGL_INFO, "extract_hook: shim runtime already exists (%lu.%lu.%hu.%lu)\n",
-						ver.info1.dwMajorVersion, ver.info1.dwMinorVersion, HIWORD(ver.ullVersion), ver.info1.dwBuildNumber);
-					if ((ver.info1.dwBuildNumber == KQF_VERF_FLAGS) && (ver.ullVersion >= MAKEDLLVERULL(KQF_VERF_MAJOR, KQF_VERF_MINOR, KQF_VERF_PATCH, 0))) {
-						FreeLibrary(hook);
-						return (ERROR_SUCCESS);
+				HANDLE map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (map != NULL) {
+					void const *base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+					if (base != NULL) {
+						result = (kqf_pak_crc(0, base, pak->size) == pak->crc);
+						UnmapViewOfFile(base);
 					}
+					CloseHandle(map);
 				}
 			}
-			FreeLibrary(hook);
 		}
+		CloseHandle(file);
 	}
-	{
-		DWORD status;
-		HRSRC res_info = FindResourceA(NULL, MAKEINTRESOURCEA(IDX_RUNTIME), RT_RCDATA);
-		if (NULL == res_info) {
+	return (result);
+}
+
+// stream the (compressed) payload to the file
+static
+DWORD write_hook(HANDLE file, KQF_PAK_HEADER const *pak, unsigned char const *data, DWORD size)
+{
+	DWORD status = ERROR_SUCCESS;
+	DWORD crc = 0;
+	DWORD total = 0;
+	DWORD pos = sizeof(*pak);
+	DWORD block;
+	unsigned char *out;
+	if (pak->magic != KQF_PAK_MAGIC) {
+		DWORD written = 0;
+		if (!WriteFile(file, data, size, &written, NULL))
+			return (GetLastError());
+		return ((written != size) ? ERROR_WRITE_FAULT : ERROR_SUCCESS);
+	}
+	out = (unsigned char *)VirtualAlloc(NULL, KQF_PAK_CHUNK, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (NULL == out) {
+		return (GetLastError());
+	}
+	for (block = 0; (ERROR_SUCCESS == status) && (block < pak->blocks); ++block) {
+		KQF_PAK_BLOCK const *head = (KQF_PAK_BLOCK const *)&data[pos];
+		DWORD written = 0;
+		if ((size - pos < sizeof(*head)) || (size - pos - sizeof(*head) < head->packed)) {
+			status = ERROR_INVALID_DATA;
+		} else if (ERROR_SUCCESS == (status = kqf_pak_unpack(head, head + 1, out))) {
+			pos += sizeof(*head) + head->packed;
+			crc = kqf_pak_crc(crc, out, head->size);
+			total += head->size;
+			if (!WriteFile(file, out, head->size, &written, NULL)) {
+				status = GetLastError();
+			} else if (written != head->size) {
+				status = ERROR_WRITE_FAULT;
+			}
+		}
+	}
+	VirtualFree(out, 0, MEM_RELEASE);
+	if ((ERROR_SUCCESS == status) && ((total != pak->size) || (crc != pak->crc))) {
+		status = ERROR_CRC;
+	}
+	return (status);
+}
+
+static
+DWORD extract_hook_path(HWND dlg, char const path[MAX_PATH])
+{
+	DWORD status;
+	HRSRC res_info = FindResourceA(NULL, MAKEINTRESOURCEA(IDX_RUNTIME), RT_RCDATA);
+	if (NULL == res_info) {
+		status = GetLastError();
+		kqf_log(KQF_LOGL_ERROR, "extract_hook: shim runtime resource not found (%#lx)\n", status);
+	} else {
+		HGLOBAL res_data = LoadResource(NULL, res_info);
+		if (NULL == res_data) {
 			status = GetLastError();
-			kqf_log(KQF_LOGL_ERROR, "extract_hook: shim runtime resource not found (%#lx)\n", status);
+			kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to load shim runtime resource (%#lx)\n", status);
 		} else {
-			HGLOBAL res_data = LoadResource(NULL, res_info);
-			if (NULL == res_data) {
-				status = GetLastError();
-				kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to load shim runtime resource (%#lx)\n", status);
+			unsigned char const *data = (unsigned char const *)LockResource(res_data);
+			DWORD size = SizeofResource(NULL, res_info);
+			KQF_PAK_HEADER pak;
+			if ((size >= sizeof(pak)) && (KQF_PAK_MAGIC == ((KQF_PAK_HEADER const *)data)->magic)) {
+				pak = *(KQF_PAK_HEADER const *)data;
 			} else {
-				LPVOID data = LockResource(res_data);
-				DWORD size = SizeofResource(NULL, res_info);
-				HANDLE file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-				if (INVALID_HANDLE_VALUE == file) {
+				// uncompressed (debug build)
+				pak.magic = 0;
+				pak.size = size;
+				pak.crc = kqf_pak_crc(0, data, size);
+				pak.blocks = 0;
+			}
+			if (same_hook(path, &pak)) {
+				kqf_log(KQF_LOGL_INFO, "extract_hook: shim runtime is up to date (%08lx)\n", pak.crc);
+				return (ERROR_SUCCESS);
+			}
+			if (newer_hook(path)) {
+				return (ERROR_SUCCESS);
+			}
+			{
+				// the working runtime is only replaced by a completely written file
+				char dir[MAX_PATH];
+				char tmp[MAX_PATH];
+				char const *name = path + lstrlenA(path);
+				while ((name > path) && (name[-1] != '\\') && (name[-1] != '/')) {
+					--name;
+				}
+				lstrcpynA(dir, path, (int)(name - path) + 1);
+				if (0 == GetTempFileNameA(dir[0] ? dir : ".", "kqf", 0, tmp)) {
 					status = GetLastError();
-					kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to create shim runtime file (%#lx)\n", status);
+					kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to create temporary shim runtime file (%#lx)\n", status);
 				} else {
-					DWORD written;
-					if (!WriteFile(file, data, size, &written, NULL)) {
+					HANDLE file = CreateFileA(tmp, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+					if (INVALID_HANDLE_VALUE == file) {
 						status = GetLastError();
-						kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to write shim runtime file (%#lx)\n", status);
-					} else if (written != size) {
-						status = ERROR_WRITE_FAULT;
-						kqf_log(KQF_LOGL_ERROR, "extract_hook: shim runtime file write fault\n");
+						kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to create shim runtime file (%#lx)\n", status);
 					} else {
-						status = ERROR_SUCCESS;
+						status = write_hook(file, &pak, data, size);
+						CloseHandle(file);
+						if (status != ERROR_SUCCESS) {
+							kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to write shim runtime file (%#lx)\n", status);
+						} else if (!MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+							status = GetLastError();
+							kqf_log(KQF_LOGL_ERROR, "extract_hook: failed to replace shim runtime file (%#lx)\n", status);
+						}
+					}
+					if (status != ERROR_SUCCESS) {
+						DeleteFileA(tmp);
 					}
-					CloseHandle(file);
 				}
 			}
 		}
-		if ((dlg != NULL) && (status != ERROR_SUCCESS)) {
-			error_msg(dlg, IDS_ERR_NO_EXTRACT, MB_ICONEXCLAMATION, status);
-		}
-		return (status);
 	}
+	if ((dlg != NULL) && (status != ERROR_SUCCESS)) {
+		error_msg(dlg, IDS_ERR_NO_EXTRACT, MB_ICONEXCLAMATION, status);
+	}
+	return (status);
+}
+
+static
+DWORD extract_hook(HWND dlg)
+{
+	char path[MAX_PATH];
+	kqf_app_filepath(KQMOE_RT_FIXNEW, path);
+	return (extract_hook_path(dlg, path));
 }
 
 
@@ -212,117 +332,227 @@ KQMOE_BIN *new_bin(char const path[MAX_PATH])
 	return (bin);
 }
 
+// maps the whole file read-only (only the touched pages are read)
 static
-KQMOE_STATE_ read_bin(KQMOE_BIN *bin)
+void const *map_bin(char const *path, DWORD *size)
 {
-	HANDLE file;
-	KQF_TRACE("read_bin(%#08lx,'%s')\n", bin, bin->name);
-	bin->version = KQMOE_VERSION_UNKNOWN;
-	bin->state = KQMOE_STATE_NONE;
-	file = CreateFileA(bin->path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	void const *base = NULL;
+	DWORD status = ERROR_SUCCESS;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
 	if (INVALID_HANDLE_VALUE == file) {
-		kqf_log(KQF_LOGL_ERROR, "read_bin: failed to open '%s' (%#lx)\n", bin->name, GetLastError());
+		status = GetLastError();
+		kqf_log(KQF_LOGL_ERROR, "map_bin: failed to open '%s' (%#lx)\n", path, status);
 	} else {
-		DWORD size = GetFileSize(file, NULL);
-		LPVOID base = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-		if (NULL == base) {
-			kqf_log(KQF_LOGL_ERROR, "read_bin: failed to allocate memory for '%s' (%#lx)\n", bin->name, GetLastError());
+		HANDLE map;
+		*size = GetFileSize(file, NULL);
+		map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (NULL == map) {
+			status = GetLastError();
+			kqf_log(KQF_LOGL_ERROR, "map_bin: failed to create mapping for '%s' (%#lx)\n", path, status);
 		} else {
-			DWORD read = 0;
-			if (!ReadFile(file, base, size, &read, NULL) || (read != size)) {
-				kqf_log(KQF_LOGL_ERROR, "read_bin: failed to read '%s' (%#lx)\n", bin->name, GetLastError());
-			} else {
-				KQMOE_INFO info;
-				char const *name;
-				if (!kqmoe_info(&info, base)) {
-					kqf_log(KQF_LOGL_NOTICE, "read_bin: version detection failed for '%s'\n", bin->name);
-				} else {
-					bin->version = info.version;
-				}
-				name = kqmoe_rt(&info);
-				if (NULL == name) {
-					kqf_log(KQF_LOGL_NOTICE, "read_bin: run-time library import not found in '%s'\n", bin->name);
-				} else if ((0 == lstrcmpiA(name, KQMOE_RT_MSVCRT)) || (0 == lstrcmpiA(name, KQMOE_RT_FIXOLD))) {
-					bin->state = KQMOE_STATE_UNCHECKED;
-				} else if (0 == lstrcmpiA(name, KQMOE_RT_FIXNEW)) {
-					bin->state = KQMOE_STATE_CHECKED;
-				} else {
-					kqf_log(KQF_LOGL_ERROR, "read_bin: unexpected run-time library name in '%s'\n", bin->name);
-				}
+			base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			if (NULL == base) {
+				status = GetLastError();
+				kqf_log(KQF_LOGL_ERROR, "map_bin: failed to map '%s' (%#lx)\n", path, status);
 			}
-			VirtualFree(base, 0, MEM_RELEASE);
+			// the view keeps the mapping alive
+			CloseHandle(map);
 		}
 		CloseHandle(file);
 	}
+	SetLastError(status);
+	return (base);
+}
+
+static
+KQMOE_STATE_ read_bin(KQMOE_BIN *bin)
+{
+	void const *base;
+	DWORD size = 0;
+	KQF_TRACE("read_bin(%#08lx,'%s')\n", bin, bin->name);
+	bin->version = KQMOE_VERSION_UNKNOWN;
+	bin->state = KQMOE_STATE_NONE;
+	base = map_bin(bin->path, &size);
+	if (base != NULL) {
+		KQMOE_INFO info;
+		char const *name;
+		if (!kqmoe_info(&info, base)) {
+			kqf_log(KQF_LOGL_NOTICE, "read_bin: version detection failed for '%s'\n", bin->name);
+		} else {
+			bin->version = info.version;
+		}
+		name = kqmoe_rt(&info);
+		if (NULL == name) {
+			kqf_log(KQF_LOGL_NOTICE, "read_bin: run-time library import not found in '%s'\n", bin->name);
+		} else if ((0 == lstrcmpiA(name, KQMOE_RT_MSVCRT)) || (0 == lstrcmpiA(name, KQMOE_RT_FIXOLD))) {
+			bin->state = KQMOE_STATE_UNCHECKED;
+		} else if (0 == lstrcmpiA(name, KQMOE_RT_FIXNEW)) {
+			bin->state = KQMOE_STATE_CHECKED;
+		} else {
+			kqf_log(KQF_LOGL_ERROR, "read_bin: unexpected run-time library name in '%s'\n", bin->name);
+		}
+		UnmapViewOfFile(base);
+	}
 	KQF_TRACE("read_bin(%#08lx,'%s')[%i,%i]\n", bin, bin->name, bin->state, bin->version);
 	return (bin->state);
 }
 
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                          Run-time import patch
+//
+// Only the import name of the run-time library and the CheckSum field differ
+// between a patched and an unpatched executable. Their file offsets are taken
+// from a read-only view, the original file is copied to a temporary file in the
+// same directory (server-side on network shares), the temporary file receives
+// the few changed bytes, is verified, and replaces the original with a rename.
+// An interrupted toggle never leaves a half-written executable behind.
+//
+
+typedef struct KQMOE_PATCH {
+	DWORD       size;      // file size
+	DWORD       name_ofs;  // file offset of the import name
+	DWORD       sum_ofs;   // file offset of OptionalHeader.CheckSum
+	char const *name;      // new import name
+} KQMOE_PATCH;
+
+static
+DWORD write_at(HANDLE file, DWORD offset, void const *data, DWORD size)
+{
+	DWORD written = 0;
+	if (SetFilePointer(file, (LONG)offset, NULL, FILE_BEGIN) != offset)
+		return (GetLastError());
+	if (!WriteFile(file, data, size, &written, NULL))
+		return (GetLastError());
+	if (written != size)
+		return (ERROR_WRITE_FAULT);
+	return (ERROR_SUCCESS);
+}
+
+static
+DWORD patch_bin(char const *path, KQMOE_PATCH const *patch)
+{
+	DWORD status;
+	HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_WRITE_THROUGH, NULL);
+	if (INVALID_HANDLE_VALUE == file) {
+		status = GetLastError();
+		kqf_log(KQF_LOGL_ERROR, "patch_bin: failed to open '%s' (%#lx)\n", path, status);
+	} else {
+		DWORD const sum = 0;
+		status = write_at(file, patch->name_ofs, patch->name, (DWORD)lstrlenA(patch->name) + 1);
+		if (ERROR_SUCCESS == status)
+			status = write_at(file, patch->sum_ofs, &sum, sizeof(sum));
+		if ((ERROR_SUCCESS == status) && !FlushFileBuffers(file))
+			status = GetLastError();
+		if (status != ERROR_SUCCESS)
+			kqf_log(KQF_LOGL_ERROR, "patch_bin: failed to write '%s' (%#lx)\n", path, status);
+		CloseHandle(file);
+	}
+	return (status);
+}
+
+// the patched file has to parse and match the expected import name/checksum
+static
+DWORD verify_bin(char const *path, KQMOE_PATCH const *patch)
+{
+	DWORD status = ERROR_FILE_CORRUPT;
+	DWORD size = 0;
+	void const *base = map_bin(path, &size);
+	if (NULL == base) {
+		status = GetLastError();
+	} else {
+		KQMOE_INFO info;
+		char const *name;
+		kqmoe_info(&info, base);
+		name = kqmoe_rt(&info);
+		if ((size == patch->size) &&
+		    (name != NULL) && (0 == lstrcmpA(name, patch->name)) &&
+		    ((DWORD)((unsigned char const *)name - (unsigned char const *)base) == patch->name_ofs) &&
+		    (0 == info.header->OptionalHeader.CheckSum)) {
+			status = ERROR_SUCCESS;
+		} else {
+			kqf_log(KQF_LOGL_ERROR, "verify_bin: integrity check failed for '%s'\n", path);
+		}
+		UnmapViewOfFile(base);
+	}
+	return (status);
+}
+
 static
 DWORD write_bin(KQMOE_BIN *bin, KQMOE_STATE_ state)
 {
-	HANDLE file;
+	void const *base;
 	DWORD status;
+	KQMOE_PATCH patch;
 	KQF_TRACE("write_bin(%#08lx,'%s',%i,%i)\n", bin, bin->name, bin->state, state);
-	file = CreateFileA(bin->path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (INVALID_HANDLE_VALUE == file) {
+	patch.size = 0;
+	base = map_bin(bin->path, &patch.size);
+	if (NULL == base) {
 		status = GetLastError();
-		kqf_log(KQF_LOGL_ERROR, "write_bin: failed to open '%s' (%#lx)\n", bin->name, status);
 	} else {
-		DWORD size = GetFileSize(file, NULL);
-		LPVOID base = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-		if (NULL == base) {
+		KQMOE_INFO info;
+		char const *name;
+		if (!kqmoe_info(&info, base)) {
+			kqf_log(KQF_LOGL_NOTICE, "write_bin: version detection failed for '%s'\n", bin->name);
+		}
+		name = kqmoe_rt(&info);
+		if (NULL == name) {
+			status = ERROR_NOT_FOUND;
+			kqf_log(KQF_LOGL_NOTICE, "write_bin: run-time library import not found in '%s'\n", bin->name);
+		} else {
+			patch.name = name;
+			switch (state) {
+			case KQMOE_STATE_UNCHECKED:
+				if (lstrcmpiA(name, KQMOE_RT_MSVCRT)) {
+					patch.name = KQMOE_RT_MSVCRT;
+				}
+				break;
+			case KQMOE_STATE_CHECKED:
+				if (lstrcmpiA(name, KQMOE_RT_FIXNEW)) {
+					patch.name = KQMOE_RT_FIXNEW;
+				}
+				break;
+			}
+			if (name == patch.name) {
+				status = RPC_S_ENTRY_ALREADY_EXISTS;
+				kqf_log(KQF_LOGL_ERROR, "write_bin: unexpected state for '%s' (%#lx)\n", bin->name, state);
+			} else if (lstrlenA(name) != lstrlenA(patch.name)) {
+				status = ERROR_INVALID_DATA;
+				kqf_log(KQF_LOGL_ERROR, "write_bin: run-time library name length mismatch in '%s'\n", bin->name);
+			} else {
+				patch.name_ofs = (DWORD)((unsigned char const *)name - (unsigned char const *)base);
+				patch.sum_ofs = (DWORD)((unsigned char const *)&info.header->OptionalHeader.CheckSum - (unsigned char const *)base);
+				status = ERROR_SUCCESS;
+			}
+		}
+		UnmapViewOfFile(base);
+	}
+	if (ERROR_SUCCESS == status) {
+		char dir[MAX_PATH];
+		char tmp[MAX_PATH];
+		lstrcpynA(dir, bin->path, (int)(bin->name - bin->path) + 1);
+		if (0 == GetTempFileNameA(dir[0] ? dir : ".", "kqf", 0, tmp)) {
 			status = GetLastError();
-			kqf_log(KQF_LOGL_ERROR, "write_bin: failed to allocate memory for '%s' (%#lx)\n", bin->name, status);
+			kqf_log(KQF_LOGL_ERROR, "write_bin: failed to create temporary file for '%s' (%#lx)\n", bin->name, status);
 		} else {
-			DWORD read = 0;
-			if (!ReadFile(file, base, size, &read, NULL) || (read != size)) {
+			if (!CopyFileA(bin->path, tmp, FALSE)) {
 				status = GetLastError();
-				kqf_log(KQF_LOGL_ERROR, "write_bin: failed to read '%s' (%#lx)\n", bin->name, status);
-			} else {
-				KQMOE_INFO info;
-				char const *name;
-				if (!kqmoe_info(&info, base)) {
-					kqf_log(KQF_LOGL_NOTICE, "write_bin: version detection failed for '%s'\n", bin->name);
-				}
-				name = kqmoe_rt(&info);
-				if (NULL == name) {
-					status = ERROR_NOT_FOUND;
-					kqf_log(KQF_LOGL_NOTICE, "write_bin: run-time library import not found in '%s'\n", bin->name);
-				} else {
-					char const *new_name = name;
-					switch (state) {
-					case KQMOE_STATE_UNCHECKED:
-						if (lstrcmpiA(name, KQMOE_RT_MSVCRT)) {
-							new_name = KQMOE_RT_MSVCRT;
-						}
-						break;
-					case KQMOE_STATE_CHECKED:
-						if (lstrcmpiA(name, KQMOE_RT_FIXNEW)) {
-							new_name = KQMOE_RT_FIXNEW;
-						}
-						break;
-					}
-					if (name == new_name) {
-						status = RPC_S_ENTRY_ALREADY_EXISTS;
-						kqf_log(KQF_LOGL_ERROR, "write_bin: unexpected state for '%s' (%#lx)\n", bin->name, state);
-					} else {
-						DWORD written = 0;
-						lstrcpyA((char *)name, new_name);
-						*(DWORD *)&info.header->OptionalHeader.CheckSum = 0;
-						if (SetFilePointer(file, 0, NULL, FILE_BEGIN) || !WriteFile(file, base, size, &written, NULL) || (written != size)) {
-							status = GetLastError();
-							kqf_log(KQF_LOGL_ERROR, "write_bin: failed to write '%s' (%#lx)\n", bin->name, status);
-						} else {
-							bin->state = state;
-							status = ERROR_SUCCESS;
-						}
-					}
+				kqf_log(KQF_LOGL_ERROR, "write_bin: failed to copy '%s' (%#lx)\n", bin->name, status);
+			} else if ((ERROR_SUCCESS == (status = patch_bin(tmp, &patch))) &&
+			           (ERROR_SUCCESS == (status = verify_bin(tmp, &patch)))) {
+				if (!MoveFileExA(tmp, bin->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+					status = GetLastError();
+					kqf_log(KQF_LOGL_ERROR, "write_bin: failed to replace '%s' (%#lx)\n", bin->name, status);
+				} else if (read_bin(bin) != state) {
+					status = ERROR_FILE_CORRUPT;
+					kqf_log(KQF_LOGL_ERROR, "write_bin: integrity check failed for '%s'\n", bin->name);
 				}
 			}
-			VirtualFree(base, 0, MEM_RELEASE);
+			if (status != ERROR_SUCCESS) {
+				DeleteFileA(tmp);
+			}
 		}
-		CloseHandle(file);
 	}
 	KQF_TRACE("write_bin(%#08lx,'%s',%i,%i)[%#lx]\n", bin, bin->name, bin->state, state, status);
 	return (status);
@@ -371,40 +601,290 @@ int is_kqmoe(char const path[MAX_PATH])
 	return (result);
 }
 
+// cheap pre-filter: 32-bit GUI executable with imports and resources
 static
-KQMOE_BIN *init_list(void) {
-	char path[MAX_PATH];
+int is_gui_exe(char const path[MAX_PATH])
+{
+	int result = 0;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (INVALID_HANDLE_VALUE == file) {
+		kqf_log(KQF_LOGL_NOTICE, "is_gui_exe: failed to open '%s' (%#lx)\n", path, GetLastError());
+	} else {
+		union {
+			IMAGE_DOS_HEADER mz;
+			BYTE             raw[1024];
+		} head;
+		DWORD read = 0;
+		if (ReadFile(file, &head, sizeof(head), &read, NULL) &&
+		    (read >= sizeof(head.mz)) &&
+		    (IMAGE_DOS_SIGNATURE == head.mz.e_magic) &&
+		    (head.mz.e_lfanew > 0) &&
+		    ((DWORD)head.mz.e_lfanew + sizeof(IMAGE_NT_HEADERS32) <= read)) {
+			IMAGE_NT_HEADERS32 const *pe = (IMAGE_NT_HEADERS32 const *)&head.raw[head.mz.e_lfanew];
+			IMAGE_OPTIONAL_HEADER32 const *opt = &pe->OptionalHeader;
+			result =
+				(IMAGE_NT_SIGNATURE == pe->Signature) &&
+				(IMAGE_FILE_MACHINE_I386 == pe->FileHeader.Machine) &&
+				(IMAGE_FILE_EXECUTABLE_IMAGE & pe->FileHeader.Characteristics) &&
+				!(IMAGE_FILE_DLL & pe->FileHeader.Characteristics) &&
+				(IMAGE_NT_OPTIONAL_HDR32_MAGIC == opt->Magic) &&
+				(IMAGE_SUBSYSTEM_WINDOWS_GUI == opt->Subsystem) &&
+				(opt->NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_RESOURCE) &&
+				(opt->DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress != 0) &&
+				(opt->DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress != 0);
+		}
+		CloseHandle(file);
+	}
+	KQF_TRACE("is_gui_exe('%s')[%i]\n", path, result);
+	return (result);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                          Game binary discovery
+//
+// The candidates are enumerated on the calling thread (directory listing only)
+// and inspected on a small pool of worker threads: the header pre-filter reads
+// the first kilobyte, only the remaining files get the version resource check
+// and read_bin. With a notify window the results are posted one by one (the
+// window owns the KQMOE_BIN and links it into s_list) and the list view fills
+// in while the dialog is already up; without one init_list waits for the pool
+// and links the results in enumeration order.
+//
+
+#define WM_KQMOE_BIN  (WM_APP + 0)  // lParam: KQMOE_BIN * (receiver owns it)
+#define WM_KQMOE_DONE (WM_APP + 1)  // all candidates inspected
+
+enum SCAN_ {
+	SCAN_THREADS = 8,  // I/O bound, at least two per processor
+	SCAN_GROW    = 64  // candidate array increment
+};
+
+typedef struct SCAN_FILE {
+	KQMOE_BIN    *bin;
+	KQMOE_STATE_  state;   // before the toggle
+	DWORD         status;  // of write_bin
+	LONGLONG      ticks;   // inspection and toggle
+	char          path[MAX_PATH];
+} SCAN_FILE;
+
+static struct {
+	HWND               notify;
+	KQMOE_STATE_       state;  // toggle target (or none)
+	SCAN_FILE         *file;
+	LONG               count;
+	LONG               alloc;
+	LONG /*volatile*/  next;
+	LONG /*volatile*/  busy;
+	LONG /*volatile*/  abort;
+	DWORD              threads;
+	HANDLE             thread[SCAN_THREADS];
+} s_scan /* = {0} */;
+static KQMOE_BIN *s_last /* = NULL */;
+
+
+// appends to s_list (single owner thread)
+static
+void link_bin(KQMOE_BIN *bin)
+{
+	bin->next = NULL;
+	bin->prev = s_last;
+	if (s_last != NULL) {
+		s_last->next = bin;
+	} else {
+		s_list = bin;
+	}
+	s_last = bin;
+}
+
+static
+int scan_add(char const *path)
+{
+	if (s_scan.count >= s_scan.alloc) {
+		LONG const alloc = s_scan.alloc + SCAN_GROW;
+		SCAN_FILE *file = (SCAN_FILE *)((NULL == s_scan.file) ?
+			LocalAlloc(LMEM_FIXED, alloc * sizeof(*file)) :
+			LocalReAlloc(s_scan.file, alloc * sizeof(*file), LMEM_MOVEABLE));
+		if (NULL == file) {
+			kqf_log(KQF_LOGL_ERROR, "scan_add: failed to allocate memory for '%s' (%#lx)\n", path, GetLastError());
+			return (0);
+		}
+		s_scan.file = file;
+		s_scan.alloc = alloc;
+	}
+	s_scan.file[s_scan.count].bin = NULL;
+	s_scan.file[s_scan.count].state = KQMOE_STATE_NONE;
+	s_scan.file[s_scan.count].status = ERROR_SUCCESS;
+	s_scan.file[s_scan.count].ticks = 0;
+	lstrcpynA(s_scan.file[s_scan.count].path, path, MAX_PATH);
+	++s_scan.count;
+	return (1);
+}
+
+// adds all files matching the pattern (relative to its directory)
+static
+int scan_find(char const pattern[MAX_PATH])
+{
+	int count = 0;
 	HANDLE find;
 	WIN32_FIND_DATAA file;
-	KQF_TRACE("init_list()\n");
-	kqf_app_filepath("*.exe", path);
-	find = FindFirstFileA(path, &file);
+	KQF_TRACE("scan_find('%s')\n", pattern);
+	find = FindFirstFileA(pattern, &file);
 	if (INVALID_HANDLE_VALUE == find) {
-		kqf_log(KQF_LOGL_ERROR, "init_list: no '%s' found (%#lx)\n", path, GetLastError());
+		kqf_log(KQF_LOGL_ERROR, "scan_find: no '%s' found (%#lx)\n", pattern, GetLastError());
 	} else {
-		KQMOE_BIN *prev = NULL;
-		KQMOE_BIN **next = &s_list;
+		char path[MAX_PATH];
+		int dir = lstrlenA(pattern);
+		while ((dir > 0) && (pattern[dir - 1] != '\\') && (pattern[dir - 1] != '/') && (pattern[dir - 1] != ':'))
+			--dir;
+		lstrcpynA(path, pattern, dir + 1);
 		do {
 			if ((0 == (FILE_ATTRIBUTE_DIRECTORY & file.dwFileAttributes)) &&
-				(0 == file.nFileSizeHigh) && (file.nFileSizeLow <= 64 * 1024 * 1024)) {
-				kqf_app_filepath(file.cFileName, path);
-				if (is_kqmoe(path)) {
-					*next = new_bin(path);
-					if (*next != NULL) {
-						read_bin(*next);
-						(*next)->prev = prev;
-						prev = *next;
-						next = &prev->next;
-					}
-				}
+				(0 == file.nFileSizeHigh) && (file.nFileSizeLow <= 64 * 1024 * 1024) &&
+				(dir + lstrlenA(file.cFileName) < MAX_PATH)) {
+				lstrcpyA(&path[dir], file.cFileName);
+				count += scan_add(path);
 			}
 		} while (FindNextFileA(find, &file));
 		FindClose(find);
 	}
-	KQF_TRACE("init_list()[%#08lx]\n", s_list);
+	KQF_TRACE("scan_find('%s')[%i]\n", pattern, count);
+	return (count);
+}
+
+static
+DWORD WINAPI scan_proc(LPVOID param)
+{
+	UNREFERENCED_PARAMETER(param);
+	for (;;) {
+		SCAN_FILE *file;
+		LARGE_INTEGER start;
+		LARGE_INTEGER stop;
+		LONG const index = InterlockedIncrement(&s_scan.next) - 1;
+		if ((index >= s_scan.count) || s_scan.abort)
+			break;
+		file = &s_scan.file[index];
+		QueryPerformanceCounter(&start);
+		if (is_gui_exe(file->path) && is_kqmoe(file->path)) {
+			KQMOE_BIN *bin = new_bin(file->path);
+			if (bin != NULL) {
+				file->state = read_bin(bin);
+				if ((s_scan.state != KQMOE_STATE_NONE) &&
+				    (file->state != KQMOE_STATE_NONE) &&
+				    (file->state != s_scan.state)) {
+					file->status = write_bin(bin, s_scan.state);
+				}
+				if (NULL == s_scan.notify) {
+					file->bin = bin;
+				} else if (!PostMessageA(s_scan.notify, WM_KQMOE_BIN, 0, (LPARAM)bin)) {
+					LocalFree(bin);
+				}
+			}
+		}
+		QueryPerformanceCounter(&stop);
+		file->ticks = stop.QuadPart - start.QuadPart;
+	}
+	// all results of the other workers have been posted before
+	if ((0 == InterlockedDecrement(&s_scan.busy)) && (s_scan.notify != NULL)) {
+		PostMessageA(s_scan.notify, WM_KQMOE_DONE, 0, 0);
+	}
+	return (0);
+}
+
+// starts the workers for the added candidates (and toggles them to state)
+static
+void scan_start(HWND notify, KQMOE_STATE_ state)
+{
+	DWORD i;
+	DWORD threads;
+	SYSTEM_INFO info;
+	KQF_TRACE("scan_start(%#08lx,%i)[%li]\n", notify, state, s_scan.count);
+	GetSystemInfo(&info);
+	threads = info.dwNumberOfProcessors * 2;
+	if (threads > SCAN_THREADS)
+		threads = SCAN_THREADS;
+	if (threads > (DWORD)s_scan.count)
+		threads = (DWORD)s_scan.count;
+	s_scan.notify = notify;
+	s_scan.state = state;
+	s_scan.next = 0;
+	s_scan.abort = 0;
+	s_scan.threads = 0;
+	s_scan.busy = (LONG)threads;
+	if (0 == threads) {
+		if (notify != NULL)
+			PostMessageA(notify, WM_KQMOE_DONE, 0, 0);
+		return;
+	}
+	for (i = 0; i < threads; ++i) {
+		DWORD id;
+		HANDLE thread = CreateThread(NULL, 0, scan_proc, NULL, 0, &id);
+		if (NULL == thread) {
+			kqf_log(KQF_LOGL_WARNING, "scan_start: failed to create worker thread (%#lx)\n", GetLastError());
+			// the work is done anyway, the busy count has to drop
+			scan_proc(NULL);
+		} else {
+			s_scan.thread[s_scan.threads++] = thread;
+		}
+	}
+}
+
+// waits for the workers (abort skips the remaining candidates)
+static
+void scan_wait(int abort)
+{
+	DWORD i;
+	if (abort)
+		InterlockedExchange(&s_scan.abort, 1);
+	if (s_scan.threads > 0) {
+		WaitForMultipleObjects(s_scan.threads, s_scan.thread, TRUE, INFINITE);
+		for (i = 0; i < s_scan.threads; ++i)
+			CloseHandle(s_scan.thread[i]);
+		s_scan.threads = 0;
+	}
+	KQF_TRACE("scan_wait(%i)[%li]\n", abort, s_scan.count);
+}
+
+static
+void scan_free(void)
+{
+	if (s_scan.file != NULL) {
+		LocalFree(s_scan.file);
+		s_scan.file = NULL;
+	}
+	s_scan.count = 0;
+	s_scan.alloc = 0;
+}
+
+static
+KQMOE_BIN *init_list(HWND notify)
+{
+	char path[MAX_PATH];
+	KQF_TRACE("init_list(%#08lx)\n", notify);
+	kqf_app_filepath("*.exe", path);
+	scan_find(path);
+	scan_start(notify, KQMOE_STATE_NONE);
+	if (NULL == notify) {
+		LONG i;
+		scan_wait(0);
+		for (i = 0; i < s_scan.count; ++i) {
+			if (s_scan.file[i].bin != NULL)
+				link_bin(s_scan.file[i].bin);
+		}
+		scan_free();
+	}
+	KQF_TRACE("init_list(%#08lx)[%#08lx]\n", notify, s_list);
 	return (s_list);
 }
 
+static
+void free_list(void)
+{
+	scan_wait(1);
+	scan_free();
+}
+
 
 static
 void dlg_init_title(HWND Dlg)
@@ -507,36 +987,35 @@ void dlg_init_list(HWND Dlg)
 	dlg_init_list_font(Dlg, List);
 	dlg_init_list_style(List);
 	dlg_init_list_columns(List);
-	if (!s_list) {
-		error_msg(Dlg, IDS_ERR_LIST_EMPTY, MB_ICONEXCLAMATION, 0);
-	} else if (0 == InterlockedCompareExchange(&s_list_init, 1, 0)) {
-		KQMOE_BIN *Bin;
-		int Extract = 0;
-		for (Bin = s_list; Bin; Bin = Bin->next) {
-			int Index;
-			LVITEMA Item = {LVIF_TEXT | LVIF_PARAM, 0, 0, 0, 0, NULL, 0, 0, (LPARAM)NULL};
-			Item.pszText = Bin->name;
-			Item.lParam = (LPARAM)Bin;
-			Index = SendMessageA(List, LVM_INSERTITEMA, 0, (LPARAM)&Item);
-			if (Index >= 0) {
-				char Text[64];
-				if (LoadStringA(kqf_mod, IDS_KQMOE_VERSION_BASE + Bin->version, Text, ARRAYSIZE(Text)) > 0) {
-					Item.mask = LVIF_TEXT;
-					Item.iItem = Index;
-					Item.iSubItem = 1;
-					Item.pszText = Text;
-					SendMessageA(List, LVM_SETITEMTEXTA, Item.iItem, (LPARAM)&Item);
-				}
-				Item.mask = LVIF_STATE;
+	init_list(Dlg);
+}
+
+static
+void dlg_list_add(HWND Dlg, KQMOE_BIN *Bin)
+{
+	HWND List = GetDlgItem(Dlg, IDC_BIN_LIST);
+	link_bin(Bin);
+	if (0 == InterlockedCompareExchange(&s_list_init, 1, 0)) {
+		int Index;
+		LVITEMA Item = {LVIF_TEXT | LVIF_PARAM, 0, 0, 0, 0, NULL, 0, 0, (LPARAM)NULL};
+		Item.pszText = Bin->name;
+		Item.lParam = (LPARAM)Bin;
+		Index = SendMessageA(List, LVM_INSERTITEMA, 0, (LPARAM)&Item);
+		if (Index >= 0) {
+			char Text[64];
+			if (LoadStringA(kqf_mod, IDS_KQMOE_VERSION_BASE + Bin->version, Text, ARRAYSIZE(Text)) > 0) {
+				Item.mask = LVIF_TEXT;
 				Item.iItem = Index;
-				Item.iSubItem = 0;
-				Item.state = Bin->state;
-				Item.stateMask = KQMOE_STATE_MASK;
-				SendMessageA(List, LVM_SETITEMSTATE, Item.iItem, (LPARAM)&Item);
-			}
-			if (KQMOE_STATE_CHECKED == Bin->state) {
-				Extract = 1;
+				Item.iSubItem = 1;
+				Item.pszText = Text;
+				SendMessageA(List, LVM_SETITEMTEXTA, Item.iItem, (LPARAM)&Item);
 			}
+			Item.mask = LVIF_STATE;
+			Item.iItem = Index;
+			Item.iSubItem = 0;
+			Item.state = Bin->state;
+			Item.stateMask = KQMOE_STATE_MASK;
+			SendMessageA(List, LVM_SETITEMSTATE, Item.iItem, (LPARAM)&Item);
 		}
 		{
 			RECT Rect;
@@ -544,14 +1023,31 @@ void dlg_init_list(HWND Dlg)
 			SendMessageA(List, LVM_SETCOLUMNWIDTH, 1, LVSCW_AUTOSIZE);
 			SendMessageA(List, LVM_SETCOLUMNWIDTH, 0, Rect.right - Rect.left - (int)SendMessageA(List, LVM_GETCOLUMNWIDTH, 1, 0));
 		}
+		InterlockedCompareExchange(&s_list_init, 0, 1);
+	}
+}
+
+static
+void dlg_list_done(HWND Dlg)
+{
+	scan_wait(0);
+	if (!s_list) {
+		error_msg(Dlg, IDS_ERR_LIST_EMPTY, MB_ICONEXCLAMATION, 0);
+	} else {
+		KQMOE_BIN *Bin;
+		int Extract = 0;
+		for (Bin = s_list; Bin; Bin = Bin->next) {
+			if (KQMOE_STATE_CHECKED == Bin->state) {
+				Extract = 1;
+			}
+		}
 		{
 			LVITEMA Item = {LVIF_STATE, 0, 0, LVIS_SELECTED | LVIS_FOCUSED, LVIS_SELECTED | LVIS_FOCUSED, NULL, 0, 0, 0};
-			SendMessageA(List, LVM_SETITEMSTATE, 0, (LPARAM)&Item);
+			SendMessageA(GetDlgItem(Dlg, IDC_BIN_LIST), LVM_SETITEMSTATE, 0, (LPARAM)&Item);
 		}
 		if (Extract) {
 			extract_hook(Dlg);
 		}
-		InterlockedCompareExchange(&s_list_init, 0, 1);
 	}
 }
 
@@ -754,6 +1250,12 @@ INT_PTR CALLBACK dlg_proc(HWND Dlg, UINT Msg, WPARAM wParam, LPARAM lParam)
 			return (dlg_info_notify(Dlg, (LPNMHDR)lParam));
 		}
 		break;
+	case WM_KQMOE_BIN:
+		dlg_list_add(Dlg, (KQMOE_BIN *)lParam);
+		return (TRUE);
+	case WM_KQMOE_DONE:
+		dlg_list_done(Dlg);
+		return (TRUE);
 	case WM_COMMAND:
 		switch (HIWORD(wParam)) {
 		case BN_CLICKED:
@@ -773,15 +1275,9 @@ INT_PTR CALLBACK dlg_proc(HWND Dlg, UINT Msg, WPARAM wParam, LPARAM lParam)
 }
 
 static
-void show_help(DWORD std_handle)
+HANDLE get_std(DWORD std_handle)
 {
-	char hlp[1024];
-	int len = LoadStringA(kqf_mod, IDS_HELP_TEXT, hlp, sizeof(hlp));
 	HANDLE con = GetStdHandle(std_handle);
-	if (0 >= len) {
-		lstrcpynA(hlp, "Usage: kq8fix [--install]\n", sizeof(hlp));
-		len = lstrlenA(hlp);
-	}
 	if ((NULL == con) || (INVALID_HANDLE_VALUE == con)) {
 		// WinXP console: start /wait kq8fix --help
 		BOOL (WINAPI *AttachConsole)(DWORD) =
@@ -791,6 +1287,19 @@ void show_help(DWORD std_handle)
 			con = GetStdHandle(std_handle);
 		}
 	}
+	return (con);
+}
+
+static
+void show_help(DWORD std_handle)
+{
+	char hlp[2048];
+	int len = LoadStringA(kqf_mod, IDS_HELP_TEXT, hlp, sizeof(hlp));
+	HANDLE con = get_std(std_handle);
+	if (0 >= len) {
+		lstrcpynA(hlp, "Usage: kq8fix [--install]\n", sizeof(hlp));
+		len = lstrlenA(hlp);
+	}
 	if ((con != NULL) && (con != INVALID_HANDLE_VALUE)) {
 		if (CharToOemBuffA(hlp, hlp, len)) {
 			DWORD dummy;
@@ -815,6 +1324,227 @@ enum KQ8FIX_EXIT_CODE {
 	KQ8FIX_EXIT_NOPATCH = 4   // Failed to modify a/the game binary.
 };
 
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                              Batch mode
+//
+// kq8fix --batch <check|enable|disable> <root>...
+//
+// A root is a directory (all *.exe in it), a wildcard pattern, or a file. All
+// candidates of all roots are inspected (and toggled) by the scan workers. The
+// shim runtime is extracted (if the embedded version is newer) into every
+// directory with an enabled game binary. The report on stdout has one record
+// per line with tab-separated fields (times in microseconds):
+//
+//   bin  <time> <status> <old state> <new state> <version> <path>
+//   dll  <time> <status> <path>
+//   end  <time> <candidates> <binaries> <changed> <failed>
+//
+// The states are "none", "off", and "on", the version is the KQMOE_VERSION_
+// value (-1 for unknown), and the status is a Win32 error code.
+//
+
+// splits the next (optionally quoted) argument off the command-line
+static
+int next_arg(char const **cmd, char arg[MAX_PATH])
+{
+	int len = 0;
+	char const *pos = *cmd;
+	while ((*pos != '\0') && (*pos <= ' '))
+		++pos;
+	if ('\0' == *pos)
+		return (0);
+	if ('\"' == *pos) {
+		for (++pos; (*pos != '\0') && (*pos != '\"'); ++pos) {
+			if (len < MAX_PATH - 1)
+				arg[len++] = *pos;
+		}
+		if ('\"' == *pos)
+			++pos;
+	} else {
+		for (; *pos > ' '; ++pos) {
+			if (len < MAX_PATH - 1)
+				arg[len++] = *pos;
+		}
+	}
+	arg[len] = '\0';
+	*cmd = pos;
+	return (1);
+}
+
+static
+void batch_out(HANDLE con, char const *format, ...)
+{
+	char text[1024];
+	int len;
+	DWORD written;
+	va_list args;
+	va_start(args, format);
+	len = wvsprintfA(text, format, args);
+	va_end(args);
+	if ((len > 0) && (con != NULL) && (con != INVALID_HANDLE_VALUE)) {
+		if (GetConsoleMode(con, &written) && CharToOemBuffA(text, text, len)) {
+			WriteConsoleA(con, text, len, &written, NULL);
+		} else {
+			WriteFile(con, text, len, &written, NULL);
+		}
+	}
+}
+
+static
+char const *batch_state(KQMOE_STATE_ state)
+{
+	switch (state) {
+	case KQMOE_STATE_UNCHECKED:
+		return ("off");
+	case KQMOE_STATE_CHECKED:
+		return ("on");
+	}
+	return ("none");
+}
+
+// no 64-bit multiplication/division helpers without the CRT
+static
+DWORD batch_usec(LONGLONG ticks, LONGLONG freq)
+{
+	while ((ticks > 0x7FFFFFFF) || (freq > 0x7FFFFFFF)) {
+		ticks >>= 1;
+		freq >>= 1;
+	}
+	return (((ticks > 0) && (freq > 0)) ? (DWORD)MulDiv((int)ticks, 1000000, (int)freq) : 0);
+}
+
+// adds the candidates of a directory, pattern, or file
+static
+int batch_root(char const root[MAX_PATH])
+{
+	char pattern[MAX_PATH];
+	LPSTR name = NULL;
+	DWORD len = GetFullPathNameA(root, MAX_PATH, pattern, &name);
+	DWORD pos;
+	if ((0 == len) || (len >= MAX_PATH)) {
+		kqf_log(KQF_LOGL_ERROR, "batch: invalid root '%s' (%#lx)\n", root, GetLastError());
+		return (0);
+	}
+	for (pos = 0; (pos < len) && (pattern[pos] != '*') && (pattern[pos] != '?'); ++pos)
+		;
+	if (pos == len) {
+		DWORD attr = GetFileAttributesA(pattern);
+		if ((attr != INVALID_FILE_ATTRIBUTES) && (FILE_ATTRIBUTE_DIRECTORY & attr)) {
+			if ((len > 0) && (pattern[len - 1] != '\\') && (pattern[len - 1] != '/'))
+				pattern[len++] = '\\';
+			if (len + sizeof("*.exe") > MAX_PATH) {
+				kqf_log(KQF_LOGL_ERROR, "batch: root too long '%s'\n", root);
+				return (0);
+			}
+			lstrcpyA(&pattern[len], "*.exe");
+		}
+	}
+	return (scan_find(pattern));
+}
+
+static
+int batch_run(char const *cmd)
+{
+	int result = KQ8FIX_EXIT_SUCCESS;
+	char arg[MAX_PATH];
+	KQMOE_STATE_ state;
+	LARGE_INTEGER freq;
+	LARGE_INTEGER start;
+	LARGE_INTEGER stop;
+	HANDLE con = get_std(STD_OUTPUT_HANDLE);
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&start);
+	if (!next_arg(&cmd, arg)) {
+		return (KQ8FIX_EXIT_INVALID);
+	} else if (0 == lstrcmpiA(arg, "check")) {
+		state = KQMOE_STATE_NONE;
+	} else if (0 == lstrcmpiA(arg, "enable")) {
+		state = KQMOE_STATE_CHECKED;
+	} else if (0 == lstrcmpiA(arg, "disable")) {
+		state = KQMOE_STATE_UNCHECKED;
+	} else {
+		return (KQ8FIX_EXIT_INVALID);
+	}
+	if (!next_arg(&cmd, arg)) {
+		return (KQ8FIX_EXIT_INVALID);
+	}
+	do {
+		batch_root(arg);
+	} while (next_arg(&cmd, arg));
+	scan_start(NULL, state);
+	scan_wait(0);
+	{
+		LONG i;
+		LONG bins = 0;
+		LONG changed = 0;
+		LONG failed = 0;
+		for (i = 0; i < s_scan.count; ++i) {
+			SCAN_FILE const *file = &s_scan.file[i];
+			if (file->bin != NULL) {
+				++bins;
+				if (file->status != ERROR_SUCCESS) {
+					++failed;
+					result = KQ8FIX_EXIT_NOPATCH;
+				} else if (file->state != file->bin->state) {
+					++changed;
+				}
+				batch_out(con, "bin\t%lu\t%lu\t%s\t%s\t%i\t%s\r\n",
+					batch_usec(file->ticks, freq.QuadPart), file->status,
+					batch_state(file->state), batch_state(file->bin->state),
+					file->bin->version, file->bin->path);
+			}
+		}
+		// one extraction per directory with an enabled game binary
+		for (i = 0; (state != KQMOE_STATE_NONE) && (i < s_scan.count); ++i) {
+			KQMOE_BIN const *bin = s_scan.file[i].bin;
+			if ((bin != NULL) && (KQMOE_STATE_CHECKED == bin->state)) {
+				int const dir = (int)(bin->name - bin->path);
+				LONG j;
+				for (j = 0; j < i; ++j) {
+					KQMOE_BIN const *other = s_scan.file[j].bin;
+					if ((other != NULL) && (KQMOE_STATE_CHECKED == other->state) &&
+					    (dir == (int)(other->name - other->path)) &&
+					    (CSTR_EQUAL == CompareStringA(LOCALE_SYSTEM_DEFAULT, NORM_IGNORECASE, bin->path, dir, other->path, dir)))
+						break;
+				}
+				if ((j == i) && (dir + sizeof(KQMOE_RT_FIXNEW) <= MAX_PATH)) {
+					char path[MAX_PATH];
+					DWORD status;
+					LARGE_INTEGER begin;
+					LARGE_INTEGER end;
+					lstrcpynA(path, bin->path, dir + 1);
+					lstrcatA(path, KQMOE_RT_FIXNEW);
+					QueryPerformanceCounter(&begin);
+					status = extract_hook_path(NULL, path);
+					QueryPerformanceCounter(&end);
+					if (status != ERROR_SUCCESS) {
+						++failed;
+						if (KQ8FIX_EXIT_SUCCESS == result)
+							result = KQ8FIX_EXIT_EXTRACT;
+					}
+					batch_out(con, "dll\t%lu\t%lu\t%s\r\n",
+						batch_usec(end.QuadPart - begin.QuadPart, freq.QuadPart), status, path);
+				}
+			}
+		}
+		if ((0 == bins) && (KQ8FIX_EXIT_SUCCESS == result)) {
+			result = KQ8FIX_EXIT_NOKQMOE;
+		}
+		QueryPerformanceCounter(&stop);
+		batch_out(con, "end\t%lu\t%li\t%li\t%li\t%li\r\n",
+			batch_usec(stop.QuadPart - start.QuadPart, freq.QuadPart),
+			s_scan.count, bins, changed, failed);
+		for (i = 0; i < s_scan.count; ++i) {
+			if (s_scan.file[i].bin != NULL)
+				LocalFree(s_scan.file[i].bin);
+		}
+	}
+	scan_free();
+	return (result);
+}
+
 int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, LPSTR CmdLine, int CmdShow)
 {
 	int result = KQ8FIX_EXIT_SUCCESS;
@@ -885,7 +1615,7 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, LPSTR CmdLine, in
 			}
 			kqf_save_cfg();
 			{
-				CHAR hlp[1024];
+				CHAR hlp[2048];
 				int len = LoadStringA(kqf_mod, IDS_HELP_TEXT, hlp, ARRAYSIZE(hlp));
 				if (len > 0) {
 					HANDLE file;
@@ -900,9 +1630,19 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, LPSTR CmdLine, in
 				}
 			}
 
+		} else if ((lstrlenA(param) >= (int)sizeof("--batch") - 1) &&
+		           (CSTR_EQUAL == CompareStringA(LOCALE_SYSTEM_DEFAULT, NORM_IGNORECASE,
+		                param, sizeof("--batch") - 1, "--batch", sizeof("--batch") - 1)) &&
+		           (param[sizeof("--batch") - 1] <= ' ')) {
+
+			result = batch_run(&param[sizeof("--batch") - 1]);
+			if (KQ8FIX_EXIT_INVALID == result) {
+				show_help(STD_ERROR_HANDLE);
+			}
+
 		} else if (0 == lstrcmpiA(param, "--install")) {
 
-			KQMOE_BIN *bin = init_list();
+			KQMOE_BIN *bin = init_list(NULL);
 			if (NULL == bin) {
 				kqf_log(KQF_LOGL_ERROR, "install: no game binaries found\n");
 				result = KQ8FIX_EXIT_NOKQMOE;
@@ -931,8 +1671,8 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, LPSTR CmdLine, in
 			result = KQ8FIX_EXIT_INVALID;
 		}
 	} else {
-		init_list();
 		DialogBoxParamA(kqf_mod, MAKEINTRESOURCEA(IDD_MAIN), NULL, dlg_proc, 0);
+		free_list();
 	}
 	if (com) {
 		CoUninitialize();
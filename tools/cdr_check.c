@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// cdr_check: verifies the perfect hash of the fake CD-ROM file table
+//
+//   cdr_check
+//
+// Recomputes the slot of every path in runtime/fake_cdrom.c with
+// FAKE_CDROM_SEED, and checks that each slot maps back to its file, that the
+// other slots are empty, and that the seed is the smallest one without
+// collisions. On failure the smallest usable seed and its slot table are
+// printed (to be pasted into fake_cdrom.h and fake_cdrom.c).
+//
+// The lookup as done in the CreateFileA hook (hash, then one compare) is then
+// timed over the table paths and paths that are not in the table, against the
+// linear scan it replaced (a compare with every entry). The compare is an
+// ASCII stand-in for lstrcmpiA, which is slower on Windows (locale tables), so
+// the ratio is a lower bound.
+
+#include "../runtime/fake_cdrom.h"
+
+#include <stdio.h>
+#include <time.h>
+
+
+#define TIMED_ROUNDS 20000
+#define TIMED_RUNS   5
+
+// mixed-case table paths and paths the game might open that are not in it
+static
+char const *const timed_paths[] = {
+	FAKE_CDROM "BARREN\\SOUND\\C_WTRDIE.AUD",
+	FAKE_CDROM "Iceworld\\Resource.vol",
+	FAKE_CDROM "temple3\\8GUI.VOL",
+	FAKE_CDROM "barren\\resource.vol",
+	FAKE_CDROM "daventry\\resource.vol",
+	FAKE_CDROM "game\\sound\\c_blddie.wav",
+	FAKE_CDROM "game\\sound\\cr_baway.au",
+	FAKE_CDROM "gnome\\sound\\oh_fdie.aud",
+	FAKE_CDROM "iceworld\\movies\\intro.avi",
+	FAKE_CDROM "swamp\\sound\\c_spkdie.aud.bak",
+	FAKE_CDROM "temple3\\9gui.vol",
+	FAKE_CDROM "setup.exe"
+};
+
+#define TIMED_PATHS ((int)(sizeof(timed_paths) / sizeof(timed_paths[0])))
+
+static volatile int timed_sink /* = 0 */;
+
+
+// ASCII lstrcmpiA
+static
+int compare_nocase(char const *a, char const *b)
+{
+	for (;;) {
+		int ca = (unsigned char)*a++;
+		int cb = (unsigned char)*b++;
+		if (('A' <= ca) && (ca <= 'Z')) {
+			ca += 'a' - 'A';
+		}
+		if (('A' <= cb) && (cb <= 'Z')) {
+			cb += 'a' - 'A';
+		}
+		if ((ca != cb) || !ca) {
+			return (ca - cb);
+		}
+	}
+}
+
+// hashed lookup as in the CreateFileA hook (-1 if not in the table)
+static
+int find_hashed(char const *path)
+{
+	int const i = fake_cdrom_lookup(path);
+	return (((i >= 0) && (0 == compare_nocase(path, fake_cdrom_files[i].path))) ? i : -1);
+}
+
+// the linear scan replaced by the hash
+static
+int find_linear(char const *path)
+{
+	int i;
+	for (i = 0; i < FAKE_CDROM_FILES; ++i) {
+		if (0 == compare_nocase(path, fake_cdrom_files[i].path)) {
+			return (i);
+		}
+	}
+	return (-1);
+}
+
+// best time of the runs in ns per lookup
+static
+double time_lookup(int (*find)(char const *path), char const *const *paths, int count)
+{
+	double best = 0;
+	int run;
+	for (run = 0; run < TIMED_RUNS; ++run) {
+		clock_t const start = clock();
+		double t;
+		int round;
+		int i;
+		for (round = 0; round < TIMED_ROUNDS; ++round) {
+			for (i = 0; i < count; ++i) {
+				timed_sink += find(paths[i]);
+			}
+		}
+		t = (double)(clock() - start) / CLOCKS_PER_SEC;
+		best = (0 == run || t < best) ? t : best;
+	}
+	return (best * 1e9 / ((double)TIMED_ROUNDS * count));
+}
+
+static
+void report_timing(void)
+{
+	char const *table[FAKE_CDROM_FILES];
+	int i;
+	for (i = 0; i < FAKE_CDROM_FILES; ++i) {
+		table[i] = fake_cdrom_files[i].path;
+	}
+	printf("lookup, best of %d runs (ns per path):\n", TIMED_RUNS);
+	printf("  table paths:  hash %6.1f, linear %6.1f\n",
+		time_lookup(find_hashed, table, FAKE_CDROM_FILES), time_lookup(find_linear, table, FAKE_CDROM_FILES));
+	printf("  mixed paths:  hash %6.1f, linear %6.1f\n",
+		time_lookup(find_hashed, timed_paths, TIMED_PATHS), time_lookup(find_linear, timed_paths, TIMED_PATHS));
+}
+
+
+static
+unsigned slot_of(char const *path, unsigned int seed)
+{
+	return ((fake_cdrom_hash(path, seed) >> 28) & (FAKE_CDROM_SLOTS - 1));
+}
+
+// fills the slot table for the seed (returns 0 on collisions)
+static
+int build_slots(unsigned int seed, int slot[FAKE_CDROM_SLOTS])
+{
+	int i;
+	for (i = 0; i < FAKE_CDROM_SLOTS; ++i) {
+		slot[i] = -1;
+	}
+	for (i = 0; i < FAKE_CDROM_FILES; ++i) {
+		unsigned const s = slot_of(fake_cdrom_files[i].path, seed);
+		if (slot[s] >= 0) {
+			return (0);
+		}
+		slot[s] = i;
+	}
+	return (1);
+}
+
+static
+int search_seed(unsigned int *seed, int slot[FAKE_CDROM_SLOTS])
+{
+	unsigned int s;
+	for (s = 0; s < 0x10000000U; ++s) {
+		if (build_slots(s, slot)) {
+			*seed = s;
+			return (1);
+		}
+	}
+	return (0);
+}
+
+
+int main(void)
+{
+	int slot[FAKE_CDROM_SLOTS];
+	unsigned int seed;
+	int errors = 0;
+	int i;
+
+	if (!build_slots(FAKE_CDROM_SEED, slot)) {
+		printf("seed %u: collision\n", FAKE_CDROM_SEED);
+		++errors;
+	} else {
+		for (i = 0; i < FAKE_CDROM_SLOTS; ++i) {
+			if (slot[i] != fake_cdrom_slot[i]) {
+				printf("slot %2d: %d (expected %d)\n", i, fake_cdrom_slot[i], slot[i]);
+				++errors;
+			}
+		}
+	}
+	for (i = 0; i < FAKE_CDROM_FILES; ++i) {
+		if (fake_cdrom_lookup(fake_cdrom_files[i].path) != i) {
+			printf("lookup '%s': %d (expected %d)\n", fake_cdrom_files[i].path, fake_cdrom_lookup(fake_cdrom_files[i].path), i);
+			++errors;
+		}
+	}
+	for (i = 0; i < TIMED_PATHS; ++i) {
+		if (find_hashed(timed_paths[i]) != find_linear(timed_paths[i])) {
+			printf("lookup '%s': %d (expected %d)\n", timed_paths[i], find_hashed(timed_paths[i]), find_linear(timed_paths[i]));
+			++errors;
+		}
+	}
+
+	if (!search_seed(&seed, slot)) {
+		printf("no seed without collisions\n");
+		return (1);
+	}
+	if (seed != FAKE_CDROM_SEED) {
+		printf("seed %u: the smallest seed is %u\n", FAKE_CDROM_SEED, seed);
+		++errors;
+	}
+	if (errors) {
+		printf("#define FAKE_CDROM_SEED   %uU\n{", seed);
+		for (i = 0; i < FAKE_CDROM_SLOTS; ++i) {
+			printf("%s%d", i ? ", " : "\n\t", slot[i]);
+		}
+		printf("\n}\n");
+		return (1);
+	}
+	printf("fake CD-ROM table: %d files in %d slots, seed %u\n", FAKE_CDROM_FILES, FAKE_CDROM_SLOTS, FAKE_CDROM_SEED);
+	report_timing();
+	return (0);
+}
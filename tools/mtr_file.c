@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "mtr_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// The records of a block are in order, but the blocks of the threads are
+// interleaved in spill order (every 50 ms). Sorting by tick restores the
+// global order within the resolution of GetTickCount.
+static
+int compare_event(void const *a, void const *b)
+{
+	MTR_EVENT const *x = (MTR_EVENT const *)a;
+	MTR_EVENT const *y = (MTR_EVENT const *)b;
+	if (x->tick != y->tick) {
+		return ((x->tick < y->tick) ? -1 : 1);
+	}
+	return ((x->seq < y->seq) ? -1 : (x->seq > y->seq));
+}
+
+// thread of a block with the pending MTR_REALLOC_OLD address
+typedef struct MTR_THREAD {
+	uint32_t id;
+	uint32_t old;
+	int      pending;
+} MTR_THREAD;
+
+static
+MTR_THREAD *find_thread(MTR_TRACE *trace, MTR_THREAD **thread, uint32_t id)
+{
+	size_t i;
+	for (i = 0; i < trace->threads; ++i) {
+		if ((*thread)[i].id == id) {
+			return (&(*thread)[i]);
+		}
+	}
+	{
+		MTR_THREAD *grown = (MTR_THREAD *)realloc(*thread, (trace->threads + 1) * sizeof(**thread));
+		if (NULL == grown) {
+			return (NULL);
+		}
+		*thread = grown;
+		grown[trace->threads].id = id;
+		grown[trace->threads].old = 0;
+		grown[trace->threads].pending = 0;
+		return (&grown[trace->threads++]);
+	}
+}
+
+int mtr_load(char const *path, MTR_TRACE *trace)
+{
+	FILE *file = fopen(path, "rb");
+	MTR_THREAD *thread = NULL;
+	size_t capacity = 0;
+	MTR_RECORD rec;
+	memset(trace, 0, sizeof(*trace));
+	if (NULL == file) {
+		perror(path);
+		return (0);
+	}
+	if ((fread(&trace->header, sizeof(trace->header), 1, file) != 1) ||
+		(trace->header.magic != MTR_MAGIC) || (trace->header.version != 1) ||
+		(trace->header.record != sizeof(MTR_RECORD))) {
+		fprintf(stderr, "%s: not a version 1 allocation trace\n", path);
+		fclose(file);
+		return (0);
+	}
+	while (!trace->truncated && (fread(&rec, sizeof(rec), 1, file) == 1)) {
+		uint32_t const id = rec.ptr;
+		uint32_t count = rec.size;
+		MTR_THREAD *owner;
+		if ((rec.tick_op & 15) != MTR_BLOCK) {
+			fprintf(stderr, "%s: block header expected at event %lu\n", path, (unsigned long)trace->events);
+			trace->truncated = 1;
+			break;
+		}
+		++trace->blocks;
+		trace->dropped += rec.ret;
+		owner = find_thread(trace, &thread, id);
+		if (NULL == owner) {
+			fprintf(stderr, "%s: out of memory\n", path);
+			break;
+		}
+		if (rec.ret != 0) {
+			// the pair might be incomplete
+			owner->pending = 0;
+		}
+		if (trace->events + count > capacity) {
+			size_t const wanted = (trace->events + count) * 2 + 1024;
+			MTR_EVENT *grown = (MTR_EVENT *)realloc(trace->event, wanted * sizeof(*grown));
+			if (NULL == grown) {
+				fprintf(stderr, "%s: out of memory\n", path);
+				break;
+			}
+			trace->event = grown;
+			capacity = wanted;
+		}
+		for (; count > 0; --count) {
+			MTR_EVENT *ev = &trace->event[trace->events];
+			if (fread(&rec, sizeof(rec), 1, file) != 1) {
+				trace->truncated = 1;
+				break;
+			}
+			if (MTR_REALLOC_OLD == (rec.tick_op & 15)) {
+				owner->old = rec.ptr;
+				owner->pending = 1;
+				continue;
+			}
+			// 28 bits of GetTickCount (wraps after three days)
+			ev->tick = ((rec.tick_op >> 4) - trace->header.tick) & 0x0FFFFFFFUL;
+			ev->op = rec.tick_op & 15;
+			ev->size = rec.size;
+			ev->ptr = rec.ptr;
+			ev->old = 0;
+			ev->ret = rec.ret;
+			ev->thread = id;
+			ev->seq = (uint32_t)trace->events++;
+			if (MTR_REALLOC == ev->op) {
+				if (owner->pending) {
+					ev->old = owner->old;
+				} else {
+					++trace->orphans;
+				}
+			}
+			owner->pending = 0;
+		}
+	}
+	fclose(file);
+	free(thread);
+	if (trace->events > 0) {
+		qsort(trace->event, trace->events, sizeof(trace->event[0]), compare_event);
+	}
+	return (1);
+}
+
+void mtr_free(MTR_TRACE *trace)
+{
+	free(trace->event);
+	memset(trace, 0, sizeof(*trace));
+}
+
+char const *mtr_op_name(uint32_t op)
+{
+	static char const *const name[] = {
+		"?", "malloc", "free", "realloc (old)", "realloc", "new", "delete"
+	};
+	return ((op < sizeof(name) / sizeof(name[0])) ? name[op] : "?");
+}
+
+
+static
+size_t hash_ptr(uint32_t ptr)
+{
+	// heap blocks are at least 8-byte aligned
+	return ((size_t)((ptr >> 3) * 0x9E3779B1UL));
+}
+
+MTR_LIVE *mtr_map_find(MTR_MAP const *map, uint32_t ptr)
+{
+	size_t i;
+	if ((0 == ptr) || (0 == map->count)) {
+		return (NULL);
+	}
+	for (i = hash_ptr(ptr) & map->mask; map->slot[i].ptr != 0; i = (i + 1) & map->mask) {
+		if (map->slot[i].ptr == ptr) {
+			return (&map->slot[i]);
+		}
+	}
+	return (NULL);
+}
+
+static
+int grow_map(MTR_MAP *map)
+{
+	size_t const size = map->slot ? (map->mask + 1) * 2 : 1024;
+	MTR_LIVE *slot = (MTR_LIVE *)calloc(size, sizeof(*slot));
+	size_t i;
+	if (NULL == slot) {
+		return (0);
+	}
+	for (i = 0; map->slot && (i <= map->mask); ++i) {
+		if (map->slot[i].ptr != 0) {
+			size_t j = hash_ptr(map->slot[i].ptr) & (size - 1);
+			while (slot[j].ptr != 0) {
+				j = (j + 1) & (size - 1);
+			}
+			slot[j] = map->slot[i];
+		}
+	}
+	free(map->slot);
+	map->slot = slot;
+	map->mask = size - 1;
+	return (1);
+}
+
+MTR_LIVE *mtr_map_add(MTR_MAP *map, uint32_t ptr)
+{
+	size_t i;
+	MTR_LIVE *block = mtr_map_find(map, ptr);
+	if (block != NULL) {
+		return (block);
+	}
+	// load factor below 1/2
+	if (((NULL == map->slot) || (2 * (map->count + 1) > map->mask + 1)) && !grow_map(map)) {
+		return (NULL);
+	}
+	for (i = hash_ptr(ptr) & map->mask; map->slot[i].ptr != 0; i = (i + 1) & map->mask) {
+	}
+	block = &map->slot[i];
+	block->ptr = ptr;
+	block->size = 0;
+	block->ret = 0;
+	block->data = NULL;
+	++map->count;
+	return (block);
+}
+
+int mtr_map_remove(MTR_MAP *map, uint32_t ptr, MTR_LIVE *removed)
+{
+	MTR_LIVE *block = mtr_map_find(map, ptr);
+	size_t i, j;
+	if (NULL == block) {
+		return (0);
+	}
+	if (removed != NULL) {
+		*removed = *block;
+	}
+	// backward shift deletion (no tombstones)
+	i = (size_t)(block - map->slot);
+	map->slot[i].ptr = 0;
+	for (j = (i + 1) & map->mask; map->slot[j].ptr != 0; j = (j + 1) & map->mask) {
+		size_t const home = hash_ptr(map->slot[j].ptr) & map->mask;
+		// move the entry if its home slot is not in (i, j]
+		if (((j > i) && ((home <= i) || (home > j))) || ((j < i) && (home <= i) && (home > j))) {
+			map->slot[i] = map->slot[j];
+			map->slot[j].ptr = 0;
+			i = j;
+		}
+	}
+	--map->count;
+	return (1);
+}
+
+void mtr_map_free(MTR_MAP *map)
+{
+	free(map->slot);
+	memset(map, 0, sizeof(*map));
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef MTR_FILE_H_
+#define MTR_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Host-side reader for the binary allocation trace (mem.trace, kq8fix.mtr),
+// the layout mirrors runtime/mem_trace.h with fixed-size types
+
+enum MTR_OP_ {
+	MTR_MALLOC      = 1,   // ptr (0: failed), size
+	MTR_FREE        = 2,   // ptr
+	MTR_REALLOC_OLD = 3,   // ptr (followed by MTR_REALLOC of the same thread)
+	MTR_REALLOC     = 4,   // ptr (0: failed or freed), size
+	MTR_NEW         = 5,   // ptr (0: failed), size
+	MTR_DELETE      = 6,   // ptr
+	MTR_BLOCK       = 15   // size: records, ptr: thread id, ret: dropped
+};
+
+#define MTR_MAGIC 0x544D514BUL  // "KQMT"
+
+typedef struct MTR_HEADER {
+	uint32_t magic;
+	uint32_t version;  // 1
+	uint32_t record;   // sizeof(MTR_RECORD)
+	uint32_t base;     // game image base (return addresses)
+	uint32_t tick;     // GetTickCount() at start
+	uint32_t process;
+	uint32_t reserved[2];
+} MTR_HEADER;
+
+typedef struct MTR_RECORD {
+	uint32_t tick_op;  // GetTickCount() << 4 | MTR_OP_
+	uint32_t size;
+	uint32_t ptr;
+	uint32_t ret;      // return address of the caller
+} MTR_RECORD;
+
+// allocation event with the thread of its block, MTR_REALLOC_OLD is folded
+// into the following MTR_REALLOC (old)
+typedef struct MTR_EVENT {
+	uint32_t tick;     // ms since the start of the trace
+	uint32_t op;
+	uint32_t size;
+	uint32_t ptr;
+	uint32_t old;      // MTR_REALLOC
+	uint32_t ret;
+	uint32_t thread;
+	uint32_t seq;      // file order
+} MTR_EVENT;
+
+typedef struct MTR_TRACE {
+	MTR_HEADER header;
+	MTR_EVENT *event;  // sorted by tick, file order within a tick
+	size_t     events;
+	size_t     blocks;
+	size_t     threads;
+	uint32_t   dropped;
+	size_t     orphans;    // MTR_REALLOC without the old address (dropped)
+	int        truncated;  // last block incomplete
+} MTR_TRACE;
+
+
+// loads a trace file, returns 0 and prints the reason on failure
+int mtr_load(char const *path, MTR_TRACE *trace);
+void mtr_free(MTR_TRACE *trace);
+
+char const *mtr_op_name(uint32_t op);
+
+
+// live blocks by trace address (open addressing, grows as required)
+typedef struct MTR_LIVE {
+	uint32_t ptr;      // 0 = empty slot
+	uint32_t size;
+	uint32_t ret;
+	void    *data;     // user data (e.g. the replayed block)
+} MTR_LIVE;
+
+typedef struct MTR_MAP {
+	MTR_LIVE *slot;
+	size_t     mask;
+	size_t     count;
+} MTR_MAP;
+
+// returns the block (NULL if unknown)
+MTR_LIVE *mtr_map_find(MTR_MAP const *map, uint32_t ptr);
+// returns the new or existing block (NULL if out of memory)
+MTR_LIVE *mtr_map_add(MTR_MAP *map, uint32_t ptr);
+// removes the block, returns 0 if it is unknown
+int mtr_map_remove(MTR_MAP *map, uint32_t ptr, MTR_LIVE *removed);
+void mtr_map_free(MTR_MAP *map);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// mtr_pool: replays a binary allocation trace (mem.trace, kq8fix.mtr) against
+// the small block pool (mem.pool, runtime/mem_pool.c) and the C heap
+//
+//   mtr_pool [-r runs] kq8fix.mtr
+//
+// The trace is converted to a sequence of malloc, free, and realloc calls on
+// dense block indices, and replayed on one thread (a) with malloc, free, and
+// realloc of the host C library, and (b) with the pool core of the runtime
+// (runtime/mem_pool_core.c: size classes, slab carving, and free lists) on a
+// region of the C heap, plus the realloc rules of hook_memory.c (pool blocks
+// stay if the new size fits the class, realloc(NULL) goes to the C heap). The
+// slab commit is a counter, there are no locks. Printed are the
+// pool share of the allocations, the slabs and peak blocks per class, the
+// fallbacks if the region is exhausted, and the best time of each replay.
+//
+// The times compare the allocator paths only: the host C library is not the
+// MSVCRT heap of the game, and the replay takes no locks, so the contention on
+// the CRT heap lock that the pool avoids is not part of the result.
+
+#include "mtr_file.h"
+
+#include "../runtime/mem_pool_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define NO_BLOCK 0xFFFFFFFFUL
+
+typedef struct REPLAY_OP {
+	uint32_t op;     // MTR_MALLOC, MTR_FREE, or MTR_REALLOC
+	uint32_t size;
+	uint32_t block;  // index of the (new) block
+	uint32_t old;    // MTR_REALLOC: index of the old block (NO_BLOCK: NULL)
+} REPLAY_OP;
+
+typedef struct REPLAY {
+	REPLAY_OP *op;
+	size_t     ops;
+	size_t     blocks;
+	uint32_t   allocs;
+	uint32_t   frees;
+	uint32_t   reallocs;
+	uint32_t   small;    // allocations up to MEM_POOL_MAX
+	void     **block;    // replayed blocks
+	uint32_t  *used;     // requested size of the replayed blocks
+} REPLAY;
+
+typedef struct POOL {
+	MEM_POOL_CORE core;  // first member (passed to commit_slab)
+	size_t        slabs;
+	uint32_t      exhausted;
+} POOL;
+
+
+static
+void *xalloc(size_t size)
+{
+	void *result = calloc(size ? size : 1, 1);
+	if (NULL == result) {
+		fputs("out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	return (result);
+}
+
+// new index for a trace address (an allocated block that was never freed is
+// freed first, to keep the replay balanced)
+static
+uint32_t new_block(REPLAY *replay, MTR_MAP *live, uint32_t ptr)
+{
+	MTR_LIVE *entry = mtr_map_find(live, ptr);
+	if (entry != NULL) {
+		REPLAY_OP *op = &replay->op[replay->ops++];
+		op->op = MTR_FREE;
+		op->block = entry->size;
+		++replay->frees;
+	} else {
+		entry = mtr_map_add(live, ptr);
+		if (NULL == entry) {
+			fputs("out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	entry->size = (uint32_t)replay->blocks;  // index instead of the size
+	return ((uint32_t)replay->blocks++);
+}
+
+static
+uint32_t old_block(MTR_MAP *live, uint32_t ptr)
+{
+	MTR_LIVE entry;
+	if ((ptr != 0) && mtr_map_remove(live, ptr, &entry)) {
+		return (entry.size);
+	}
+	return (NO_BLOCK);
+}
+
+static
+void convert(REPLAY *replay, MTR_TRACE const *trace)
+{
+	MTR_MAP live;
+	size_t i;
+	memset(&live, 0, sizeof(live));
+	// at most one additional free per event
+	replay->op = (REPLAY_OP *)xalloc(2 * trace->events * sizeof(*replay->op));
+	for (i = 0; i < trace->events; ++i) {
+		MTR_EVENT const *ev = &trace->event[i];
+		REPLAY_OP *op;
+		uint32_t old;
+		switch (ev->op) {
+		case MTR_MALLOC:
+		case MTR_NEW:
+			if (ev->ptr != 0) {
+				uint32_t const block = new_block(replay, &live, ev->ptr);
+				op = &replay->op[replay->ops++];
+				op->op = MTR_MALLOC;
+				op->size = ev->size;
+				op->block = block;
+				++replay->allocs;
+				replay->small += (ev->size <= MEM_POOL_MAX);
+			}
+			break;
+		case MTR_FREE:
+		case MTR_DELETE:
+			old = old_block(&live, ev->ptr);
+			if (old != NO_BLOCK) {
+				op = &replay->op[replay->ops++];
+				op->op = MTR_FREE;
+				op->block = old;
+				++replay->frees;
+			}
+			break;
+		case MTR_REALLOC:
+			if (0 == ev->size) {
+				// realloc(ptr, 0) frees the block
+				old = old_block(&live, ev->old);
+				if (old != NO_BLOCK) {
+					op = &replay->op[replay->ops++];
+					op->op = MTR_FREE;
+					op->block = old;
+					++replay->frees;
+				}
+			} else if (ev->ptr != 0) {
+				uint32_t block;
+				old = old_block(&live, ev->old);
+				block = new_block(replay, &live, ev->ptr);
+				op = &replay->op[replay->ops++];
+				op->op = MTR_REALLOC;
+				op->size = ev->size;
+				op->block = block;
+				op->old = old;
+				++replay->reallocs;
+			}
+			// failed reallocs keep the old block
+			break;
+		}
+	}
+	mtr_map_free(&live);
+	replay->block = (void **)xalloc(replay->blocks * sizeof(*replay->block));
+	replay->used = (uint32_t *)xalloc(replay->blocks * sizeof(*replay->used));
+}
+
+
+static
+void replay_heap(REPLAY *replay)
+{
+	size_t i;
+	for (i = 0; i < replay->ops; ++i) {
+		REPLAY_OP const *op = &replay->op[i];
+		switch (op->op) {
+		case MTR_MALLOC:
+			replay->block[op->block] = malloc(op->size);
+			break;
+		case MTR_FREE:
+			free(replay->block[op->block]);
+			replay->block[op->block] = NULL;
+			break;
+		case MTR_REALLOC:
+			if (NO_BLOCK == op->old) {
+				replay->block[op->block] = realloc(NULL, op->size);
+			} else {
+				replay->block[op->block] = realloc(replay->block[op->old], op->size);
+				if (op->old != op->block) {
+					replay->block[op->old] = NULL;
+				}
+			}
+			break;
+		}
+	}
+}
+
+
+// the region is allocated up front, the slabs are only counted
+static
+int commit_slab(MEM_POOL_CORE *core)
+{
+	POOL *pool = (POOL *)core;
+	if (pool->slabs >= MEM_POOL_SLABS) {
+		++pool->exhausted;
+		return (-1);
+	}
+	return ((int)pool->slabs++);
+}
+
+static
+void init_pool(POOL *pool)
+{
+	unsigned char *base = pool->core.base;
+	pool->slabs = 0;
+	pool->exhausted = 0;
+	mem_pool_core_init(&pool->core, base ? base : xalloc((size_t)MEM_POOL_SLABS * MEM_POOL_SLAB), commit_slab);
+}
+
+static
+int pool_owns(POOL const *pool, void const *ptr)
+{
+	return ((ptr != NULL) && mem_pool_core_owns(&pool->core, ptr));
+}
+
+static
+void *pool_alloc(POOL *pool, uint32_t size)
+{
+	if (size > MEM_POOL_MAX) {
+		return (NULL);
+	}
+	return (mem_pool_core_alloc(&pool->core, mem_pool_core_class(&pool->core, size)));
+}
+
+static
+void pool_free(POOL *pool, void *ptr)
+{
+	if (pool_owns(pool, ptr)) {
+		mem_pool_core_free(&pool->core, mem_pool_core_class_of(&pool->core, ptr), ptr);
+	} else {
+		free(ptr);
+	}
+}
+
+// realloc rules of hook_memory.c (MSVCRT_realloc, block_realloc)
+static
+void *pool_realloc(POOL *pool, void *ptr, uint32_t size, uint32_t used)
+{
+	void *result;
+	if (!pool_owns(pool, ptr)) {
+		return (realloc(ptr, size));
+	}
+	if (size <= pool->core.cls[mem_pool_core_class_of(&pool->core, ptr)].size) {
+		return (ptr);
+	}
+	result = pool_alloc(pool, size);
+	if (NULL == result) {
+		result = malloc(size);
+	}
+	if (result != NULL) {
+		memcpy(result, ptr, used);
+		pool_free(pool, ptr);
+	}
+	return (result);
+}
+
+static
+void replay_pool(REPLAY *replay, POOL *pool)
+{
+	size_t i;
+	for (i = 0; i < replay->ops; ++i) {
+		REPLAY_OP const *op = &replay->op[i];
+		void *block;
+		switch (op->op) {
+		case MTR_MALLOC:
+			block = pool_alloc(pool, op->size);
+			replay->block[op->block] = block ? block : malloc(op->size);
+			replay->used[op->block] = op->size;
+			break;
+		case MTR_FREE:
+			pool_free(pool, replay->block[op->block]);
+			replay->block[op->block] = NULL;
+			break;
+		case MTR_REALLOC:
+			if (NO_BLOCK == op->old) {
+				replay->block[op->block] = realloc(NULL, op->size);
+			} else {
+				uint32_t const used = replay->used[op->old];
+				replay->block[op->block] = pool_realloc(pool, replay->block[op->old], op->size, (used < op->size) ? used : op->size);
+				if (op->old != op->block) {
+					replay->block[op->old] = NULL;
+				}
+			}
+			replay->used[op->block] = op->size;
+			break;
+		}
+	}
+}
+
+
+// frees the blocks that are live at the end of the trace (not timed)
+static
+void release(REPLAY *replay, POOL *pool)
+{
+	size_t i;
+	for (i = 0; i < replay->blocks; ++i) {
+		if (replay->block[i] != NULL) {
+			if (pool != NULL) {
+				pool_free(pool, replay->block[i]);
+			} else {
+				free(replay->block[i]);
+			}
+			replay->block[i] = NULL;
+		}
+	}
+}
+
+static
+double seconds(clock_t start)
+{
+	return ((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+static
+void report(REPLAY const *replay, POOL const *pool, int runs, double heap, double timed)
+{
+	size_t const ops = replay->ops ? replay->ops : 1;
+	int i;
+	printf("replay: %lu calls (%lu malloc, %lu free, %lu realloc), %lu blocks\n",
+		(unsigned long)replay->ops, (unsigned long)replay->allocs, (unsigned long)replay->frees,
+		(unsigned long)replay->reallocs, (unsigned long)replay->blocks);
+	printf("malloc up to %u bytes: %lu (%lu%%)\n", (unsigned)MEM_POOL_MAX,
+		(unsigned long)replay->small, (unsigned long)(replay->allocs ? 100.0 * replay->small / replay->allocs : 0));
+	printf("pool: %lu of %u slabs, exhausted %lu times\n",
+		(unsigned long)pool->slabs, (unsigned)MEM_POOL_SLABS, (unsigned long)pool->exhausted);
+	for (i = 0; i < MEM_POOL_CLASSES; ++i) {
+		MEM_POOL_CLASS const *cls = &pool->core.cls[i];
+		if (cls->allocs != 0) {
+			printf("  %4lu bytes: %10lu allocs, %8lu peak blocks, %4lu slabs\n",
+				(unsigned long)cls->size, (unsigned long)cls->allocs, (unsigned long)cls->peak, (unsigned long)cls->slabs);
+		}
+	}
+	printf("best of %d runs:\n", runs);
+	printf("  heap %8.1f ms (%6.1f ns per call)\n", heap * 1000.0, heap * 1e9 / ops);
+	printf("  pool %8.1f ms (%6.1f ns per call)\n", timed * 1000.0, timed * 1e9 / ops);
+}
+
+
+int main(int argc, char *argv[])
+{
+	MTR_TRACE trace;
+	REPLAY replay;
+	POOL *pool;
+	double heap = 0;
+	double timed = 0;
+	int runs = 5;
+	int arg = 1;
+	int run;
+	if ((argc > 3) && (0 == strcmp(argv[1], "-r"))) {
+		runs = atoi(argv[2]);
+		runs = (runs > 0) ? runs : 1;
+		arg = 3;
+	}
+	if (arg + 1 != argc) {
+		fputs("usage: mtr_pool [-r runs] kq8fix.mtr\n", stderr);
+		return (EXIT_FAILURE);
+	}
+	if (!mtr_load(argv[arg], &trace)) {
+		return (EXIT_FAILURE);
+	}
+	memset(&replay, 0, sizeof(replay));
+	convert(&replay, &trace);
+	mtr_free(&trace);
+	pool = (POOL *)xalloc(sizeof(*pool));
+	// alternating runs, so that both see the same state of the process heap
+	for (run = 0; run < runs; ++run) {
+		clock_t start = clock();
+		double t;
+		replay_heap(&replay);
+		t = seconds(start);
+		heap = (0 == run || t < heap) ? t : heap;
+		release(&replay, NULL);
+		init_pool(pool);
+		start = clock();
+		replay_pool(&replay, pool);
+		t = seconds(start);
+		timed = (0 == run || t < timed) ? t : timed;
+		release(&replay, pool);
+	}
+	report(&replay, pool, runs, heap, timed);
+	free(pool->core.base);
+	free(pool);
+	free(replay.op);
+	free(replay.block);
+	free(replay.used);
+	return (EXIT_SUCCESS);
+}
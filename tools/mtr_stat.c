@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// mtr_stat: summary of a binary allocation trace (mem.trace, kq8fix.mtr)
+//
+//   mtr_stat [-n callers] kq8fix.mtr
+//
+// Prints the event counts, the peak of the live heap bytes, a size histogram,
+// the callers with the most allocations, and the callers of the blocks that
+// are still live at the end of the trace (leak candidates). The callers are
+// printed as return addresses relative to the game image base (see the map
+// file of the game executable). Blocks that were allocated before the trace
+// started are reported as unknown frees.
+
+#include "mtr_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+	SIZE_CLASSES = 33  // power of two buckets (0, 1, 2-3, 4-7, ...)
+};
+
+typedef struct CALLER {
+	uint32_t ret;
+	uint32_t allocs;
+	uint64_t bytes;
+	uint32_t live;       // blocks at the end
+	uint64_t live_bytes;
+} CALLER;
+
+typedef struct STAT {
+	uint32_t ops[16];
+	uint32_t failed;
+	uint32_t unknown;    // frees of blocks allocated before the trace
+	uint64_t live;       // bytes
+	uint64_t peak;
+	uint32_t peak_tick;
+	uint32_t peak_blocks;
+	uint32_t count[SIZE_CLASSES];
+	uint64_t bytes[SIZE_CLASSES];
+	CALLER  *caller;
+	size_t   callers;
+	MTR_MAP  by_ret;     // ret -> caller index (size)
+	MTR_MAP  blocks;
+} STAT;
+
+
+static
+unsigned size_class(uint32_t size)
+{
+	unsigned n = 0;
+	while (size != 0) {
+		size >>= 1;
+		++n;
+	}
+	return (n);
+}
+
+static
+CALLER *find_caller(STAT *stat, uint32_t ret)
+{
+	// the map ignores 0, a null return address is mapped to 1
+	MTR_LIVE *entry = mtr_map_find(&stat->by_ret, ret ? ret : 1);
+	if (NULL == entry) {
+		CALLER *grown = (CALLER *)realloc(stat->caller, (stat->callers + 1) * sizeof(*grown));
+		entry = mtr_map_add(&stat->by_ret, ret ? ret : 1);
+		if ((NULL == grown) || (NULL == entry)) {
+			fputs("out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		stat->caller = grown;
+		memset(&grown[stat->callers], 0, sizeof(*grown));
+		grown[stat->callers].ret = ret;
+		entry->size = (uint32_t)stat->callers++;
+	}
+	return (&stat->caller[entry->size]);
+}
+
+static
+void add_block(STAT *stat, MTR_EVENT const *ev)
+{
+	MTR_LIVE *block;
+	CALLER *caller;
+	if (0 == ev->ptr) {
+		++stat->failed;
+		return;
+	}
+	block = mtr_map_add(&stat->blocks, ev->ptr);
+	if (NULL == block) {
+		fputs("out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (block->size != 0) {
+		// allocated twice (missed free), the old block is replaced
+		stat->live -= block->size;
+	}
+	block->size = ev->size;
+	block->ret = ev->ret;
+	stat->live += ev->size;
+	++stat->count[size_class(ev->size)];
+	stat->bytes[size_class(ev->size)] += ev->size;
+	caller = find_caller(stat, ev->ret);
+	++caller->allocs;
+	caller->bytes += ev->size;
+	if (stat->live > stat->peak) {
+		stat->peak = stat->live;
+		stat->peak_tick = ev->tick;
+		stat->peak_blocks = (uint32_t)stat->blocks.count;
+	}
+}
+
+static
+void remove_block(STAT *stat, uint32_t ptr)
+{
+	MTR_LIVE block;
+	if (mtr_map_remove(&stat->blocks, ptr, &block)) {
+		stat->live -= block.size;
+	} else if (ptr != 0) {
+		++stat->unknown;
+	}
+}
+
+static
+void replay(STAT *stat, MTR_TRACE const *trace)
+{
+	size_t i;
+	for (i = 0; i < trace->events; ++i) {
+		MTR_EVENT const *ev = &trace->event[i];
+		++stat->ops[ev->op & 15];
+		switch (ev->op) {
+		case MTR_MALLOC:
+		case MTR_NEW:
+			add_block(stat, ev);
+			break;
+		case MTR_FREE:
+		case MTR_DELETE:
+			remove_block(stat, ev->ptr);
+			break;
+		case MTR_REALLOC:
+			if ((ev->ptr != 0) || (0 == ev->size)) {
+				// moved, grown in place, or freed
+				remove_block(stat, ev->old);
+				if (ev->ptr != 0) {
+					add_block(stat, ev);
+				}
+			} else {
+				// the old block is still valid
+				++stat->failed;
+			}
+			break;
+		}
+	}
+}
+
+static
+int compare_allocs(void const *a, void const *b)
+{
+	CALLER const *x = (CALLER const *)a;
+	CALLER const *y = (CALLER const *)b;
+	return ((x->allocs != y->allocs) ? ((x->allocs < y->allocs) ? 1 : -1) : 0);
+}
+
+static
+int compare_live(void const *a, void const *b)
+{
+	CALLER const *x = (CALLER const *)a;
+	CALLER const *y = (CALLER const *)b;
+	return ((x->live_bytes != y->live_bytes) ? ((x->live_bytes < y->live_bytes) ? 1 : -1) : 0);
+}
+
+static
+void print_caller(MTR_TRACE const *trace, CALLER const *caller)
+{
+	printf("  %08lx (+%08lx) %10lu allocs %12llu bytes, live %8lu blocks %12llu bytes\n",
+		(unsigned long)caller->ret, (unsigned long)(caller->ret - trace->header.base),
+		(unsigned long)caller->allocs, (unsigned long long)caller->bytes,
+		(unsigned long)caller->live, (unsigned long long)caller->live_bytes);
+}
+
+static
+void report(STAT *stat, MTR_TRACE const *trace, size_t top)
+{
+	uint32_t const end = trace->events ? trace->event[trace->events - 1].tick : 0;
+	size_t i;
+	printf("process %lu, image base %08lx, %lu ms, %lu threads, %lu blocks%s\n",
+		(unsigned long)trace->header.process, (unsigned long)trace->header.base,
+		(unsigned long)end, (unsigned long)trace->threads, (unsigned long)trace->blocks,
+		trace->truncated ? " (truncated)" : "");
+	printf("events %lu, dropped %lu, realloc without old address %lu\n",
+		(unsigned long)trace->events, (unsigned long)trace->dropped, (unsigned long)trace->orphans);
+	for (i = 1; i < 16; ++i) {
+		if (stat->ops[i] && (i != MTR_REALLOC_OLD)) {
+			printf("  %-8s %10lu\n", mtr_op_name((uint32_t)i), (unsigned long)stat->ops[i]);
+		}
+	}
+	printf("failed %lu, unknown frees %lu\n", (unsigned long)stat->failed, (unsigned long)stat->unknown);
+	printf("peak %llu bytes in %lu blocks at %lu ms, live at the end %llu bytes in %lu blocks\n",
+		(unsigned long long)stat->peak, (unsigned long)stat->peak_blocks, (unsigned long)stat->peak_tick,
+		(unsigned long long)stat->live, (unsigned long)stat->blocks.count);
+	puts("sizes:");
+	for (i = 0; i < SIZE_CLASSES; ++i) {
+		if (stat->count[i]) {
+			unsigned long const low = i ? 1UL << (i - 1) : 0;
+			unsigned long const high = i ? (1UL << (i - 1)) * 2 - 1 : 0;
+			printf("  %10lu - %10lu %10lu allocs %12llu bytes\n", low, high,
+				(unsigned long)stat->count[i], (unsigned long long)stat->bytes[i]);
+		}
+	}
+	for (i = 0; i <= stat->blocks.mask && stat->blocks.slot; ++i) {
+		MTR_LIVE const *block = &stat->blocks.slot[i];
+		if (block->ptr != 0) {
+			CALLER *caller = find_caller(stat, block->ret);
+			++caller->live;
+			caller->live_bytes += block->size;
+		}
+	}
+	qsort(stat->caller, stat->callers, sizeof(*stat->caller), compare_allocs);
+	printf("callers by allocations (%lu):\n", (unsigned long)stat->callers);
+	for (i = 0; (i < stat->callers) && (i < top); ++i) {
+		print_caller(trace, &stat->caller[i]);
+	}
+	qsort(stat->caller, stat->callers, sizeof(*stat->caller), compare_live);
+	puts("callers by live bytes at the end:");
+	for (i = 0; (i < stat->callers) && (i < top) && stat->caller[i].live; ++i) {
+		print_caller(trace, &stat->caller[i]);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	MTR_TRACE trace;
+	STAT stat;
+	size_t top = 20;
+	int arg = 1;
+	if ((argc > 3) && (0 == strcmp(argv[1], "-n"))) {
+		top = (size_t)strtoul(argv[2], NULL, 10);
+		arg = 3;
+	}
+	if (arg + 1 != argc) {
+		fputs("usage: mtr_stat [-n callers] kq8fix.mtr\n", stderr);
+		return (EXIT_FAILURE);
+	}
+	if (!mtr_load(argv[arg], &trace)) {
+		return (EXIT_FAILURE);
+	}
+	memset(&stat, 0, sizeof(stat));
+	replay(&stat, &trace);
+	report(&stat, &trace, top);
+	mtr_map_free(&stat.blocks);
+	mtr_map_free(&stat.by_ret);
+	free(stat.caller);
+	mtr_free(&trace);
+	return (EXIT_SUCCESS);
+}
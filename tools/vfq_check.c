@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2014,2016,2019 Nico Bendlin <nico@nicode.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// vfq_check: verifies the video frame queue of the in-process player
+//
+//   vfq_check
+//
+// Runs runtime/video_core.c (the Windows-independent part of the player)
+// through a simulated playback: a decoder that fills the queue whenever it
+// has space, and a presenter clock that is on time, late, and stalled. Also
+// checks the aspect ratio fit and the row copy of bottom-up sources.
+
+#include "../runtime/video_core.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+#define FRAME_MS     40  // 25 fps
+#define FRAME_WIDTH  4
+#define FRAME_HEIGHT 3
+#define FRAME_BYTES  (FRAME_WIDTH * FRAME_HEIGHT * 4)
+
+static unsigned char s_pixels[VIDEO_QUEUE_FRAMES * FRAME_BYTES];
+static int errors /* = 0 */;
+
+#define CHECK(cond) ((cond) ? (void)0 : (void)(printf("%s:%d: %s\n", __FILE__, __LINE__, #cond), ++errors))
+
+
+// fills the queue (the frame number is stored in the first pixel byte)
+static
+int decode(VIDEO_QUEUE *queue, int next, int frames)
+{
+	VIDEO_FRAME *back;
+	while ((next < frames) && ((back = video_queue_back(queue)) != NULL)) {
+		VIDEO_FRAME const *current = video_queue_current(queue);
+		CHECK((NULL == current) || (back->pixels != current->pixels));
+		memset(back->pixels, next & 0xFF, FRAME_BYTES);
+		video_queue_push(queue, (long)next * FRAME_MS);
+		++next;
+	}
+	return (next);
+}
+
+static
+void check_queue(void)
+{
+	VIDEO_QUEUE queue;
+	VIDEO_FRAME const *frame;
+	int next;
+	long clock;
+
+	video_queue_init(&queue, s_pixels, FRAME_BYTES);
+	CHECK(NULL == video_queue_current(&queue));
+	CHECK(-1 == video_queue_next(&queue));
+	CHECK(NULL == video_queue_pick(&queue, 0));
+
+	// the first fill uses every slot, then one is kept for the presented frame
+	next = decode(&queue, 0, 100);
+	CHECK(VIDEO_QUEUE_FRAMES == next);
+	frame = video_queue_pick(&queue, 0);
+	CHECK((frame != NULL) && (0 == *(unsigned char const *)frame->pixels));
+	CHECK(video_queue_next(&queue) == FRAME_MS);
+	next = decode(&queue, next, 100);
+	CHECK(VIDEO_QUEUE_FRAMES == next);
+	CHECK(NULL == video_queue_pick(&queue, FRAME_MS - 1));
+
+	// on time: every frame is presented once
+	for (clock = FRAME_MS; clock < 20 * FRAME_MS; clock += FRAME_MS) {
+		frame = video_queue_pick(&queue, clock);
+		CHECK((frame != NULL) && (frame->time == clock));
+		CHECK((frame != NULL) && (clock / FRAME_MS == *(unsigned char const *)frame->pixels));
+		next = decode(&queue, next, 100);
+	}
+	CHECK(20 == queue.presented);
+	CHECK(0 == queue.dropped);
+
+	// late presenter: the due frames are dropped, the latest one is shown
+	clock = 24 * FRAME_MS + FRAME_MS / 2;
+	frame = video_queue_pick(&queue, clock);
+	CHECK((frame != NULL) && (24 * FRAME_MS == frame->time));
+	CHECK(4 == queue.dropped);
+	next = decode(&queue, next, 100);
+
+	// stalled decoder: the last frame stays presented
+	while ((frame = video_queue_pick(&queue, 1000 * FRAME_MS)) != NULL) {
+		CHECK(frame == video_queue_current(&queue));
+	}
+	CHECK(video_queue_current(&queue) != NULL);
+	CHECK(-1 == video_queue_next(&queue));
+	CHECK((long)(next - 1) * FRAME_MS == video_queue_current(&queue)->time);
+	printf("frame queue: %lu presented, %lu dropped\n", queue.presented, queue.dropped);
+}
+
+static
+void check_fit(void)
+{
+	VIDEO_RECT rect;
+	// pillarbox (4:3 in 16:9)
+	video_fit(640, 480, 1920, 1080, &rect);
+	CHECK((240 == rect.left) && (0 == rect.top) && (1680 == rect.right) && (1080 == rect.bottom));
+	// letterbox (16:9 in 4:3)
+	video_fit(1920, 1080, 640, 480, &rect);
+	CHECK((0 == rect.left) && (60 == rect.top) && (640 == rect.right) && (420 == rect.bottom));
+	// same ratio, large sizes (no overflow)
+	video_fit(4096, 2160, 40960, 21600, &rect);
+	CHECK((0 == rect.left) && (0 == rect.top) && (40960 == rect.right) && (21600 == rect.bottom));
+	// unknown source size fills the target
+	video_fit(0, 0, 640, 480, &rect);
+	CHECK((0 == rect.left) && (0 == rect.top) && (640 == rect.right) && (480 == rect.bottom));
+}
+
+static
+void check_rows(void)
+{
+	unsigned char const src[3][8] = {
+		{ 1, 1, 1, 1, 9, 9, 9, 9 },
+		{ 2, 2, 2, 2, 9, 9, 9, 9 },
+		{ 3, 3, 3, 3, 9, 9, 9, 9 }
+	};
+	unsigned char dst[3][4];
+	int row;
+	video_copy_rows(dst, src, 8, 4, 3);
+	for (row = 0; row < 3; ++row) {
+		CHECK(row + 1 == dst[row][0] && row + 1 == dst[row][3]);
+	}
+	// bottom-up: the last row in memory is the top row
+	video_copy_rows(dst, src, -8, 4, 3);
+	for (row = 0; row < 3; ++row) {
+		CHECK(3 - row == dst[row][0] && 3 - row == dst[row][3]);
+	}
+}
+
+
+int main(void)
+{
+	check_queue();
+	check_fit();
+	check_rows();
+	if (errors) {
+		printf("%d errors\n", errors);
+		return (1);
+	}
+	printf("video frame queue: ok\n");
+	return (0);
+}